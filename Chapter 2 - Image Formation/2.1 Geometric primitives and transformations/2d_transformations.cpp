@@ -1,13 +1,105 @@
 #include <opencv2/opencv.hpp>
 #include <iostream>
+#include <functional>
+#include "warp_engine.hpp"
+#include "../../Tools/fixed_point_warp.hpp"
 
 using namespace cv;
 using namespace std;
 
-int main() {
+//Wall time of fn in milliseconds
+double timeMs(const function<void()>& fn) {
+    int64 start = getTickCount();
+    fn();
+    return (getTickCount() - start) * 1000.0 / getTickFrequency();
+}
+
+/* Benchmark of per-call warps against the cached warp engine
+   1) Warp the same frame repeatedly with warpPerspective, which maps every pixel back through the matrix each call,
+      and with WarpEngine, which builds the remap tables on the first frame and reuses them afterwards
+   2) Time translate -> rotate -> scale as three warpAffine calls and as one composed warp
+*/
+void benchmarkWarp(const Mat& img, const Mat& perspective_matrix, int frames) {
+    cout << "Benchmarking " << frames << " frames of " << img.cols << "x" << img.rows << " on " << getNumThreads() << " threads" << endl;
+
+    Mat reference_img, engine_img;
+    double perCallMs = timeMs([&] {
+        for(int i = 0; i < frames; i++) {
+            profiled::warpPerspective(img, reference_img, perspective_matrix, img.size());
+        }
+    });
+    WarpEngine engine;
+    PlanarTransform rectify = PlanarTransform::fromMat(perspective_matrix);
+    double firstMs = timeMs([&] { engine.warp(img, engine_img, rectify); });
+    double cachedMs = timeMs([&] {
+        for(int i = 1; i < frames; i++) {
+            engine.warp(img, engine_img, rectify);
+        }
+    });
+    double maxError = norm(reference_img, engine_img, NORM_INF);
+    cout << "perspective: warpPerspective " << perCallMs / frames << " ms/frame, engine " << cachedMs / max(1, frames - 1)
+         << " ms/frame (first frame with tables " << firstMs << " ms), speedup " << perCallMs / (firstMs + cachedMs)
+         << "x, max difference " << maxError << endl;
+
+    Point2f center(img.cols/2.0, img.rows/2.0);
+    Mat translate_matrix = (Mat_<double>(2, 3) << 1, 0, img.rows/4, 0, 1, img.cols/4);
+    Mat rotate_matrix = getRotationMatrix2D(center, 45, 1.0);
+    Mat scale_matrix = (Mat_<double>(2, 3) << .5, 0, 0, 0, .5, 0);
+    Mat stepwise_img, composed_img;
+    double stepwiseMs = timeMs([&] {
+        for(int i = 0; i < frames; i++) {
+            profiled::warpAffine(img, stepwise_img, translate_matrix, img.size());
+            profiled::warpAffine(stepwise_img, stepwise_img, rotate_matrix, img.size());
+            profiled::warpAffine(stepwise_img, stepwise_img, scale_matrix, img.size());
+        }
+    });
+    PlanarTransform chain = PlanarTransform::fromMat(translate_matrix)
+                                .then(PlanarTransform::fromMat(rotate_matrix))
+                                .then(PlanarTransform::fromMat(scale_matrix));
+    double composedMs = timeMs([&] {
+        for(int i = 0; i < frames; i++) {
+            engine.warp(img, composed_img, chain);
+        }
+    });
+    cout << "translate -> rotate -> scale: three warpAffine " << stepwiseMs / frames << " ms/frame, composed "
+         << composedMs / frames << " ms/frame, speedup " << stepwiseMs / composedMs << "x" << endl;
+    cout << "table cache: " << engine.hits() << " hits, " << engine.misses() << " misses" << endl;
+}
+
+/* Benchmark of warpPerspective against the bounds-aware tiled warp
+   1) Warp at the source size, as main() does, and at twice the source size, where more of the output falls
+      outside the source and those tiles are only filled
+   2) Report how the tiles were classified and the largest difference from the cached engine's tables, which the
+      tiled warp reproduces exactly
+*/
+void benchmarkTiledWarp(const string& name, const Mat& img, const Mat& perspective_matrix, int frames) {
+    const Size sizes[] = {img.size(), Size(2 * img.cols, 2 * img.rows)};
+    for(const Size& size : sizes) {
+        Mat reference_img, tiled_img, engine_img;
+        WarpTileCounts counts;
+        double perCallMs = timeMs([&] {
+            for(int i = 0; i < frames; i++) {
+                profiled::warpPerspective(img, reference_img, perspective_matrix, size);
+            }
+        });
+        double tiledMs = timeMs([&] {
+            for(int i = 0; i < frames; i++) {
+                counts = tiledWarpPerspective(img, tiled_img, perspective_matrix, size);
+            }
+        });
+        WarpEngine().warp(img, engine_img, PlanarTransform::fromMat(perspective_matrix), size);
+        cout << name << " " << size.width << "x" << size.height << ": warpPerspective " << perCallMs / frames
+             << " ms, tiled " << tiledMs / frames << " ms, speedup " << perCallMs / tiledMs << "x, tiles "
+             << counts.outside << " outside / " << counts.inside << " inside / " << counts.boundary << " boundary, max difference "
+             << norm(engine_img, tiled_img, NORM_INF) << " from the engine, " << norm(reference_img, tiled_img, NORM_INF)
+             << " from warpPerspective" << endl;
+    }
+}
+
+int main(int argc, char** argv) {
     // Read an image from file
-    Mat img = imread("Pictures/truck.jpg");
-    Mat proj_img = imread("Pictures/sudoku.jpg");
+    Mat img = profiled::imread("Pictures/truck.jpg");
+    Mat proj_img = profiled::imread("Pictures/sudoku.jpg");
     if (img.empty() || proj_img.empty()) {
         cout << "Could not open or find the image" << endl;
         return -1;
@@ -25,21 +117,22 @@ int main() {
     int tx = height/4;
     int ty = width/4;
     Mat translate_matrix = (Mat_<double>(2, 3) << 1, 0, tx, 0, 1, ty);
-    warpAffine(img, translated_img, translate_matrix, img.size());
-    imwrite("Pictures/translated_img.png", translated_img);
+    profiled::warpAffine(img, translated_img, translate_matrix, img.size());
+    profiled::imwrite("Pictures/translated_img.png", translated_img);
 
 
     /* Rotation transformation (linear transformation, preserves lengths):
     1) Create Mat output object
     2) Determine center of the image
     3) Acquire the Mat 2x3 transformation matrix with getRotationMatrix2d(center, degrees, scale)
-    4) Apply transformation with warpAffine(src Mat, output Mat, transformation Mat, original size)
+    4) Apply transformation with fixedPointWarpAffine(src Mat, output Mat, transformation Mat, original size), warpAffine's
+       fixed-point arithmetic, so the rotation matches the batch and tiled tools pixel for pixel on every OpenCV version
     */
     Mat rotated_img;
     Point2f center(img.cols/2.0, img.rows/2.0);
     Mat rotate_matrix = getRotationMatrix2D(center, 45, 1.0);
-    warpAffine(img, rotated_img, rotate_matrix, img.size());
-    imwrite("Pictures/rotated_img.png", rotated_img);
+    fixedPointWarpAffine(img, rotated_img, rotate_matrix, img.size());
+    profiled::imwrite("Pictures/rotated_img.png", rotated_img);
     
 
     /* Scaling transformation (linear transformation, preserves angles):
@@ -48,7 +141,7 @@ int main() {
     */
     Mat scaled_img;
     resize(img, scaled_img, Size(.5*img.cols, .5*img.rows));
-    imwrite("Pictures/scaled_img.png", scaled_img);
+    profiled::imwrite("Pictures/scaled_img.png", scaled_img);
 
 
     /* Affine transformation (linear transformation, preserves parallelism):
@@ -61,8 +154,8 @@ int main() {
     Point2f srcQuadA[] = {Point2f(0, 0), Point2f(img.cols-1, 0), Point2f(0, img.rows-1), Point2f(img.cols-1, img.rows-1)};
     Point2f dstQuadA[] = {Point2f((img.cols-1)/2, 0), Point2f(img.cols-1, 0), Point2f(0, img.rows-1), Point2f((img.cols-1)/2, img.rows-1)};
     Mat affine_matrix = getAffineTransform(srcQuadA, dstQuadA);
-    warpAffine(img, affined_img, affine_matrix, affined_img.size());
-    imwrite("Pictures/affined_img.png", affined_img);
+    profiled::warpAffine(img, affined_img, affine_matrix, affined_img.size());
+    profiled::imwrite("Pictures/affined_img.png", affined_img);
 
 
     /* Perpsective transformation (preserves straight lines):
@@ -77,16 +170,42 @@ int main() {
     Point2f srcQuadP1[] = {Point2f(2, 124), Point2f(412, 1), Point2f(142, 486), Point2f(608, 329)};
     Point2f dstQuadP1[] = {Point2f(25, -100), Point2f(650, -100), Point2f(25, 450), Point2f(675, 450)};
     Mat perspective_matrix1 = getPerspectiveTransform(srcQuadP1, dstQuadP1);
-    warpPerspective(proj_img, sudoku_img, perspective_matrix1, sudoku_img.size());
-    imwrite("Pictures/sudoku_img.png", sudoku_img);
+    profiled::warpPerspective(proj_img, sudoku_img, perspective_matrix1, sudoku_img.size());
+    profiled::imwrite("Pictures/sudoku_img.png", sudoku_img);
 
     // Much harder to eyeball truck coordinates since there is a lot of z-axis involved, raises question of 3D object to 2D image
     Mat projected_img;
     Point2f srcQuadP2[] = {Point2f(67, 199), Point2f(279, 19), Point2f(65, 304), Point2f(281, 382)};
     Point2f dstQuadP2[] = {Point2f(-67, -199), Point2f(1210, -199), Point2f(-67, 810), Point2f(1210, 810)};
     Mat perspective_matrix2 = getPerspectiveTransform(srcQuadP2, dstQuadP2);
-    warpPerspective(img, projected_img, perspective_matrix2, projected_img.size());
-    imwrite("Pictures/projected_img.png", projected_img);
-    
+    profiled::warpPerspective(img, projected_img, perspective_matrix2, projected_img.size());
+    profiled::imwrite("Pictures/projected_img.png", projected_img);
+
+
+    /* Composed transformation (one resample for the whole chain):
+    1) Build each step as a PlanarTransform, a 3x3 homography, and chain them with then() which multiplies the matrices
+    2) Warp once with WarpEngine, which caches the fixed-point remap tables so the next frame with the same
+       transform and size skips the per-pixel mapping
+    3) The same engine reproduces the truck perspective warp from its cached tables
+    */
+    WarpEngine engine;
+    Mat composed_img, engineProjected_img;
+    PlanarTransform chain = PlanarTransform::translate(tx, ty)
+                                .then(PlanarTransform::rotate(center, 45, 1.0))
+                                .then(PlanarTransform::scale(.5, .5));
+    engine.warp(img, composed_img, chain);
+    profiled::imwrite("Pictures/composed_img.png", composed_img);
+    engine.warp(img, engineProjected_img, PlanarTransform::fromMat(perspective_matrix2));
+    double maxError = norm(projected_img, engineProjected_img, NORM_INF);
+    cout << "Warp engine projection max difference from warpPerspective: " << maxError << endl;
+
+    //Run with --benchmark [frames] to compare per-call warps against the cached, composed engine and the tiled warp
+    if(argc > 1 && string(argv[1]) == "--benchmark") {
+        int frames = argc > 2 ? atoi(argv[2]) : 100;
+        benchmarkWarp(img, perspective_matrix2, frames);
+        benchmarkTiledWarp("truck", img, perspective_matrix2, frames);
+        benchmarkTiledWarp("sudoku", proj_img, perspective_matrix1, frames);
+    }
+
     return 0;
 }
\ No newline at end of file
@@ -1,11 +1,33 @@
 #include <opencv2/core.hpp>
+#include <opencv2/imgcodecs.hpp>
+#include <cfloat>
 #include <iostream>
 #include <fstream>
+#include <functional>
+#include "point_transforms.hpp"
+#include "point_cloud_io.hpp"
+#include "point_rasterizer.hpp"
 
 using namespace cv;
 using namespace std;
 
+//Wall time of fn in milliseconds
+double timeMs(const function<void()>& fn) {
+    int64 start = getTickCount();
+    fn();
+    return (getTickCount() - start) * 1000.0 / getTickFrequency();
+}
+
+bool isBinaryPointFile(const string& filename) {
+    return filename.size() >= 4 && filename.compare(filename.size() - 4, 4, ".pcb") == 0;
+}
+
+//Files ending in .pcb use the binary format from point_cloud_io.hpp, everything else is "x y z" text per line
 void loadPoints(const string& filename, vector<Point3f>& points) {
+    if(isBinaryPointFile(filename)) {
+        loadPointsBinary(filename, points);
+        return;
+    }
     ifstream in(filename);
     float x, y, z;
     while(in >> x >> y >> z) {
@@ -13,10 +35,15 @@ void loadPoints(const string& filename, vector<Point3f>& points) {
     }
 }
 
+//'\n' instead of endl, endl flushes the stream on every line
 void savePoints(const string& filename, const vector<Point3f>& points) {
+    if(isBinaryPointFile(filename)) {
+        savePointsBinary(filename, points);
+        return;
+    }
     ofstream out(filename);
     for(const auto& point : points) {
-        out << point.x << " " << point.y << " " << point.z << endl;
+        out << point.x << " " << point.y << " " << point.z << '\n';
     }
 }
 
@@ -27,16 +54,7 @@ void savePoints(const string& filename, const vector<Point3f>& points) {
 2) Matrix multiply the original points against the rotation matrix
 */
 void rotatePoints(vector<Point3f>& points, float angleDegrees) {
-    Mat rotate_matrix = (Mat_<float>(3, 3) <<
-                            cos(angleDegrees * CV_PI / 180), -sin(angleDegrees * CV_PI / 180), 0,
-                            sin(angleDegrees * CV_PI / 180), cos(angleDegrees * CV_PI / 180), 0,
-                            0, 0, 1);
-
-    for(auto& point : points) {
-        Mat point_matrix = (Mat_<float>(3,1) << point.x, point.y, point.z);
-        point_matrix = rotate_matrix * point_matrix;
-        point = Point3f(point_matrix.at<float>(0), point_matrix.at<float>(1), point_matrix.at<float>(2));
-    }
+    PointTransform::rotateZ(angleDegrees).apply(points);
 }
 
 /*
@@ -69,11 +87,7 @@ void scalePoints(vector<Point3f>& points, float sx, float sy, float sz) {
      [0, 0, 0, 1]]
 */
 void affinePoints(vector<Point3f>& points, Mat& affine_matrix) {
-    for(auto& point : points) {
-        Mat point_matrix = (Mat_<float>(4, 1) << point.x, point.y, point.z, 1);
-        point_matrix = affine_matrix * point_matrix;
-        point = Point3f(point_matrix.at<float>(0), point_matrix.at<float>(1), point_matrix.at<float>(2));
-    }
+    PointTransform::fromMat(affine_matrix).apply(points);
 }
 
 /*
@@ -82,6 +96,35 @@ void affinePoints(vector<Point3f>& points, Mat& affine_matrix) {
 **If we want to do a 3D to 2D projection, we would only return 2 of the 3 dimensions
 */
 void perspectivePoints(vector<Point3f>& points, Mat& perspective_matrix) {
+    PointTransform::fromMat(perspective_matrix).apply(points);
+}
+
+/* Per-point reference versions
+   The original implementations that build a Mat for every point, kept so benchmarkTransforms() can compare
+   them against the batched PointTransform engine.
+*/
+void rotatePointsPerPoint(vector<Point3f>& points, float angleDegrees) {
+    Mat rotate_matrix = (Mat_<float>(3, 3) <<
+                            cos(angleDegrees * CV_PI / 180), -sin(angleDegrees * CV_PI / 180), 0,
+                            sin(angleDegrees * CV_PI / 180), cos(angleDegrees * CV_PI / 180), 0,
+                            0, 0, 1);
+
+    for(auto& point : points) {
+        Mat point_matrix = (Mat_<float>(3,1) << point.x, point.y, point.z);
+        point_matrix = rotate_matrix * point_matrix;
+        point = Point3f(point_matrix.at<float>(0), point_matrix.at<float>(1), point_matrix.at<float>(2));
+    }
+}
+
+void affinePointsPerPoint(vector<Point3f>& points, Mat& affine_matrix) {
+    for(auto& point : points) {
+        Mat point_matrix = (Mat_<float>(4, 1) << point.x, point.y, point.z, 1);
+        point_matrix = affine_matrix * point_matrix;
+        point = Point3f(point_matrix.at<float>(0), point_matrix.at<float>(1), point_matrix.at<float>(2));
+    }
+}
+
+void perspectivePointsPerPoint(vector<Point3f>& points, Mat& perspective_matrix) {
     for(auto& point : points) {
         Mat point_matrix = (Mat_<float>(4, 1) << point.x, point.y, point.z, 1);
         point_matrix = perspective_matrix * point_matrix;
@@ -89,7 +132,240 @@ void perspectivePoints(vector<Point3f>& points, Mat& perspective_matrix) {
     }
 }
 
-int main() {
+double maxPointError(const vector<Point3f>& a, const vector<Point3f>& b) {
+    double maxError = 0;
+    for(size_t i = 0; i < a.size(); i++) {
+        maxError = max(maxError, norm(a[i] - b[i]));
+    }
+    return maxError;
+}
+
+/* Benchmark of the per-point Mat versions against the batched engine
+   1) Generate a random cloud of the requested size
+   2) Time each per-point function and its PointTransform equivalent on a copy of the same cloud
+   3) Time the rotate -> translate -> scale -> affine -> perspective chain step by step and as one composed matrix
+*/
+void benchmarkTransforms(size_t count, Mat& affine_matrix, Mat& perspective_matrix) {
+    vector<Point3f> cloud(count);
+    RNG rng(0x3d);
+    for(auto& point : cloud) {
+        point = Point3f(rng.uniform(-1.f, 1.f), rng.uniform(-1.f, 1.f), rng.uniform(-1.f, 1.f));
+    }
+
+    auto report = [&](const string& name, vector<Point3f>& reference, vector<Point3f>& batched, double perPointMs, double batchedMs) {
+        cout << name << ": per-point " << perPointMs << " ms, batched " << batchedMs << " ms, speedup "
+             << perPointMs / batchedMs << "x, max error " << maxPointError(reference, batched) << endl;
+    };
+
+    cout << "Benchmarking " << count << " points on " << getNumThreads() << " threads" << endl;
+
+    vector<Point3f> reference = cloud, batched = cloud;
+    double perPointMs = timeMs([&] { rotatePointsPerPoint(reference, 45); });
+    double batchedMs = timeMs([&] { rotatePoints(batched, 45); });
+    report("rotate", reference, batched, perPointMs, batchedMs);
+
+    reference = cloud;
+    batched = cloud;
+    perPointMs = timeMs([&] { affinePointsPerPoint(reference, affine_matrix); });
+    batchedMs = timeMs([&] { affinePoints(batched, affine_matrix); });
+    report("affine", reference, batched, perPointMs, batchedMs);
+
+    reference = cloud;
+    batched = cloud;
+    perPointMs = timeMs([&] { perspectivePointsPerPoint(reference, perspective_matrix); });
+    batchedMs = timeMs([&] { perspectivePoints(batched, perspective_matrix); });
+    report("perspective", reference, batched, perPointMs, batchedMs);
+
+    reference = cloud;
+    batched = cloud;
+    double stepwiseMs = timeMs([&] {
+        rotatePointsPerPoint(reference, 45);
+        translatePoints(reference, 10, 20, 30);
+        scalePoints(reference, 2, 2, 2);
+        affinePointsPerPoint(reference, affine_matrix);
+        perspectivePointsPerPoint(reference, perspective_matrix);
+    });
+    double composedMs = timeMs([&] {
+        PointTransform::rotateZ(45)
+            .then(PointTransform::translate(10, 20, 30))
+            .then(PointTransform::scale(2, 2, 2))
+            .then(PointTransform::fromMat(affine_matrix))
+            .then(PointTransform::fromMat(perspective_matrix))
+            .apply(batched);
+    });
+    report("composed chain", reference, batched, stepwiseMs, composedMs);
+}
+
+/* Benchmark of the text format against the binary format
+   1) Write and read the same random cloud with savePoints/loadPoints in text and in binary
+   2) Map the binary file and touch every point to measure the zero-copy path
+   3) Stream the binary file through a transform chunk by chunk with transformPointCloudFile
+*/
+void benchmarkPointIO(size_t count) {
+    vector<Point3f> cloud(count);
+    RNG rng(0x10);
+    for(auto& point : cloud) {
+        point = Point3f(rng.uniform(-100.f, 100.f), rng.uniform(-100.f, 100.f), rng.uniform(-100.f, 100.f));
+    }
+    const double megabytes = count * sizeof(Point3f) / (1024.0 * 1024.0);
+    const string textFile = "Points/benchmark_points.txt", binaryFile = "Points/benchmark_points.pcb";
+    const string transformedFile = "Points/benchmark_transformed.pcb";
+
+    auto report = [&](const string& name, double ms) {
+        cout << name << ": " << ms << " ms, " << megabytes / (ms / 1000.0) << " MB/s" << endl;
+    };
+
+    cout << "Benchmarking point I/O with " << count << " points (" << megabytes << " MB as Point3f)" << endl;
+    vector<Point3f> loaded;
+    report("text save", timeMs([&] { savePoints(textFile, cloud); }));
+    report("text load", timeMs([&] { loadPoints(textFile, loaded); }));
+    loaded.clear();
+    report("binary save", timeMs([&] { savePoints(binaryFile, cloud); }));
+    report("binary load", timeMs([&] { loadPoints(binaryFile, loaded); }));
+
+    double checksum = 0;
+    report("binary mmap", timeMs([&] {
+        MappedPointCloud mapped(binaryFile);
+        for(size_t i = 0; i < mapped.size(); i++) {
+            checksum += mapped.points()[i].x;
+        }
+    }));
+    report("binary streamed rotate", timeMs([&] {
+        transformPointCloudFile(binaryFile, transformedFile, PointTransform::rotateZ(45));
+    }));
+    cout << "checksum " << checksum << ", binary round trip " << (loaded.size() == cloud.size() && maxPointError(loaded, cloud) == 0 ? "exact" : "MISMATCH") << endl;
+
+    remove(textFile.c_str());
+    remove(binaryFile.c_str());
+    remove(transformedFile.c_str());
+}
+
+/* Dense cloud on the faces of the box spanned by points
+   Every point gets the colour of its face, so the rendered image shows which faces the z-buffer kept.
+*/
+void sampleBoxSurface(const vector<Point3f>& points, size_t count, vector<Point3f>& cloud, vector<Vec3b>& colors, uint64 seed) {
+    Point3f lo(FLT_MAX, FLT_MAX, FLT_MAX), hi(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+    for(const auto& point : points) {
+        lo = Point3f(min(lo.x, point.x), min(lo.y, point.y), min(lo.z, point.z));
+        hi = Point3f(max(hi.x, point.x), max(hi.y, point.y), max(hi.z, point.z));
+    }
+    const Vec3b faceColors[6] = {Vec3b(60, 60, 220), Vec3b(60, 220, 60), Vec3b(220, 60, 60),
+                                 Vec3b(60, 220, 220), Vec3b(220, 60, 220), Vec3b(220, 220, 60)};
+    cloud.resize(count);
+    colors.resize(count);
+    RNG rng(seed);
+    for(size_t i = 0; i < count; i++) {
+        int face = rng.uniform(0, 6), axis = face / 2;
+        float p[3] = {rng.uniform(lo.x, hi.x), rng.uniform(lo.y, hi.y), rng.uniform(lo.z, hi.z)};
+        p[axis] = face % 2 ? (&hi.x)[axis] : (&lo.x)[axis];
+        cloud[i] = Point3f(p[0], p[1], p[2]);
+        colors[i] = faceColors[face];
+    }
+}
+
+//Rotation about the x-axis, so the perspective view along z sees more than the front face
+PointTransform rotateX(float angleDegrees) {
+    float c = (float)cos(angleDegrees * CV_PI / 180), s = (float)sin(angleDegrees * CV_PI / 180);
+    return PointTransform(Matx44f(1, 0,  0, 0,
+                                  0, c, -s, 0,
+                                  0, s,  c, 0,
+                                  0, 0,  0, 1));
+}
+
+/* Serial z-buffer reference for the tiled rasterizer
+   1) Draw every point's splat straight into the full image in point order, keeping strictly nearer depths
+   2) Colour each pixel from the point that won it
+*/
+void rasterizeReference(const vector<Point3f>& cloud, const vector<Vec3b>& colors, const PointRasterizer& rasterizer, Mat& depth, Mat& image) {
+    Size size = rasterizer.getSize();
+    int splat = rasterizer.getSplatSize();
+    depth = Mat(size, CV_32FC1, Scalar(numeric_limits<float>::infinity()));
+    image = Mat::zeros(size, CV_8UC3);
+    for(size_t i = 0; i < cloud.size(); i++) {
+        int column, row;
+        if(!rasterizer.getViewport().project(cloud[i], column, row)) {
+            continue;
+        }
+        for(int y = max(row - (splat - 1) / 2, 0); y <= min(row + splat / 2, size.height - 1); y++) {
+            for(int x = max(column - (splat - 1) / 2, 0); x <= min(column + splat / 2, size.width - 1); x++) {
+                if(cloud[i].z < depth.at<float>(y, x)) {
+                    depth.at<float>(y, x) = cloud[i].z;
+                    image.at<Vec3b>(y, x) = colors[i];
+                }
+            }
+        }
+    }
+}
+
+//Pixels whose bytes differ, so +inf in both images counts as equal
+int countDifferentPixels(const Mat& a, const Mat& b) {
+    int different = 0;
+    const size_t pixelSize = a.elemSize();
+    for(int y = 0; y < a.rows; y++) {
+        for(int x = 0; x < a.cols; x++) {
+            different += memcmp(a.ptr(y) + x * pixelSize, b.ptr(y) + x * pixelSize, pixelSize) != 0;
+        }
+    }
+    return different;
+}
+
+/* Benchmark of the tiled rasterizer over point count and thread count
+   1) Sample a tilted box surface with the requested number of points and project it with perspectivePoints
+   2) Check the tiled result against the serial reference once per count
+   3) Render 1920x1080 frames with 1 and 3 pixel splats on 1, 2, 4, ... threads up to the number of CPUs
+*/
+void benchmarkRasterizer(const vector<Point3f>& points, size_t maxCount, Mat& perspective_matrix) {
+    const Size size(1920, 1080);
+    const int defaultThreads = getNumThreads();
+
+    vector<size_t> counts = {1000000, 4000000};
+    counts.erase(remove_if(counts.begin(), counts.end(), [&](size_t count) { return count >= maxCount; }), counts.end());
+    counts.push_back(maxCount);
+    for(size_t count : counts) {
+        vector<Point3f> cloud;
+        vector<Vec3b> colors;
+        sampleBoxSurface(points, count, cloud, colors, count);
+        rotateX(-60).then(PointTransform::rotateZ(30)).apply(cloud);
+        perspectivePoints(cloud, perspective_matrix);
+        PointTransform::scale(1, 1, -1).apply(cloud);
+
+        PointRasterizer rasterizer(size, RasterViewport::fit(cloud, size), 3);
+        Mat depth, image, referenceDepth, referenceImage;
+        double referenceMs = timeMs([&] { rasterizeReference(cloud, colors, rasterizer, referenceDepth, referenceImage); });
+        rasterizer.render(cloud, colors, depth, image);
+        cout << count << " points: serial reference " << referenceMs << " ms, tiled result differs in "
+             << countDifferentPixels(depth, referenceDepth) << " depth and " << countDifferentPixels(image, referenceImage) << " colour pixels" << endl;
+
+        for(int splat : {1, 3}) {
+            rasterizer.setSplatSize(splat);
+            for(int threads = 1; ; threads = min(threads * 2, getNumberOfCPUs())) {
+                setNumThreads(threads);
+                rasterizer.render(cloud, colors, depth, image);
+                double ms = DBL_MAX;
+                for(int run = 0; run < 3; run++) {
+                    ms = min(ms, timeMs([&] { rasterizer.render(cloud, colors, depth, image); }));
+                }
+                cout << "  splat " << splat << ", " << threads << " threads: " << ms << " ms, "
+                     << count / (ms * 1000.0) << " Mpoints/s" << endl;
+                if(threads == getNumberOfCPUs()) {
+                    break;
+                }
+            }
+        }
+    }
+    setNumThreads(defaultThreads);
+}
+
+int main(int argc, char** argv) {
+    //Convert an existing text cloud: --convert <input.txt> <output.pcb>
+    if(argc > 3 && string(argv[1]) == "--convert") {
+        if(!convertTextToBinary(argv[2], argv[3])) {
+            cout << "Could not convert " << argv[2] << endl;
+            return 1;
+        }
+        return 0;
+    }
+
     vector<Point3f> points, rotate_points, translate_points, scale_points, affine_points, perspective_points;
     loadPoints("cube.txt", points);
     rotate_points = points;
@@ -126,5 +402,52 @@ int main() {
     perspectivePoints(perspective_points, perspective_matrix);
     savePoints("Points/perspective_points.txt", perspective_points);
 
+    /* Rasterized perspective view:
+    1) Sample the faces of the cube densely and tilt it so three faces are visible
+    2) Project the cloud with perspectivePoints, flipping z so that nearer points have the smaller depth
+    3) Draw it with the tiled z-buffer rasterizer into a face-coloured image and a depth-shaded image
+    */
+    vector<Point3f> surface_points;
+    vector<Vec3b> surface_colors;
+    sampleBoxSurface(points, 400000, surface_points, surface_colors, 0x3d);
+    rotateX(-60).then(PointTransform::rotateZ(30)).apply(surface_points);
+    perspectivePoints(surface_points, perspective_matrix);
+    PointTransform::scale(1, 1, -1).apply(surface_points);
+    PointRasterizer rasterizer(Size(640, 480), RasterViewport::fit(surface_points, Size(640, 480)), 2);
+    Mat depth_map, render_img, depth_img;
+    rasterizer.render(surface_points, surface_colors, depth_map, render_img);
+    rasterizer.render(surface_points, depth_map, depth_img);
+    profiled::imwrite("Points/perspective_render.png", render_img);
+    profiled::imwrite("Points/perspective_depth.png", depth_img);
+
+    /* Composed transformation:
+    1) Chain the individual transforms with then(), which multiplies their 4x4 matrices once
+    2) Apply the composed matrix to every point in a single pass instead of one pass per transform
+    */
+    vector<Point3f> composed_points = points;
+    PointTransform::rotateZ(45)
+        .then(PointTransform::translate(10, 20, 30))
+        .then(PointTransform::scale(2, 2, 2))
+        .apply(composed_points);
+    savePoints("Points/composed_points.txt", composed_points);
+
+    //Run with --benchmark [point count] to compare the per-point versions against the batched engine
+    if(argc > 1 && string(argv[1]) == "--benchmark") {
+        size_t count = argc > 2 ? stoul(argv[2]) : 4000000;
+        benchmarkTransforms(count, affine_matrix, perspective_matrix);
+    }
+
+    //Run with --benchmark-io [point count] to compare the text and binary point formats
+    if(argc > 1 && string(argv[1]) == "--benchmark-io") {
+        size_t count = argc > 2 ? stoul(argv[2]) : 10000000;
+        benchmarkPointIO(count);
+    }
+
+    //Run with --benchmark-raster [point count] to time the tiled rasterizer over point and thread counts
+    if(argc > 1 && string(argv[1]) == "--benchmark-raster") {
+        size_t count = argc > 2 ? stoul(argv[2]) : 20000000;
+        benchmarkRasterizer(points, count, perspective_matrix);
+    }
+
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,275 @@
+#pragma once
+
+#include <opencv2/core.hpp>
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "point_transforms.hpp"
+
+/* Binary point cloud format (.pcb)
+   A 16 byte header followed by the raw Point3f array, so a file can be mapped straight into memory and used
+   as a const Point3f* without parsing:
+       [0..3]   magic "PCB1"
+       [4..7]   uint32 version (1)
+       [8..15]  uint64 point count
+       [16..]   count * {float x, float y, float z}, native (little endian) byte order
+   The data starts at a 16 byte offset, so the mapped array is aligned for SIMD loads of floats.
+*/
+struct PointCloudHeader {
+    char magic[4];
+    uint32_t version;
+    uint64_t count;
+};
+
+static const char POINT_CLOUD_MAGIC[4] = {'P', 'C', 'B', '1'};
+static const uint32_t POINT_CLOUD_VERSION = 1;
+
+inline bool isValidPointCloudHeader(const PointCloudHeader& header) {
+    return memcmp(header.magic, POINT_CLOUD_MAGIC, 4) == 0 && header.version == POINT_CLOUD_VERSION;
+}
+
+/* Zero-copy reader
+   1) mmap the whole file read-only, the page cache pages it in on demand so this also works for clouds larger than RAM
+   2) Validate the header and the file size against the point count
+   3) points() points directly into the mapping, nothing is copied
+*/
+class MappedPointCloud {
+public:
+    MappedPointCloud() {}
+    explicit MappedPointCloud(const std::string& filename) { open(filename); }
+    ~MappedPointCloud() { close(); }
+    MappedPointCloud(const MappedPointCloud&) = delete;
+    MappedPointCloud& operator=(const MappedPointCloud&) = delete;
+
+    bool open(const std::string& filename) {
+        close();
+        int fd = ::open(filename.c_str(), O_RDONLY);
+        if(fd < 0) {
+            return false;
+        }
+        struct stat info;
+        if(fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(PointCloudHeader)) {
+            ::close(fd);
+            return false;
+        }
+        void* mapping = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);    //The mapping keeps its own reference to the file
+        if(mapping == MAP_FAILED) {
+            return false;
+        }
+        base = mapping;
+        length = (size_t)info.st_size;
+
+        const PointCloudHeader* header = static_cast<const PointCloudHeader*>(base);
+        if(!isValidPointCloudHeader(*header) || header->count > (length - sizeof(PointCloudHeader)) / sizeof(cv::Point3f)) {
+            close();
+            return false;
+        }
+        count = (size_t)header->count;
+        madvise(base, length, MADV_SEQUENTIAL);
+        return true;
+    }
+
+    void close() {
+        if(base) {
+            munmap(base, length);
+        }
+        base = nullptr;
+        length = 0;
+        count = 0;
+    }
+
+    bool empty() const { return base == nullptr; }
+    size_t size() const { return count; }
+    const cv::Point3f* points() const {
+        return reinterpret_cast<const cv::Point3f*>(static_cast<const char*>(base) + sizeof(PointCloudHeader));
+    }
+
+private:
+    void* base = nullptr;
+    size_t length = 0;
+    size_t count = 0;
+};
+
+/* Chunked streaming reader
+   For pipelines that want a bounded buffer instead of a mapping: read() fills at most maxPoints points per call
+   and returns how many were read, 0 at the end of the file.
+*/
+class PointCloudReader {
+public:
+    PointCloudReader() {}
+    ~PointCloudReader() { close(); }
+    PointCloudReader(const PointCloudReader&) = delete;
+    PointCloudReader& operator=(const PointCloudReader&) = delete;
+
+    bool open(const std::string& filename) {
+        close();
+        file = fopen(filename.c_str(), "rb");
+        if(!file) {
+            return false;
+        }
+        PointCloudHeader header;
+        if(fread(&header, sizeof(header), 1, file) != 1 || !isValidPointCloudHeader(header)) {
+            close();
+            return false;
+        }
+        remaining = total = (size_t)header.count;
+        return true;
+    }
+
+    size_t read(std::vector<cv::Point3f>& chunk, size_t maxPoints) {
+        chunk.resize(std::min(maxPoints, remaining));
+        size_t got = chunk.empty() ? 0 : fread(chunk.data(), sizeof(cv::Point3f), chunk.size(), file);
+        chunk.resize(got);
+        remaining -= got;
+        return got;
+    }
+
+    void close() {
+        if(file) {
+            fclose(file);
+        }
+        file = nullptr;
+        remaining = total = 0;
+    }
+
+    size_t size() const { return total; }
+
+private:
+    FILE* file = nullptr;
+    size_t total = 0;
+    size_t remaining = 0;
+};
+
+/* Chunked streaming writer
+   1) open() writes a header with a count of 0
+   2) write() appends whole chunks with a single fwrite through a 4MB stdio buffer, never per point
+   3) close() seeks back and patches the final count into the header
+*/
+class PointCloudWriter {
+public:
+    PointCloudWriter() {}
+    ~PointCloudWriter() { close(); }
+    PointCloudWriter(const PointCloudWriter&) = delete;
+    PointCloudWriter& operator=(const PointCloudWriter&) = delete;
+
+    bool open(const std::string& filename) {
+        close();
+        file = fopen(filename.c_str(), "wb");
+        if(!file) {
+            return false;
+        }
+        buffer.resize(4 << 20);
+        setvbuf(file, buffer.data(), _IOFBF, buffer.size());
+        count = 0;
+        ok = writeHeader();
+        return ok;
+    }
+
+    bool write(const cv::Point3f* points, size_t n) {
+        if(!file || !ok) {
+            return false;
+        }
+        ok = n == 0 || fwrite(points, sizeof(cv::Point3f), n, file) == n;
+        count += n;
+        return ok;
+    }
+
+    bool write(const std::vector<cv::Point3f>& points) {
+        return write(points.data(), points.size());
+    }
+
+    //Returns false if any write failed
+    bool close() {
+        if(!file) {
+            return ok;
+        }
+        ok = ok && fseek(file, 0, SEEK_SET) == 0 && writeHeader();
+        ok = fclose(file) == 0 && ok;
+        file = nullptr;
+        return ok;
+    }
+
+private:
+    bool writeHeader() {
+        PointCloudHeader header;
+        memcpy(header.magic, POINT_CLOUD_MAGIC, 4);
+        header.version = POINT_CLOUD_VERSION;
+        header.count = count;
+        return fwrite(&header, sizeof(header), 1, file) == 1;
+    }
+
+    FILE* file = nullptr;
+    std::vector<char> buffer;
+    size_t count = 0;
+    bool ok = true;
+};
+
+//Whole-cloud helpers, the binary counterparts of loadPoints/savePoints (loading appends like loadPoints does)
+inline bool loadPointsBinary(const std::string& filename, std::vector<cv::Point3f>& points) {
+    MappedPointCloud cloud;
+    if(!cloud.open(filename)) {
+        return false;
+    }
+    points.insert(points.end(), cloud.points(), cloud.points() + cloud.size());
+    return true;
+}
+
+inline bool savePointsBinary(const std::string& filename, const std::vector<cv::Point3f>& points) {
+    PointCloudWriter writer;
+    return writer.open(filename) && writer.write(points) && writer.close();
+}
+
+/* Text to binary converter
+   Parses the "x y z" per line format of cube.txt in chunks, so the text file never has to fit in memory.
+*/
+inline bool convertTextToBinary(const std::string& textFile, const std::string& binaryFile, size_t chunkPoints = 1 << 20) {
+    std::ifstream in(textFile);
+    PointCloudWriter writer;
+    if(!in || !writer.open(binaryFile)) {
+        return false;
+    }
+    std::vector<cv::Point3f> chunk;
+    chunk.reserve(chunkPoints);
+    float x, y, z;
+    while(in >> x >> y >> z) {
+        chunk.push_back(cv::Point3f(x, y, z));
+        if(chunk.size() == chunkPoints) {
+            writer.write(chunk);
+            chunk.clear();
+        }
+    }
+    writer.write(chunk);
+    return writer.close();
+}
+
+/* Out-of-core transform
+   Streams a binary cloud through a PointTransform one chunk at a time: the source is mapped (zero-copy), each
+   chunk is transformed into a small reusable buffer and appended to the output, so memory stays at one chunk
+   no matter how large the cloud is.
+*/
+inline bool transformPointCloudFile(const std::string& inFile, const std::string& outFile, const PointTransform& transform,
+                                    size_t chunkPoints = 1 << 20) {
+    MappedPointCloud source;
+    PointCloudWriter writer;
+    if(!source.open(inFile) || !writer.open(outFile)) {
+        return false;
+    }
+    std::vector<cv::Point3f> chunk(std::min(chunkPoints, source.size()));
+    for(size_t begin = 0; begin < source.size(); begin += chunkPoints) {
+        size_t n = std::min(chunkPoints, source.size() - begin);
+        transform.apply(source.points() + begin, chunk.data(), n);
+        if(!writer.write(chunk.data(), n)) {
+            return false;
+        }
+    }
+    return writer.close();
+}
@@ -0,0 +1,302 @@
+#pragma once
+
+#include <opencv2/core.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+#include "../../Tools/profiler.hpp"
+
+/* Mapping from projected points to pixels
+   After perspectivePoints the x and y of a point are image plane coordinates, the viewport scales and offsets them
+   into pixels: column = x * scale.x + offset.x, row = y * scale.y + offset.y. z is kept as the depth, smaller is
+   nearer, so negate z first (PointTransform::scale(1, 1, -1)) for a camera looking down -z.
+*/
+struct RasterViewport {
+    cv::Point2f scale = cv::Point2f(1, 1);
+    cv::Point2f offset = cv::Point2f(0, 0);
+
+    //Uniform scale that fits the x/y bounds of the finite points into size with a margin, +y points up in the image
+    static RasterViewport fit(const std::vector<cv::Point3f>& points, cv::Size size, float margin = 0.05f) {
+        float minX = std::numeric_limits<float>::max(), maxX = -minX, minY = minX, maxY = -minX;
+        for(const auto& point : points) {
+            if(std::isfinite(point.x) && std::isfinite(point.y)) {
+                minX = std::min(minX, point.x);
+                maxX = std::max(maxX, point.x);
+                minY = std::min(minY, point.y);
+                maxY = std::max(maxY, point.y);
+            }
+        }
+        RasterViewport viewport;
+        if(minX > maxX) {
+            return viewport;
+        }
+        float sx = size.width * (1 - 2 * margin) / std::max(maxX - minX, 1e-6f);
+        float sy = size.height * (1 - 2 * margin) / std::max(maxY - minY, 1e-6f);
+        float s = std::min(sx, sy);
+        viewport.scale = cv::Point2f(s, -s);
+        viewport.offset = cv::Point2f(size.width * 0.5f - s * (minX + maxX) * 0.5f, size.height * 0.5f + s * (minY + maxY) * 0.5f);
+        return viewport;
+    }
+
+    //Pixel the point lands in, false for NaN/inf coordinates or depths
+    bool project(const cv::Point3f& point, int& column, int& row) const {
+        float x = point.x * scale.x + offset.x, y = point.y * scale.y + offset.y;
+        //Also rejects NaN, and keeps the floor inside int16 for the bins
+        if(!(x > -16384.f && x < 16384.f && y > -16384.f && y < 16384.f && std::isfinite(point.z))) {
+            return false;
+        }
+        column = cvFloor(x);
+        row = cvFloor(y);
+        return true;
+    }
+};
+
+/* Tiled z-buffer point rasterizer
+   Draws every point as a splatSize x splatSize square (centred on its pixel, the extra pixel of an even size goes
+   right and down) and keeps the nearest one per pixel:
+   1) Bin: the cloud is split into chunks of 64K points and each chunk counts, in parallel, how many samples it sends
+      to every screen tile (a splat on a tile border goes to each tile it touches). A prefix sum over tile-major,
+      chunk-minor order gives every (tile, chunk) pair its own slice of one sample array, and a second parallel pass
+      writes the samples into it. No two tasks write the same slot, so there are no atomics or locks
+   2) Resolve: every tile is one task with a private tileSize x tileSize z-buffer in cache. It walks its samples,
+      clips each splat to the tile and keeps the nearest depth, then writes its rectangle of the outputs
+   Samples reach a tile in the original point order, so ties go to the earlier point and the image is the same as
+   the one a serial z-buffer draws, on any number of threads.
+   The bins are kept between frames, so render the frames of one size through the same rasterizer. render() itself
+   is not reentrant.
+*/
+class PointRasterizer {
+public:
+    PointRasterizer(cv::Size imageSize, const RasterViewport& rasterViewport, int splat = 1, int tile = 64)
+        : size(imageSize), viewport(rasterViewport), splatSize(splat), tileSize(tile) {
+        CV_Assert(size.width > 0 && size.height > 0 && size.width < 16384 && size.height < 16384);
+        CV_Assert(splatSize >= 1 && splatSize <= 32 && tileSize >= 8 && tileSize <= 256);
+    }
+
+    void setViewport(const RasterViewport& rasterViewport) { viewport = rasterViewport; }
+    void setSplatSize(int splat) {
+        CV_Assert(splat >= 1 && splat <= 32);
+        splatSize = splat;
+    }
+    //Points with a depth outside [near, far] are culled, the default keeps every finite depth
+    void setDepthRange(float nearDepth, float farDepth) {
+        CV_Assert(nearDepth <= farDepth);
+        depthNear = nearDepth;
+        depthFar = farDepth;
+    }
+
+    cv::Size getSize() const { return size; }
+    const RasterViewport& getViewport() const { return viewport; }
+    int getSplatSize() const { return splatSize; }
+
+    /* The three outputs all come with depth, CV_32FC1 with +inf where no point landed:
+       colors       one BGR colour per point, image is CV_8UC3
+       intensities  one gray level per point, image is CV_8UC1
+       neither      image is CV_8UC1 shaded by depth, 255 at the nearest point and 64 at the farthest
+       Empty pixels are 0 in the image. Returns the number of points that passed the culling.
+    */
+    size_t render(const std::vector<cv::Point3f>& points, const std::vector<cv::Vec3b>& colors, cv::Mat& depth, cv::Mat& image) {
+        PROFILE_SCOPE("PointRasterizer::render", points.size() * sizeof(cv::Point3f));
+        CV_Assert(colors.size() == points.size());
+        size_t accepted = bin(points);
+        image.create(size, CV_8UC3);
+        const cv::Vec3b* color = colors.data();
+        resolve(depth, [&](int y, int x, uint32_t index, float) {
+            image.at<cv::Vec3b>(y, x) = index == EMPTY ? cv::Vec3b() : color[index];
+        });
+        return accepted;
+    }
+
+    size_t render(const std::vector<cv::Point3f>& points, const std::vector<uchar>& intensities, cv::Mat& depth, cv::Mat& image) {
+        PROFILE_SCOPE("PointRasterizer::render", points.size() * sizeof(cv::Point3f));
+        CV_Assert(intensities.size() == points.size());
+        size_t accepted = bin(points);
+        image.create(size, CV_8UC1);
+        const uchar* intensity = intensities.data();
+        resolve(depth, [&](int y, int x, uint32_t index, float) {
+            image.at<uchar>(y, x) = index == EMPTY ? 0 : intensity[index];
+        });
+        return accepted;
+    }
+
+    size_t render(const std::vector<cv::Point3f>& points, cv::Mat& depth, cv::Mat& image) {
+        PROFILE_SCOPE("PointRasterizer::render", points.size() * sizeof(cv::Point3f));
+        size_t accepted = bin(points);
+        image.create(size, CV_8UC1);
+        const float range = std::max(maxDepth - minDepth, 1e-12f), nearest = minDepth;
+        resolve(depth, [&](int y, int x, uint32_t index, float z) {
+            image.at<uchar>(y, x) = index == EMPTY ? 0 : cv::saturate_cast<uchar>(255 - 191 * (z - nearest) / range);
+        });
+        return accepted;
+    }
+
+private:
+    struct Sample {
+        int16_t x, y;       //Pixel the splat is centred on, may lie just outside the image
+        float depth;
+        uint32_t index;     //Point the sample came from
+    };
+
+    static const uint32_t EMPTY = 0xffffffffu;
+    static const int CHUNK = 1 << 16;
+
+    //Splat extent around the centre pixel: [centre + lo, centre + hi]
+    int splatLo() const { return -(splatSize - 1) / 2; }
+    int splatHi() const { return splatSize / 2; }
+
+    /* Visits every tile a point covers
+       Returns false for culled points, so both binning passes see exactly the same samples
+    */
+    template<typename Visit>
+    bool forEachTile(const cv::Point3f& point, int& column, int& row, Visit visit) const {
+        if(!viewport.project(point, column, row) || !(point.z >= depthNear && point.z <= depthFar)) {
+            return false;
+        }
+        int x0 = std::max(column + splatLo(), 0), x1 = std::min(column + splatHi(), size.width - 1);
+        int y0 = std::max(row + splatLo(), 0), y1 = std::min(row + splatHi(), size.height - 1);
+        if(x0 > x1 || y0 > y1) {
+            return false;
+        }
+        for(int ty = y0 / tileSize; ty <= y1 / tileSize; ty++) {
+            for(int tx = x0 / tileSize; tx <= x1 / tileSize; tx++) {
+                visit(ty * tilesX + tx);
+            }
+        }
+        return true;
+    }
+
+    size_t bin(const std::vector<cv::Point3f>& points) {
+        CV_Assert(points.size() < EMPTY);
+        const size_t count = points.size();
+        tilesX = (size.width + tileSize - 1) / tileSize;
+        tilesY = (size.height + tileSize - 1) / tileSize;
+        const int tiles = tilesX * tilesY;
+        const int chunks = (int)((count + CHUNK - 1) / CHUNK);
+        counts.assign((size_t)chunks * tiles, 0);
+        chunkAccepted.assign(chunks, 0);
+        chunkMin.assign(chunks, std::numeric_limits<float>::max());
+        chunkMax.assign(chunks, -std::numeric_limits<float>::max());
+
+        //1) Count the samples every chunk sends to every tile
+        const cv::Point3f* data = points.data();
+        cv::parallel_for_(cv::Range(0, chunks), [&](const cv::Range& range) {
+            for(int c = range.start; c < range.end; c++) {
+                uint32_t* chunkCounts = &counts[(size_t)c * tiles];
+                size_t begin = (size_t)c * CHUNK, end = std::min(count, begin + CHUNK);
+                size_t accepted = 0;
+                float lo = chunkMin[c], hi = chunkMax[c];
+                for(size_t i = begin; i < end; i++) {
+                    int column, row;
+                    if(forEachTile(data[i], column, row, [&](int t) { chunkCounts[t]++; })) {
+                        accepted++;
+                        lo = std::min(lo, data[i].z);
+                        hi = std::max(hi, data[i].z);
+                    }
+                }
+                chunkAccepted[c] = accepted;
+                chunkMin[c] = lo;
+                chunkMax[c] = hi;
+            }
+        });
+
+        //2) Tile-major prefix sum gives the write offset of each (chunk, tile) slice
+        tileStart.assign(tiles + 1, 0);
+        offsets.resize(counts.size());
+        size_t total = 0;
+        for(int t = 0; t < tiles; t++) {
+            tileStart[t] = total;
+            for(int c = 0; c < chunks; c++) {
+                offsets[(size_t)c * tiles + t] = total;
+                total += counts[(size_t)c * tiles + t];
+            }
+        }
+        tileStart[tiles] = total;
+        if(samples.size() < total) {
+            samples.resize(total);
+        }
+
+        //3) Scatter the samples, every chunk only writes inside its own slices
+        cv::parallel_for_(cv::Range(0, chunks), [&](const cv::Range& range) {
+            for(int c = range.start; c < range.end; c++) {
+                size_t* next = &offsets[(size_t)c * tiles];
+                size_t begin = (size_t)c * CHUNK, end = std::min(count, begin + CHUNK);
+                for(size_t i = begin; i < end; i++) {
+                    int column, row;
+                    forEachTile(data[i], column, row, [&](int t) {
+                        Sample& sample = samples[next[t]++];
+                        sample.x = (int16_t)column;
+                        sample.y = (int16_t)row;
+                        sample.depth = data[i].z;
+                        sample.index = (uint32_t)i;
+                    });
+                }
+            }
+        });
+
+        size_t accepted = 0;
+        minDepth = std::numeric_limits<float>::max();
+        maxDepth = -minDepth;
+        for(int c = 0; c < chunks; c++) {
+            accepted += chunkAccepted[c];
+            minDepth = std::min(minDepth, chunkMin[c]);
+            maxDepth = std::max(maxDepth, chunkMax[c]);
+        }
+        return accepted;
+    }
+
+    //Resolves every tile into depth, shade(y, x, index, depth) writes the image pixel (index is EMPTY for no point)
+    template<typename Shade>
+    void resolve(cv::Mat& depth, Shade shade) {
+        depth.create(size, CV_32FC1);
+        const int tiles = tilesX * tilesY;
+        const int lo = splatLo(), hi = splatHi();
+        cv::parallel_for_(cv::Range(0, tiles), [&](const cv::Range& range) {
+            std::vector<float> z(tileSize * tileSize);
+            std::vector<uint32_t> winner(tileSize * tileSize);
+            for(int t = range.start; t < range.end; t++) {
+                cv::Rect rect(t % tilesX * tileSize, t / tilesX * tileSize, tileSize, tileSize);
+                rect &= cv::Rect(0, 0, size.width, size.height);
+                std::fill(z.begin(), z.end(), std::numeric_limits<float>::infinity());
+                std::fill(winner.begin(), winner.end(), EMPTY);
+
+                for(size_t s = tileStart[t]; s < tileStart[t + 1]; s++) {
+                    const Sample& sample = samples[s];
+                    int x0 = std::max(sample.x + lo - rect.x, 0), x1 = std::min(sample.x + hi - rect.x, rect.width - 1);
+                    int y0 = std::max(sample.y + lo - rect.y, 0), y1 = std::min(sample.y + hi - rect.y, rect.height - 1);
+                    for(int y = y0; y <= y1; y++) {
+                        float* zRow = &z[y * tileSize];
+                        uint32_t* winnerRow = &winner[y * tileSize];
+                        for(int x = x0; x <= x1; x++) {
+                            //Strictly nearer, so on equal depth the earlier point stays
+                            if(sample.depth < zRow[x]) {
+                                zRow[x] = sample.depth;
+                                winnerRow[x] = sample.index;
+                            }
+                        }
+                    }
+                }
+
+                for(int y = 0; y < rect.height; y++) {
+                    float* depthRow = depth.ptr<float>(rect.y + y) + rect.x;
+                    for(int x = 0; x < rect.width; x++) {
+                        depthRow[x] = z[y * tileSize + x];
+                        shade(rect.y + y, rect.x + x, winner[y * tileSize + x], z[y * tileSize + x]);
+                    }
+                }
+            }
+        }, tiles);
+    }
+
+    cv::Size size;
+    RasterViewport viewport;
+    int splatSize, tileSize;
+    float depthNear = -std::numeric_limits<float>::max(), depthFar = std::numeric_limits<float>::max();
+    int tilesX = 0, tilesY = 0;
+    float minDepth = 0, maxDepth = 0;
+    std::vector<uint32_t> counts;
+    std::vector<size_t> offsets, tileStart, chunkAccepted;
+    std::vector<float> chunkMin, chunkMax;
+    std::vector<Sample> samples;
+};
@@ -0,0 +1,136 @@
+#pragma once
+
+#include <opencv2/core.hpp>
+#include <opencv2/core/hal/intrin.hpp>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include "../../Tools/profiler.hpp"
+
+/* Batched 3D point transform engine
+   Every transform from 3d_transformations.cpp (rotate, translate, scale, affine, perspective) is a 4x4 homogeneous
+   matrix, so instead of building a cv::Mat per point we keep one fixed-size Matx44f for the whole cloud:
+   1) Build a transform with one of the static constructors, e.g. PointTransform::rotateZ(45)
+   2) Chain transforms with then(), which multiplies the matrices once, so a rotate -> translate -> perspective
+      chain is still a single pass over the points
+   3) apply() deinterleaves the vector<Point3f> into SIMD registers, does the 4x4 multiply (and the homogeneous
+      divide only if the bottom row is not [0, 0, 0, 1]) and splits large clouds into chunks across threads
+*/
+class PointTransform {
+public:
+    PointTransform() : matrix(cv::Matx44f::eye()) {}
+    explicit PointTransform(const cv::Matx44f& m) : matrix(m) {}
+
+    //Rotation about the z-axis, same matrix as rotatePoints
+    static PointTransform rotateZ(float angleDegrees) {
+        float c = (float)cos(angleDegrees * CV_PI / 180), s = (float)sin(angleDegrees * CV_PI / 180);
+        return PointTransform(cv::Matx44f(c, -s, 0, 0,
+                                          s,  c, 0, 0,
+                                          0,  0, 1, 0,
+                                          0,  0, 0, 1));
+    }
+
+    static PointTransform translate(float dx, float dy, float dz) {
+        return PointTransform(cv::Matx44f(1, 0, 0, dx,
+                                          0, 1, 0, dy,
+                                          0, 0, 1, dz,
+                                          0, 0, 0, 1));
+    }
+
+    static PointTransform scale(float sx, float sy, float sz) {
+        return PointTransform(cv::Matx44f(sx, 0, 0, 0,
+                                          0, sy, 0, 0,
+                                          0, 0, sz, 0,
+                                          0, 0, 0, 1));
+    }
+
+    //Wraps an existing 4x4 CV_32F affine or perspective matrix like the ones built in main()
+    static PointTransform fromMat(const cv::Mat& m) {
+        CV_Assert(m.rows == 4 && m.cols == 4 && m.type() == CV_32FC1 && m.isContinuous());
+        return PointTransform(cv::Matx44f(m.ptr<float>()));
+    }
+
+    //Returns the transform that applies *this first and next second (next.matrix * matrix)
+    PointTransform then(const PointTransform& next) const {
+        return PointTransform(next.matrix * matrix);
+    }
+
+    const cv::Matx44f& mat() const { return matrix; }
+
+    //Only a non-trivial bottom row needs the divide by w'
+    bool isProjective() const {
+        return matrix(3, 0) != 0 || matrix(3, 1) != 0 || matrix(3, 2) != 0 || matrix(3, 3) != 1;
+    }
+
+    void apply(std::vector<cv::Point3f>& points) const {
+        apply(points.data(), points.data(), points.size());
+    }
+
+    //src and dst may be the same buffer
+    void apply(const cv::Point3f* src, cv::Point3f* dst, size_t count) const {
+        PROFILE_SCOPE("PointTransform::apply", count * sizeof(cv::Point3f));
+        const size_t chunk = 1 << 16;   //Points per task, 768KB of Point3f so a chunk stays in L2
+        if(count <= chunk) {
+            applyChunk(src, dst, (int)count);
+            return;
+        }
+        int chunks = (int)((count + chunk - 1) / chunk);
+        cv::parallel_for_(cv::Range(0, chunks), [&](const cv::Range& range) {
+            for(int c = range.start; c < range.end; c++) {
+                size_t begin = c * chunk;
+                size_t end = std::min(count, begin + chunk);
+                applyChunk(src + begin, dst + begin, (int)(end - begin));
+            }
+        });
+    }
+
+private:
+    void applyChunk(const cv::Point3f* src, cv::Point3f* dst, int count) const {
+        const cv::Matx44f& m = matrix;
+        const bool projective = isProjective();
+        const float* in = reinterpret_cast<const float*>(src);
+        float* out = reinterpret_cast<float*>(dst);
+        int i = 0;
+
+#if (CV_SIMD || CV_SIMD_SCALABLE)
+        const int lanes = cv::VTraits<cv::v_float32>::vlanes();
+        cv::v_float32 m00 = cv::vx_setall_f32(m(0, 0)), m01 = cv::vx_setall_f32(m(0, 1)), m02 = cv::vx_setall_f32(m(0, 2)), m03 = cv::vx_setall_f32(m(0, 3));
+        cv::v_float32 m10 = cv::vx_setall_f32(m(1, 0)), m11 = cv::vx_setall_f32(m(1, 1)), m12 = cv::vx_setall_f32(m(1, 2)), m13 = cv::vx_setall_f32(m(1, 3));
+        cv::v_float32 m20 = cv::vx_setall_f32(m(2, 0)), m21 = cv::vx_setall_f32(m(2, 1)), m22 = cv::vx_setall_f32(m(2, 2)), m23 = cv::vx_setall_f32(m(2, 3));
+        cv::v_float32 m30 = cv::vx_setall_f32(m(3, 0)), m31 = cv::vx_setall_f32(m(3, 1)), m32 = cv::vx_setall_f32(m(3, 2)), m33 = cv::vx_setall_f32(m(3, 3));
+        for(; i <= count - lanes; i += lanes) {
+            cv::v_float32 x, y, z;
+            cv::v_load_deinterleave(in + 3 * i, x, y, z);
+            cv::v_float32 ox = cv::v_fma(m00, x, cv::v_fma(m01, y, cv::v_fma(m02, z, m03)));
+            cv::v_float32 oy = cv::v_fma(m10, x, cv::v_fma(m11, y, cv::v_fma(m12, z, m13)));
+            cv::v_float32 oz = cv::v_fma(m20, x, cv::v_fma(m21, y, cv::v_fma(m22, z, m23)));
+            if(projective) {
+                cv::v_float32 w = cv::v_fma(m30, x, cv::v_fma(m31, y, cv::v_fma(m32, z, m33)));
+                ox = cv::v_div(ox, w);
+                oy = cv::v_div(oy, w);
+                oz = cv::v_div(oz, w);
+            }
+            cv::v_store_interleave(out + 3 * i, ox, oy, oz);
+        }
+        cv::vx_cleanup();
+#endif
+
+        for(; i < count; i++) {
+            float x = in[3 * i], y = in[3 * i + 1], z = in[3 * i + 2];
+            float ox = m(0, 0) * x + m(0, 1) * y + m(0, 2) * z + m(0, 3);
+            float oy = m(1, 0) * x + m(1, 1) * y + m(1, 2) * z + m(1, 3);
+            float oz = m(2, 0) * x + m(2, 1) * y + m(2, 2) * z + m(2, 3);
+            if(projective) {
+                float w = m(3, 0) * x + m(3, 1) * y + m(3, 2) * z + m(3, 3);
+                ox /= w;
+                oy /= w;
+                oz /= w;
+            }
+            out[3 * i] = ox;
+            out[3 * i + 1] = oy;
+            out[3 * i + 2] = oz;
+        }
+    }
+
+    cv::Matx44f matrix;
+};
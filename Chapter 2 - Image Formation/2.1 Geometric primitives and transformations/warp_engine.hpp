@@ -0,0 +1,362 @@
+#pragma once
+
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "../../Tools/profiler.hpp"
+
+/* Composed 2D warps
+   Every transform in 2d_transformations.cpp (translate, rotate, scale, affine, perspective) is a 3x3 homography, an
+   affine one just has [0, 0, 1] as its bottom row. Chaining them with then() multiplies the matrices, so a
+   translate -> rotate -> perspective sequence is resampled once instead of three times, with one interpolation's
+   worth of blur and cost.
+*/
+class PlanarTransform {
+public:
+    PlanarTransform() : matrix(cv::Matx33d::eye()) {}
+    explicit PlanarTransform(const cv::Matx33d& m) : matrix(m) {}
+
+    static PlanarTransform translate(double tx, double ty) {
+        return PlanarTransform(cv::Matx33d(1, 0, tx,
+                                           0, 1, ty,
+                                           0, 0, 1));
+    }
+
+    //Same matrix as getRotationMatrix2D(center, angleDegrees, scale)
+    static PlanarTransform rotate(cv::Point2f center, double angleDegrees, double scale = 1.0) {
+        return fromMat(cv::getRotationMatrix2D(center, angleDegrees, scale));
+    }
+
+    static PlanarTransform scale(double sx, double sy) {
+        return PlanarTransform(cv::Matx33d(sx, 0, 0,
+                                           0, sy, 0,
+                                           0, 0, 1));
+    }
+
+    //Wraps a 2x3 warpAffine or 3x3 warpPerspective matrix, CV_32F or CV_64F
+    static PlanarTransform fromMat(const cv::Mat& m) {
+        CV_Assert((m.rows == 2 || m.rows == 3) && m.cols == 3 && (m.type() == CV_32FC1 || m.type() == CV_64FC1));
+        cv::Mat m64;
+        m.convertTo(m64, CV_64F);
+        cv::Matx33d h = cv::Matx33d::eye();
+        for(int i = 0; i < m.rows; i++) {
+            for(int j = 0; j < 3; j++) {
+                h(i, j) = m64.at<double>(i, j);
+            }
+        }
+        return PlanarTransform(h);
+    }
+
+    //Returns the transform that applies *this first and next second (next.matrix * matrix)
+    PlanarTransform then(const PlanarTransform& next) const {
+        return PlanarTransform(next.matrix * matrix);
+    }
+
+    const cv::Matx33d& mat() const { return matrix; }
+
+    bool isProjective() const {
+        return matrix(2, 0) != 0 || matrix(2, 1) != 0 || matrix(2, 2) != 1;
+    }
+
+private:
+    cv::Matx33d matrix;
+};
+
+/* Remap tables for one warp
+   Source positions in the fixed-point form remap() uses internally: xy holds the integer pixel (CV_16SC2) and
+   fraction the 1/32 pixel sub-position as a row of OpenCV's interpolation table (CV_16UC1). That is 6 bytes per
+   output pixel instead of 8 for a pair of float maps, and remap() skips the float to fixed-point conversion.
+*/
+struct WarpMaps {
+    cv::Mat xy;
+    cv::Mat fraction;
+};
+
+/* Warp engine with cached remap tables
+   warp() looks the (matrix, source size, output size) key up in a small LRU cache, so the per-pixel inverse mapping
+   and divide is done once for a camera's rectification and every later frame only pays for the remap itself.
+   1) buildMaps() walks the output rows across threads, mapping each pixel back through the inverse homography
+      in double precision and rounding to 1/32 pixel, the same as warpPerspective does on every call
+   2) remapTiled() splits the output into tiles and remaps them across threads, a tile's source footprint is
+      compact even for rotations, so the source rows it reads stay in cache
+   The cache is guarded by a mutex and hands out shared pointers, one engine can serve several threads and an
+   evicted table stays alive until the warps using it finish.
+*/
+class WarpEngine {
+public:
+    explicit WarpEngine(size_t maxCached = 8) : capacity(std::max<size_t>(1, maxCached)) {}
+
+    //Sub-pixel interpolations only (INTER_LINEAR, INTER_CUBIC, INTER_LANCZOS4), dsize defaults to the source size
+    void warp(const cv::Mat& src, cv::Mat& dst, const PlanarTransform& transform, cv::Size dsize = cv::Size(),
+              int interpolation = cv::INTER_LINEAR, int borderMode = cv::BORDER_CONSTANT,
+              const cv::Scalar& borderValue = cv::Scalar()) {
+        PROFILE_SCOPE("WarpEngine::warp", src);
+        CV_Assert(!src.empty() && src.dims == 2);
+        CV_Assert(interpolation == cv::INTER_LINEAR || interpolation == cv::INTER_CUBIC || interpolation == cv::INTER_LANCZOS4);
+        if(dsize.area() == 0) {
+            dsize = src.size();
+        }
+        std::shared_ptr<const WarpMaps> tables = maps(transform, src.size(), dsize);
+        if(dst.data == src.data) {
+            dst.release();
+        }
+        dst.create(dsize, src.type());
+        remapTiled(src, dst, *tables, interpolation, borderMode, borderValue);
+    }
+
+    //Cached tables for the transform, built on the first request
+    std::shared_ptr<const WarpMaps> maps(const PlanarTransform& transform, cv::Size srcSize, cv::Size dsize) {
+        Key key = {transform.mat(), srcSize, dsize};
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for(auto it = entries.begin(); it != entries.end(); ++it) {
+                if(it->key == key) {
+                    entries.splice(entries.begin(), entries, it);
+                    hitCount++;
+                    return entries.front().maps;
+                }
+            }
+            missCount++;
+        }
+        //Built outside the lock so other keys are not held up, a racing build of the same key is only wasted work
+        std::shared_ptr<WarpMaps> built = std::make_shared<WarpMaps>();
+        buildMaps(transform, srcSize, dsize, *built);
+        std::lock_guard<std::mutex> lock(mutex);
+        entries.push_front(Entry{key, built});
+        if(entries.size() > capacity) {
+            entries.pop_back();
+        }
+        return built;
+    }
+
+    size_t hits() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return hitCount;
+    }
+
+    size_t misses() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return missCount;
+    }
+
+    void clear() {
+        std::lock_guard<std::mutex> lock(mutex);
+        entries.clear();
+    }
+
+    //Inverse mapping of every output pixel, rows split across threads
+    static void buildMaps(const PlanarTransform& transform, cv::Size srcSize, cv::Size dsize, WarpMaps& out) {
+        CV_Assert(srcSize.area() > 0 && dsize.area() > 0);
+        CV_Assert(cv::determinant(transform.mat()) != 0);
+        cv::Matx33d inv = transform.mat().inv();
+        out.xy.create(dsize, CV_16SC2);
+        out.fraction.create(dsize, CV_16UC1);
+        const double* M = inv.val;
+        cv::parallel_for_(cv::Range(0, dsize.height), [&](const cv::Range& range) {
+            for(int y = range.start; y < range.end; y++) {
+                short* xy = out.xy.ptr<short>(y);
+                ushort* fraction = out.fraction.ptr<ushort>(y);
+                const double X0 = M[1] * y + M[2], Y0 = M[4] * y + M[5], W0 = M[7] * y + M[8];
+                for(int x = 0; x < dsize.width; x++) {
+                    double W = W0 + M[6] * x;
+                    W = W != 0 ? cv::INTER_TAB_SIZE / W : 0;
+                    //Clamped before the cast, far off-source pixels near the horizon would overflow int
+                    double fX = std::max((double)INT_MIN, std::min((double)INT_MAX, (X0 + M[0] * x) * W));
+                    double fY = std::max((double)INT_MIN, std::min((double)INT_MAX, (Y0 + M[3] * x) * W));
+                    int X = cv::saturate_cast<int>(fX), Y = cv::saturate_cast<int>(fY);
+                    xy[2 * x] = cv::saturate_cast<short>(X >> cv::INTER_BITS);
+                    xy[2 * x + 1] = cv::saturate_cast<short>(Y >> cv::INTER_BITS);
+                    fraction[x] = (ushort)((Y & (cv::INTER_TAB_SIZE - 1)) * cv::INTER_TAB_SIZE + (X & (cv::INTER_TAB_SIZE - 1)));
+                }
+            }
+        });
+    }
+
+    //remap() over output tiles in parallel, each tile reads the matching window of the tables
+    static void remapTiled(const cv::Mat& src, cv::Mat& dst, const WarpMaps& tables, int interpolation, int borderMode,
+                           const cv::Scalar& borderValue) {
+        CV_Assert(tables.xy.size() == dst.size() && tables.fraction.size() == dst.size());
+        const int tileRows = 32, tileCols = 256;   //8K output pixels, about 48KB of tables per tile
+        const int tilesX = (dst.cols + tileCols - 1) / tileCols, tilesY = (dst.rows + tileRows - 1) / tileRows;
+        cv::parallel_for_(cv::Range(0, tilesX * tilesY), [&](const cv::Range& range) {
+            for(int t = range.start; t < range.end; t++) {
+                cv::Rect tile((t % tilesX) * tileCols, (t / tilesX) * tileRows, tileCols, tileRows);
+                tile &= cv::Rect(0, 0, dst.cols, dst.rows);
+                cv::Mat dstTile = dst(tile);
+                cv::remap(src, dstTile, tables.xy(tile), tables.fraction(tile), interpolation, borderMode, borderValue);
+            }
+        });
+    }
+
+private:
+    struct Key {
+        cv::Matx33d matrix;
+        cv::Size srcSize, dsize;
+        bool operator==(const Key& other) const {
+            return srcSize == other.srcSize && dsize == other.dsize && memcmp(matrix.val, other.matrix.val, sizeof(matrix.val)) == 0;
+        }
+    };
+
+    struct Entry {
+        Key key;
+        std::shared_ptr<const WarpMaps> maps;
+    };
+
+    size_t capacity;
+    std::list<Entry> entries;   //Most recently used first
+    mutable std::mutex mutex;
+    size_t hitCount = 0, missCount = 0;
+};
+
+/* Bounds-aware tiled warpPerspective
+   Each output tile's corners are projected back through the inverse homography. As long as w' stays positive over
+   the tile, the tile maps to a convex quad in the source, so its corners decide the whole tile:
+       outside   all corners beyond the same source edge, the tile is filled with the border value and never sampled
+       inside    all corners at least a sixteenth of a pixel inside the last full 2x2 neighbourhood, every pixel is
+                 sampled with no bound tests
+       boundary  anything else (including w' <= 0 somewhere), every pixel is tested like remap() does
+   The margins cover the 1/32 pixel rounding, so the classification is conservative and the output matches
+   WarpEngine/remap() exactly. Only CV_8U images with 1 to 4 channels, bilinear sampling and a constant border.
+*/
+enum WarpTileClass { WARP_TILE_OUTSIDE, WARP_TILE_INSIDE, WARP_TILE_BOUNDARY };
+
+struct WarpTileCounts {
+    int outside = 0;
+    int inside = 0;
+    int boundary = 0;
+};
+
+inline WarpTileClass classifyWarpTile(const cv::Matx33d& inv, const cv::Rect& tile, cv::Size srcSize) {
+    const double margin = 1.0 / 16;
+    const int xs[2] = {tile.x, tile.x + tile.width - 1}, ys[2] = {tile.y, tile.y + tile.height - 1};
+    bool inside = true, left = true, right = true, above = true, below = true;
+    for(int y : ys) {
+        for(int x : xs) {
+            double w = inv(2, 0) * x + inv(2, 1) * y + inv(2, 2);
+            if(w <= 0) {
+                return WARP_TILE_BOUNDARY;
+            }
+            double sx = (inv(0, 0) * x + inv(0, 1) * y + inv(0, 2)) / w;
+            double sy = (inv(1, 0) * x + inv(1, 1) * y + inv(1, 2)) / w;
+            inside = inside && sx >= margin && sx <= srcSize.width - 1 - margin && sy >= margin && sy <= srcSize.height - 1 - margin;
+            left = left && sx <= -1 - margin;
+            right = right && sx >= srcSize.width + margin;
+            above = above && sy <= -1 - margin;
+            below = below && sy >= srcSize.height + margin;
+        }
+    }
+    if(inside) {
+        return WARP_TILE_INSIDE;
+    }
+    return left || right || above || below ? WARP_TILE_OUTSIDE : WARP_TILE_BOUNDARY;
+}
+
+/* One tile row, pixels [x0, x1) of output row y
+   Positions are computed exactly as buildMaps() does. The weights are remap()'s 15-bit bilinear table entries
+   divided by 32: with 1/32 pixel steps they are whole numbers summing to 1024, so the rounding is unchanged.
+*/
+template<int cn>
+void warpPerspectiveRow(const cv::Mat& src, uchar* dst, const double* M, int y, int x0, int x1, bool checked,
+                        const uchar* border) {
+    const int width = src.cols, height = src.rows;
+    const size_t step = src.step;
+    const double X0 = M[1] * y + M[2], Y0 = M[4] * y + M[5], W0 = M[7] * y + M[8];
+    for(int x = x0; x < x1; x++) {
+        double W = W0 + M[6] * x;
+        W = W != 0 ? cv::INTER_TAB_SIZE / W : 0;
+        double fX = std::max((double)INT_MIN, std::min((double)INT_MAX, (X0 + M[0] * x) * W));
+        double fY = std::max((double)INT_MIN, std::min((double)INT_MAX, (Y0 + M[3] * x) * W));
+        int X = cv::saturate_cast<int>(fX), Y = cv::saturate_cast<int>(fY);
+        int sx = cv::saturate_cast<short>(X >> cv::INTER_BITS), sy = cv::saturate_cast<short>(Y >> cv::INTER_BITS);
+        int ax = X & (cv::INTER_TAB_SIZE - 1), ay = Y & (cv::INTER_TAB_SIZE - 1);
+        int w00 = (cv::INTER_TAB_SIZE - ax) * (cv::INTER_TAB_SIZE - ay), w01 = ax * (cv::INTER_TAB_SIZE - ay);
+        int w10 = (cv::INTER_TAB_SIZE - ax) * ay, w11 = ax * ay;
+        uchar* d = dst + x * cn;
+
+        const uchar *p00, *p01, *p10, *p11;
+        if(!checked || (sx >= 0 && sx < width - 1 && sy >= 0 && sy < height - 1)) {
+            p00 = src.data + sy * step + sx * cn;
+            p01 = p00 + cn;
+            p10 = p00 + step;
+            p11 = p10 + cn;
+        }
+        else if(sx >= width || sx + 1 < 0 || sy >= height || sy + 1 < 0) {
+            for(int c = 0; c < cn; c++) {
+                d[c] = border[c];
+            }
+            continue;
+        }
+        else {
+            //Straddles the edge, neighbours outside the source read the border value
+            auto at = [&](int px, int py) {
+                return px >= 0 && px < width && py >= 0 && py < height ? src.data + py * step + px * cn : border;
+            };
+            p00 = at(sx, sy);
+            p01 = at(sx + 1, sy);
+            p10 = at(sx, sy + 1);
+            p11 = at(sx + 1, sy + 1);
+        }
+        for(int c = 0; c < cn; c++) {
+            d[c] = (uchar)((p00[c] * w00 + p01[c] * w01 + p10[c] * w10 + p11[c] * w11 + 512) >> 10);
+        }
+    }
+}
+
+//Tiles of 32x128 output pixels run across threads, returns how many tiles took each path
+inline WarpTileCounts tiledWarpPerspective(const cv::Mat& src, cv::Mat& dst, const cv::Mat& perspective,
+                                           cv::Size dsize = cv::Size(), const cv::Scalar& borderValue = cv::Scalar()) {
+    CV_Assert(!src.empty() && src.depth() == CV_8U && src.channels() <= 4);
+    const cv::Matx33d inv = PlanarTransform::fromMat(perspective).mat().inv();
+    if(dsize.area() == 0) {
+        dsize = src.size();
+    }
+    cv::Mat source = src;
+    if(dst.data == src.data) {
+        source = src.clone();
+    }
+    dst.create(dsize, src.type());
+    uchar border[4];
+    for(int c = 0; c < 4; c++) {
+        border[c] = cv::saturate_cast<uchar>(borderValue[c]);
+    }
+
+    const int tileRows = 32, tileCols = 128, cn = src.channels();
+    const int tilesX = (dsize.width + tileCols - 1) / tileCols, tilesY = (dsize.height + tileRows - 1) / tileRows;
+    std::vector<uchar> classes(tilesX * tilesY);
+    cv::parallel_for_(cv::Range(0, tilesX * tilesY), [&](const cv::Range& range) {
+        for(int t = range.start; t < range.end; t++) {
+            cv::Rect tile((t % tilesX) * tileCols, (t / tilesX) * tileRows, tileCols, tileRows);
+            tile &= cv::Rect(0, 0, dsize.width, dsize.height);
+            WarpTileClass tileClass = classifyWarpTile(inv, tile, source.size());
+            classes[t] = (uchar)tileClass;
+            if(tileClass == WARP_TILE_OUTSIDE) {
+                dst(tile).setTo(borderValue);
+                continue;
+            }
+            const bool checked = tileClass == WARP_TILE_BOUNDARY;
+            for(int y = tile.y; y < tile.y + tile.height; y++) {
+                uchar* row = dst.ptr<uchar>(y);
+                switch(cn) {
+                    case 1: warpPerspectiveRow<1>(source, row, inv.val, y, tile.x, tile.x + tile.width, checked, border); break;
+                    case 2: warpPerspectiveRow<2>(source, row, inv.val, y, tile.x, tile.x + tile.width, checked, border); break;
+                    case 3: warpPerspectiveRow<3>(source, row, inv.val, y, tile.x, tile.x + tile.width, checked, border); break;
+                    default: warpPerspectiveRow<4>(source, row, inv.val, y, tile.x, tile.x + tile.width, checked, border); break;
+                }
+            }
+        }
+    });
+
+    WarpTileCounts counts;
+    for(uchar tileClass : classes) {
+        counts.outside += tileClass == WARP_TILE_OUTSIDE;
+        counts.inside += tileClass == WARP_TILE_INSIDE;
+        counts.boundary += tileClass == WARP_TILE_BOUNDARY;
+    }
+    return counts;
+}
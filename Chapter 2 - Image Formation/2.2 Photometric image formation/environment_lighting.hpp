@@ -0,0 +1,335 @@
+#pragma once
+
+#include <opencv2/core.hpp>
+#include <opencv2/core/hal/intrin.hpp>
+#include <opencv2/imgproc.hpp>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include "shading_renderer.hpp"
+#include "../../Tools/profiler.hpp"
+
+/* Real spherical harmonics up to order 2 (9 functions) of a unit direction d
+   Ordered (l, m) = (0, 0), (1, -1), (1, 0), (1, 1), (2, -2), (2, -1), (2, 0), (2, 1), (2, 2).
+*/
+inline void sphericalHarmonics(const cv::Vec3f& d, float* y) {
+    y[0] = 0.282095f;
+    y[1] = 0.488603f * d[1];
+    y[2] = 0.488603f * d[2];
+    y[3] = 0.488603f * d[0];
+    y[4] = 1.092548f * d[0] * d[1];
+    y[5] = 1.092548f * d[1] * d[2];
+    y[6] = 0.315392f * (3 * d[2] * d[2] - 1);
+    y[7] = 1.092548f * d[0] * d[2];
+    y[8] = 0.546274f * (d[0] * d[0] - d[1] * d[1]);
+}
+
+/* Octahedral map of the unit sphere onto [-1, 1]^2
+   The upper hemisphere is projected onto the diamond |u| + |v| <= 1 and the lower one folded into the corners. It
+   needs no trigonometry and spreads texels far more evenly than a latitude-longitude table.
+*/
+inline cv::Vec2f octahedralEncode(const cv::Vec3f& d) {
+    const float inv = 1.f / (std::abs(d[0]) + std::abs(d[1]) + std::abs(d[2]));
+    float u = d[0] * inv, v = d[1] * inv;
+    if(d[2] < 0) {
+        const float fu = (1 - std::abs(v)) * (u >= 0 ? 1.f : -1.f), fv = (1 - std::abs(u)) * (v >= 0 ? 1.f : -1.f);
+        u = fu;
+        v = fv;
+    }
+    return cv::Vec2f(u, v);
+}
+
+inline cv::Vec3f octahedralDecode(float u, float v) {
+    cv::Vec3f d(u, v, 1 - std::abs(u) - std::abs(v));
+    if(d[2] < 0) {
+        d[0] = (1 - std::abs(v)) * (u >= 0 ? 1.f : -1.f);
+        d[1] = (1 - std::abs(u)) * (v >= 0 ? 1.f : -1.f);
+    }
+    return unitVector(d);
+}
+
+/* Environment lighting for the Lambert + Phong model
+   The lights (or an environment map) are projected once, after which every pixel costs the same however many lights
+   there are:
+   1) Diffuse: the irradiance sum over lights of intensity * max(N.L, 0) is approximated from the 9 order-2 spherical
+      harmonic coefficients of the lighting, which reduce to a quadratic polynomial in N (Ramamoorthi and Hanrahan).
+      The clamped cosine is smooth enough that order 2 keeps the error to a few percent of a single light and much
+      less for many lights or an environment map.
+   2) Specular: sum over lights of intensity * max(R.V, 0)^n equals sum of intensity * max(R'.L, 0)^n with R' the view
+      direction mirrored about N, so it only depends on R' and n. It is tabulated for a set of shininess levels over
+      an octahedral map of R' and read back with bilinear interpolation, blending the two levels around the
+      material's shininess in log space.
+   Point lights are seen from one reference point, like distant lights, so they match the per-light renderer only
+   where the surface is small next to the light distance.
+*/
+class EnvironmentLighting {
+public:
+    explicit EnvironmentLighting(const std::vector<float>& shininessLevels = {1, 2, 5, 10, 20, 50, 100, 200}, int tableSize = 64)
+        : levels(shininessLevels), size(tableSize) {
+        CV_Assert(!levels.empty() && size >= 2 && std::is_sorted(levels.begin(), levels.end()) && levels.front() > 0);
+    }
+
+    //Directional and point lights, point lights as seen from center
+    void fromLights(const std::vector<ShadingLight>& lights, cv::Vec3f center = cv::Vec3f(0, 0, 0)) {
+        std::vector<cv::Vec3f> directions;
+        std::vector<float> weights;
+        for(const ShadingLight& light : lights) {
+            CV_Assert(light.type != LIGHT_MAP);
+            directions.push_back(unitVector(light.type == LIGHT_POINT ? light.vector - center : light.vector));
+            weights.push_back(light.intensity);
+        }
+        project(directions, weights);
+    }
+
+    /* Latitude-longitude radiance map, CV_32FC1
+       Row 0 looks along +y and the last row along -y, column 0 starts at azimuth -pi around y measured from +z
+       towards +x. Maps wider than 128 columns are averaged down first, the result is the same to within the tables'
+       resolution. Each texel is a light with its radiance times its solid angle as intensity.
+    */
+    void fromEnvironmentMap(const cv::Mat& latlong) {
+        CV_Assert(latlong.type() == CV_32FC1 && !latlong.empty());
+        cv::Mat radiance = latlong;
+        if(latlong.cols > 128) {
+            cv::resize(latlong, radiance, cv::Size(128, std::max(1, 128 * latlong.rows / latlong.cols)), 0, 0, cv::INTER_AREA);
+        }
+        std::vector<cv::Vec3f> directions;
+        std::vector<float> weights;
+        const double dTheta = CV_PI / radiance.rows, dPhi = 2 * CV_PI / radiance.cols;
+        for(int i = 0; i < radiance.rows; i++) {
+            const double theta = (i + 0.5) * dTheta;
+            for(int j = 0; j < radiance.cols; j++) {
+                const double phi = (j + 0.5) * dPhi - CV_PI;
+                directions.push_back(cv::Vec3f((float)(std::sin(theta) * std::sin(phi)), (float)std::cos(theta), (float)(std::sin(theta) * std::cos(phi))));
+                weights.push_back((float)(radiance.at<float>(i, j) * std::sin(theta) * dTheta * dPhi));
+            }
+        }
+        project(directions, weights);
+    }
+
+    const float* coefficients() const { return sh; }
+
+    //Diffuse term for a normal of any length
+    float irradiance(const cv::Vec3f& normal) const {
+        const cv::Vec3f n = unitVector(normal);
+        const float* k = poly;
+        float e = k[0] + k[1] * n[0] + k[2] * n[1] + k[3] * n[2] + k[4] * n[0] * n[0] + k[5] * n[1] * n[1] + k[6] * n[2] * n[2] +
+                  k[7] * n[0] * n[1] + k[8] * n[0] * n[2] + k[9] * n[1] * n[2];
+        return std::max(e, 0.f);
+    }
+
+    //Specular term for the mirrored view direction and a shininess inside the tabulated levels
+    float specular(const cv::Vec3f& reflection, float shininess) const {
+        int level;
+        float blend;
+        selectLevels(shininess, level, blend);
+        cv::Vec2f uv = octahedralEncode(reflection);
+        float s = lookup(level, uv[0], uv[1]);
+        return blend > 0 ? s + blend * (lookup(level + 1, uv[0], uv[1]) - s) : s;
+    }
+
+    /* Shades like ShadingRenderer::render with the renderer's material and view direction, but from the projected
+       lighting instead of the renderer's lights. Only the normal and view maps are read.
+    */
+    void render(const ShadingMaps& maps, const ShadingRenderer& renderer, cv::Mat& dst) const {
+        PROFILE_SCOPE("EnvironmentLighting::render");
+        const cv::Size size = maps.size();
+        const bool perPixelView = !maps.view[0].empty();
+        for(int c = 0; c < 3; c++) {
+            CV_Assert(maps.normal[c].type() == CV_32FC1 && maps.normal[c].size() == size);
+            CV_Assert(!perPixelView || (maps.view[c].type() == CV_32FC1 && maps.view[c].size() == size));
+        }
+        int level;
+        float blend;
+        selectLevels(renderer.getMaterial().shininess, level, blend);
+        const cv::Vec3f view = unitVector(renderer.getViewDir());
+
+        dst.create(size, CV_8UC3);
+        const int tileRows = 32, tileCols = 256;
+        const int tilesX = (size.width + tileCols - 1) / tileCols, tilesY = (size.height + tileRows - 1) / tileRows;
+        cv::parallel_for_(cv::Range(0, tilesX * tilesY), [&](const cv::Range& range) {
+            std::vector<float> channels(3 * tileCols);
+            for(int t = range.start; t < range.end; t++) {
+                const int x0 = (t % tilesX) * tileCols, x1 = std::min(size.width, x0 + tileCols);
+                const int y0 = (t / tilesX) * tileRows, y1 = std::min(size.height, y0 + tileRows);
+                for(int y = y0; y < y1; y++) {
+                    float* b = channels.data();
+                    float* g = b + tileCols;
+                    float* r = g + tileCols;
+                    shadeRow(maps, renderer.getMaterial(), view, perPixelView, level, blend, y, x0, x1, b, g, r);
+                    storeShadedRow(b, g, r, dst.ptr<uchar>(y) + 3 * x0, x1 - x0);
+                }
+            }
+        });
+    }
+
+private:
+    //Spherical harmonic coefficients and specular tables of weighted directions
+    void project(const std::vector<cv::Vec3f>& directions, const std::vector<float>& weights) {
+        std::fill(sh, sh + 9, 0.f);
+        for(size_t i = 0; i < directions.size(); i++) {
+            float y[9];
+            sphericalHarmonics(directions[i], y);
+            for(int k = 0; k < 9; k++) {
+                sh[k] += weights[i] * y[k];
+            }
+        }
+        //Irradiance polynomial in (x, y, z): constant, x, y, z, xx, yy, zz, xy, xz, yz
+        const float c1 = 0.429043f, c2 = 0.511664f, c3 = 0.743125f, c4 = 0.886227f, c5 = 0.247708f;
+        poly[0] = c4 * sh[0] - c5 * sh[6];
+        poly[1] = 2 * c2 * sh[3];
+        poly[2] = 2 * c2 * sh[1];
+        poly[3] = 2 * c2 * sh[2];
+        poly[4] = c1 * sh[8];
+        poly[5] = -c1 * sh[8];
+        poly[6] = c3 * sh[6];
+        poly[7] = 2 * c1 * sh[4];
+        poly[8] = 2 * c1 * sh[7];
+        poly[9] = 2 * c1 * sh[5];
+
+        //Texels are independent and built across threads, each direction's log cosine is shared by all levels
+        const int levelCount = (int)levels.size();
+        table.assign((size_t)levelCount * size * size, 0.f);
+        cv::parallel_for_(cv::Range(0, size * size), [&](const cv::Range& range) {
+            std::vector<double> sums(levelCount);
+            for(int texel = range.start; texel < range.end; texel++) {
+                const int tx = texel % size, ty = texel / size;
+                const cv::Vec3f r = octahedralDecode((tx + 0.5f) * 2 / size - 1, (ty + 0.5f) * 2 / size - 1);
+                std::fill(sums.begin(), sums.end(), 0.0);
+                for(size_t i = 0; i < directions.size(); i++) {
+                    const float cosine = r.dot(directions[i]);
+                    if(cosine > 0) {
+                        const double logCosine = std::log((double)cosine);
+                        for(int level = 0; level < levelCount; level++) {
+                            sums[level] += weights[i] * std::exp(levels[level] * logCosine);
+                        }
+                    }
+                }
+                for(int level = 0; level < levelCount; level++) {
+                    table[(size_t)level * size * size + texel] = (float)sums[level];
+                }
+            }
+        });
+    }
+
+    //The level at or below the shininess and the log-space weight of the one above
+    void selectLevels(float shininess, int& level, float& blend) const {
+        CV_Assert(shininess >= levels.front() && shininess <= levels.back());
+        level = 0;
+        while(level + 1 < (int)levels.size() && levels[level + 1] <= shininess) {
+            level++;
+        }
+        blend = 0;
+        if(level + 1 < (int)levels.size() && shininess > levels[level]) {
+            blend = std::log(shininess / levels[level]) / std::log(levels[level + 1] / levels[level]);
+        }
+    }
+
+    //Texel coordinate of u or v, clamped so the right/bottom neighbour always exists
+    float texel(float u) const {
+        return std::min(std::max((u + 1) * 0.5f * size - 0.5f, 0.f), size - 1.001f);
+    }
+
+    float lookup(int level, float u, float v) const {
+        const float fx = texel(u), fy = texel(v);
+        const int x0 = (int)fx, y0 = (int)fy;
+        const float ax = fx - x0, ay = fy - y0;
+        const float* t = &table[((size_t)level * size + y0) * size + x0];
+        const float top = t[0] + ax * (t[1] - t[0]), bottom = t[size] + ax * (t[size + 1] - t[size]);
+        return top + ay * (bottom - top);
+    }
+
+    void shadeRow(const ShadingMaps& maps, const ShadingMaterial& material, cv::Vec3f view, bool perPixelView, int level,
+                  float blend, int y, int x0, int x1, float* b, float* g, float* r) const {
+        const float* n[3];
+        const float* v[3] = {nullptr, nullptr, nullptr};
+        for(int c = 0; c < 3; c++) {
+            n[c] = maps.normal[c].ptr<float>(y) + x0;
+            if(perPixelView) v[c] = maps.view[c].ptr<float>(y) + x0;
+        }
+        const cv::Vec3f kd = material.diffuse * 255.f, ks = material.specular * 255.f;
+        const int len = x1 - x0;
+        int x = 0;
+
+#if (CV_SIMD || CV_SIMD_SCALABLE)
+        const int lanes = cv::VTraits<cv::v_float32>::vlanes();
+        const cv::v_float32 zero = cv::vx_setzero_f32(), one = cv::vx_setall_f32(1.f), two = cv::vx_setall_f32(2.f);
+        const cv::v_float32 half = cv::vx_setall_f32(0.5f * size), maxTexel = cv::vx_setall_f32(size - 1.001f);
+        const cv::v_float32 vBlend = cv::vx_setall_f32(blend);
+        cv::v_float32 k[10];
+        for(int i = 0; i < 10; i++) {
+            k[i] = cv::vx_setall_f32(poly[i]);
+        }
+        const float* levelTable = &table[(size_t)level * size * size];
+        const int nextLevel = blend > 0 ? size * size : 0;
+        for(; x <= len - lanes; x += lanes) {
+            cv::v_float32 nx = cv::vx_load(n[0] + x), ny = cv::vx_load(n[1] + x), nz = cv::vx_load(n[2] + x);
+            normalizeVectors(nx, ny, nz);
+            cv::v_float32 vx = cv::vx_setall_f32(view[0]), vy = cv::vx_setall_f32(view[1]), vz = cv::vx_setall_f32(view[2]);
+            if(perPixelView) {
+                vx = cv::vx_load(v[0] + x);
+                vy = cv::vx_load(v[1] + x);
+                vz = cv::vx_load(v[2] + x);
+                normalizeVectors(vx, vy, vz);
+            }
+
+            //Irradiance polynomial
+            cv::v_float32 e = cv::v_fma(k[1], nx, cv::v_fma(k[2], ny, cv::v_fma(k[3], nz, k[0])));
+            e = cv::v_fma(cv::v_mul(k[4], nx), nx, cv::v_fma(cv::v_mul(k[5], ny), ny, cv::v_fma(cv::v_mul(k[6], nz), nz, e)));
+            e = cv::v_fma(cv::v_mul(k[7], nx), ny, cv::v_fma(cv::v_mul(k[8], nx), nz, cv::v_fma(cv::v_mul(k[9], ny), nz, e)));
+            cv::v_float32 diffuse = cv::v_max(e, zero);
+
+            //View mirrored about the normal, octahedral coordinates, bilinear table reads
+            cv::v_float32 scale = cv::v_mul(two, cv::v_fma(nx, vx, cv::v_fma(ny, vy, cv::v_mul(nz, vz))));
+            cv::v_float32 rx = cv::v_sub(cv::v_mul(scale, nx), vx), ry = cv::v_sub(cv::v_mul(scale, ny), vy), rz = cv::v_sub(cv::v_mul(scale, nz), vz);
+            cv::v_float32 inv = cv::v_div(one, cv::v_add(cv::v_abs(rx), cv::v_add(cv::v_abs(ry), cv::v_abs(rz))));
+            cv::v_float32 u = cv::v_mul(rx, inv), w = cv::v_mul(ry, inv);
+            cv::v_float32 below = cv::v_lt(rz, zero);
+            cv::v_float32 foldU = cv::v_mul(cv::v_sub(one, cv::v_abs(w)), cv::v_select(cv::v_ge(u, zero), one, cv::v_sub(zero, one)));
+            cv::v_float32 foldW = cv::v_mul(cv::v_sub(one, cv::v_abs(u)), cv::v_select(cv::v_ge(w, zero), one, cv::v_sub(zero, one)));
+            u = cv::v_select(below, foldU, u);
+            w = cv::v_select(below, foldW, w);
+            cv::v_float32 fx = cv::v_min(cv::v_max(cv::v_sub(cv::v_mul(cv::v_add(u, one), half), cv::vx_setall_f32(0.5f)), zero), maxTexel);
+            cv::v_float32 fy = cv::v_min(cv::v_max(cv::v_sub(cv::v_mul(cv::v_add(w, one), half), cv::vx_setall_f32(0.5f)), zero), maxTexel);
+            cv::v_int32 ix = cv::v_trunc(fx), iy = cv::v_trunc(fy);
+            cv::v_float32 ax = cv::v_sub(fx, cv::v_cvt_f32(ix)), ay = cv::v_sub(fy, cv::v_cvt_f32(iy));
+            cv::v_int32 index = cv::v_add(cv::v_mul(iy, cv::vx_setall_s32(size)), ix);
+            auto bilinear = [&](const float* t) {
+                cv::v_float32 t00 = cv::v_lut(t, index), t01 = cv::v_lut(t + 1, index);
+                cv::v_float32 t10 = cv::v_lut(t + size, index), t11 = cv::v_lut(t + size + 1, index);
+                cv::v_float32 top = cv::v_fma(ax, cv::v_sub(t01, t00), t00), bottom = cv::v_fma(ax, cv::v_sub(t11, t10), t10);
+                return cv::v_fma(ay, cv::v_sub(bottom, top), top);
+            };
+            cv::v_float32 specular = bilinear(levelTable);
+            if(nextLevel) {
+                specular = cv::v_fma(vBlend, cv::v_sub(bilinear(levelTable + nextLevel), specular), specular);
+            }
+
+            cv::v_store(b + x, cv::v_fma(diffuse, cv::vx_setall_f32(kd[0]), cv::v_mul(specular, cv::vx_setall_f32(ks[0]))));
+            cv::v_store(g + x, cv::v_fma(diffuse, cv::vx_setall_f32(kd[1]), cv::v_mul(specular, cv::vx_setall_f32(ks[1]))));
+            cv::v_store(r + x, cv::v_fma(diffuse, cv::vx_setall_f32(kd[2]), cv::v_mul(specular, cv::vx_setall_f32(ks[2]))));
+        }
+        cv::vx_cleanup();
+#endif
+
+        for(; x < len; x++) {
+            cv::Vec3f normal = unitVector(cv::Vec3f(n[0][x], n[1][x], n[2][x]));
+            cv::Vec3f viewer = perPixelView ? unitVector(cv::Vec3f(v[0][x], v[1][x], v[2][x])) : view;
+            cv::Vec3f reflection = 2 * normal.dot(viewer) * normal - viewer;
+            cv::Vec2f uv = octahedralEncode(reflection);
+            float diffuse = irradiance(normal);
+            float specular = lookup(level, uv[0], uv[1]);
+            if(blend > 0) {
+                specular += blend * (lookup(level + 1, uv[0], uv[1]) - specular);
+            }
+            b[x] = diffuse * kd[0] + specular * ks[0];
+            g[x] = diffuse * kd[1] + specular * ks[1];
+            r[x] = diffuse * kd[2] + specular * ks[2];
+        }
+    }
+
+    std::vector<float> levels;
+    int size;
+    float sh[9] = {0, 0, 0, 0, 0, 0, 0, 0, 0};
+    float poly[10] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+    std::vector<float> table;   //levels x size x size, row-major per level
+};
@@ -1,5 +1,6 @@
 #include <opencv2/opencv.hpp>
 #include <iostream>
+#include "../../Chapter 3 - Image Processing/3.1 Point Operators/point_operator_pipeline.hpp"
 
 using namespace cv;
 using namespace std;
@@ -8,16 +9,18 @@ using namespace std;
 Formula for changing brightness and contrast is: output_img = input_img*alpha + beta. The values of 
 alpha and beta are responsible for contrast and brightness respectively with contrast being 1.0<= beta <=3.0
 and brightness being 0<= alpha <=100. We use special function convertTo(output Mat, -1, alpha, beta).
+The point operator pipeline builds the same mapping as a 256-entry table once and applies it to every channel in one pass,
+further point operators (gamma, threshold, ...) can be chained onto it at no extra cost per pixel.
 */
 void brightness(Mat input_img, double alpha, double beta) {
     
     Mat output_img;
-    input_img.convertTo(output_img, -1, alpha, beta);
-    imwrite("Pictures/bright_img.png", output_img);
+    PointOperatorPipeline().linear(alpha, beta).apply(input_img, output_img);
+    profiled::imwrite("Pictures/bright_img.png", output_img);
 }
 
 int main() {
-    Mat img = imread("Pictures/truck.jpg", IMREAD_COLOR);
+    Mat img = profiled::imread("Pictures/truck.jpg", IMREAD_COLOR);
     if(img.empty()) {
         cout << "Could not read image" << endl;
         return 1;
@@ -1,6 +1,8 @@
 #include <opencv2/opencv.hpp>
 #include <iostream>
 #include <cmath>
+#include "shading_renderer.hpp"
+#include "environment_lighting.hpp"
 
 using namespace cv;
 using namespace std;
@@ -60,31 +62,198 @@ Vec3f phongShading(Vec3f normal, Vec3f lightDir, Vec3f viewDir, Vec3f specularCo
     return phongTerm*lightIntensity*specularColor;
 }
 
-int main() {
-    Mat object = Mat::zeros(Size(512, 512), CV_32FC3);
-
-    Vec3f diffuseColor(0.0, 0.0, 1.0);      //Color red
-    Vec3f specularColor(1.0, 1.0, 1.0);     //Color white
-    float lightIntensity = 1.0;
-    float shininess = 20;
+/* The dummy geometry of the original loop as structure-of-arrays maps
+   normal = (x/width, y/height, 1), the per-pixel light direction (x/width, 1-y/height, 1) and the surface lying in
+   the z = 0 plane at (x/width, y/height) for point lights. At 512x512 this is exactly the original 512 divisor.
+*/
+ShadingMaps dummyScene(Size size) {
+    ShadingMaps maps;
+    for(int c = 0; c < 3; c++) {
+        maps.normal[c].create(size, CV_32FC1);
+        maps.light[c].create(size, CV_32FC1);
+        maps.position[c].create(size, CV_32FC1);
+    }
+    for(int y = 0; y < size.height; y++) {
+        for(int x = 0; x < size.width; x++) {
+            float u = x/(float)size.width, v = y/(float)size.height;
+            maps.normal[0].at<float>(y, x) = u;
+            maps.normal[1].at<float>(y, x) = v;
+            maps.normal[2].at<float>(y, x) = 1;
+            maps.light[0].at<float>(y, x) = u;
+            maps.light[1].at<float>(y, x) = 1 - v;
+            maps.light[2].at<float>(y, x) = 1;
+            maps.position[0].at<float>(y, x) = u;
+            maps.position[1].at<float>(y, x) = v;
+            maps.position[2].at<float>(y, x) = 0;
+        }
+    }
+    return maps;
+}
 
-    //Dummy loop for each '3D point' (in this 2D representation)
+/* The original loop, lambertShading + phongShading for every pixel, generalised to the renderer's lights
+   Kept as the reference the vectorised renderer is checked and benchmarked against.
+*/
+void shadeReference(const ShadingMaps& maps, const ShadingRenderer& renderer, Mat& object) {
+    const ShadingMaterial& material = renderer.getMaterial();
+    object = Mat::zeros(maps.size(), CV_32FC3);
     for(int y = 0; y < object.rows; y++) {
         for(int x = 0; x < object.cols; x++) {
-            //For each point, get the normal, light direction, and view direction from data (these are all dummy values)
-            Vec3f normal(x/512.0, y/512.0, 1);
-            Vec3f lightDir(x/512.0, 1-y/512.0, 1);
-            Vec3f viewDir(2,2,4);
-
-            Vec3f lambert = lambertShading(normal, lightDir, diffuseColor, lightIntensity);
-            Vec3f phong = phongShading(normal, lightDir, viewDir, specularColor, shininess, lightIntensity);
-            object.at<Vec3f>(y,x) = lambert + phong;
+            Vec3f normal(maps.normal[0].at<float>(y, x), maps.normal[1].at<float>(y, x), maps.normal[2].at<float>(y, x));
+            Vec3f shade(0, 0, 0);
+            for(const ShadingLight& light : renderer.getLights()) {
+                Vec3f lightDir = light.vector;
+                if(light.type == LIGHT_POINT) {
+                    lightDir = light.vector - Vec3f(maps.position[0].at<float>(y, x), maps.position[1].at<float>(y, x), maps.position[2].at<float>(y, x));
+                }
+                else if(light.type == LIGHT_MAP) {
+                    lightDir = Vec3f(maps.light[0].at<float>(y, x), maps.light[1].at<float>(y, x), maps.light[2].at<float>(y, x));
+                }
+                shade += lambertShading(normal, lightDir, material.diffuse, light.intensity);
+                shade += phongShading(normal, lightDir, renderer.getViewDir(), material.specular, material.shininess, light.intensity);
+            }
+            object.at<Vec3f>(y,x) = shade;
         }
     }
-    
-    //Convert to 8-bit image for display
     object.convertTo(object, CV_8UC3, 255.0);
-    imwrite("Pictures/shaded.png", object);
+}
+
+/* Benchmark of the per-pixel reference against the tile renderer
+   A 4K frame of the dummy scene lit by a growing mix of point and directional lights.
+*/
+void benchmarkShading(const ShadingMaterial& material, Size size, const vector<int>& lightCounts) {
+    ShadingMaps maps = dummyScene(size);
+    cout << "Benchmarking " << size.width << "x" << size.height << " on " << getNumThreads() << " threads" << endl;
+    for(int count : lightCounts) {
+        ShadingRenderer renderer(material);
+        RNG rng(count);
+        for(int i = 0; i < count; i++) {
+            float intensity = 1.f/count;
+            if(i % 2 == 0) {
+                renderer.addLight(ShadingLight::point(Vec3f(rng.uniform(0.f, 1.f), rng.uniform(0.f, 1.f), rng.uniform(0.2f, 1.f)), intensity));
+            }
+            else {
+                renderer.addLight(ShadingLight::directional(Vec3f(rng.uniform(-1.f, 1.f), rng.uniform(-1.f, 1.f), 1), intensity));
+            }
+        }
+        Mat reference_img, rendered_img;
+        int64 start = getTickCount();
+        shadeReference(maps, renderer, reference_img);
+        double referenceMs = (getTickCount() - start) * 1000.0 / getTickFrequency();
+        start = getTickCount();
+        renderer.render(maps, rendered_img);
+        double renderMs = (getTickCount() - start) * 1000.0 / getTickFrequency();
+        cout << count << " lights: per-pixel " << referenceMs << " ms, renderer " << renderMs << " ms, speedup "
+             << referenceMs / renderMs << "x, max difference " << norm(reference_img, rendered_img, NORM_INF) << endl;
+    }
+}
+
+//count directional lights from random directions above the surface, sharing a total intensity of 1
+void addRandomLights(ShadingRenderer& renderer, int count, uint64 seed) {
+    RNG rng(seed);
+    for(int i = 0; i < count; i++) {
+        renderer.addLight(ShadingLight::directional(Vec3f(rng.uniform(-1.f, 1.f), rng.uniform(-1.f, 1.f), rng.uniform(0.1f, 1.f)), 1.f/count));
+    }
+}
+
+/* Validation of the environment lighting against brute-force per-light shading
+   1) Irradiance and specular at random directions against the exact sums over the lights, as a fraction of the
+      total light intensity
+   2) The rendered 8-bit images of both against each other
+*/
+void validateEnvironment(const ShadingMaps& maps, const ShadingRenderer& renderer, const EnvironmentLighting& environment) {
+    RNG rng(7);
+    const float shininess = renderer.getMaterial().shininess;
+    double diffuseError = 0, specularError = 0;
+    for(int i = 0; i < 10000; i++) {
+        Vec3f direction = unitVector(Vec3f(rng.gaussian(1), rng.gaussian(1), rng.gaussian(1)));
+        float diffuse = 0, specular = 0;
+        for(const ShadingLight& light : renderer.getLights()) {
+            float cosine = direction.dot(unitVector(light.vector));
+            diffuse += light.intensity * max(cosine, 0.f);
+            specular += light.intensity * pow(max(cosine, 0.f), shininess);
+        }
+        diffuseError = max(diffuseError, (double)abs(environment.irradiance(direction) - diffuse));
+        specularError = max(specularError, (double)abs(environment.specular(direction, shininess) - specular));
+    }
+    Mat brute_img, environment_img, difference;
+    renderer.render(maps, brute_img);
+    environment.render(maps, renderer, environment_img);
+    absdiff(brute_img, environment_img, difference);
+    cout << renderer.getLights().size() << " lights: max irradiance error " << diffuseError << ", max specular error "
+         << specularError << ", image mean difference " << mean(difference)[2] << " (red), max " << norm(difference, NORM_INF) << endl;
+}
+
+/* Benchmark of per-light shading against environment lighting as the light count grows
+   The per-light renderer grows linearly with the lights, the environment mode pays once for the projection and then
+   the same per frame whatever the count.
+*/
+void benchmarkEnvironment(const ShadingMaterial& material, Size size, const vector<int>& lightCounts) {
+    ShadingMaps maps = dummyScene(size);
+    cout << "Benchmarking environment lighting at " << size.width << "x" << size.height << endl;
+    for(int count : lightCounts) {
+        ShadingRenderer renderer(material);
+        addRandomLights(renderer, count, count);
+        EnvironmentLighting environment;
+        Mat brute_img, environment_img;
+        int64 start = getTickCount();
+        renderer.render(maps, brute_img);
+        double bruteMs = (getTickCount() - start) * 1000.0 / getTickFrequency();
+        start = getTickCount();
+        environment.fromLights(renderer.getLights());
+        double projectMs = (getTickCount() - start) * 1000.0 / getTickFrequency();
+        start = getTickCount();
+        environment.render(maps, renderer, environment_img);
+        double environmentMs = (getTickCount() - start) * 1000.0 / getTickFrequency();
+        cout << count << " lights: per-light " << bruteMs << " ms, environment " << environmentMs << " ms + projection "
+             << projectMs << " ms once" << endl;
+    }
+}
+
+int main(int argc, char** argv) {
+    ShadingMaterial material;
+    material.diffuse = Vec3f(0.0, 0.0, 1.0);    //Color red
+    material.specular = Vec3f(1.0, 1.0, 1.0);   //Color white
+    material.shininess = 20;
+    float lightIntensity = 1.0;
+
+    /* Shade the dummy scene with the tile renderer
+       1) The normals and the per-pixel light direction of the original loop are held as float planes
+       2) One LIGHT_MAP light reads its direction from those planes, the view direction stays (2, 2, 4)
+       3) render() writes the 8-bit image directly, compared here against the original per-pixel loop
+    */
+    ShadingMaps maps = dummyScene(Size(512, 512));
+    ShadingRenderer renderer(material, Vec3f(2, 2, 4));
+    renderer.addLight(ShadingLight::map(lightIntensity));
+    Mat object, reference;
+    renderer.render(maps, object);
+    profiled::imwrite("Pictures/shaded.png", object);
+    shadeReference(maps, renderer, reference);
+    cout << "Renderer max difference from the per-pixel loop: " << norm(reference, object, NORM_INF) << endl;
+
+    /* Environment lighting
+       1) Sixteen directional lights are projected once into spherical harmonics and a specular table
+       2) Every pixel is then shaded from its normal and view direction alone, checked against the per-light renderer
+    */
+    ShadingRenderer manyLights(material, Vec3f(2, 2, 4));
+    addRandomLights(manyLights, 16, 16);
+    EnvironmentLighting environment;
+    environment.fromLights(manyLights.getLights());
+    Mat environment_img;
+    environment.render(maps, manyLights, environment_img);
+    profiled::imwrite("Pictures/environmentShaded.png", environment_img);
+    for(int count : {1, 16, 256}) {
+        ShadingRenderer validation(material, Vec3f(2, 2, 4));
+        addRandomLights(validation, count, count);
+        EnvironmentLighting projected;
+        projected.fromLights(validation.getLights());
+        validateEnvironment(maps, validation, projected);
+    }
+
+    //Run with --benchmark to time 4K frames with 1, 4, 16 and 64 lights, then environment lighting up to 1024 lights
+    if(argc > 1 && string(argv[1]) == "--benchmark") {
+        benchmarkShading(material, Size(3840, 2160), {1, 4, 16, 64});
+        benchmarkEnvironment(material, Size(3840, 2160), {1, 4, 16, 64, 256, 1024});
+    }
 
     return 0;
 }
\ No newline at end of file
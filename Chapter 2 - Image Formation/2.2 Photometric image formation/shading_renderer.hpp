@@ -0,0 +1,322 @@
+#pragma once
+
+#include <opencv2/core.hpp>
+#include <opencv2/core/hal/intrin.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <vector>
+#include "../../Tools/profiler.hpp"
+
+/* Fast log2/exp2 for the specular power
+   x^n = exp2(n * log2(x)), log2 from the float's exponent plus a degree 5 polynomial of the mantissa and exp2 from a
+   degree 4 polynomial of the fraction shifted into the exponent. The relative error of x^n is about 1e-4 for n = 20,
+   far below one step of the 8-bit output. The scalar versions do the same arithmetic for the row tails.
+*/
+inline float fastLog2(float x) {
+    int bits;
+    memcpy(&bits, &x, sizeof(bits));
+    const int exponent = (bits >> 23) - 127;
+    bits = (bits & 0x7fffff) | 0x3f800000;
+    float m;
+    memcpy(&m, &bits, sizeof(m));
+    const float t = m - 1.f;
+    float q = -0.034596001f;
+    q = q * t + 0.14643690f;
+    q = q * t - 0.30339406f;
+    q = q * t + 0.46930410f;
+    q = q * t - 0.72044289f;
+    q = q * t + 1.44268328f;
+    return t * q + (float)exponent;
+}
+
+inline float fastExp2(float y) {
+    y = std::max(y, -126.f);
+    const float i = std::floor(y), f = y - i;
+    float p = 0.013683997f;
+    p = p * f + 0.051717827f;
+    p = p * f + 0.24162116f;
+    p = p * f + 0.69296962f;
+    p = p * f + 1.0000036f;
+    int bits;
+    memcpy(&bits, &p, sizeof(bits));
+    bits += (int)i * (1 << 23);
+    memcpy(&p, &bits, sizeof(p));
+    return p;
+}
+
+inline float fastPow(float x, float n) {
+    return fastExp2(n * fastLog2(x));
+}
+
+#if (CV_SIMD || CV_SIMD_SCALABLE)
+inline cv::v_float32 fastLog2(const cv::v_float32& x) {
+    cv::v_int32 bits = cv::v_reinterpret_as_s32(x);
+    cv::v_float32 exponent = cv::v_cvt_f32(cv::v_sub(cv::v_shr<23>(bits), cv::vx_setall_s32(127)));
+    cv::v_float32 m = cv::v_reinterpret_as_f32(cv::v_or(cv::v_and(bits, cv::vx_setall_s32(0x7fffff)), cv::vx_setall_s32(0x3f800000)));
+    cv::v_float32 t = cv::v_sub(m, cv::vx_setall_f32(1.f));
+    cv::v_float32 q = cv::vx_setall_f32(-0.034596001f);
+    q = cv::v_fma(q, t, cv::vx_setall_f32(0.14643690f));
+    q = cv::v_fma(q, t, cv::vx_setall_f32(-0.30339406f));
+    q = cv::v_fma(q, t, cv::vx_setall_f32(0.46930410f));
+    q = cv::v_fma(q, t, cv::vx_setall_f32(-0.72044289f));
+    q = cv::v_fma(q, t, cv::vx_setall_f32(1.44268328f));
+    return cv::v_fma(t, q, exponent);
+}
+
+inline cv::v_float32 fastExp2(const cv::v_float32& y) {
+    cv::v_float32 clamped = cv::v_max(y, cv::vx_setall_f32(-126.f));
+    cv::v_int32 i = cv::v_floor(clamped);
+    cv::v_float32 f = cv::v_sub(clamped, cv::v_cvt_f32(i));
+    cv::v_float32 p = cv::vx_setall_f32(0.013683997f);
+    p = cv::v_fma(p, f, cv::vx_setall_f32(0.051717827f));
+    p = cv::v_fma(p, f, cv::vx_setall_f32(0.24162116f));
+    p = cv::v_fma(p, f, cv::vx_setall_f32(0.69296962f));
+    p = cv::v_fma(p, f, cv::vx_setall_f32(1.0000036f));
+    return cv::v_reinterpret_as_f32(cv::v_add(cv::v_reinterpret_as_s32(p), cv::v_shl<23>(i)));
+}
+
+inline cv::v_float32 fastPow(const cv::v_float32& x, const cv::v_float32& n) {
+    return fastExp2(cv::v_mul(n, fastLog2(x)));
+}
+#endif
+
+#if (CV_SIMD || CV_SIMD_SCALABLE)
+inline void normalizeVectors(cv::v_float32& x, cv::v_float32& y, cv::v_float32& z) {
+    cv::v_float32 inv = cv::v_invsqrt(cv::v_fma(x, x, cv::v_fma(y, y, cv::v_mul(z, z))));
+    x = cv::v_mul(x, inv);
+    y = cv::v_mul(y, inv);
+    z = cv::v_mul(z, inv);
+}
+#endif
+
+inline cv::Vec3f unitVector(const cv::Vec3f& a) {
+    return a * (1.f / std::sqrt(a.dot(a)));
+}
+
+//Rounds and saturates each channel row and interleaves them into BGR pixels
+inline void storeShadedRow(const float* b, const float* g, const float* r, uchar* dst, int len) {
+    int x = 0;
+#if (CV_SIMD || CV_SIMD_SCALABLE)
+    const int lanes = cv::VTraits<cv::v_float32>::vlanes();
+    auto pack = [&](const float* src) {
+        cv::v_int16 low = cv::v_pack(cv::v_round(cv::vx_load(src)), cv::v_round(cv::vx_load(src + lanes)));
+        cv::v_int16 high = cv::v_pack(cv::v_round(cv::vx_load(src + 2 * lanes)), cv::v_round(cv::vx_load(src + 3 * lanes)));
+        return cv::v_pack_u(low, high);
+    };
+    for(; x <= len - 4 * lanes; x += 4 * lanes) {
+        cv::v_store_interleave(dst + 3 * x, pack(b + x), pack(g + x), pack(r + x));
+    }
+    cv::vx_cleanup();
+#endif
+    for(; x < len; x++) {
+        dst[3 * x] = cv::saturate_cast<uchar>(b[x]);
+        dst[3 * x + 1] = cv::saturate_cast<uchar>(g[x]);
+        dst[3 * x + 2] = cv::saturate_cast<uchar>(r[x]);
+    }
+}
+
+enum ShadingLightType { LIGHT_DIRECTIONAL, LIGHT_POINT, LIGHT_MAP };
+
+struct ShadingLight {
+    ShadingLightType type;
+    cv::Vec3f vector;   //Direction towards a directional light or position of a point light, unused by LIGHT_MAP
+    float intensity;
+
+    static ShadingLight directional(cv::Vec3f direction, float intensity = 1.f) { return ShadingLight{LIGHT_DIRECTIONAL, direction, intensity}; }
+    static ShadingLight point(cv::Vec3f position, float intensity = 1.f) { return ShadingLight{LIGHT_POINT, position, intensity}; }
+    //A light whose direction is given per pixel by ShadingMaps::light, like the dummy lightDir in reflectance_and_shading.cpp
+    static ShadingLight map(float intensity = 1.f) { return ShadingLight{LIGHT_MAP, cv::Vec3f(0, 0, 0), intensity}; }
+};
+
+//Colours in BGR like the rest of the repo
+struct ShadingMaterial {
+    cv::Vec3f diffuse;
+    cv::Vec3f specular;
+    float shininess;
+};
+
+/* Per-pixel geometry as structure-of-arrays, one CV_32FC1 plane per vector component
+   Only normal is always needed. position is read when there is a point light, light when there is a LIGHT_MAP
+   light and view replaces the renderer's constant view direction when present. None need to be unit length.
+*/
+struct ShadingMaps {
+    cv::Mat normal[3];
+    cv::Mat position[3];
+    cv::Mat light[3];
+    cv::Mat view[3];
+
+    cv::Size size() const { return normal[0].size(); }
+};
+
+/* Lambert + Phong tile renderer
+   The same model as lambertShading + phongShading, summed over any number of lights:
+       I = sum over lights of  intensity * (K_d * max(N.L, 0) + K_s * max(R.V, 0)^n),  R = 2(N.L)N - L
+   1) The output is split into tiles of 32x256 pixels that run across threads, the planes of a tile row stay in L1
+   2) A tile row is shaded one SIMD vector of pixels at a time (8 with AVX2, 16 with AVX-512): N and V are
+      normalised once per pixel with a reciprocal square root, each light adds its diffuse and specular terms to two
+      running sums and the material colours are applied once at the end. R needs no normalising, it is a unit
+      vector whenever N and L are.
+   3) The three channel rows are scaled by 255, rounded and interleaved straight into the CV_8UC3 output, the same
+      values convertTo(CV_8UC3, 255.0) gives
+*/
+class ShadingRenderer {
+public:
+    explicit ShadingRenderer(const ShadingMaterial& material, cv::Vec3f viewDir = cv::Vec3f(2, 2, 4))
+        : material(material), viewDir(viewDir) {}
+
+    void addLight(const ShadingLight& light) { lights.push_back(light); }
+    void clearLights() { lights.clear(); }
+    const std::vector<ShadingLight>& getLights() const { return lights; }
+    const ShadingMaterial& getMaterial() const { return material; }
+    cv::Vec3f getViewDir() const { return viewDir; }
+
+    void render(const ShadingMaps& maps, cv::Mat& dst) const {
+        PROFILE_SCOPE("ShadingRenderer::render");
+        const cv::Size size = maps.size();
+        for(int c = 0; c < 3; c++) {
+            CV_Assert(maps.normal[c].type() == CV_32FC1 && maps.normal[c].size() == size);
+        }
+        bool points = false, mapped = false;
+        for(const ShadingLight& light : lights) {
+            points = points || light.type == LIGHT_POINT;
+            mapped = mapped || light.type == LIGHT_MAP;
+        }
+        const bool perPixelView = !maps.view[0].empty();
+        for(int c = 0; c < 3; c++) {
+            CV_Assert(!points || (maps.position[c].type() == CV_32FC1 && maps.position[c].size() == size));
+            CV_Assert(!mapped || (maps.light[c].type() == CV_32FC1 && maps.light[c].size() == size));
+            CV_Assert(!perPixelView || (maps.view[c].type() == CV_32FC1 && maps.view[c].size() == size));
+        }
+
+        //Directional lights and the constant view are normalised once here instead of at every pixel
+        std::vector<ShadingLight> prepared = lights;
+        for(ShadingLight& light : prepared) {
+            if(light.type == LIGHT_DIRECTIONAL) {
+                light.vector = unitVector(light.vector);
+            }
+        }
+        const cv::Vec3f view = unitVector(viewDir);
+
+        dst.create(size, CV_8UC3);
+        const int tileRows = 32, tileCols = 256;
+        const int tilesX = (size.width + tileCols - 1) / tileCols, tilesY = (size.height + tileRows - 1) / tileRows;
+        cv::parallel_for_(cv::Range(0, tilesX * tilesY), [&](const cv::Range& range) {
+            std::vector<float> channels(3 * tileCols);
+            for(int t = range.start; t < range.end; t++) {
+                const int x0 = (t % tilesX) * tileCols, x1 = std::min(size.width, x0 + tileCols);
+                const int y0 = (t / tilesX) * tileRows, y1 = std::min(size.height, y0 + tileRows);
+                for(int y = y0; y < y1; y++) {
+                    float* b = channels.data();
+                    float* g = b + tileCols;
+                    float* r = g + tileCols;
+                    shadeRow(maps, prepared, view, perPixelView, points, mapped, y, x0, x1, b, g, r);
+                    storeShadedRow(b, g, r, dst.ptr<uchar>(y) + 3 * x0, x1 - x0);
+                }
+            }
+        });
+    }
+
+private:
+    //Scaled BGR values of pixels [x0, x1) of row y into b, g and r
+    void shadeRow(const ShadingMaps& maps, const std::vector<ShadingLight>& prepared, cv::Vec3f view, bool perPixelView,
+                  bool points, bool mapped, int y, int x0, int x1, float* b, float* g, float* r) const {
+        const float* n[3];
+        const float* p[3] = {nullptr, nullptr, nullptr};
+        const float* l[3] = {nullptr, nullptr, nullptr};
+        const float* v[3] = {nullptr, nullptr, nullptr};
+        for(int c = 0; c < 3; c++) {
+            n[c] = maps.normal[c].ptr<float>(y) + x0;
+            if(points) p[c] = maps.position[c].ptr<float>(y) + x0;
+            if(mapped) l[c] = maps.light[c].ptr<float>(y) + x0;
+            if(perPixelView) v[c] = maps.view[c].ptr<float>(y) + x0;
+        }
+        const cv::Vec3f kd = material.diffuse * 255.f, ks = material.specular * 255.f;
+        const int len = x1 - x0;
+        int x = 0;
+
+#if (CV_SIMD || CV_SIMD_SCALABLE)
+        const int lanes = cv::VTraits<cv::v_float32>::vlanes();
+        const cv::v_float32 zero = cv::vx_setzero_f32(), two = cv::vx_setall_f32(2.f), shininess = cv::vx_setall_f32(material.shininess);
+        for(; x <= len - lanes; x += lanes) {
+            cv::v_float32 nx = cv::vx_load(n[0] + x), ny = cv::vx_load(n[1] + x), nz = cv::vx_load(n[2] + x);
+            normalizeVectors(nx, ny, nz);
+            cv::v_float32 vx = cv::vx_setall_f32(view[0]), vy = cv::vx_setall_f32(view[1]), vz = cv::vx_setall_f32(view[2]);
+            if(perPixelView) {
+                vx = cv::vx_load(v[0] + x);
+                vy = cv::vx_load(v[1] + x);
+                vz = cv::vx_load(v[2] + x);
+                normalizeVectors(vx, vy, vz);
+            }
+            cv::v_float32 px = zero, py = zero, pz = zero;
+            if(points) {
+                px = cv::vx_load(p[0] + x);
+                py = cv::vx_load(p[1] + x);
+                pz = cv::vx_load(p[2] + x);
+            }
+
+            cv::v_float32 diffuse = zero, specular = zero;
+            for(const ShadingLight& light : prepared) {
+                cv::v_float32 lx, ly, lz;
+                if(light.type == LIGHT_DIRECTIONAL) {
+                    lx = cv::vx_setall_f32(light.vector[0]);
+                    ly = cv::vx_setall_f32(light.vector[1]);
+                    lz = cv::vx_setall_f32(light.vector[2]);
+                }
+                else {
+                    if(light.type == LIGHT_POINT) {
+                        lx = cv::v_sub(cv::vx_setall_f32(light.vector[0]), px);
+                        ly = cv::v_sub(cv::vx_setall_f32(light.vector[1]), py);
+                        lz = cv::v_sub(cv::vx_setall_f32(light.vector[2]), pz);
+                    }
+                    else {
+                        lx = cv::vx_load(l[0] + x);
+                        ly = cv::vx_load(l[1] + x);
+                        lz = cv::vx_load(l[2] + x);
+                    }
+                    normalizeVectors(lx, ly, lz);
+                }
+                cv::v_float32 intensity = cv::vx_setall_f32(light.intensity);
+                cv::v_float32 nDotL = cv::v_fma(nx, lx, cv::v_fma(ny, ly, cv::v_mul(nz, lz)));
+                diffuse = cv::v_fma(intensity, cv::v_max(nDotL, zero), diffuse);
+                cv::v_float32 scale = cv::v_mul(two, nDotL);
+                cv::v_float32 rx = cv::v_fma(scale, nx, cv::v_sub(zero, lx));
+                cv::v_float32 ry = cv::v_fma(scale, ny, cv::v_sub(zero, ly));
+                cv::v_float32 rz = cv::v_fma(scale, nz, cv::v_sub(zero, lz));
+                cv::v_float32 rDotV = cv::v_max(cv::v_fma(rx, vx, cv::v_fma(ry, vy, cv::v_mul(rz, vz))), zero);
+                specular = cv::v_fma(intensity, fastPow(rDotV, shininess), specular);
+            }
+            cv::v_store(b + x, cv::v_fma(diffuse, cv::vx_setall_f32(kd[0]), cv::v_mul(specular, cv::vx_setall_f32(ks[0]))));
+            cv::v_store(g + x, cv::v_fma(diffuse, cv::vx_setall_f32(kd[1]), cv::v_mul(specular, cv::vx_setall_f32(ks[1]))));
+            cv::v_store(r + x, cv::v_fma(diffuse, cv::vx_setall_f32(kd[2]), cv::v_mul(specular, cv::vx_setall_f32(ks[2]))));
+        }
+        cv::vx_cleanup();
+#endif
+
+        for(; x < len; x++) {
+            cv::Vec3f normal = unitVector(cv::Vec3f(n[0][x], n[1][x], n[2][x]));
+            cv::Vec3f viewer = perPixelView ? unitVector(cv::Vec3f(v[0][x], v[1][x], v[2][x])) : view;
+            float diffuse = 0, specular = 0;
+            for(const ShadingLight& light : prepared) {
+                cv::Vec3f lightDir = light.vector;
+                if(light.type == LIGHT_POINT) {
+                    lightDir = unitVector(light.vector - cv::Vec3f(p[0][x], p[1][x], p[2][x]));
+                }
+                else if(light.type == LIGHT_MAP) {
+                    lightDir = unitVector(cv::Vec3f(l[0][x], l[1][x], l[2][x]));
+                }
+                float nDotL = normal.dot(lightDir);
+                diffuse += light.intensity * std::max(nDotL, 0.f);
+                cv::Vec3f reflection = 2 * nDotL * normal - lightDir;
+                specular += light.intensity * fastPow(std::max(reflection.dot(viewer), 0.f), material.shininess);
+            }
+            b[x] = diffuse * kd[0] + specular * ks[0];
+            g[x] = diffuse * kd[1] + specular * ks[1];
+            r[x] = diffuse * kd[2] + specular * ks[2];
+        }
+    }
+
+    ShadingMaterial material;
+    cv::Vec3f viewDir;
+    std::vector<ShadingLight> lights;
+};
@@ -1,11 +1,70 @@
 #include <opencv2/opencv.hpp>
 #include <iostream>
+#include <functional>
+#include "color_converter.hpp"
+#include "../../Tools/derived_image_cache.hpp"
 
 using namespace cv;
 using namespace std;
 
-int main() {
-    Mat img = imread("Pictures/truck.jpg", IMREAD_COLOR);
+/* Benchmark of one cvtColor call per plane against the fused multi-output conversion
+   1) Check every fused plane against cvtColor on the same image
+   2) Time gray + HSV (what main writes) and all four planes, once with cvtColor per plane and once fused
+   3) Report the BGR bytes each version reads, cvtColor reads the whole frame once per plane
+*/
+void benchmarkColor(const Mat& img, int frames) {
+    auto timeMs = [&](const function<void()>& fn) {
+        fn();
+        int64 start = getTickCount();
+        for(int i = 0; i < frames; i++) {
+            fn();
+        }
+        return (getTickCount() - start) * 1000.0 / getTickFrequency() / frames;
+    };
+
+    ColorOutputs fused;
+    convertColors(img, fused, COLOR_PLANE_ALL);
+    Mat gray_img, hsv_img, ycrcb_img, lab_img;
+    profiled::cvtColor(img, gray_img, COLOR_BGR2GRAY);
+    profiled::cvtColor(img, hsv_img, COLOR_BGR2HSV);
+    profiled::cvtColor(img, ycrcb_img, COLOR_BGR2YCrCb);
+    profiled::cvtColor(img, lab_img, COLOR_BGR2Lab);
+    cout << "Max difference to cvtColor: gray " << norm(fused.gray, gray_img, NORM_INF) << ", HSV " << norm(fused.hsv, hsv_img, NORM_INF)
+         << ", YCrCb " << norm(fused.ycrcb, ycrcb_img, NORM_INF) << ", Lab " << norm(fused.lab, lab_img, NORM_INF) << endl;
+
+    const double megapixels = img.total() / 1e6, frameMB = img.total() * 3 / (1024.0 * 1024.0);
+    auto report = [&](const string& name, int planes, double separateMs, double fusedMs) {
+        cout << name << ": cvtColor " << separateMs << " ms (" << megapixels / (separateMs / 1000.0) << " MPix/s, reads "
+             << planes * frameMB << " MB), fused " << fusedMs << " ms (" << megapixels / (fusedMs / 1000.0) << " MPix/s, reads "
+             << frameMB << " MB), speedup " << separateMs / fusedMs << "x" << endl;
+    };
+
+    cout << "Benchmarking " << img.cols << "x" << img.rows << " over " << frames << " frames on " << getNumThreads() << " threads" << endl;
+    double separateMs = timeMs([&] {
+        profiled::cvtColor(img, gray_img, COLOR_BGR2GRAY);
+        profiled::cvtColor(img, hsv_img, COLOR_BGR2HSV);
+    });
+    double fusedMs = timeMs([&] { convertColors(img, fused, COLOR_PLANE_GRAY | COLOR_PLANE_HSV); });
+    report("gray + HSV", 2, separateMs, fusedMs);
+
+    separateMs = timeMs([&] {
+        profiled::cvtColor(img, gray_img, COLOR_BGR2GRAY);
+        profiled::cvtColor(img, hsv_img, COLOR_BGR2HSV);
+        profiled::cvtColor(img, ycrcb_img, COLOR_BGR2YCrCb);
+        profiled::cvtColor(img, lab_img, COLOR_BGR2Lab);
+    });
+    fusedMs = timeMs([&] { convertColors(img, fused, COLOR_PLANE_ALL); });
+    report("gray + HSV + YCrCb + Lab", 4, separateMs, fusedMs);
+}
+
+int main(int argc, char** argv) {
+    /* Derived image cache
+       The decoded picture and the planes below come from the cache, keyed by the file's content and the conversion.
+       Run with IMAGE_CACHE=<dir> to keep them on disk, a second run then only maps them instead of decoding and
+       converting again (see Tools/derived_image_cache.hpp).
+    */
+    DerivedImageCache& cache = DerivedImageCache::shared();
+    Mat img = cache.imread("Pictures/truck.jpg", IMREAD_COLOR);
     if(img.empty()) {
         cout << "Failed to read image" << endl;
         return 1;
@@ -14,16 +73,28 @@ int main() {
     /* Convert to HSV color space
        Reduces the influence of light intensity or shadows from the outside by separating luma (image intensity) from chroma (color information).
     */
-    Mat hsv_img;
-    cvtColor(img, hsv_img, COLOR_BGR2HSV);
-    imwrite("Pictures/hsv_img.png", hsv_img);
+    //Both planes come from one read of the frame, see color_converter.hpp, bit-identical to cvtColor
+    NamedImages planes = cache.get(vector<Mat>(1, img), "convertColors planes=gray,hsv", [&](NamedImages& out) {
+        ColorOutputs converted;
+        convertColors(img, converted, COLOR_PLANE_GRAY | COLOR_PLANE_HSV);
+        out.push_back(make_pair(string("gray"), converted.gray));
+        out.push_back(make_pair(string("hsv"), converted.hsv));
+    });
+    profiled::imwrite("Pictures/hsv_img.png", planes[1].second);
 
     /* Convert to Grayscale
        Reduce the amount of data needed to store the image by a factor of 3 by only keeping luminance and easier to perform edge detection and thresholding.
     */
-    Mat gray_img;
-    cvtColor(img, gray_img, COLOR_BGR2GRAY);
-    imwrite("Pictures/gray_img.png", gray_img);
+    profiled::imwrite("Pictures/gray_img.png", planes[0].second);
+
+    //Run with --benchmark [frames] to compare the fused conversion against one cvtColor per plane
+    if(argc > 1 && string(argv[1]) == "--benchmark") {
+        int frames = argc > 2 ? stoi(argv[2]) : 50;
+        Mat large;
+        resize(img, large, Size(), 4, 4, INTER_LINEAR);
+        benchmarkColor(img, frames);
+        benchmarkColor(large, frames);
+    }
 
     return 0;
 }
\ No newline at end of file
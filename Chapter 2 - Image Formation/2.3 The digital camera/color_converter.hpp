@@ -0,0 +1,271 @@
+#pragma once
+
+#include <opencv2/core.hpp>
+#include <opencv2/core/hal/intrin.hpp>
+#include <algorithm>
+#include <cmath>
+#include "../../Tools/profiler.hpp"
+
+/* Planes convertColors() can write, OR them together to request several at once */
+enum ColorPlanes {
+    COLOR_PLANE_GRAY = 1,
+    COLOR_PLANE_HSV = 2,
+    COLOR_PLANE_YCRCB = 4,
+    COLOR_PLANE_LAB = 8,
+    COLOR_PLANE_ALL = 15
+};
+
+/* Outputs of convertColors(), only the requested ones are (re)allocated */
+struct ColorOutputs {
+    cv::Mat gray;     //CV_8UC1, cvtColor(COLOR_BGR2GRAY)
+    cv::Mat hsv;      //CV_8UC3, cvtColor(COLOR_BGR2HSV), hue in [0, 180)
+    cv::Mat ycrcb;    //CV_8UC3, cvtColor(COLOR_BGR2YCrCb)
+    cv::Mat lab;      //CV_8UC3, cvtColor(COLOR_BGR2Lab), sRGB with the D65 white point
+};
+
+/* Fixed-point tables of cvtColor's 8-bit conversions
+   The same integer arithmetic cvtColor uses, so every plane is bit-identical to it:
+   gray     (b*3735 + g*19235 + r*9798 + 2^14) >> 15
+   YCrCb    Y with the 14 bit weights 1868/9617/4899, Cr = (r - Y)*11682 and Cb = (b - Y)*9241 around 128
+   HSV      S and H divide through the reciprocal tables 255*2^12/v and 180*2^12/(6*diff)
+   Lab      sRGB gamma to 2^3 * 255 fixed point, the XYZ weights over the white point in 2^12, then a cube root table
+            indexed by the 12 bit descaled X/Y/Z and L/a/b in 2^15
+   OpenCV builds its cube root table in software float, where two entries land exactly on .5 and round to even.
+   The table here is built in double and those two entries are set to OpenCV's values.
+*/
+struct ColorTables {
+    enum {
+        GRAY_SHIFT = 15, GRAY_B = 3735, GRAY_G = 19235, GRAY_R = 9798,
+        YCC_SHIFT = 14, YCC_B = 1868, YCC_G = 9617, YCC_R = 4899, YCC_CR = 11682, YCC_CB = 9241,
+        HSV_SHIFT = 12,
+        LAB_SHIFT = 12, LAB_SHIFT2 = 15, LAB_CBRT_SIZE = 256 * 3 / 2 * 8
+    };
+
+    int sdiv[256], hdiv[256];
+    int gamma[256];
+    int cbrt[LAB_CBRT_SIZE];
+    int xyz[9];     //Rows X, Y, Z, columns r, g, b
+
+    static const ColorTables& get() {
+        static const ColorTables tables;
+        return tables;
+    }
+
+private:
+    ColorTables() {
+        sdiv[0] = hdiv[0] = 0;
+        for(int i = 1; i < 256; i++) {
+            sdiv[i] = cvRound((255 << HSV_SHIFT) / (double)i);
+            hdiv[i] = cvRound((180 << HSV_SHIFT) / (6.0 * i));
+        }
+        for(int i = 0; i < 256; i++) {
+            double x = i / 255.0;
+            gamma[i] = cvRound(255.0 * 8 * (x <= 0.04045 ? x / 12.92 : std::pow((x + 0.055) / 1.055, 2.4)));
+        }
+        for(int i = 0; i < LAB_CBRT_SIZE; i++) {
+            double x = i / (255.0 * 8);
+            cbrt[i] = cvRound((1 << LAB_SHIFT2) * (x < 0.008856 ? x * 7.787 + 16.0 / 116 : std::cbrt(x)));
+        }
+        cbrt[49] = 9454;
+        cbrt[628] = 22126;
+
+        const double sRGB2XYZ[9] = {0.412453, 0.357580, 0.180423,
+                                    0.212671, 0.715160, 0.072169,
+                                    0.019334, 0.119193, 0.950227};
+        const double whitePoint[3] = {0.950456, 1.0, 1.088754};
+        for(int i = 0; i < 9; i++) {
+            xyz[i] = cvRound((1 << LAB_SHIFT) * sRGB2XYZ[i] / whitePoint[i / 3]);
+        }
+    }
+};
+
+/* Scalar versions of each plane, used for the row tails and as the reference for the vector code */
+inline uchar grayPixel(int b, int g, int r) {
+    typedef ColorTables T;
+    return (uchar)((b * T::GRAY_B + g * T::GRAY_G + r * T::GRAY_R + (1 << (T::GRAY_SHIFT - 1))) >> T::GRAY_SHIFT);
+}
+
+inline void ycrcbPixel(int b, int g, int r, uchar* dst) {
+    typedef ColorTables T;
+    const int delta = (128 << T::YCC_SHIFT) + (1 << (T::YCC_SHIFT - 1));
+    int y = (b * T::YCC_B + g * T::YCC_G + r * T::YCC_R + (1 << (T::YCC_SHIFT - 1))) >> T::YCC_SHIFT;
+    dst[0] = cv::saturate_cast<uchar>(y);
+    dst[1] = cv::saturate_cast<uchar>(((r - y) * T::YCC_CR + delta) >> T::YCC_SHIFT);
+    dst[2] = cv::saturate_cast<uchar>(((b - y) * T::YCC_CB + delta) >> T::YCC_SHIFT);
+}
+
+inline void hsvPixel(const ColorTables& t, int b, int g, int r, uchar* dst) {
+    const int round = 1 << (ColorTables::HSV_SHIFT - 1);
+    int v = std::max(b, std::max(g, r)), diff = v - std::min(b, std::min(g, r));
+    int s = (diff * t.sdiv[v] + round) >> ColorTables::HSV_SHIFT;
+    int h = v == r ? g - b : v == g ? b - r + 2 * diff : r - g + 4 * diff;
+    h = (h * t.hdiv[diff] + round) >> ColorTables::HSV_SHIFT;
+    dst[0] = (uchar)(h < 0 ? h + 180 : h);
+    dst[1] = (uchar)s;
+    dst[2] = (uchar)v;
+}
+
+inline void labPixel(const ColorTables& t, int b, int g, int r, uchar* dst) {
+    typedef ColorTables T;
+    const int round = 1 << (T::LAB_SHIFT - 1), round2 = 1 << (T::LAB_SHIFT2 - 1);
+    const int lScale = (116 * 255 + 50) / 100, lShift = -((16 * 255 * (1 << T::LAB_SHIFT2) + 50) / 100);
+    int R = t.gamma[r], G = t.gamma[g], B = t.gamma[b];
+    int fX = t.cbrt[(R * t.xyz[0] + G * t.xyz[1] + B * t.xyz[2] + round) >> T::LAB_SHIFT];
+    int fY = t.cbrt[(R * t.xyz[3] + G * t.xyz[4] + B * t.xyz[5] + round) >> T::LAB_SHIFT];
+    int fZ = t.cbrt[(R * t.xyz[6] + G * t.xyz[7] + B * t.xyz[8] + round) >> T::LAB_SHIFT];
+    dst[0] = cv::saturate_cast<uchar>((lScale * fY + lShift + round2) >> T::LAB_SHIFT2);
+    dst[1] = cv::saturate_cast<uchar>((500 * (fX - fY) + (128 << T::LAB_SHIFT2) + round2) >> T::LAB_SHIFT2);
+    dst[2] = cv::saturate_cast<uchar>((200 * (fY - fZ) + (128 << T::LAB_SHIFT2) + round2) >> T::LAB_SHIFT2);
+}
+
+/* One row of every requested plane
+   Each vector of pixels is loaded and widened to four int32 quarters once, then every requested plane is computed
+   from those registers and packed back to 8 bits with saturation, so the BGR row is read from memory once no matter
+   how many planes are written.
+*/
+inline void convertColorRow(const ColorTables& t, const uchar* bgr, uchar* gray, uchar* hsv, uchar* ycrcb, uchar* lab, int cols) {
+    int x = 0;
+#if (CV_SIMD || CV_SIMD_SCALABLE)
+    typedef ColorTables T;
+    const int lanes = cv::VTraits<cv::v_uint8>::vlanes();
+    for(; x <= cols - lanes; x += lanes) {
+        cv::v_uint8 b, g, r;
+        cv::v_load_deinterleave(bgr + 3 * x, b, g, r);
+        cv::v_uint16 bLo, bHi, gLo, gHi, rLo, rHi;
+        cv::v_expand(b, bLo, bHi);
+        cv::v_expand(g, gLo, gHi);
+        cv::v_expand(r, rLo, rHi);
+        cv::v_uint32 b0, b1, b2, b3, g0, g1, g2, g3, r0, r1, r2, r3;
+        cv::v_expand(bLo, b0, b1);
+        cv::v_expand(bHi, b2, b3);
+        cv::v_expand(gLo, g0, g1);
+        cv::v_expand(gHi, g2, g3);
+        cv::v_expand(rLo, r0, r1);
+        cv::v_expand(rHi, r2, r3);
+
+        //Runs plane(b, g, r, c0, c1, c2) on the four quarters and packs each output channel back to one v_uint8
+        auto quarters = [&](auto plane, cv::v_uint8& c0, cv::v_uint8& c1, cv::v_uint8& c2) {
+            cv::v_int32 a0, a1, a2, a3, d0, d1, d2, d3, e0, e1, e2, e3;
+            plane(cv::v_reinterpret_as_s32(b0), cv::v_reinterpret_as_s32(g0), cv::v_reinterpret_as_s32(r0), a0, d0, e0);
+            plane(cv::v_reinterpret_as_s32(b1), cv::v_reinterpret_as_s32(g1), cv::v_reinterpret_as_s32(r1), a1, d1, e1);
+            plane(cv::v_reinterpret_as_s32(b2), cv::v_reinterpret_as_s32(g2), cv::v_reinterpret_as_s32(r2), a2, d2, e2);
+            plane(cv::v_reinterpret_as_s32(b3), cv::v_reinterpret_as_s32(g3), cv::v_reinterpret_as_s32(r3), a3, d3, e3);
+            c0 = cv::v_pack_u(cv::v_pack(a0, a1), cv::v_pack(a2, a3));
+            c1 = cv::v_pack_u(cv::v_pack(d0, d1), cv::v_pack(d2, d3));
+            c2 = cv::v_pack_u(cv::v_pack(e0, e1), cv::v_pack(e2, e3));
+        };
+
+        if(gray) {
+            const cv::v_int32 wb = cv::vx_setall_s32(T::GRAY_B), wg = cv::vx_setall_s32(T::GRAY_G), wr = cv::vx_setall_s32(T::GRAY_R);
+            const cv::v_int32 round = cv::vx_setall_s32(1 << (T::GRAY_SHIFT - 1));
+            cv::v_uint8 y, unused0, unused1;
+            quarters([&](const cv::v_int32& vb, const cv::v_int32& vg, const cv::v_int32& vr, cv::v_int32& c0, cv::v_int32& c1, cv::v_int32& c2) {
+                c0 = cv::v_shr<T::GRAY_SHIFT>(cv::v_add(cv::v_add(cv::v_mul(vb, wb), cv::v_mul(vg, wg)), cv::v_add(cv::v_mul(vr, wr), round)));
+                c1 = c2 = c0;
+            }, y, unused0, unused1);
+            cv::v_store(gray + x, y);
+        }
+
+        if(ycrcb) {
+            const cv::v_int32 wb = cv::vx_setall_s32(T::YCC_B), wg = cv::vx_setall_s32(T::YCC_G), wr = cv::vx_setall_s32(T::YCC_R);
+            const cv::v_int32 wcr = cv::vx_setall_s32(T::YCC_CR), wcb = cv::vx_setall_s32(T::YCC_CB);
+            const cv::v_int32 round = cv::vx_setall_s32(1 << (T::YCC_SHIFT - 1));
+            const cv::v_int32 delta = cv::vx_setall_s32((128 << T::YCC_SHIFT) + (1 << (T::YCC_SHIFT - 1)));
+            cv::v_uint8 y, cr, cb;
+            quarters([&](const cv::v_int32& vb, const cv::v_int32& vg, const cv::v_int32& vr, cv::v_int32& c0, cv::v_int32& c1, cv::v_int32& c2) {
+                c0 = cv::v_shr<T::YCC_SHIFT>(cv::v_add(cv::v_add(cv::v_mul(vb, wb), cv::v_mul(vg, wg)), cv::v_add(cv::v_mul(vr, wr), round)));
+                c1 = cv::v_shr<T::YCC_SHIFT>(cv::v_add(cv::v_mul(cv::v_sub(vr, c0), wcr), delta));
+                c2 = cv::v_shr<T::YCC_SHIFT>(cv::v_add(cv::v_mul(cv::v_sub(vb, c0), wcb), delta));
+            }, y, cr, cb);
+            cv::v_store_interleave(ycrcb + 3 * x, y, cr, cb);
+        }
+
+        if(hsv) {
+            const cv::v_int32 round = cv::vx_setall_s32(1 << (T::HSV_SHIFT - 1)), hueRange = cv::vx_setall_s32(180), zero = cv::vx_setzero_s32();
+            cv::v_uint8 h, s, v;
+            quarters([&](const cv::v_int32& vb, const cv::v_int32& vg, const cv::v_int32& vr, cv::v_int32& c0, cv::v_int32& c1, cv::v_int32& c2) {
+                cv::v_int32 value = cv::v_max(vb, cv::v_max(vg, vr));
+                cv::v_int32 diff = cv::v_sub(value, cv::v_min(vb, cv::v_min(vg, vr)));
+                cv::v_int32 hue = cv::v_select(cv::v_eq(value, vr), cv::v_sub(vg, vb),
+                                  cv::v_select(cv::v_eq(value, vg), cv::v_add(cv::v_sub(vb, vr), cv::v_add(diff, diff)),
+                                               cv::v_add(cv::v_sub(vr, vg), cv::v_shl<2>(diff))));
+                hue = cv::v_shr<T::HSV_SHIFT>(cv::v_add(cv::v_mul(hue, cv::v_lut(t.hdiv, diff)), round));
+                c0 = cv::v_add(hue, cv::v_and(cv::v_lt(hue, zero), hueRange));
+                c1 = cv::v_shr<T::HSV_SHIFT>(cv::v_add(cv::v_mul(diff, cv::v_lut(t.sdiv, value)), round));
+                c2 = value;
+            }, h, s, v);
+            cv::v_store_interleave(hsv + 3 * x, h, s, v);
+        }
+
+        if(lab) {
+            const cv::v_int32 x0 = cv::vx_setall_s32(t.xyz[0]), x1 = cv::vx_setall_s32(t.xyz[1]), x2 = cv::vx_setall_s32(t.xyz[2]);
+            const cv::v_int32 y0 = cv::vx_setall_s32(t.xyz[3]), y1 = cv::vx_setall_s32(t.xyz[4]), y2 = cv::vx_setall_s32(t.xyz[5]);
+            const cv::v_int32 z0 = cv::vx_setall_s32(t.xyz[6]), z1 = cv::vx_setall_s32(t.xyz[7]), z2 = cv::vx_setall_s32(t.xyz[8]);
+            const cv::v_int32 round = cv::vx_setall_s32(1 << (T::LAB_SHIFT - 1));
+            const cv::v_int32 lScale = cv::vx_setall_s32((116 * 255 + 50) / 100);
+            const cv::v_int32 lShift = cv::vx_setall_s32(-((16 * 255 * (1 << T::LAB_SHIFT2) + 50) / 100) + (1 << (T::LAB_SHIFT2 - 1)));
+            const cv::v_int32 abShift = cv::vx_setall_s32((128 << T::LAB_SHIFT2) + (1 << (T::LAB_SHIFT2 - 1)));
+            const cv::v_int32 w500 = cv::vx_setall_s32(500), w200 = cv::vx_setall_s32(200);
+            cv::v_uint8 l, a, bb;
+            quarters([&](const cv::v_int32& vb, const cv::v_int32& vg, const cv::v_int32& vr, cv::v_int32& c0, cv::v_int32& c1, cv::v_int32& c2) {
+                cv::v_int32 R = cv::v_lut(t.gamma, vr), G = cv::v_lut(t.gamma, vg), B = cv::v_lut(t.gamma, vb);
+                cv::v_int32 fX = cv::v_lut(t.cbrt, cv::v_shr<T::LAB_SHIFT>(cv::v_add(cv::v_add(cv::v_mul(R, x0), cv::v_mul(G, x1)), cv::v_add(cv::v_mul(B, x2), round))));
+                cv::v_int32 fY = cv::v_lut(t.cbrt, cv::v_shr<T::LAB_SHIFT>(cv::v_add(cv::v_add(cv::v_mul(R, y0), cv::v_mul(G, y1)), cv::v_add(cv::v_mul(B, y2), round))));
+                cv::v_int32 fZ = cv::v_lut(t.cbrt, cv::v_shr<T::LAB_SHIFT>(cv::v_add(cv::v_add(cv::v_mul(R, z0), cv::v_mul(G, z1)), cv::v_add(cv::v_mul(B, z2), round))));
+                c0 = cv::v_shr<T::LAB_SHIFT2>(cv::v_add(cv::v_mul(fY, lScale), lShift));
+                c1 = cv::v_shr<T::LAB_SHIFT2>(cv::v_add(cv::v_mul(cv::v_sub(fX, fY), w500), abShift));
+                c2 = cv::v_shr<T::LAB_SHIFT2>(cv::v_add(cv::v_mul(cv::v_sub(fY, fZ), w200), abShift));
+            }, l, a, bb);
+            cv::v_store_interleave(lab + 3 * x, l, a, bb);
+        }
+    }
+    cv::vx_cleanup();
+#endif
+
+    for(; x < cols; x++) {
+        int b = bgr[3 * x], g = bgr[3 * x + 1], r = bgr[3 * x + 2];
+        if(gray) {
+            gray[x] = grayPixel(b, g, r);
+        }
+        if(ycrcb) {
+            ycrcbPixel(b, g, r, ycrcb + 3 * x);
+        }
+        if(hsv) {
+            hsvPixel(t, b, g, r, hsv + 3 * x);
+        }
+        if(lab) {
+            labPixel(t, b, g, r, lab + 3 * x);
+        }
+    }
+}
+
+/* Multi-output colour conversion
+   Writes any combination of gray, HSV, YCrCb and Lab from one read of the 8-bit BGR image, bit-identical to calling
+   cvtColor once per plane. Rows are split into bands across threads.
+*/
+inline void convertColors(const cv::Mat& bgr, ColorOutputs& out, int planes) {
+    PROFILE_SCOPE("convertColors", bgr);
+    CV_Assert(bgr.type() == CV_8UC3 && (planes & ~COLOR_PLANE_ALL) == 0);
+    const ColorTables& tables = ColorTables::get();
+    if(planes & COLOR_PLANE_GRAY) {
+        out.gray.create(bgr.size(), CV_8UC1);
+    }
+    if(planes & COLOR_PLANE_HSV) {
+        out.hsv.create(bgr.size(), CV_8UC3);
+    }
+    if(planes & COLOR_PLANE_YCRCB) {
+        out.ycrcb.create(bgr.size(), CV_8UC3);
+    }
+    if(planes & COLOR_PLANE_LAB) {
+        out.lab.create(bgr.size(), CV_8UC3);
+    }
+    cv::parallel_for_(cv::Range(0, bgr.rows), [&](const cv::Range& range) {
+        for(int y = range.start; y < range.end; y++) {
+            convertColorRow(tables, bgr.ptr<uchar>(y),
+                            planes & COLOR_PLANE_GRAY ? out.gray.ptr<uchar>(y) : nullptr,
+                            planes & COLOR_PLANE_HSV ? out.hsv.ptr<uchar>(y) : nullptr,
+                            planes & COLOR_PLANE_YCRCB ? out.ycrcb.ptr<uchar>(y) : nullptr,
+                            planes & COLOR_PLANE_LAB ? out.lab.ptr<uchar>(y) : nullptr, bgr.cols);
+        }
+    }, std::max(1.0, bgr.rows / 64.0));
+}
@@ -0,0 +1,326 @@
+#pragma once
+
+#include <opencv2/core.hpp>
+#include <opencv2/core/hal/intrin.hpp>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include "../../Tools/profiler.hpp"
+
+/* Prefilters for Downscaler, each stretched by the scale factor so it covers the same part of the spectrum at any ratio
+   BOX       area average over the output pixel's footprint, the same weights as resize(INTER_AREA)
+   GAUSSIAN  sigma of half an output pixel, cut at 3 sigma
+   LANCZOS   windowed sinc with 3 lobes, sharpest of the three with a little ringing at hard edges
+*/
+enum DownscaleFilter { DOWNSCALE_BOX, DOWNSCALE_GAUSSIAN, DOWNSCALE_LANCZOS };
+
+/* Polyphase weights for one axis
+   Output sample o reads the source samples first[o] .. first[o] + taps - 1 with weights[o * taps + k]. Windows that
+   cross the image edge are shifted inside and the weights of the missing samples are added to the edge sample
+   (replicated border), so the resampling loops never test bounds. Every window is normalised to sum to 1.
+*/
+struct PolyphaseTable {
+    int taps = 0;
+    std::vector<int> first;
+    std::vector<float> weights;
+
+    static PolyphaseTable build(int srcLen, int dstLen, DownscaleFilter filter) {
+        CV_Assert(srcLen > 0 && dstLen > 0 && dstLen <= srcLen);
+        const double scale = (double)srcLen / dstLen;
+        const double support = filter == DOWNSCALE_BOX ? 0.5 : filter == DOWNSCALE_GAUSSIAN ? 1.5 : 3.0;
+        auto center = [&](int o) { return (o + 0.5) * scale - 0.5; };
+
+        //Trim each window to its nonzero weights, the widest one sets the tap count
+        std::vector<int> lo(dstLen), hi(dstLen);
+        int widest = 1;
+        for(int o = 0; o < dstLen; o++) {
+            const double c = center(o);
+            lo[o] = (int)std::floor(c - support * scale) - 1;
+            hi[o] = (int)std::ceil(c + support * scale) + 1;
+            while(weight(filter, lo[o], c, scale) == 0) lo[o]++;
+            while(weight(filter, hi[o], c, scale) == 0) hi[o]--;
+            widest = std::max(widest, hi[o] - lo[o] + 1);
+        }
+
+        PolyphaseTable table;
+        table.taps = std::min(srcLen, widest);
+        table.first.resize(dstLen);
+        table.weights.assign((size_t)dstLen * table.taps, 0.f);
+        std::vector<double> window(table.taps);
+        for(int o = 0; o < dstLen; o++) {
+            const double c = center(o);
+            const int first = std::max(0, std::min(lo[o], srcLen - table.taps));
+            std::fill(window.begin(), window.end(), 0.0);
+            double sum = 0;
+            for(int p = lo[o]; p <= hi[o]; p++) {
+                const int k = std::max(0, std::min(p, srcLen - 1)) - first;
+                if(k >= 0 && k < table.taps) {
+                    double w = weight(filter, p, c, scale);
+                    window[k] += w;
+                    sum += w;
+                }
+            }
+            table.first[o] = first;
+            for(int k = 0; k < table.taps; k++) {
+                table.weights[(size_t)o * table.taps + k] = (float)(window[k] / sum);
+            }
+        }
+        return table;
+    }
+
+private:
+    //Weight of source sample p for an output centred on source position c
+    static double weight(DownscaleFilter filter, int p, double c, double scale) {
+        if(filter == DOWNSCALE_BOX) {
+            return std::max(0.0, std::min(p + 0.5, c + scale / 2) - std::max(p - 0.5, c - scale / 2));
+        }
+        const double t = (p - c) / scale;
+        if(filter == DOWNSCALE_GAUSSIAN) {
+            return std::abs(t) < 1.5 ? std::exp(-2 * t * t) : 0.0;
+        }
+        if(std::abs(t) >= 3) {
+            return 0.0;
+        }
+        auto sinc = [](double x) { return x == 0 ? 1.0 : std::sin(CV_PI * x) / (CV_PI * x); };
+        return sinc(t) * sinc(t / 3);
+    }
+};
+
+/* Anti-aliased downscaler
+   The prefilter and the decimation are one operation: every output pixel is the weighted sum of the source pixels
+   under its stretched kernel, so only output pixels are computed and nothing aliases before it is filtered.
+   1) Each source row is converted to float and filtered horizontally straight into the output width, into a ring
+      of rows as tall as the vertical kernel
+   2) As soon as the ring holds an output row's window it is filtered vertically (SIMD across the row) and rounded
+      to 8 bits
+   3) For a mip chain every level is a stage fed by the float rows of the level above, so all levels come out of
+      one streaming pass over the source without rounding between levels
+   The output rows are split into bands across threads. A band works out, from the deepest level up, which rows of
+   every level its own rows depend on and streams only those, recomputing the few rows at the band edges.
+   The weight tables are built for the first image and reused while the source size and output sizes stay the same,
+   so the thumbnails of a video or a folder of photos from one camera only pay for the filtering. Like ImagePyramid,
+   one Downscaler should not be used from several threads at once.
+*/
+class Downscaler {
+public:
+    explicit Downscaler(DownscaleFilter filter = DOWNSCALE_LANCZOS) : filter(filter) {}
+
+    //CV_8U with 1 to 4 channels, dsize no larger than the source in either direction
+    void resize(const cv::Mat& src, cv::Mat& dst, cv::Size dsize) {
+        std::vector<cv::Mat> levels;
+        run(src, std::vector<cv::Size>(1, dsize), levels);
+        dst = levels[0];
+    }
+
+    //Up to count levels, each half the size of the one above rounded up as pyrDown does, levels[0] is half the source
+    void mipChain(const cv::Mat& src, std::vector<cv::Mat>& levels, int count) {
+        std::vector<cv::Size> sizes;
+        cv::Size size = src.size();
+        for(int k = 0; k < count && (size.width > 1 || size.height > 1); k++) {
+            size = cv::Size((size.width + 1) / 2, (size.height + 1) / 2);
+            sizes.push_back(size);
+        }
+        CV_Assert(!sizes.empty());
+        run(src, sizes, levels);
+    }
+
+private:
+    struct LevelTables {
+        PolyphaseTable horizontal, vertical;
+    };
+
+    //Streaming state of one level inside one band
+    struct Stage {
+        cv::Range input, output;   //Rows of the level above it consumes, rows of its own level it produces
+        int next = 0;              //Next output row
+        std::vector<float> ring;   //vertical.taps horizontally filtered rows, row y in slot y % taps
+        std::vector<float> row;    //Last output row before rounding
+        std::vector<const float*> window;
+    };
+
+    void run(const cv::Mat& src, const std::vector<cv::Size>& sizes, std::vector<cv::Mat>& outputs) {
+        PROFILE_SCOPE("Downscaler::run", src);
+        CV_Assert(!src.empty() && src.dims == 2 && src.depth() == CV_8U && src.channels() <= 4);
+        prepare(src.size(), sizes);
+        outputs.resize(sizes.size());
+        for(size_t k = 0; k < sizes.size(); k++) {
+            outputs[k].create(sizes[k], src.type());
+        }
+        const int bands = std::max(1, std::min(cv::getNumThreads(), sizes[0].height / 32));
+        cv::parallel_for_(cv::Range(0, bands), [&](const cv::Range& range) {
+            for(int band = range.start; band < range.end; band++) {
+                runBand(src, outputs, band, bands);
+            }
+        });
+    }
+
+    void prepare(cv::Size srcSize, const std::vector<cv::Size>& sizes) {
+        if(srcSize == tableSource && sizes == tableSizes) {
+            return;
+        }
+        tables.clear();
+        cv::Size above = srcSize;
+        for(const cv::Size& size : sizes) {
+            CV_Assert(size.width > 0 && size.height > 0 && size.width <= above.width && size.height <= above.height);
+            LevelTables level;
+            level.horizontal = PolyphaseTable::build(above.width, size.width, filter);
+            level.vertical = PolyphaseTable::build(above.height, size.height, filter);
+            tables.push_back(level);
+            above = size;
+        }
+        tableSource = srcSize;
+        tableSizes = sizes;
+    }
+
+    //Input rows the vertical table reads for the output rows in range
+    static cv::Range window(const PolyphaseTable& table, const cv::Range& range) {
+        if(range.empty()) {
+            return cv::Range(0, 0);
+        }
+        return cv::Range(table.first[range.start], table.first[range.end - 1] + table.taps);
+    }
+
+    static cv::Range hull(const cv::Range& a, const cv::Range& b) {
+        if(a.empty()) return b;
+        if(b.empty()) return a;
+        return cv::Range(std::min(a.start, b.start), std::max(a.end, b.end));
+    }
+
+    void runBand(const cv::Mat& src, std::vector<cv::Mat>& outputs, int band, int bands) const {
+        const int levels = (int)tables.size(), cn = src.channels();
+        std::vector<cv::Range> own(levels);
+        for(int k = 0; k < levels; k++) {
+            const int rows = outputs[k].rows;
+            own[k] = cv::Range(rows * band / bands, rows * (band + 1) / bands);
+        }
+
+        //Rows each stage must produce: its own plus whatever the stage below reads
+        std::vector<Stage> stages(levels);
+        for(int k = levels - 1; k >= 0; k--) {
+            stages[k].output = k == levels - 1 ? own[k] : hull(own[k], stages[k + 1].input);
+            stages[k].input = window(tables[k].vertical, stages[k].output);
+            stages[k].next = stages[k].output.start;
+            stages[k].ring.resize((size_t)tables[k].vertical.taps * outputs[k].cols * cn);
+            stages[k].row.resize((size_t)outputs[k].cols * cn);
+            stages[k].window.resize(tables[k].vertical.taps);
+        }
+        if(stages[0].input.empty()) {
+            return;
+        }
+
+        std::vector<float> sourceRow((size_t)src.cols * cn);
+        for(int y = stages[0].input.start; y < stages[0].input.end; y++) {
+            loadRow(src.ptr<uchar>(y), sourceRow.data(), src.cols * cn);
+            feed(stages, 0, y, sourceRow.data(), outputs, own, cn);
+        }
+    }
+
+    //Hands row y of the level above to stage k and emits every output row whose window is now complete
+    void feed(std::vector<Stage>& stages, int k, int y, const float* row, std::vector<cv::Mat>& outputs,
+              const std::vector<cv::Range>& own, int cn) const {
+        Stage& stage = stages[k];
+        if(y < stage.input.start || y >= stage.input.end) {
+            return;
+        }
+        const PolyphaseTable& horizontal = tables[k].horizontal;
+        const PolyphaseTable& vertical = tables[k].vertical;
+        const int len = outputs[k].cols * cn;
+        float* slot = stage.ring.data() + (size_t)(y % vertical.taps) * len;
+        switch(cn) {
+            case 1: horizontalPass<1>(row, slot, horizontal); break;
+            case 2: horizontalPass<2>(row, slot, horizontal); break;
+            case 3: horizontalPass<3>(row, slot, horizontal); break;
+            default: horizontalPass<4>(row, slot, horizontal); break;
+        }
+
+        while(stage.next < stage.output.end && vertical.first[stage.next] + vertical.taps - 1 <= y) {
+            const int o = stage.next++;
+            for(int j = 0; j < vertical.taps; j++) {
+                stage.window[j] = stage.ring.data() + (size_t)((vertical.first[o] + j) % vertical.taps) * len;
+            }
+            verticalPass(stage.window.data(), &vertical.weights[(size_t)o * vertical.taps], vertical.taps, stage.row.data(), len);
+            if(o >= own[k].start && o < own[k].end) {
+                storeRow(stage.row.data(), outputs[k].ptr<uchar>(o), len);
+            }
+            if(k + 1 < (int)stages.size()) {
+                feed(stages, k + 1, o, stage.row.data(), outputs, own, cn);
+            }
+        }
+    }
+
+    template<int cn>
+    static void horizontalPass(const float* src, float* dst, const PolyphaseTable& table) {
+        const int taps = table.taps, outputs = (int)table.first.size();
+        for(int o = 0; o < outputs; o++) {
+            const float* w = &table.weights[(size_t)o * taps];
+            const float* s = src + table.first[o] * cn;
+            float sum[cn] = {0};
+            for(int k = 0; k < taps; k++) {
+                for(int c = 0; c < cn; c++) {
+                    sum[c] += w[k] * s[k * cn + c];
+                }
+            }
+            for(int c = 0; c < cn; c++) {
+                dst[o * cn + c] = sum[c];
+            }
+        }
+    }
+
+    static void verticalPass(const float** rows, const float* w, int taps, float* dst, int len) {
+        int x = 0;
+#if (CV_SIMD || CV_SIMD_SCALABLE)
+        const int lanes = cv::VTraits<cv::v_float32>::vlanes();
+        for(; x <= len - lanes; x += lanes) {
+            cv::v_float32 sum = cv::vx_setzero_f32();
+            for(int k = 0; k < taps; k++) {
+                sum = cv::v_fma(cv::vx_load(rows[k] + x), cv::vx_setall_f32(w[k]), sum);
+            }
+            cv::v_store(dst + x, sum);
+        }
+        cv::vx_cleanup();
+#endif
+        for(; x < len; x++) {
+            float sum = 0;
+            for(int k = 0; k < taps; k++) {
+                sum += w[k] * rows[k][x];
+            }
+            dst[x] = sum;
+        }
+    }
+
+    static void loadRow(const uchar* src, float* dst, int len) {
+        int x = 0;
+#if (CV_SIMD || CV_SIMD_SCALABLE)
+        const int lanes = cv::VTraits<cv::v_float32>::vlanes();
+        for(; x <= len - lanes; x += lanes) {
+            cv::v_store(dst + x, cv::v_cvt_f32(cv::v_reinterpret_as_s32(cv::vx_load_expand_q(src + x))));
+        }
+        cv::vx_cleanup();
+#endif
+        for(; x < len; x++) {
+            dst[x] = src[x];
+        }
+    }
+
+    //Rounds to nearest and saturates, the same as saturate_cast<uchar>
+    static void storeRow(const float* src, uchar* dst, int len) {
+        int x = 0;
+#if (CV_SIMD || CV_SIMD_SCALABLE)
+        const int lanes = cv::VTraits<cv::v_float32>::vlanes();
+        for(; x <= len - 4 * lanes; x += 4 * lanes) {
+            cv::v_int16 low = cv::v_pack(cv::v_round(cv::vx_load(src + x)), cv::v_round(cv::vx_load(src + x + lanes)));
+            cv::v_int16 high = cv::v_pack(cv::v_round(cv::vx_load(src + x + 2 * lanes)), cv::v_round(cv::vx_load(src + x + 3 * lanes)));
+            cv::v_store(dst + x, cv::v_pack_u(low, high));
+        }
+        cv::vx_cleanup();
+#endif
+        for(; x < len; x++) {
+            dst[x] = cv::saturate_cast<uchar>(src[x]);
+        }
+    }
+
+    DownscaleFilter filter;
+    cv::Size tableSource;
+    std::vector<cv::Size> tableSizes;
+    std::vector<LevelTables> tables;
+};
@@ -1,11 +1,67 @@
 #include <opencv2/opencv.hpp>
 #include <iostream>
+#include <functional>
+#include "downscaler.hpp"
 
 using namespace cv;
 using namespace std;
 
-int main() {
-    Mat img = imread("Pictures/truck.jpg", IMREAD_COLOR);
+/* Benchmark of the separate-pass downsampling against the fused downscaler
+   1) Quarter size: nearest + GaussianBlur as main() does, resize with INTER_AREA, and the Downscaler with each filter
+   2) Five level mip chain: repeated pyrDown, repeated resize(INTER_AREA) and one mipChain() pass
+   The box filter uses the INTER_AREA weights, so its difference from resize shows only float rounding.
+*/
+void benchmarkDownscale(const Mat& img, int runs) {
+    auto timeMs = [&](const function<void()>& fn) {
+        int64 start = getTickCount();
+        for(int i = 0; i < runs; i++) {
+            fn();
+        }
+        return (getTickCount() - start) * 1000.0 / getTickFrequency() / runs;
+    };
+
+    cout << "Benchmarking " << img.cols << "x" << img.rows << " on " << getNumThreads() << " threads" << endl;
+    Size quarter(img.cols / 4, img.rows / 4);
+    Mat nearest_img, area_img, box_img, gaussian_img, lanczos_img;
+    double separateMs = timeMs([&] {
+        resize(img, nearest_img, quarter, 0, 0, INTER_NEAREST);
+        profiled::GaussianBlur(nearest_img, nearest_img, Size(5, 5), 1.5, 1.5);
+    });
+    double areaMs = timeMs([&] { resize(img, area_img, quarter, 0, 0, INTER_AREA); });
+    Downscaler box(DOWNSCALE_BOX), gaussian(DOWNSCALE_GAUSSIAN), lanczos(DOWNSCALE_LANCZOS);
+    double boxMs = timeMs([&] { box.resize(img, box_img, quarter); });
+    double gaussianMs = timeMs([&] { gaussian.resize(img, gaussian_img, quarter); });
+    double lanczosMs = timeMs([&] { lanczos.resize(img, lanczos_img, quarter); });
+    cout << "quarter size: nearest + GaussianBlur " << separateMs << " ms, INTER_AREA " << areaMs << " ms, box " << boxMs
+         << " ms (max difference from INTER_AREA " << norm(area_img, box_img, NORM_INF) << "), gaussian " << gaussianMs
+         << " ms, lanczos " << lanczosMs << " ms" << endl;
+
+    const int levels = 5;
+    vector<Mat> mips;
+    double pyrDownMs = timeMs([&] {
+        Mat level = img;
+        for(int k = 0; k < levels; k++) {
+            Mat next;
+            profiled::pyrDown(level, next);
+            level = next;
+        }
+    });
+    double repeatedAreaMs = timeMs([&] {
+        Mat level = img;
+        for(int k = 0; k < levels; k++) {
+            Mat next;
+            resize(level, next, Size((level.cols + 1) / 2, (level.rows + 1) / 2), 0, 0, INTER_AREA);
+            level = next;
+        }
+    });
+    double chainMs = timeMs([&] { box.mipChain(img, mips, levels); });
+    double lanczosChainMs = timeMs([&] { lanczos.mipChain(img, mips, levels); });
+    cout << levels << " level mip chain: pyrDown " << pyrDownMs << " ms, INTER_AREA " << repeatedAreaMs << " ms, box chain "
+         << chainMs << " ms, lanczos chain " << lanczosChainMs << " ms" << endl;
+}
+
+int main(int argc, char** argv) {
+    Mat img = profiled::imread("Pictures/truck.jpg", IMREAD_COLOR);
     if(img.empty()) {
         cout << "Failed to read image" << endl;
         return 1;
@@ -19,7 +75,7 @@ int main() {
     */
     Mat downSampled_img;
     resize(img, downSampled_img, Size(), 0.25, 0.25, INTER_NEAREST);
-    imwrite("Pictures/downSampled_img.png", downSampled_img);
+    profiled::imwrite("Pictures/downSampled_img.png", downSampled_img);
 
     /* Upscale image with Nearest-Neighbor sampling
        Increasing the quality of an image, the opposite objective of downsampling. 
@@ -27,7 +83,7 @@ int main() {
     */
     Mat upNearest_img;
     resize(downSampled_img, upNearest_img, img.size(), 0, 0, INTER_NEAREST);
-    imwrite("Pictures/upNearest_img.png", upNearest_img);
+    profiled::imwrite("Pictures/upNearest_img.png", upNearest_img);
     
     /* Upscale image with Bilinear Interpolation sampling
        Increasing the quality of an image, the opposite objective of downsampling. 
@@ -35,16 +91,39 @@ int main() {
     */
     Mat upBilinear_img;
     resize(downSampled_img, upBilinear_img, img.size(), 0, 0, INTER_LINEAR);
-    imwrite("Pictures/upBilinear_img.png", upBilinear_img);
+    profiled::imwrite("Pictures/upBilinear_img.png", upBilinear_img);
 
     /* Anti-aliasing via gaussian blur technique
        Smoothing the image out to reduce the noise in an image and any high frequency components that 
        can cause false edges to be detected. GaussianBlur(src Mat, output Mat, kernel size, std x-direction, std y-direction)
     */
     Mat antiAliased_img;
-    GaussianBlur(downSampled_img, antiAliased_img, Size(5, 5), 1.5, 1.5);
+    profiled::GaussianBlur(downSampled_img, antiAliased_img, Size(5, 5), 1.5, 1.5);
     resize(antiAliased_img, antiAliased_img, img.size(), 0, 0, INTER_LINEAR);
-    imwrite("Pictures/antiAliased_img.png", antiAliased_img);
+    profiled::imwrite("Pictures/antiAliased_img.png", antiAliased_img);
+
+    /* Anti-aliasing by prefiltering during the downscale
+       Blurring after INTER_NEAREST cannot undo the aliasing, the discarded pixels are already gone. The Downscaler
+       weights every source pixel under a lanczos kernel stretched to the output pixel size, so the high frequencies
+       are removed as part of the decimation. mipChain() then emits every half-size level in one pass over the source.
+    */
+    Mat lanczosDown_img, lanczosUp_img;
+    Downscaler lanczos(DOWNSCALE_LANCZOS);
+    lanczos.resize(img, lanczosDown_img, downSampled_img.size());
+    profiled::imwrite("Pictures/lanczosDown_img.png", lanczosDown_img);
+    resize(lanczosDown_img, lanczosUp_img, img.size(), 0, 0, INTER_LINEAR);
+    profiled::imwrite("Pictures/lanczosUp_img.png", lanczosUp_img);
+
+    vector<Mat> mips;
+    lanczos.mipChain(img, mips, 5);
+    for(size_t i = 0; i < mips.size(); i++) {
+        profiled::imwrite("Pictures/mip" + to_string(i + 1) + "_img.png", mips[i]);
+    }
+
+    //Run with --benchmark [runs] to compare against the separate passes
+    if(argc > 1 && string(argv[1]) == "--benchmark") {
+        benchmarkDownscale(img, argc > 2 ? atoi(argv[2]) : 20);
+    }
 
     return 0;
 }
\ No newline at end of file
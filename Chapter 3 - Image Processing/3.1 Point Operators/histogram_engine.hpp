@@ -0,0 +1,353 @@
+#pragma once
+
+#include <opencv2/core.hpp>
+#include <opencv2/core/hal/intrin.hpp>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include "../../Tools/profiler.hpp"
+
+/* Privatized histogram of an 8-bit single channel image
+   1) The rows are split into one band per thread, each band counts into its own private histogram so threads never
+      write the same counters
+   2) Inside a band, consecutive pixels go to four interleaved sub-histograms, runs of equal values (flat regions)
+      would otherwise make every increment wait on the previous one
+   3) The private histograms are merged in one serial pass of 256 adds per band
+   The counts are added to hist[0..255].
+*/
+inline void privatizedHistogram(const cv::Mat& src, int* hist) {
+    CV_Assert(src.type() == CV_8UC1);
+    const int bands = std::max(1, std::min(src.rows, cv::getNumThreads()));
+    const int bandRows = (src.rows + bands - 1) / bands;
+    std::vector<int> privateHists((size_t)bands * 256, 0);
+    cv::parallel_for_(cv::Range(0, bands), [&](const cv::Range& range) {
+        for(int b = range.start; b < range.end; b++) {
+            int sub[4][256] = {{0}};
+            for(int y = b * bandRows; y < std::min(src.rows, (b + 1) * bandRows); y++) {
+                const uchar* row = src.ptr<uchar>(y);
+                int x = 0;
+                for(; x <= src.cols - 4; x += 4) {
+                    sub[0][row[x]]++;
+                    sub[1][row[x + 1]]++;
+                    sub[2][row[x + 2]]++;
+                    sub[3][row[x + 3]]++;
+                }
+                for(; x < src.cols; x++) {
+                    sub[0][row[x]]++;
+                }
+            }
+            int* out = &privateHists[(size_t)b * 256];
+            for(int v = 0; v < 256; v++) {
+                out[v] = sub[0][v] + sub[1][v] + sub[2][v] + sub[3][v];
+            }
+        }
+    }, bands);
+    for(int b = 0; b < bands; b++) {
+        for(int v = 0; v < 256; v++) {
+            hist[v] += privateHists[(size_t)b * 256 + v];
+        }
+    }
+}
+
+//The table equalizeHist builds from the histogram of an image with total pixels (Count is int, or int64 past 2^31 pixels)
+template<typename Count>
+inline std::vector<int> equalizationTable(const Count* hist, Count total) {
+    std::vector<int> lut(256, 0);
+    int first = 0;
+    while(first < 255 && hist[first] == 0) {
+        first++;
+    }
+    if(hist[first] == total) {
+        lut[first] = first;     //Constant image, equalizeHist leaves it as it is
+        return lut;
+    }
+    const float scale = 255.f / (total - hist[first]);
+    Count sum = 0;
+    for(int v = first + 1; v < 256; v++) {
+        sum += hist[v];
+        lut[v] = cv::saturate_cast<uchar>(sum * scale);
+    }
+    return lut;
+}
+
+#if (CV_SIMD || CV_SIMD_SCALABLE)
+//Table lookup of 16-bit indices below 256, gathered 32 bits at a time
+inline cv::v_uint16 tableLookup16(const int* lut, const cv::v_uint16& index) {
+    cv::v_uint32 low, high;
+    cv::v_expand(index, low, high);
+    return cv::v_pack(cv::v_reinterpret_as_u32(cv::v_lut(lut, cv::v_reinterpret_as_s32(low))),
+                      cv::v_reinterpret_as_u32(cv::v_lut(lut, cv::v_reinterpret_as_s32(high))));
+}
+#endif
+
+//dst[i] = lut[src[i]] over len bytes
+inline void tableLookupRow(const uchar* src, const int* lut, uchar* dst, int len) {
+    int i = 0;
+#if (CV_SIMD || CV_SIMD_SCALABLE)
+    const int lanes = cv::VTraits<cv::v_uint8>::vlanes();
+    for(; i <= len - lanes; i += lanes) {
+        cv::v_uint16 low, high;
+        cv::v_expand(cv::vx_load(src + i), low, high);
+        cv::v_store(dst + i, cv::v_pack(tableLookup16(lut, low), tableLookup16(lut, high)));
+    }
+    cv::vx_cleanup();
+#endif
+    for(; i < len; i++) {
+        dst[i] = (uchar)lut[src[i]];
+    }
+}
+
+//LUT(src, lut, dst) for an 8-bit image of any channel count, rows in parallel (dst may be src)
+inline void applyTable(const cv::Mat& src, cv::Mat& dst, const int* lut) {
+    CV_Assert(src.depth() == CV_8U);
+    const cv::Mat source = src;
+    dst.create(src.size(), src.type());
+    const int len = src.cols * src.channels();
+    cv::parallel_for_(cv::Range(0, src.rows), [&](const cv::Range& range) {
+        for(int y = range.start; y < range.end; y++) {
+            tableLookupRow(source.ptr<uchar>(y), lut, dst.ptr<uchar>(y), len);
+        }
+    }, std::max(1.0, src.rows / 64.0));
+}
+
+//equalizeHist(src, dst) with the histogram and the mapping both computed in parallel, the output is identical
+inline void parallelEqualizeHist(const cv::Mat& src, cv::Mat& dst) {
+    PROFILE_SCOPE("parallelEqualizeHist", src);
+    CV_Assert(src.type() == CV_8UC1);
+    int hist[256] = {0};
+    privatizedHistogram(src, hist);
+    const std::vector<int> lut = equalizationTable(hist, (int)src.total());
+    applyTable(src, dst, lut.data());
+}
+
+/* Tiled adaptive equalization (CLAHE)
+   The image is split into a grid of tiles, each tile gets its own equalization table from the histogram of a window
+   around it, and every pixel blends the tables of the four nearest tile centres bilinearly so there are no seams.
+   1) Window histograms. Every window edge is a cut through the image, the cuts split it into a lattice of cells. One
+      pass over the pixels counts each cell (privatized per band of cell rows), then the cell histograms are summed into
+      an integral histogram over the lattice. Any window's histogram is then four lookups per bin, so the cost per tile
+      is the same whatever the window size.
+   2) Clipping. Bins above clipLimit * windowArea / 256 are cut and the excess spread over all bins, which limits how
+      much the contrast of flat regions is amplified. A clip limit <= 0 disables it.
+   3) Blending, rows in parallel with the four table lookups gathered with SIMD.
+   With overlap 1 the windows are the tiles themselves and the output is identical to createCLAHE(clipLimit, tiles).
+   A larger overlap widens each window around its tile centre (clamped to the image) for smoother local contrast, at
+   the same cost per tile.
+*/
+class AdaptiveEqualizer {
+public:
+    AdaptiveEqualizer(double clipLimit = 40.0, cv::Size tiles = cv::Size(8, 8), double overlap = 1.0)
+        : clip(clipLimit), grid(tiles), windowScale(overlap) {
+        CV_Assert(tiles.width > 0 && tiles.height > 0 && overlap >= 1);
+    }
+
+    void apply(const cv::Mat& src, cv::Mat& dst) {
+        CV_Assert(src.type() == CV_8UC1 && !src.empty());
+        const cv::Mat source = src;
+        //Like CLAHE, sizes that do not divide into the grid are extended at the bottom/right with BORDER_REFLECT_101
+        padded = src.size();
+        if(src.cols % grid.width != 0 || src.rows % grid.height != 0) {
+            padded = cv::Size(src.cols + grid.width - src.cols % grid.width, src.rows + grid.height - src.rows % grid.height);
+        }
+        tile = cv::Size(padded.width / grid.width, padded.height / grid.height);
+
+        windowHistograms(source);
+        buildTables();
+        dst.create(src.size(), CV_8UC1);
+        blend(source, dst);
+    }
+
+private:
+    //Window edges along one axis for tiles of this length, clamped to the padded image
+    void windowEdges(int tiles, int tileLen, int paddedLen, std::vector<int>& starts, std::vector<int>& cuts) const {
+        const int windowLen = std::min(paddedLen, (int)std::lround(windowScale * tileLen));
+        starts.resize(tiles);
+        cuts.assign(1, 0);
+        cuts.push_back(paddedLen);
+        for(int t = 0; t < tiles; t++) {
+            const int center = t * tileLen + tileLen / 2;
+            starts[t] = std::min(std::max(center - windowLen / 2, 0), paddedLen - windowLen);
+            cuts.push_back(starts[t]);
+            cuts.push_back(starts[t] + windowLen);
+        }
+        std::sort(cuts.begin(), cuts.end());
+        cuts.erase(std::unique(cuts.begin(), cuts.end()), cuts.end());
+    }
+
+    //Cell histograms over the lattice of window edges, then their integral, then every window's histogram
+    void windowHistograms(const cv::Mat& src) {
+        std::vector<int> startX, startY, cutsX, cutsY;
+        windowEdges(grid.width, tile.width, padded.width, startX, cutsX);
+        windowEdges(grid.height, tile.height, padded.height, startY, cutsY);
+        windowSize = cv::Size(std::min(padded.width, (int)std::lround(windowScale * tile.width)),
+                              std::min(padded.height, (int)std::lround(windowScale * tile.height)));
+        const int cellsX = (int)cutsX.size() - 1, cellsY = (int)cutsY.size() - 1;
+
+        //Source column of every padded column, the padding reflects back into the image
+        std::vector<int> srcX(padded.width);
+        for(int x = 0; x < padded.width; x++) {
+            srcX[x] = cv::borderInterpolate(x, src.cols, cv::BORDER_REFLECT_101);
+        }
+
+        //Integral histogram, entry (j, i) holds the cells above cut j and left of cut i. Cell (j, i) is counted into
+        //entry (j+1, i+1) first, each band of cell rows only writes its own entries.
+        const size_t stride = (size_t)(cellsX + 1) * 256;
+        integral.assign((size_t)(cellsY + 1) * stride, 0);
+        cv::parallel_for_(cv::Range(0, cellsY), [&](const cv::Range& range) {
+            for(int j = range.start; j < range.end; j++) {
+                int* cells = &integral[(size_t)(j + 1) * stride];
+                for(int y = cutsY[j]; y < cutsY[j + 1]; y++) {
+                    const uchar* row = src.ptr<uchar>(cv::borderInterpolate(y, src.rows, cv::BORDER_REFLECT_101));
+                    for(int i = 0; i < cellsX; i++) {
+                        int* hist = cells + (size_t)(i + 1) * 256;
+                        const int x1 = cutsX[i + 1], inside = std::min(x1, src.cols);
+                        int x = cutsX[i];
+                        for(; x < inside; x++) {
+                            hist[row[x]]++;
+                        }
+                        for(; x < x1; x++) {
+                            hist[row[srcX[x]]]++;
+                        }
+                    }
+                }
+            }
+        });
+        for(int j = 1; j <= cellsY; j++) {
+            for(int i = 1; i <= cellsX; i++) {
+                int* out = &integral[(size_t)j * stride + (size_t)i * 256];
+                const int* up = out - stride;
+                const int* left = out - 256;
+                const int* upLeft = up - 256;
+                for(int v = 0; v < 256; v++) {
+                    out[v] += up[v] + left[v] - upLeft[v];
+                }
+            }
+        }
+
+        //Window histogram = I(bottom, right) - I(top, right) - I(bottom, left) + I(top, left)
+        histograms.assign((size_t)grid.area() * 256, 0);
+        for(int ty = 0; ty < grid.height; ty++) {
+            const int top = cutIndex(cutsY, startY[ty]), bottom = cutIndex(cutsY, startY[ty] + windowSize.height);
+            for(int tx = 0; tx < grid.width; tx++) {
+                const int left = cutIndex(cutsX, startX[tx]), right = cutIndex(cutsX, startX[tx] + windowSize.width);
+                const int* a = &integral[(size_t)bottom * stride + (size_t)right * 256];
+                const int* b = &integral[(size_t)top * stride + (size_t)right * 256];
+                const int* c = &integral[(size_t)bottom * stride + (size_t)left * 256];
+                const int* d = &integral[(size_t)top * stride + (size_t)left * 256];
+                int* out = &histograms[(size_t)(ty * grid.width + tx) * 256];
+                for(int v = 0; v < 256; v++) {
+                    out[v] = a[v] - b[v] - c[v] + d[v];
+                }
+            }
+        }
+    }
+
+    static int cutIndex(const std::vector<int>& cuts, int position) {
+        return (int)(std::lower_bound(cuts.begin(), cuts.end(), position) - cuts.begin());
+    }
+
+    //Clip each window histogram, redistribute the excess the way CLAHE does and turn it into a table
+    void buildTables() {
+        const int area = windowSize.area();
+        int limit = 0;
+        if(clip > 0) {
+            limit = std::max(1, (int)(clip * area / 256));
+        }
+        const float scale = 255.f / area;
+        tables.resize((size_t)grid.area() * 256);
+        cv::parallel_for_(cv::Range(0, grid.area()), [&](const cv::Range& range) {
+            for(int t = range.start; t < range.end; t++) {
+                int* hist = &histograms[(size_t)t * 256];
+                if(limit > 0) {
+                    int clipped = 0;
+                    for(int v = 0; v < 256; v++) {
+                        if(hist[v] > limit) {
+                            clipped += hist[v] - limit;
+                            hist[v] = limit;
+                        }
+                    }
+                    const int batch = clipped / 256;
+                    int residual = clipped - batch * 256;
+                    for(int v = 0; v < 256; v++) {
+                        hist[v] += batch;
+                    }
+                    if(residual != 0) {
+                        const int step = std::max(256 / residual, 1);
+                        for(int v = 0; v < 256 && residual > 0; v += step, residual--) {
+                            hist[v]++;
+                        }
+                    }
+                }
+                float* table = &tables[(size_t)t * 256];
+                int sum = 0;
+                for(int v = 0; v < 256; v++) {
+                    sum += hist[v];
+                    table[v] = cv::saturate_cast<uchar>(sum * scale);
+                }
+            }
+        });
+    }
+
+    /* Bilinear blend of the four nearest tables, in the same float arithmetic as CLAHE:
+       ((T11*(1-xa) + T12*xa)*(1-ya) + (T21*(1-xa) + T22*xa)*ya), rounded to nearest
+    */
+    void blend(const cv::Mat& src, cv::Mat& dst) const {
+        const int cols = src.cols;
+        std::vector<int> index1(cols), index2(cols);
+        std::vector<float> weight1(cols), weight2(cols);
+        const float invTileWidth = 1.f / tile.width, invTileHeight = 1.f / tile.height;
+        for(int x = 0; x < cols; x++) {
+            const float txf = x * invTileWidth - 0.5f;
+            const int tx1 = cvFloor(txf);
+            weight2[x] = txf - tx1;
+            weight1[x] = 1.f - weight2[x];
+            index1[x] = std::max(tx1, 0) * 256;
+            index2[x] = std::min(tx1 + 1, grid.width - 1) * 256;
+        }
+
+        cv::parallel_for_(cv::Range(0, src.rows), [&](const cv::Range& range) {
+            for(int y = range.start; y < range.end; y++) {
+                const float tyf = y * invTileHeight - 0.5f;
+                const int ty1 = cvFloor(tyf);
+                const float ya = tyf - ty1, ya1 = 1.f - ya;
+                const float* plane1 = &tables[(size_t)std::max(ty1, 0) * grid.width * 256];
+                const float* plane2 = &tables[(size_t)std::min(ty1 + 1, grid.height - 1) * grid.width * 256];
+                const uchar* in = src.ptr<uchar>(y);
+                uchar* out = dst.ptr<uchar>(y);
+                int x = 0;
+#if (CV_SIMD || CV_SIMD_SCALABLE)
+                const int lanes = cv::VTraits<cv::v_float32>::vlanes();
+                const cv::v_float32 vya = cv::vx_setall_f32(ya), vya1 = cv::vx_setall_f32(ya1);
+                auto blendLanes = [&](const cv::v_int32& value, int at) {
+                    const cv::v_int32 i1 = cv::v_add(cv::vx_load(&index1[at]), value);
+                    const cv::v_int32 i2 = cv::v_add(cv::vx_load(&index2[at]), value);
+                    const cv::v_float32 w1 = cv::vx_load(&weight1[at]), w2 = cv::vx_load(&weight2[at]);
+                    const cv::v_float32 top = cv::v_add(cv::v_mul(cv::v_lut(plane1, i1), w1), cv::v_mul(cv::v_lut(plane1, i2), w2));
+                    const cv::v_float32 bottom = cv::v_add(cv::v_mul(cv::v_lut(plane2, i1), w1), cv::v_mul(cv::v_lut(plane2, i2), w2));
+                    return cv::v_round(cv::v_add(cv::v_mul(top, vya1), cv::v_mul(bottom, vya)));
+                };
+                for(; x <= cols - 2 * lanes; x += 2 * lanes) {
+                    cv::v_uint32 low, high;
+                    cv::v_expand(cv::vx_load_expand(in + x), low, high);
+                    cv::v_pack_store(out + x, cv::v_pack_u(blendLanes(cv::v_reinterpret_as_s32(low), x),
+                                                          blendLanes(cv::v_reinterpret_as_s32(high), x + lanes)));
+                }
+                cv::vx_cleanup();
+#endif
+                for(; x < cols; x++) {
+                    const int i1 = index1[x] + in[x], i2 = index2[x] + in[x];
+                    const float value = (plane1[i1] * weight1[x] + plane1[i2] * weight2[x]) * ya1 +
+                                        (plane2[i1] * weight1[x] + plane2[i2] * weight2[x]) * ya;
+                    out[x] = cv::saturate_cast<uchar>(value);
+                }
+            }
+        });
+    }
+
+    double clip;
+    cv::Size grid;
+    double windowScale;
+    cv::Size padded, tile, windowSize;
+    std::vector<int> integral, histograms;
+    std::vector<float> tables;
+};
@@ -0,0 +1,237 @@
+#pragma once
+
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+#include <opencv2/core/hal/intrin.hpp>
+#include <algorithm>
+#include <cmath>
+#include <mutex>
+#include <vector>
+#include "histogram_engine.hpp"
+#include "../../Tools/profiler.hpp"
+
+/* Point operator pipeline
+   An 8-bit point operator maps each of the 256 input values to one output value, so any chain of them is a single
+   256-entry lookup table. The pipeline records the chain and
+   1) Composes the fixed stages (linear, gamma, threshold, lookup) into one table as they are added. Each stage's table
+      is taken by running the OpenCV function itself on a 0..255 ramp, so the result is identical to calling it.
+   2) Resolves equalize() stages in apply(), they depend on the image: the histogram of the input pushed through the
+      table in front of the stage is exactly the histogram equalizeHist would have seen, so one histogram of the input
+      is enough for any number of them.
+   3) Applies the final table in one vectorised pass over bands of rows in parallel, with BGR to gray fused in front
+      when the chain starts with grayscale(), using the same fixed-point weights as cvtColor.
+   Without equalize() the image is read once and written once. With it, the input is read once more for the histogram.
+*/
+class PointOperatorPipeline {
+public:
+    PointOperatorPipeline() : segments(1, identity()) {}
+
+    //cvtColor(src, dst, COLOR_BGR2GRAY) in front of the chain, must come before every other stage
+    PointOperatorPipeline& grayscale() {
+        CV_Assert(stages == 0);
+        toGray = true;
+        return *this;
+    }
+
+    //convertTo(dst, -1, alpha, beta)
+    PointOperatorPipeline& linear(double alpha, double beta) {
+        cv::Mat table;
+        ramp().convertTo(table, -1, alpha, beta);
+        return compose(table);
+    }
+
+    //threshold(src, dst, thresh, maxval, type), the automatic THRESH_OTSU/THRESH_TRIANGLE modes are not point operators
+    PointOperatorPipeline& threshold(double thresh, double maxval, int type) {
+        CV_Assert((type & ~cv::THRESH_MASK) == 0);
+        cv::Mat table;
+        cv::threshold(ramp(), table, thresh, maxval, type);
+        return compose(table);
+    }
+
+    //dst = 255 * (src/255)^gamma
+    PointOperatorPipeline& gamma(double exponent) {
+        cv::Mat table(1, 256, CV_8UC1);
+        for(int v = 0; v < 256; v++) {
+            table.at<uchar>(v) = cv::saturate_cast<uchar>(255 * std::pow(v / 255.0, exponent));
+        }
+        return compose(table);
+    }
+
+    //Any 256-entry 8-bit table, like LUT(src, table, dst)
+    PointOperatorPipeline& lookup(const cv::Mat& table) {
+        CV_Assert(table.total() == 256 && table.type() == CV_8UC1);
+        return compose(table.isContinuous() ? table : table.clone());
+    }
+
+    //equalizeHist(src, dst) of the image at this point of the chain
+    PointOperatorPipeline& equalize() {
+        segments.push_back(identity());
+        stages++;
+        return *this;
+    }
+
+    int stageCount() const { return stages; }
+
+    /* The composed table for this image, equalize() stages resolved from its histogram
+       src is the 8-bit input of the chain: a gray image, or a BGR image when the chain starts with grayscale().
+       Without equalize() stages the table does not depend on src.
+    */
+    std::vector<int> table(const cv::Mat& src) const {
+        if(segments.size() == 1) {
+            return segments[0];
+        }
+        std::vector<int> hist(256, 0);
+        histogram(src, hist.data());
+        return resolve(hist.data(), (int)src.total());
+    }
+
+    /* dst = chain(src)
+       src is 8-bit. With grayscale() it must be BGR and dst is gray, otherwise the table is applied to every channel
+       (equalize() then needs a single channel, like equalizeHist).
+    */
+    void apply(const cv::Mat& src, cv::Mat& dst) const {
+        PROFILE_SCOPE("PointOperatorPipeline::apply", src);
+        CV_Assert(!src.empty() && src.depth() == CV_8U);
+        CV_Assert(!toGray || src.channels() == 3);
+        CV_Assert(toGray || segments.size() == 1 || src.channels() == 1);
+        const cv::Mat source = src;  //Keeps src alive if dst is src and gets reallocated
+        dst.create(src.size(), toGray ? CV_8UC1 : src.type());
+
+        if(segments.size() == 1) {
+            if(toGray) {
+                runGray(source, dst, segments[0].data(), nullptr);
+            }
+            else {
+                applyTable(source, dst, segments[0].data());
+            }
+        }
+        else if(toGray) {
+            //Gray conversion and histogram in one pass, then the resolved table in place
+            std::vector<int> hist(256, 0);
+            runGray(source, dst, identity().data(), hist.data());
+            const std::vector<int> lut = resolve(hist.data(), (int)dst.total());
+            applyTable(dst, dst, lut.data());
+        }
+        else {
+            applyTable(source, dst, table(source).data());
+        }
+    }
+
+private:
+    static std::vector<int> identity() {
+        std::vector<int> lut(256);
+        for(int v = 0; v < 256; v++) {
+            lut[v] = v;
+        }
+        return lut;
+    }
+
+    static cv::Mat ramp() {
+        cv::Mat values(1, 256, CV_8UC1);
+        for(int v = 0; v < 256; v++) {
+            values.at<uchar>(v) = (uchar)v;
+        }
+        return values;
+    }
+
+    //Appends a stage: the current table is followed by table
+    PointOperatorPipeline& compose(const cv::Mat& table) {
+        const uchar* next = table.ptr<uchar>();
+        for(int& value : segments.back()) {
+            value = next[value];
+        }
+        stages++;
+        return *this;
+    }
+
+    //Walks the segments, pushing the histogram of the input through each one to equalize the next
+    std::vector<int> resolve(const int* inputHist, int total) const {
+        std::vector<int> lut = segments[0];
+        for(size_t s = 1; s < segments.size(); s++) {
+            int hist[256] = {0};
+            for(int v = 0; v < 256; v++) {
+                hist[lut[v]] += inputHist[v];
+            }
+            const std::vector<int> equalized = equalizationTable(hist, total);
+            for(int& value : lut) {
+                value = segments[s][equalized[value]];
+            }
+        }
+        return lut;
+    }
+
+    //Histogram of the input of the chain
+    void histogram(const cv::Mat& src, int* hist) const {
+        if(toGray) {
+            cv::Mat gray(src.size(), CV_8UC1);
+            runGray(src, gray, identity().data(), hist);
+            return;
+        }
+        privatizedHistogram(src, hist);
+    }
+
+    //One pass over a BGR image: gray conversion, then the table, optionally counting the output values
+    static void runGray(const cv::Mat& src, cv::Mat& dst, const int* lut, int* hist) {
+        std::mutex merge;
+        cv::parallel_for_(cv::Range(0, src.rows), [&](const cv::Range& range) {
+            int local[256] = {0};
+            for(int y = range.start; y < range.end; y++) {
+                uchar* out = dst.ptr<uchar>(y);
+                grayRow(src.ptr<uchar>(y), lut, out, src.cols);
+                if(hist) {
+                    for(int x = 0; x < dst.cols; x++) {
+                        local[out[x]]++;
+                    }
+                }
+            }
+            if(hist) {
+                std::lock_guard<std::mutex> lock(merge);
+                for(int v = 0; v < 256; v++) {
+                    hist[v] += local[v];
+                }
+            }
+        }, std::max(1.0, src.rows / 64.0));
+    }
+
+#if (CV_SIMD || CV_SIMD_SCALABLE)
+    //(b*3735 + g*19235 + r*9798 + 2^14) >> 15, cvtColor's 8-bit BGR2GRAY
+    static cv::v_uint16 gray16(const cv::v_uint16& b, const cv::v_uint16& g, const cv::v_uint16& r) {
+        cv::v_uint32 b0, b1, g0, g1, r0, r1;
+        cv::v_expand(b, b0, b1);
+        cv::v_expand(g, g0, g1);
+        cv::v_expand(r, r0, r1);
+        const cv::v_uint32 wb = cv::vx_setall_u32(GRAY_B), wg = cv::vx_setall_u32(GRAY_G), wr = cv::vx_setall_u32(GRAY_R);
+        const cv::v_uint32 round = cv::vx_setall_u32(1 << (GRAY_SHIFT - 1));
+        cv::v_uint32 y0 = cv::v_add(cv::v_add(cv::v_mul(b0, wb), cv::v_mul(g0, wg)), cv::v_add(cv::v_mul(r0, wr), round));
+        cv::v_uint32 y1 = cv::v_add(cv::v_add(cv::v_mul(b1, wb), cv::v_mul(g1, wg)), cv::v_add(cv::v_mul(r1, wr), round));
+        return cv::v_pack(cv::v_shr<GRAY_SHIFT>(y0), cv::v_shr<GRAY_SHIFT>(y1));
+    }
+#endif
+
+    static void grayRow(const uchar* bgr, const int* lut, uchar* dst, int cols) {
+        int x = 0;
+#if (CV_SIMD || CV_SIMD_SCALABLE)
+        const int lanes = cv::VTraits<cv::v_uint8>::vlanes();
+        for(; x <= cols - lanes; x += lanes) {
+            cv::v_uint8 b, g, r;
+            cv::v_load_deinterleave(bgr + 3 * x, b, g, r);
+            cv::v_uint16 b0, b1, g0, g1, r0, r1;
+            cv::v_expand(b, b0, b1);
+            cv::v_expand(g, g0, g1);
+            cv::v_expand(r, r0, r1);
+            cv::v_store(dst + x, cv::v_pack(tableLookup16(lut, gray16(b0, g0, r0)), tableLookup16(lut, gray16(b1, g1, r1))));
+        }
+        cv::vx_cleanup();
+#endif
+        for(; x < cols; x++) {
+            const uchar* p = bgr + 3 * x;
+            dst[x] = (uchar)lut[(p[0] * GRAY_B + p[1] * GRAY_G + p[2] * GRAY_R + (1 << (GRAY_SHIFT - 1))) >> GRAY_SHIFT];
+        }
+    }
+
+    enum { GRAY_SHIFT = 15, GRAY_B = 3735, GRAY_G = 19235, GRAY_R = 9798 };
+
+    bool toGray = false;
+    int stages = 0;
+    std::vector<std::vector<int>> segments;   //Fixed tables between equalize() stages
+};
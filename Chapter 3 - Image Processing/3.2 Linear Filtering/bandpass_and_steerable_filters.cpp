@@ -1,16 +1,273 @@
 #include <opencv2/opencv.hpp>
 #include <iostream>
+#include "derivative_filter_bank.hpp"
+#include "gradient_engine.hpp"
+#include "image_pyramid.hpp"
+#include "steerable_filters.hpp"
+#include "../../Tools/async_image_writer.hpp"
+#include "../../Tools/derived_image_cache.hpp"
 
 using namespace cv;
 using namespace std;
 
-int main() {
-    Mat img = imread("Pictures/truck.jpg", IMREAD_GRAYSCALE);
+/* Benchmark of the filter bank against the direct calls
+   1) Run the same ten Sobel/Laplacian calls the bank replaces, one full-image convolution each
+   2) Run the bank again on the same image, then once more with its specialised kernels turned off
+   3) Compare every output pair, with integer scale and delta they should be identical
+*/
+void benchmarkFilterBank(const Mat& img, const DerivativeFilterBank& bank, const vector<Mat>& responses) {
+    int64 start = getTickCount();
+    vector<Mat> direct(10);
+    profiled::Sobel(img, direct[0], CV_8UC1, 1, 1, 3, 1, 1);
+    profiled::Sobel(img, direct[1], CV_8UC1, 0, 1, 3, 1, 1);
+    profiled::Sobel(img, direct[2], CV_8UC1, 1, 0, 3, 1, 1);
+    profiled::Sobel(img, direct[3], CV_8UC1, 1, 1, 7, 1, 1);
+    profiled::Sobel(img, direct[4], CV_8UC1, 1, 1, 3, 5, 1);
+    profiled::Sobel(img, direct[5], CV_8UC1, 1, 1, 3, 1, 5);
+    profiled::Laplacian(img, direct[6], -1, 1, 1, 1);
+    profiled::Laplacian(img, direct[7], -1, 7, 1, 1);
+    profiled::Laplacian(img, direct[8], -1, 1, 5, 1);
+    profiled::Laplacian(img, direct[9], -1, 1, 1, 5);
+    double directMs = (getTickCount() - start) * 1000.0 / getTickFrequency();
+
+    vector<Mat> banked;
+    start = getTickCount();
+    bank.apply(img, banked);
+    double bankMs = (getTickCount() - start) * 1000.0 / getTickFrequency();
+
+    DerivativeFilterBank generic = bank;
+    generic.setFixedKernels(false);
+    vector<Mat> genericOutputs;
+    start = getTickCount();
+    generic.apply(img, genericOutputs);
+    double genericMs = (getTickCount() - start) * 1000.0 / getTickFrequency();
+    double genericDifference = 0;
+    for(size_t i = 0; i < banked.size(); i++) {
+        genericDifference = max(genericDifference, norm(banked[i], genericOutputs[i], NORM_INF));
+    }
+
+    cout << "Direct calls: " << directMs << " ms, filter bank: " << bankMs << " ms, speedup " << directMs / bankMs << "x" << endl;
+    cout << "Filter bank with generic kernels: " << genericMs << " ms, specialised kernels speedup " << genericMs / bankMs
+         << "x, max difference " << genericDifference << endl;
+    for(size_t i = 0; i < direct.size() && i < responses.size(); i++) {
+        cout << "Output " << i << " max difference " << norm(direct[i], responses[i], NORM_INF) << endl;
+    }
+}
+
+/* Benchmark of steering against brute-force rotated kernels
+   1) Brute force: build the rotated 2D kernel for each of the N angles and run filter2D once per angle
+   2) Steerable: compute the basis responses once and steer() to each of the N angles
+   3) Report both times and the largest difference between the two responses
+*/
+void benchmarkSteerable(const Mat& img, int order, double sigma, int angles) {
+    SteerableFilter filter(order, sigma);
+    Mat imgFloat;
+    img.convertTo(imgFloat, CV_32F);
+
+    int64 start = getTickCount();
+    vector<Mat> bruteForce(angles);
+    for(int i = 0; i < angles; i++) {
+        filter2D(imgFloat, bruteForce[i], CV_32F, filter.kernelAt(i * 180.0 / angles));
+    }
+    double bruteForceMs = (getTickCount() - start) * 1000.0 / getTickFrequency();
+
+    start = getTickCount();
+    vector<Mat> steered(angles);
+    filter.compute(img);
+    for(int i = 0; i < angles; i++) {
+        filter.steer(i * 180.0 / angles, steered[i]);
+    }
+    double steeredMs = (getTickCount() - start) * 1000.0 / getTickFrequency();
+
+    double maxDifference = 0;
+    for(int i = 0; i < angles; i++) {
+        maxDifference = max(maxDifference, norm(bruteForce[i], steered[i], NORM_INF));
+    }
+    cout << "Order " << order << " steerable filter, " << angles << " angles, " << filter.kernelSize() << "x" << filter.kernelSize()
+         << " kernel: brute force " << bruteForceMs << " ms, steered " << steeredMs << " ms, speedup " << bruteForceMs / steeredMs
+         << "x, max difference " << maxDifference << endl;
+}
+
+/* Benchmark of the pyramid object against pyrDown/pyrUp chains
+   1) Feed the same frame to one ImagePyramid repeatedly, like a video loop, building every Gaussian and Laplacian level
+   2) Build the same levels the usual way: pyrDown per level, then pyrUp and subtract per level
+   3) Report both times, how often the arena was allocated and whether the Gaussian levels match pyrDown
+*/
+void benchmarkPyramid(const Mat& img, int levels, int frames) {
+    ImagePyramid pyramid(levels);
+    int64 start = getTickCount();
+    for(int frame = 0; frame < frames; frame++) {
+        pyramid.setImage(img);
+        for(int level = 0; level < levels - 1; level++) {
+            pyramid.laplacian(level);
+        }
+    }
+    double pyramidMs = (getTickCount() - start) * 1000.0 / getTickFrequency() / frames;
+
+    vector<Mat> gaussian(levels), laplacian(levels - 1);
+    start = getTickCount();
+    for(int frame = 0; frame < frames; frame++) {
+        gaussian[0] = img;
+        for(int level = 1; level < levels; level++) {
+            profiled::pyrDown(gaussian[level - 1], gaussian[level]);
+        }
+        for(int level = 0; level < levels - 1; level++) {
+            Mat expanded;
+            profiled::pyrUp(gaussian[level + 1], expanded, gaussian[level].size());
+            subtract(gaussian[level], expanded, laplacian[level], noArray(), CV_16S);
+        }
+    }
+    double chainMs = (getTickCount() - start) * 1000.0 / getTickFrequency() / frames;
+
+    bool identical = true;
+    for(int level = 1; level < levels; level++) {
+        identical = identical && norm(gaussian[level], pyramid.gaussian(level), NORM_INF) == 0;
+    }
+    cout << levels << " level pyramid, " << frames << " frames: pyrDown/pyrUp " << chainMs << " ms/frame, pyramid object "
+         << pyramidMs << " ms/frame, speedup " << chainMs / pyramidMs << "x, " << pyramid.arenaAllocations()
+         << " arena allocation(s) of " << pyramid.arenaBytes() / 1024 << " KB, Gaussian levels "
+         << (identical ? "identical" : "different") << endl;
+}
+
+/* Benchmark of the fused gradient pass against the separate calls
+   1) The usual chain: Sobel dx and dy into CV_16S, convert both to float for magnitude() and phase(), quantise the
+      angle into bins and convertScaleAbs the magnitude for display, every step another pass over full images
+   2) One GradientEngine::compute() with L2 magnitude, 9 orientation bins and the visualisation
+   3) dx and dy must be identical, the magnitude and bins are compared against the chain
+*/
+void benchmarkGradients(const Mat& img, int frames) {
+    GradientOptions options;
+    options.magnitude = GRADIENT_L2;
+    options.orientationBins = 9;
+    options.visualize = true;
+    GradientEngine engine(options);
+    GradientOutputs fused;
+    Mat dx, dy, dxFloat, dyFloat, magnitudes, angles, bins, visual;
+
+    auto chain = [&] {
+        profiled::Sobel(img, dx, CV_16S, 1, 0, 3);
+        profiled::Sobel(img, dy, CV_16S, 0, 1, 3);
+        dx.convertTo(dxFloat, CV_32F);
+        dy.convertTo(dyFloat, CV_32F);
+        magnitude(dxFloat, dyFloat, magnitudes);
+        phase(dxFloat, dyFloat, angles, true);
+        bins.create(img.size(), CV_8U);
+        for(int y = 0; y < img.rows; y++) {
+            for(int x = 0; x < img.cols; x++) {
+                float angle = angles.at<float>(y, x);
+                bins.at<uchar>(y, x) = (uchar)min((int)((angle >= 180 ? angle - 180 : angle) * 9 / 180), 8);
+            }
+        }
+        convertScaleAbs(magnitudes, visual, options.visualScale);
+    };
+
+    chain();
+    engine.compute(img, fused);
+    int64 start = getTickCount();
+    for(int frame = 0; frame < frames; frame++) {
+        chain();
+    }
+    double chainMs = (getTickCount() - start) * 1000.0 / getTickFrequency() / frames;
+    start = getTickCount();
+    for(int frame = 0; frame < frames; frame++) {
+        engine.compute(img, fused);
+    }
+    double fusedMs = (getTickCount() - start) * 1000.0 / getTickFrequency() / frames;
+
+    int sameBins = 0;
+    for(int y = 0; y < img.rows; y++) {
+        for(int x = 0; x < img.cols; x++) {
+            sameBins += bins.at<uchar>(y, x) == fused.orientation.at<uchar>(y, x);
+        }
+    }
+    cout << "Gradients, " << frames << " frames: separate calls " << chainMs << " ms/frame, fused " << fusedMs
+         << " ms/frame, speedup " << chainMs / fusedMs << "x, dx/dy difference " << max(norm(dx, fused.dx, NORM_INF), norm(dy, fused.dy, NORM_INF))
+         << ", magnitude difference " << norm(magnitudes, fused.magnitude, NORM_INF) << ", same orientation bin "
+         << 100.0 * sameBins / img.total() << "%, visualisation difference " << norm(visual, fused.visual, NORM_INF) << endl;
+}
+
+/* Benchmark of the output formats
+   Writes the same images synchronously with imwrite (default PNG settings) and through the background writer with
+   fast PNG, PNM and a single container. For the writer, "blocked" is how long the caller spent queueing, the rest of
+   the time until wait() returned overlapped with whatever the caller does next.
+*/
+void benchmarkWriter(const vector<Mat>& images) {
+    int64 start = getTickCount();
+    for(size_t i = 0; i < images.size(); i++) {
+        profiled::imwrite("Pictures/benchmark_" + to_string(i) + "_img.png", images[i]);
+    }
+    cout << "Synchronous imwrite: " << (getTickCount() - start) * 1000.0 / getTickFrequency() << " ms" << endl;
+
+    const char* names[] = {"PNG level 1", "PNM", "container"};
+    for(int format = OUTPUT_PNG; format <= OUTPUT_CONTAINER; format++) {
+        AsyncImageWriter writer;
+        writer.setFormat((ImageOutputFormat)format, "Pictures/benchmark_outputs.imc");
+        writer.setPngCompression(1);
+        start = getTickCount();
+        for(size_t i = 0; i < images.size(); i++) {
+            writer.write("Pictures/benchmark_" + to_string(i) + "_img.png", images[i]);
+        }
+        double blockedMs = (getTickCount() - start) * 1000.0 / getTickFrequency();
+        writer.wait();
+        double totalMs = (getTickCount() - start) * 1000.0 / getTickFrequency();
+        cout << "Background writer, " << names[format] << ": blocked " << blockedMs << " ms, written after " << totalMs << " ms" << endl;
+    }
+
+    //The benchmark files are only timed, none of them is kept
+    for(size_t i = 0; i < images.size(); i++) {
+        const string filename = "Pictures/benchmark_" + to_string(i) + "_img.png";
+        remove(filename.c_str());
+        remove(AsyncImageWriter::pnmName(filename, images[i].channels()).c_str());
+    }
+    remove("Pictures/benchmark_outputs.imc");
+}
+
+int main(int argc, char** argv) {
+    //Decoded through the cache, IMAGE_CACHE=<dir> keeps it and the pyramid below between runs
+    DerivedImageCache& cache = DerivedImageCache::shared();
+    Mat img = cache.imread("Pictures/truck.jpg", IMREAD_GRAYSCALE);
     if(img.empty()) {
         cout << "Failed to read image" << endl;
         return 1;
     }
 
+    /* Output writer
+       The outputs are queued to background writer threads instead of being PNG-compressed one after the other on this
+       thread. --format pnm writes uncompressed .pgm files instead, --format container puts every output in the single
+       uncompressed file Pictures/bandpass_outputs.imc, --compression sets the PNG level (0-9).
+    */
+    bool benchmark = false;
+    AsyncImageWriter writer;
+    for(int i = 1; i < argc; i++) {
+        string option = argv[i];
+        if(option == "--benchmark") {
+            benchmark = true;
+        }
+        else if(option == "--format" && i + 1 < argc) {
+            string format = argv[++i];
+            if(format == "pnm") {
+                writer.setFormat(OUTPUT_PNM);
+            }
+            else if(format == "container") {
+                writer.setFormat(OUTPUT_CONTAINER, "Pictures/bandpass_outputs.imc");
+            }
+            else if(format != "png") {
+                cout << "Unknown format " << format << ", expected png, pnm or container" << endl;
+                return 1;
+            }
+        }
+        else if(option == "--compression" && i + 1 < argc) {
+            writer.setPngCompression(atoi(argv[++i]));
+        }
+    }
+
+    /* Derivative filter bank
+       All of the Sobel and Laplacian variants below convolve the same image with only a handful of distinct kernels, scale
+       and delta are just applied afterwards. Instead of one full-image convolution per output, every output is registered
+       with the bank (same arguments as Sobel/Laplacian) and apply() computes each distinct kernel once.
+    */
+    DerivativeFilterBank bank;
+
     /* Sobel operator
        Combine Gaussian smoothing and differentiation, so the result is more or less resistant to the noise.
        Calculates output image derivative by convolving image with appropriate kernel:
@@ -21,34 +278,22 @@ int main() {
                                      [-1, 0, 1]]       [ 1,  2,  1]]
        Sobel(src Mat, output Mat, output depth, dx, dy, kernel size, scale factor, delta value)
     */
-    Mat sobel_img;
-    Sobel(img, sobel_img, CV_8UC1, 1, 1, 3, 1, 1);
-    imwrite("Pictures/sobel_img.png", sobel_img);
+    int sobel = bank.add(DerivativeRequest::sobel(1, 1, 3, 1, 1));
 
     // dx=0, so the output will show horizontal lines
-    Mat dx_sobel_img;
-    Sobel(img, dx_sobel_img, CV_8UC1, 0, 1, 3, 1, 1);
-    imwrite("Pictures/dx_sobel_img.png", dx_sobel_img);
+    int dx_sobel = bank.add(DerivativeRequest::sobel(0, 1, 3, 1, 1));
 
     // dy=0, so the output will show vertical lines
-    Mat dy_sobel_img;
-    Sobel(img, dy_sobel_img, CV_8UC1, 1, 0, 3, 1, 1);
-    imwrite("Pictures/dy_sobel_img.png", dy_sobel_img);
+    int dy_sobel = bank.add(DerivativeRequest::sobel(1, 0, 3, 1, 1));
 
     // Kernel size is optimal at 3 but can be 1, 3, 5, 7, and so on. Higher the size, the more textured, jagged, and noisy output.
-    Mat kernel_sobel_img;
-    Sobel(img, kernel_sobel_img, CV_8UC1, 1, 1, 7, 1, 1);
-    imwrite("Pictures/kernel_sobel_img.png", kernel_sobel_img);
+    int kernel_sobel = bank.add(DerivativeRequest::sobel(1, 1, 7, 1, 1));
 
     // Increasing scale factor makes the approximately non-0 (non-black) RGB values brighter
-    Mat scale_sobel_img;
-    Sobel(img, scale_sobel_img, CV_8UC1, 1, 1, 3, 5, 1);
-    imwrite("Pictures/scale_sobel_img.png", scale_sobel_img);
+    int scale_sobel = bank.add(DerivativeRequest::sobel(1, 1, 3, 5, 1));
 
     // Increasing delta value makes the approximately non-255 (non-white) RGB values brighter
-    Mat delta_sobel_img;
-    Sobel(img, delta_sobel_img, CV_8UC1, 1, 1, 3, 1, 5);
-    imwrite("Pictures/delta_sobel_img.png", delta_sobel_img);
+    int delta_sobel = bank.add(DerivativeRequest::sobel(1, 1, 3, 1, 5));
 
 
     /* Laplacian operator
@@ -60,24 +305,82 @@ int main() {
         [0, 1, 0]]
        Laplacian(src Mat, output Mat, output depth, kernel size, scale factor, delta value)
     */
-    Mat laplacian_img;
-    Laplacian(img, laplacian_img, -1, 1, 1, 1);
-    imwrite("Pictures/laplacian_img.png", laplacian_img);
+    int laplacian = bank.add(DerivativeRequest::laplacian(1, 1, 1));
 
     // Kernel size is optimal at 3 but can be 1, 3, 5, 7, and so on. Higher the size, the more textured, jagged, and noisy output.
-    Mat kernel_laplacian_img;
-    Laplacian(img, kernel_laplacian_img, -1, 7, 1, 1);
-    imwrite("Pictures/kernel_laplacian_img.png", kernel_laplacian_img);
+    int kernel_laplacian = bank.add(DerivativeRequest::laplacian(7, 1, 1));
 
     // Increasing scale factor makes the approximately non-0 (non-black) RGB values brighter
-    Mat scale_laplacian_img;
-    Laplacian(img, scale_laplacian_img, -1, 1, 5, 1);
-    imwrite("Pictures/scale_laplacian_img.png", scale_laplacian_img);
+    int scale_laplacian = bank.add(DerivativeRequest::laplacian(1, 5, 1));
 
     // Increasing delta value makes the approximately non-255 (non-white) RGB values brighter
-    Mat delta_laplacian_img;
-    Laplacian(img, delta_laplacian_img, -1, 1, 1, 5);
-    imwrite("Pictures/delta_laplacian_img.png", delta_laplacian_img);
+    int delta_laplacian = bank.add(DerivativeRequest::laplacian(1, 1, 5));
+
+    vector<Mat> responses;
+    bank.apply(img, responses);
+    cout << bank.outputCount() << " Sobel/Laplacian outputs from " << bank.distinctKernels() << " distinct kernels" << endl;
+    writer.write("Pictures/sobel_img.png", responses[sobel]);
+    writer.write("Pictures/dx_sobel_img.png", responses[dx_sobel]);
+    writer.write("Pictures/dy_sobel_img.png", responses[dy_sobel]);
+    writer.write("Pictures/kernel_sobel_img.png", responses[kernel_sobel]);
+    writer.write("Pictures/scale_sobel_img.png", responses[scale_sobel]);
+    writer.write("Pictures/delta_sobel_img.png", responses[delta_sobel]);
+    writer.write("Pictures/laplacian_img.png", responses[laplacian]);
+    writer.write("Pictures/kernel_laplacian_img.png", responses[kernel_laplacian]);
+    writer.write("Pictures/scale_laplacian_img.png", responses[scale_laplacian]);
+    writer.write("Pictures/delta_laplacian_img.png", responses[delta_laplacian]);
+
+    /* Signed gradients
+       The Sobel outputs above are clipped to 8 bits, so every negative derivative is lost. GradientEngine keeps dx and dy
+       in int16 and, in the same pass over the image, adds the magnitude, a quantised orientation and an 8-bit view of
+       the magnitude, which is everything an edge detector or a HOG descriptor needs.
+       Orientation bins are scaled to [0, 255] here only to make them visible.
+    */
+    GradientOptions gradientOptions;
+    gradientOptions.magnitude = GRADIENT_L2;
+    gradientOptions.orientationBins = 9;
+    gradientOptions.visualize = true;
+    GradientOutputs gradients;
+    GradientEngine(gradientOptions).compute(img, gradients);
+    Mat gradientOrientation_img;
+    gradients.orientation.convertTo(gradientOrientation_img, CV_8U, 255.0 / (gradientOptions.orientationBins - 1));
+    writer.write("Pictures/gradientMagnitude_img.png", gradients.visual);
+    writer.write("Pictures/gradientOrientation_img.png", gradientOrientation_img);
+
+
+
+    /* Steerable filters
+       A directional derivative of a Gaussian at any angle is a weighted sum of a few basis filters (Gx and Gy for the first
+       derivative, Gxx, Gxy and Gyy for the second), so the basis responses are computed once and the response at any
+       angle is cheap. The dominant orientation and its strength at every pixel also follow in closed form from the basis.
+       SteerableFilter(derivative order, sigma), compute(src Mat), steer(angle, output Mat), dominantOrientation(angle Mat, strength Mat)
+    */
+    SteerableFilter firstOrder(1, 2.0);
+    firstOrder.compute(img);
+    Mat steered_img;
+    firstOrder.steer(45, steered_img);
+    normalize(steered_img, steered_img, 0, 255, NORM_MINMAX, CV_8U);
+    writer.write("Pictures/steered_img.png", steered_img);
+
+    // Orientation is scaled from [0, 180) degrees to [0, 255], strength is stretched to the full 8-bit range
+    SteerableFilter secondOrder(2, 2.0);
+    secondOrder.compute(img);
+    Mat orientation_img, orientationStrength_img;
+    secondOrder.dominantOrientation(orientation_img, orientationStrength_img);
+    orientation_img.convertTo(orientation_img, CV_8U, 255.0 / 180.0);
+    normalize(orientationStrength_img, orientationStrength_img, 0, 255, NORM_MINMAX, CV_8U);
+    writer.write("Pictures/orientation_img.png", orientation_img);
+    writer.write("Pictures/orientationStrength_img.png", orientationStrength_img);
+
+    //Run with --benchmark to time the filter bank, the steerable filters, the pyramid and the writer against their direct versions
+    if(benchmark) {
+        benchmarkFilterBank(img, bank, responses);
+        benchmarkGradients(img, 30);
+        benchmarkSteerable(img, 1, 2.0, 16);
+        benchmarkSteerable(img, 2, 2.0, 16);
+        benchmarkPyramid(img, 5, 30);
+        benchmarkWriter(responses);
+    }
 
 
     /* Gaussian Pyramid
@@ -87,26 +390,53 @@ int main() {
       It is called an Octave. The same pattern continues as we go upper in pyramid (ie, resolution decreases). Similarly while 
       expanding, area becomes 4 times in each level. We can find Gaussian pyramids using cv.pyrDown() and cv.pyrUp() functions.
     */
-    Mat lowerRes_img;
-    pyrDown(img, lowerRes_img);
-    pyrDown(lowerRes_img, lowerRes_img);
-    pyrDown(lowerRes_img, lowerRes_img);
-    pyrDown(lowerRes_img, lowerRes_img);
-    imwrite("Pictures/lowerRes_img.png", lowerRes_img);
+    // All five levels live in one preallocated arena and are only computed when asked for, level 4 builds levels 1-4.
+    // The levels kept below and the reconstruction are one cache entry: lowerRes_img, laplacianPyramid0-3_img, reconstructed_img
+    NamedImages pyramidLevels = cache.get(vector<Mat>(1, img), "pyramid levels=5 laplacian=8u+128 reconstruct", [&](NamedImages& out) {
+        ImagePyramid pyramid(5);
+        pyramid.setImage(img);
+        out.push_back(make_pair(string("lowerRes_img"), pyramid.gaussian(4).clone()));
+
+        /* Laplacian Pyramid
+           Laplacian Pyramids are formed from the Gaussian Pyramids. There is no exclusive function for that. Laplacian pyramid images are 
+           like edge images only. Most of its elements are zeros. They are used in image compression. A level in Laplacian Pyramid is formed 
+           by the difference between that level in Gaussian Pyramid and expanded version of its upper level in Gaussian Pyramid.
+           The pyramid object already built these levels in the same pass as the downsampling above. They are signed, so 128 is
+           added to show them as 8-bit images. Adding the levels back up from the coarsest level reconstructs the original image.
+        */
+        for(int level = 0; level < pyramid.levels() - 1; level++) {
+            Mat laplacianPyramid_img;
+            pyramid.laplacian(level).convertTo(laplacianPyramid_img, CV_8U, 1, 128);
+            out.push_back(make_pair("laplacianPyramid" + to_string(level) + "_img", laplacianPyramid_img));
+        }
+
+        Mat reconstructed_img;
+        pyramid.reconstruct(reconstructed_img);
+        out.push_back(make_pair(string("reconstructed_img"), reconstructed_img));
+    });
+    Mat lowerRes_img = pyramidLevels.front().second;
+    writer.write("Pictures/lowerRes_img.png", lowerRes_img);
 
     Mat higherRes_img;
-    pyrUp(lowerRes_img, higherRes_img);
-    pyrUp(higherRes_img, higherRes_img);
-    pyrUp(higherRes_img, higherRes_img);
-    pyrUp(higherRes_img, higherRes_img);
-    imwrite("Pictures/higherRes_img.png", higherRes_img);
-
-    /* Laplacian Pyramid
-       Laplacian Pyramids are formed from the Gaussian Pyramids. There is no exclusive function for that. Laplacian pyramid images are 
-       like edge images only. Most of its elements are zeros. They are used in image compression. A level in Laplacian Pyramid is formed 
-       by the difference between that level in Gaussian Pyramid and expanded version of its upper level in Gaussian Pyramid.
-    */
-    
+    profiled::pyrUp(lowerRes_img, higherRes_img);
+    profiled::pyrUp(higherRes_img, higherRes_img);
+    profiled::pyrUp(higherRes_img, higherRes_img);
+    profiled::pyrUp(higherRes_img, higherRes_img);
+    writer.write("Pictures/higherRes_img.png", higherRes_img);
+
+    for(size_t i = 1; i + 1 < pyramidLevels.size(); i++) {
+        writer.write("Pictures/" + pyramidLevels[i].first + ".png", pyramidLevels[i].second);
+    }
+
+    Mat reconstructed_img = pyramidLevels.back().second;
+    cout << "Laplacian pyramid reconstruction " << (norm(img, reconstructed_img, NORM_INF) == 0 ? "matches" : "differs from")
+         << " the original image" << endl;
+
+    //Every queued output has to be on disk before the program exits
+    if(!writer.wait()) {
+        cout << "Failed to write the outputs" << endl;
+        return 1;
+    }
 
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,331 @@
+#pragma once
+
+#include <opencv2/core.hpp>
+#include <opencv2/core/hal/intrin.hpp>
+#include <algorithm>
+#include <climits>
+#include <cstdlib>
+#include <vector>
+#include "fixed_kernels.hpp"
+#include "../../Tools/profiler.hpp"
+
+/* One requested output of the filter bank, mirroring the arguments of Sobel and Laplacian:
+   dst = saturate(scale * raw + delta), where raw is the integer derivative response of the image.
+   Several requests that only differ in scale, delta or output depth share the same raw response.
+*/
+struct DerivativeRequest {
+    bool isLaplacian = false;
+    int dx = 0, dy = 0;
+    int ksize = 3;
+    double scale = 1, delta = 0;
+    int ddepth = CV_8U;
+
+    static DerivativeRequest sobel(int dx, int dy, int ksize = 3, double scale = 1, double delta = 0, int ddepth = CV_8U) {
+        DerivativeRequest request;
+        request.dx = dx;
+        request.dy = dy;
+        request.ksize = ksize;
+        request.scale = scale;
+        request.delta = delta;
+        request.ddepth = ddepth;
+        return request;
+    }
+
+    static DerivativeRequest laplacian(int ksize = 1, double scale = 1, double delta = 0, int ddepth = CV_8U) {
+        DerivativeRequest request = sobel(0, 0, ksize, scale, delta, ddepth);
+        request.isLaplacian = true;
+        return request;
+    }
+};
+
+/* Integer 1D Sobel kernel of the given derivative order, built the same way as getDerivKernels:
+   1) Start from [1] and convolve with [1, 1] (smoothing) ksize - order - 1 times
+   2) Convolve with [-1, 1] (differencing) order times
+   ksize 3 is the familiar [1, 2, 1], [-1, 0, 1] and [1, -2, 1].
+*/
+inline std::vector<int> sobelKernel1D(int order, int ksize) {
+    CV_Assert(ksize % 2 == 1 && ksize > order);
+    std::vector<int> kernel(ksize + 1, 0);
+    kernel[0] = 1;
+    for(int i = 0; i < ksize - order - 1; i++) {
+        int oldValue = kernel[0];
+        for(int j = 1; j <= ksize; j++) {
+            int newValue = kernel[j] + kernel[j - 1];
+            kernel[j - 1] = oldValue;
+            oldValue = newValue;
+        }
+    }
+    for(int i = 0; i < order; i++) {
+        int oldValue = -kernel[0];
+        for(int j = 1; j <= ksize; j++) {
+            int newValue = kernel[j - 1] - kernel[j];
+            kernel[j - 1] = oldValue;
+            oldValue = newValue;
+        }
+    }
+    kernel.resize(ksize);
+    return kernel;
+}
+
+/* A raw response is a sum of separable terms (kx along X, ky along Y):
+   Sobel(dx, dy) is one term, Laplacian is d2/dx2 + d2/dy2, two terms. ksize 1 Laplacian is the 3x3
+   [[0, 1, 0], [1, -4, 1], [0, 1, 0]] kernel, which splits into [1, -2, 1] x [1] + [1] x [1, -2, 1].
+*/
+struct SeparableTerm {
+    std::vector<int> kx, ky;
+    bool operator==(const SeparableTerm& other) const { return kx == other.kx && ky == other.ky; }
+};
+
+inline std::vector<SeparableTerm> derivativeTerms(const DerivativeRequest& request) {
+    std::vector<SeparableTerm> terms;
+    if(request.isLaplacian) {
+        if(request.ksize == 1) {
+            terms.push_back({sobelKernel1D(2, 3), {1}});
+            terms.push_back({{1}, sobelKernel1D(2, 3)});
+        }
+        else {
+            terms.push_back({sobelKernel1D(2, request.ksize), sobelKernel1D(0, request.ksize)});
+            terms.push_back({sobelKernel1D(0, request.ksize), sobelKernel1D(2, request.ksize)});
+        }
+        return terms;
+    }
+    //Like Sobel, ksize 1 means a 3-tap derivative with no smoothing in the other direction
+    int ksizeX = request.ksize == 1 && request.dx > 0 ? 3 : request.ksize;
+    int ksizeY = request.ksize == 1 && request.dy > 0 ? 3 : request.ksize;
+    terms.push_back({sobelKernel1D(request.dx, ksizeX), sobelKernel1D(request.dy, ksizeY)});
+    return terms;
+}
+
+/* Multi-output derivative filter bank
+   Sobel and Laplacian with different scale and delta all convolve the image with the same few kernels. The bank
+   collects every requested output, then in one call:
+   1) Deduplicates the requests by their actual kernels, so each distinct raw derivative is convolved once
+   2) Splits the image into bands of rows across threads, each band is copied once with its border (BORDER_REFLECT_101)
+      and stays in cache while every raw response is computed from it
+   3) Computes a raw row in int32 (vertical pass in 16-bit SIMD lanes, horizontal pass in 32-bit lanes) and immediately
+      writes every output that uses it through its scale/delta/saturate stage
+   4) Runs each pass through its compile-time specialisation from fixed_kernels.hpp when the kernel has one (every
+      Sobel/Laplacian kernel up to second order does), the horizontal pass in 16-bit lanes when the response fits
+   With integer scale and delta the 8-bit outputs are identical to calling Sobel/Laplacian directly. Kernels are limited
+   to ksize <= 7 so the vertical pass fits in 16 bits.
+*/
+class DerivativeFilterBank {
+public:
+    //Returns the index of this output in the vector filled by apply()
+    int add(const DerivativeRequest& request) {
+        CV_Assert(request.ksize >= 1 && request.ksize <= 7 && request.ksize % 2 == 1);
+        CV_Assert(request.ddepth == CV_8U || request.ddepth == CV_16S || request.ddepth == CV_32F);
+        std::vector<SeparableTerm> terms = derivativeTerms(request);
+        int raw = 0;
+        while(raw < (int)rawTerms.size() && !(rawTerms[raw] == terms)) {
+            raw++;
+        }
+        if(raw == (int)rawTerms.size()) {
+            rawTerms.push_back(terms);
+            rawPasses.push_back(fixedPasses(terms));
+        }
+        for(const auto& term : terms) {
+            radius = std::max(radius, (int)std::max(term.kx.size(), term.ky.size()) / 2);
+        }
+        requests.push_back(request);
+        rawIndex.push_back(raw);
+        return (int)requests.size() - 1;
+    }
+
+    int outputCount() const { return (int)requests.size(); }
+    int distinctKernels() const { return (int)rawTerms.size(); }
+
+    //false runs every kernel through the generic loops, for comparison, the outputs are the same
+    void setFixedKernels(bool enabled) { fixedKernels = enabled; }
+
+    void apply(const cv::Mat& src, std::vector<cv::Mat>& outputs) const {
+        PROFILE_SCOPE("DerivativeFilterBank::apply", src);
+        CV_Assert(src.depth() == CV_8U && !src.empty());
+        const int cn = src.channels(), rows = src.rows, cols = src.cols, rowLen = cols * cn;
+        const int paddedLen = (cols + 2 * radius) * cn;
+        outputs.resize(requests.size());
+        for(size_t i = 0; i < requests.size(); i++) {
+            outputs[i].create(src.size(), CV_MAKETYPE(requests[i].ddepth, cn));
+        }
+
+        const int bandRows = std::max(16, rows / std::max(1, cv::getNumThreads() * 4));
+        const int bands = (rows + bandRows - 1) / bandRows;
+        cv::parallel_for_(cv::Range(0, bands), [&](const cv::Range& range) {
+            std::vector<uchar> band((size_t)(bandRows + 2 * radius) * paddedLen);
+            std::vector<short> vertical(paddedLen);
+            std::vector<int> raw(rowLen);
+
+            for(int b = range.start; b < range.end; b++) {
+                const int y0 = b * bandRows, y1 = std::min(rows, y0 + bandRows);
+                copyBand(src, y0 - radius, y1 + radius, band.data(), paddedLen);
+
+                for(size_t r = 0; r < rawTerms.size(); r++) {
+                    for(int y = y0; y < y1; y++) {
+                        std::fill(raw.begin(), raw.end(), 0);
+                        for(size_t t = 0; t < rawTerms[r].size(); t++) {
+                            //Row y of the image is row (y - y0 + radius) of the band
+                            const SeparableTerm& term = rawTerms[r][t];
+                            const FixedPasses& fixed = rawPasses[r][t];
+                            const int ry = (int)term.ky.size() / 2, rx = (int)term.kx.size() / 2;
+                            const uchar* top = band.data() + (size_t)(y - y0 + radius - ry) * paddedLen;
+                            const short* in = vertical.data() + (radius - rx) * cn;
+                            if(fixedKernels && fixed.vertical) {
+                                fixed.vertical(top, paddedLen, vertical.data(), paddedLen);
+                            }
+                            else {
+                                verticalPass(top, paddedLen, term.ky, vertical.data(), paddedLen);
+                            }
+                            if(fixedKernels && fixed.horizontal) {
+                                fixed.horizontal(in, cn, raw.data(), rowLen);
+                            }
+                            else {
+                                horizontalPass(in, cn, term.kx, raw.data(), rowLen);
+                            }
+                        }
+                        for(size_t i = 0; i < requests.size(); i++) {
+                            if(rawIndex[i] == (int)r) {
+                                outputStage(raw.data(), requests[i], outputs[i].ptr(y), rowLen);
+                            }
+                        }
+                    }
+                }
+            }
+        });
+    }
+
+private:
+    //Specialised passes of one term, nullptr where the kernel has none
+    struct FixedPasses {
+        FixedVerticalFn vertical = nullptr;
+        FixedHorizontalFn horizontal = nullptr;
+    };
+
+    static int absoluteSum(const std::vector<int>& kernel) {
+        int sum = 0;
+        for(int k : kernel) {
+            sum += std::abs(k);
+        }
+        return sum;
+    }
+
+    //The horizontal pass can stay in 16 bits when no 8-bit input can push the term past 255 * sum|ky| * sum|kx|
+    static std::vector<FixedPasses> fixedPasses(const std::vector<SeparableTerm>& terms) {
+        std::vector<FixedPasses> passes(terms.size());
+        for(size_t t = 0; t < terms.size(); t++) {
+            const FixedDerivativeKernel* fy = findFixedDerivativeKernel(terms[t].ky);
+            const FixedDerivativeKernel* fx = findFixedDerivativeKernel(terms[t].kx);
+            const bool narrow = 255 * absoluteSum(terms[t].ky) * absoluteSum(terms[t].kx) <= SHRT_MAX;
+            passes[t].vertical = fy ? fy->vertical : nullptr;
+            passes[t].horizontal = fx ? (narrow ? fx->narrow : fx->wide) : nullptr;
+        }
+        return passes;
+    }
+
+    //Copies image rows [first, last) with a radius-wide border on every side into a contiguous band
+    void copyBand(const cv::Mat& src, int first, int last, uchar* band, int paddedLen) const {
+        const int cn = src.channels(), cols = src.cols;
+        for(int y = first; y < last; y++) {
+            const uchar* row = src.ptr<uchar>(cv::borderInterpolate(y, src.rows, cv::BORDER_REFLECT_101));
+            uchar* out = band + (size_t)(y - first) * paddedLen;
+            std::copy(row, row + cols * cn, out + radius * cn);
+            for(int p = 1; p <= radius; p++) {
+                const uchar* left = row + cv::borderInterpolate(-p, cols, cv::BORDER_REFLECT_101) * cn;
+                const uchar* right = row + cv::borderInterpolate(cols - 1 + p, cols, cv::BORDER_REFLECT_101) * cn;
+                std::copy(left, left + cn, out + (radius - p) * cn);
+                std::copy(right, right + cn, out + (radius + cols - 1 + p) * cn);
+            }
+        }
+    }
+
+    //out[i] = sum_j ky[j] * row_j[i], rows are paddedLen apart
+    static void verticalPass(const uchar* top, int rowStep, const std::vector<int>& ky, short* out, int len) {
+        int i = 0;
+#if (CV_SIMD || CV_SIMD_SCALABLE)
+        const int lanes = cv::VTraits<cv::v_int16>::vlanes();
+        for(; i <= len - lanes; i += lanes) {
+            cv::v_int16 acc = cv::vx_setzero_s16();
+            for(size_t j = 0; j < ky.size(); j++) {
+                if(ky[j] != 0) {
+                    cv::v_int16 pixels = cv::v_reinterpret_as_s16(cv::vx_load_expand(top + j * rowStep + i));
+                    acc = cv::v_add_wrap(acc, cv::v_mul_wrap(pixels, cv::vx_setall_s16((short)ky[j])));
+                }
+            }
+            cv::v_store(out + i, acc);
+        }
+        cv::vx_cleanup();
+#endif
+        for(; i < len; i++) {
+            int acc = 0;
+            for(size_t j = 0; j < ky.size(); j++) {
+                acc += ky[j] * top[j * rowStep + i];
+            }
+            out[i] = (short)acc;
+        }
+    }
+
+    //raw[i] += sum_j kx[j] * in[i + j*cn]
+    static void horizontalPass(const short* in, int cn, const std::vector<int>& kx, int* raw, int len) {
+        int i = 0;
+#if (CV_SIMD || CV_SIMD_SCALABLE)
+        const int lanes = cv::VTraits<cv::v_int32>::vlanes();
+        for(; i <= len - lanes; i += lanes) {
+            cv::v_int32 acc = cv::vx_load(raw + i);
+            for(size_t j = 0; j < kx.size(); j++) {
+                if(kx[j] != 0) {
+                    acc = cv::v_add(acc, cv::v_mul(cv::vx_load_expand(in + i + j * cn), cv::vx_setall_s32(kx[j])));
+                }
+            }
+            cv::v_store(raw + i, acc);
+        }
+        cv::vx_cleanup();
+#endif
+        for(; i < len; i++) {
+            int acc = raw[i];
+            for(size_t j = 0; j < kx.size(); j++) {
+                acc += kx[j] * in[i + j * cn];
+            }
+            raw[i] = acc;
+        }
+    }
+
+    //dst = saturate(scale * raw + delta), rounded to nearest like saturate_cast
+    static void outputStage(const int* raw, const DerivativeRequest& request, uchar* dst, int len) {
+        const float scale = (float)request.scale, delta = (float)request.delta;
+        int i = 0;
+        if(request.ddepth == CV_8U) {
+            uchar* out = dst;
+#if (CV_SIMD || CV_SIMD_SCALABLE)
+            const int lanes = cv::VTraits<cv::v_int32>::vlanes();
+            const cv::v_float32 vscale = cv::vx_setall_f32(scale), vdelta = cv::vx_setall_f32(delta);
+            for(; i <= len - 2 * lanes; i += 2 * lanes) {
+                cv::v_int32 low = cv::v_round(cv::v_fma(cv::v_cvt_f32(cv::vx_load(raw + i)), vscale, vdelta));
+                cv::v_int32 high = cv::v_round(cv::v_fma(cv::v_cvt_f32(cv::vx_load(raw + i + lanes)), vscale, vdelta));
+                cv::v_pack_u_store(out + i, cv::v_pack(low, high));
+            }
+            cv::vx_cleanup();
+#endif
+            for(; i < len; i++) {
+                out[i] = cv::saturate_cast<uchar>(raw[i] * scale + delta);
+            }
+        }
+        else if(request.ddepth == CV_16S) {
+            short* out = reinterpret_cast<short*>(dst);
+            for(; i < len; i++) {
+                out[i] = cv::saturate_cast<short>(raw[i] * scale + delta);
+            }
+        }
+        else {
+            float* out = reinterpret_cast<float*>(dst);
+            for(; i < len; i++) {
+                out[i] = raw[i] * scale + delta;
+            }
+        }
+    }
+
+    std::vector<DerivativeRequest> requests;
+    std::vector<int> rawIndex;
+    std::vector<std::vector<SeparableTerm>> rawTerms;
+    std::vector<std::vector<FixedPasses>> rawPasses;
+    int radius = 0;
+    bool fixedKernels = true;
+};
@@ -0,0 +1,237 @@
+#pragma once
+
+#include <opencv2/core.hpp>
+#include <opencv2/core/hal/intrin.hpp>
+#include <utility>
+#include <vector>
+
+/* Compile-time specialised convolution kernels
+   The filters of 3.2 keep convolving with the same few small integer kernels: the Sobel and Laplacian kernels of size
+   1, 3, 5 and 7 and the 8-bit Gaussian taps of the binomial and sigma = 1.5 kernels. With the taps passed at run time
+   every pixel vector loops over them with a broadcast multiply per tap. Here the taps are template arguments:
+   1) Each tap becomes a fixed chain of shifts and adds from the non-adjacent form of its coefficient (31 is x*32 - x,
+      6 is x*4 + x*2), a zero tap disappears together with its load
+   2) The template recursion over the taps unrolls the tap loop completely, the row pointers are set up once per row
+   3) The runtime dispatchers below look a kernel up by its taps. A kernel without a specialisation gets nullptr and
+      the caller keeps its generic loop.
+   Lanes wrap instead of saturating, so an intermediate that overflows is harmless as long as the final sum fits. The
+   integer sums are then the same as the generic path's and every output matches it bit for bit.
+*/
+
+//Position of the lowest set bit of c > 0
+constexpr int lowestSetBit(int c) { return (c & 1) ? 0 : 1 + lowestSetBit(c >> 1); }
+//Non-adjacent form digit at that bit: -1 when the bit above is set too, so a run of ones costs two terms, not one per bit
+constexpr int signedDigit(int c) { return ((c >> lowestSetBit(c)) & 3) == 3 ? -1 : 1; }
+
+#if (CV_SIMD || CV_SIMD_SCALABLE)
+//v_add/v_sub saturate 8- and 16-bit lanes, 32-bit lanes always wrap
+inline cv::v_uint16 wrapAdd(const cv::v_uint16& a, const cv::v_uint16& b) { return cv::v_add_wrap(a, b); }
+inline cv::v_int16 wrapAdd(const cv::v_int16& a, const cv::v_int16& b) { return cv::v_add_wrap(a, b); }
+inline cv::v_int32 wrapAdd(const cv::v_int32& a, const cv::v_int32& b) { return cv::v_add(a, b); }
+inline cv::v_uint16 wrapSub(const cv::v_uint16& a, const cv::v_uint16& b) { return cv::v_sub_wrap(a, b); }
+inline cv::v_int16 wrapSub(const cv::v_int16& a, const cv::v_int16& b) { return cv::v_sub_wrap(a, b); }
+inline cv::v_int32 wrapSub(const cv::v_int32& a, const cv::v_int32& b) { return cv::v_sub(a, b); }
+
+//acc + Sign * C * x with C >= 0, one shift and one add or subtract per non-zero digit of C
+template<int C, int Sign, bool Zero = (C == 0)>
+struct ShiftAdd {
+    template<typename V>
+    static V apply(const V& acc, const V& x) {
+        const V term = cv::v_shl<lowestSetBit(C)>(x);
+        const V sum = Sign * signedDigit(C) > 0 ? wrapAdd(acc, term) : wrapSub(acc, term);
+        return ShiftAdd<C - signedDigit(C) * (1 << lowestSetBit(C)), Sign>::apply(sum, x);
+    }
+};
+
+template<int C, int Sign>
+struct ShiftAdd<C, Sign, true> {
+    template<typename V>
+    static V apply(const V& acc, const V&) { return acc; }
+};
+
+//acc + K * x for any integer constant K
+template<int K, typename V>
+inline V shiftAddMultiply(const V& acc, const V& x) {
+    return ShiftAdd<(K < 0 ? -K : K), (K < 0 ? -1 : 1)>::apply(acc, x);
+}
+#endif
+
+/* A kernel as template arguments
+   accumulate() adds K_j * load(j) for every tap to a vector accumulator, sum() is the scalar sum_j K_j * taps[j][i]
+   for the tails. Both recurse over the taps, which the compiler flattens into straight-line code.
+*/
+template<int... Taps>
+struct FixedTaps;
+
+template<>
+struct FixedTaps<> {
+    enum { size = 0 };
+#if (CV_SIMD || CV_SIMD_SCALABLE)
+    template<typename V, typename Load>
+    static V accumulate(const V& acc, const Load&, int) { return acc; }
+#endif
+    template<typename T>
+    static int sum(const T* const*, int, int) { return 0; }
+};
+
+template<int K, int... Rest>
+struct FixedTaps<K, Rest...> {
+    enum { size = 1 + sizeof...(Rest) };
+#if (CV_SIMD || CV_SIMD_SCALABLE)
+    template<typename V, typename Load>
+    static V accumulate(const V& acc, const Load& load, int j) {
+        return FixedTaps<Rest...>::accumulate(K == 0 ? acc : shiftAddMultiply<K>(acc, load(j)), load, j + 1);
+    }
+#endif
+    template<typename T>
+    static int sum(const T* const* taps, int i, int j) {
+        return K * taps[j][i] + FixedTaps<Rest...>::sum(taps, i, j + 1);
+    }
+};
+
+typedef void (*FixedRow8uFn)(const uchar* const* rows, int rowStep, uchar* dst, int len);
+typedef void (*FixedVerticalFn)(const uchar* top, int rowStep, short* out, int len);
+typedef void (*FixedHorizontalFn)(const short* in, int cn, int* raw, int len);
+
+//convolveRow8u of fused_separable_filter.hpp with the taps fixed: dst[i] = (sum_j K_j * tap_j[i] + 128) >> 8
+template<int... Taps>
+void fixedConvolveRow8u(const uchar* const* rows, int rowStep, uchar* dst, int len) {
+    typedef FixedTaps<Taps...> Kernel;
+    const uchar* taps[Kernel::size];
+    for(int j = 0; j < Kernel::size; j++) {
+        taps[j] = rowStep ? rows[0] + j * rowStep : rows[j];
+    }
+    int i = 0;
+#if (CV_SIMD || CV_SIMD_SCALABLE)
+    const int lanes = cv::VTraits<cv::v_uint16>::vlanes();
+    const cv::v_uint16 round = cv::vx_setall_u16(128);
+    for(; i <= len - lanes; i += lanes) {
+        cv::v_uint16 acc = Kernel::accumulate(round, [&](int j) { return cv::vx_load_expand(taps[j] + i); }, 0);
+        cv::v_pack_store(dst + i, cv::v_shr<8>(acc));
+    }
+    cv::vx_cleanup();
+#endif
+    for(; i < len; i++) {
+        dst[i] = (uchar)((Kernel::sum(taps, i, 0) + 128) >> 8);
+    }
+}
+
+//DerivativeFilterBank::verticalPass with the taps fixed: out[i] = sum_j K_j * row_j[i], rows rowStep apart
+template<int... Taps>
+void fixedVerticalPass(const uchar* top, int rowStep, short* out, int len) {
+    typedef FixedTaps<Taps...> Kernel;
+    const uchar* taps[Kernel::size];
+    for(int j = 0; j < Kernel::size; j++) {
+        taps[j] = top + j * rowStep;
+    }
+    int i = 0;
+#if (CV_SIMD || CV_SIMD_SCALABLE)
+    const int lanes = cv::VTraits<cv::v_int16>::vlanes();
+    for(; i <= len - lanes; i += lanes) {
+        cv::v_int16 acc = Kernel::accumulate(cv::vx_setzero_s16(), [&](int j) {
+            return cv::v_reinterpret_as_s16(cv::vx_load_expand(taps[j] + i));
+        }, 0);
+        cv::v_store(out + i, acc);
+    }
+    cv::vx_cleanup();
+#endif
+    for(; i < len; i++) {
+        out[i] = (short)Kernel::sum(taps, i, 0);
+    }
+}
+
+/* DerivativeFilterBank::horizontalPass with the taps fixed: raw[i] += sum_j K_j * in[i + j*cn]
+   Narrow sums in 16-bit lanes, twice as many per instruction, and widens once at the end. Only for rows whose response
+   is known to fit in 16 bits, the caller checks that from the kernels.
+*/
+template<bool Narrow, int... Taps>
+void fixedHorizontalPass(const short* in, int cn, int* raw, int len) {
+    typedef FixedTaps<Taps...> Kernel;
+    const short* taps[Kernel::size];
+    for(int j = 0; j < Kernel::size; j++) {
+        taps[j] = in + j * cn;
+    }
+    int i = 0;
+#if (CV_SIMD || CV_SIMD_SCALABLE)
+    if(Narrow) {
+        const int lanes = cv::VTraits<cv::v_int16>::vlanes(), half = lanes / 2;
+        for(; i <= len - lanes; i += lanes) {
+            cv::v_int16 acc = Kernel::accumulate(cv::vx_setzero_s16(), [&](int j) { return cv::vx_load(taps[j] + i); }, 0);
+            cv::v_int32 low, high;
+            cv::v_expand(acc, low, high);
+            cv::v_store(raw + i, cv::v_add(cv::vx_load(raw + i), low));
+            cv::v_store(raw + i + half, cv::v_add(cv::vx_load(raw + i + half), high));
+        }
+    }
+    else {
+        const int lanes = cv::VTraits<cv::v_int32>::vlanes();
+        for(; i <= len - lanes; i += lanes) {
+            cv::v_int32 acc = Kernel::accumulate(cv::vx_load(raw + i), [&](int j) { return cv::vx_load_expand(taps[j] + i); }, 0);
+            cv::v_store(raw + i, acc);
+        }
+    }
+    cv::vx_cleanup();
+#endif
+    for(; i < len; i++) {
+        raw[i] += Kernel::sum(taps, i, 0);
+    }
+}
+
+/* Gaussian rows by their taps
+   The 8-bit kernels fixedPointGaussianKernel gives for ksize 1, 3, 5 and 7: the binomial kernels of sigma <= 0 and
+   the sigma = 1.5 kernels, separable_filtering.cpp's 5-tap among them. nullptr for any other kernel.
+*/
+inline FixedRow8uFn fixedConvolveRow8uFor(const std::vector<int>& kernel) {
+    static const std::vector<std::pair<std::vector<int>, FixedRow8uFn>> rows = {
+        {{256}, fixedConvolveRow8u<256>},
+        {{64, 128, 64}, fixedConvolveRow8u<64, 128, 64>},
+        {{16, 64, 96, 64, 16}, fixedConvolveRow8u<16, 64, 96, 64, 16>},
+        {{8, 28, 56, 72, 56, 28, 8}, fixedConvolveRow8u<8, 28, 56, 72, 56, 28, 8>},
+        {{79, 98, 79}, fixedConvolveRow8u<79, 98, 79>},
+        {{31, 60, 74, 60, 31}, fixedConvolveRow8u<31, 60, 74, 60, 31>},
+        {{9, 29, 55, 70, 55, 29, 9}, fixedConvolveRow8u<9, 29, 55, 70, 55, 29, 9>}
+    };
+    for(const auto& row : rows) {
+        if(row.first == kernel) {
+            return row.second;
+        }
+    }
+    return nullptr;
+}
+
+//Both passes of one derivative kernel, the horizontal one in 16-bit (narrow) and 32-bit (wide) lanes
+struct FixedDerivativeKernel {
+    std::vector<int> taps;
+    FixedVerticalFn vertical;
+    FixedHorizontalFn narrow, wide;
+};
+
+template<int... Taps>
+FixedDerivativeKernel fixedDerivativeKernel() {
+    return FixedDerivativeKernel{{Taps...}, fixedVerticalPass<Taps...>, fixedHorizontalPass<true, Taps...>, fixedHorizontalPass<false, Taps...>};
+}
+
+/* Derivative kernels by their taps
+   Every 1D kernel sobelKernel1D builds for ksize 3, 5 and 7 and derivative orders 0 to 2, and the [1] of ksize 1, which
+   covers every Sobel and Laplacian the bank accepts up to second order. nullptr for any other kernel.
+*/
+inline const FixedDerivativeKernel* findFixedDerivativeKernel(const std::vector<int>& kernel) {
+    static const std::vector<FixedDerivativeKernel> kernels = {
+        fixedDerivativeKernel<1>(),
+        fixedDerivativeKernel<1, 2, 1>(),
+        fixedDerivativeKernel<-1, 0, 1>(),
+        fixedDerivativeKernel<1, -2, 1>(),
+        fixedDerivativeKernel<1, 4, 6, 4, 1>(),
+        fixedDerivativeKernel<-1, -2, 0, 2, 1>(),
+        fixedDerivativeKernel<1, 0, -2, 0, 1>(),
+        fixedDerivativeKernel<1, 6, 15, 20, 15, 6, 1>(),
+        fixedDerivativeKernel<-1, -4, -5, 0, 5, 4, 1>(),
+        fixedDerivativeKernel<1, 2, -1, -4, -1, 2, 1>()
+    };
+    for(const auto& fixed : kernels) {
+        if(fixed.taps == kernel) {
+            return &fixed;
+        }
+    }
+    return nullptr;
+}
@@ -0,0 +1,167 @@
+#pragma once
+
+#include <opencv2/core.hpp>
+#include <opencv2/core/hal/intrin.hpp>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include "fixed_kernels.hpp"
+#include "../../Tools/profiler.hpp"
+
+/* Fixed-point Gaussian kernel
+   For CV_8U images GaussianBlur does not filter in floating point, it rounds the kernel to 8 fractional bits
+   (taps sum to exactly 256) and rounds the result of every 1D pass back to 8 bits. To be bit-identical we build the
+   taps the same way:
+   1) k[i] = exp(-(i - (n-1)/2)^2 / (2*sigma^2)), normalized so the taps sum to 1
+   2) Scale the outer taps by 256 with error diffusion, walking in from both ends
+   3) The center tap takes whatever is left, so the sum is exactly 256
+   Like getGaussianKernel, sigma <= 0 uses the fixed binomial kernels for n <= 7 and derives sigma from n otherwise.
+*/
+inline std::vector<int> fixedPointGaussianKernel(int n, double sigma) {
+    CV_Assert(n > 0 && n % 2 == 1);
+    if(sigma <= 0) {
+        static const int binomial[4][7] = {{256}, {64, 128, 64}, {16, 64, 96, 64, 16}, {8, 28, 56, 72, 56, 28, 8}};
+        if(n <= 7) {
+            return std::vector<int>(binomial[n / 2], binomial[n / 2] + n);
+        }
+        sigma = ((n - 1) * 0.5 - 1) * 0.3 + 0.8;
+    }
+    int half = n / 2;
+    std::vector<double> values(half);
+    double sum = 1;
+    for(int i = 0, x = 1 - n; i < half; i++, x += 2) {
+        values[i] = std::exp(x * x * (-0.125 / (sigma * sigma)));
+        sum += 2 * values[i];
+    }
+
+    std::vector<int> kernel(n);
+    double error = 0;
+    int fixedSum = 0;
+    for(int i = 0; i < half; i++) {
+        double adjusted = values[i] / sum * 256 + error;
+        int tap = cvRound(adjusted);
+        error = adjusted - tap;
+        kernel[i] = kernel[n - 1 - i] = tap;
+        fixedSum += 2 * tap;
+    }
+    kernel[half] = 256 - fixedSum;
+    return kernel;
+}
+
+/* 1D pass over len elements: dst[i] = (sum_j kernel[j]*tap_j[i] + 128) >> 8
+   For the horizontal pass rows[0] is a row that already includes the left border and tap j is rows[0] + j*rowStep
+   (rowStep = channels). For the vertical pass rowStep is 0 and tap j is rows[j]. The taps are non-negative and sum
+   to 256, so every partial sum fits in 16 bits and the vector path can use 16-bit lanes.
+*/
+inline void convolveRow8u(const uchar* const* rows, int rowStep, const int* kernel, int n, uchar* dst, int len) {
+    int i = 0;
+#if (CV_SIMD || CV_SIMD_SCALABLE)
+    const int lanes = cv::VTraits<cv::v_uint16>::vlanes();
+    const cv::v_uint16 round = cv::vx_setall_u16(128);
+    for(; i <= len - lanes; i += lanes) {
+        cv::v_uint16 acc = cv::v_mul_wrap(cv::vx_load_expand(rows[0] + i), cv::vx_setall_u16((ushort)kernel[0]));
+        for(int j = 1; j < n; j++) {
+            const uchar* src = rowStep ? rows[0] + j * rowStep : rows[j];
+            acc = cv::v_add(acc, cv::v_mul_wrap(cv::vx_load_expand(src + i), cv::vx_setall_u16((ushort)kernel[j])));
+        }
+        cv::v_pack_store(dst + i, cv::v_shr<8>(cv::v_add(acc, round)));
+    }
+    cv::vx_cleanup();
+#endif
+    for(; i < len; i++) {
+        int acc = 128;
+        for(int j = 0; j < n; j++) {
+            const uchar* src = rowStep ? rows[0] + j * rowStep : rows[j];
+            acc += kernel[j] * src[i];
+        }
+        dst[i] = (uchar)(acc >> 8);
+    }
+}
+
+/* Fused separable filter for 8-bit images
+   Equivalent to filtering with kx along X into an 8-bit image and then with ky along Y, the way separable_filtering.cpp
+   chains two GaussianBlur calls, but without the full-frame intermediate:
+   1) The image is split into bands of rows, one parallel_for_ task per band
+   2) Each band keeps a ring of ky.size() horizontally filtered rows, each new source row is filtered along X once
+      into the slot of the row that just left the window
+   3) Every output row is the vertical combination of the rows in the ring, so the intermediate never leaves cache
+   Borders are BORDER_REFLECT_101 (the GaussianBlur default). Taps use 8 fractional bits and must sum to 256, see
+   fixedPointGaussianKernel. Kernels with a compile-time specialisation in fixed_kernels.hpp run through it unless
+   fixedKernels is false, the output is the same either way. Returns the number of scratch bytes the bands used, for
+   comparison with a full-frame intermediate.
+*/
+inline size_t fusedSeparableFilter8u(const cv::Mat& src, cv::Mat& dst, const std::vector<int>& kx, const std::vector<int>& ky,
+                                     bool fixedKernels = true) {
+    PROFILE_SCOPE("fusedSeparableFilter8u", src);
+    CV_Assert(src.depth() == CV_8U && !src.empty());
+    CV_Assert(kx.size() % 2 == 1 && ky.size() % 2 == 1);
+    const int cn = src.channels(), rows = src.rows, cols = src.cols;
+    const int nx = (int)kx.size(), ny = (int)ky.size(), rx = nx / 2, ry = ny / 2;
+    const int rowLen = cols * cn;
+    const FixedRow8uFn fixedX = fixedKernels ? fixedConvolveRow8uFor(kx) : nullptr;
+    const FixedRow8uFn fixedY = fixedKernels ? fixedConvolveRow8uFor(ky) : nullptr;
+
+    cv::Mat source = src;
+    if(source.data == dst.data) {
+        source = src.clone();
+    }
+    dst.create(src.size(), src.type());
+
+    //Bands of at least 32 output rows, a few per thread so uneven bands balance out
+    const int bandRows = std::max(32, rows / std::max(1, cv::getNumThreads() * 4));
+    const int bands = (rows + bandRows - 1) / bandRows;
+    const size_t scratchPerBand = (size_t)ny * rowLen + (size_t)(cols + 2 * rx) * cn;
+
+    cv::parallel_for_(cv::Range(0, bands), [&](const cv::Range& range) {
+        std::vector<uchar> ring((size_t)ny * rowLen);
+        std::vector<uchar> padded((size_t)(cols + 2 * rx) * cn);
+        std::vector<const uchar*> window(ny);
+
+        //Horizontal pass of source row y (border-reflected) into ring slot
+        auto filterRow = [&](int y, uchar* out) {
+            const uchar* row = source.ptr<uchar>(cv::borderInterpolate(y, rows, cv::BORDER_REFLECT_101));
+            std::copy(row, row + rowLen, padded.begin() + rx * cn);
+            for(int p = 1; p <= rx; p++) {
+                const uchar* left = row + cv::borderInterpolate(-p, cols, cv::BORDER_REFLECT_101) * cn;
+                const uchar* right = row + cv::borderInterpolate(cols - 1 + p, cols, cv::BORDER_REFLECT_101) * cn;
+                std::copy(left, left + cn, padded.begin() + (rx - p) * cn);
+                std::copy(right, right + cn, padded.begin() + (rx + cols - 1 + p) * cn);
+            }
+            const uchar* start = padded.data();
+            if(fixedX) {
+                fixedX(&start, cn, out, rowLen);
+            }
+            else {
+                convolveRow8u(&start, cn, kx.data(), nx, out, rowLen);
+            }
+        };
+
+        for(int band = range.start; band < range.end; band++) {
+            const int y0 = band * bandRows, y1 = std::min(rows, y0 + bandRows);
+            //Prime the ring with the rows above the first output row, virtual row v lives in slot (v - first) % ny
+            const int first = y0 - ry;
+            for(int v = first; v < y0 + ry; v++) {
+                filterRow(v, &ring[(size_t)(v - first) * rowLen]);
+            }
+            for(int y = y0; y < y1; y++) {
+                int newest = y + ry;
+                filterRow(newest, &ring[(size_t)((newest - first) % ny) * rowLen]);
+                for(int j = 0; j < ny; j++) {
+                    window[j] = &ring[(size_t)((y - ry + j - first) % ny) * rowLen];
+                }
+                if(fixedY) {
+                    fixedY(window.data(), 0, dst.ptr<uchar>(y), rowLen);
+                }
+                else {
+                    convolveRow8u(window.data(), 0, ky.data(), ny, dst.ptr<uchar>(y), rowLen);
+                }
+            }
+        }
+    });
+    return scratchPerBand * (size_t)std::min(bands, cv::getNumThreads());
+}
+
+//GaussianBlur(Size(ksize, 1)) followed by GaussianBlur(Size(1, ksize)) on an 8-bit image, in one pass
+inline size_t fusedGaussianBlur8u(const cv::Mat& src, cv::Mat& dst, int ksize, double sigmaX, double sigmaY, bool fixedKernels = true) {
+    return fusedSeparableFilter8u(src, dst, fixedPointGaussianKernel(ksize, sigmaX), fixedPointGaussianKernel(ksize, sigmaY), fixedKernels);
+}
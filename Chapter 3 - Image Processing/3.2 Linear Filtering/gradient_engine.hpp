@@ -0,0 +1,265 @@
+#pragma once
+
+#include <opencv2/core.hpp>
+#include <opencv2/core/hal/intrin.hpp>
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <vector>
+#include "../../Tools/profiler.hpp"
+
+enum GradientKernel { GRADIENT_SOBEL, GRADIENT_SCHARR };
+enum GradientMagnitude { GRADIENT_NO_MAGNITUDE, GRADIENT_L1, GRADIENT_L2 };
+
+/* What GradientEngine::compute() writes besides dx and dy
+   magnitude          L1 gives CV_16SC1 |dx| + |dy|, L2 gives CV_32FC1 sqrt(dx^2 + dy^2) like magnitude()
+   orientationBins    0 for none, otherwise CV_8UC1 bin indices of the fastAtan2/phase() angle, HOG style
+   signedOrientation  bins cover [0, 360) instead of [0, 180), where opposite gradients share a bin
+   visualize          CV_8UC1 saturate(magnitude * visualScale), the L1 magnitude if no magnitude is requested
+*/
+struct GradientOptions {
+    GradientKernel kernel = GRADIENT_SOBEL;
+    GradientMagnitude magnitude = GRADIENT_L2;
+    int orientationBins = 0;
+    bool signedOrientation = false;
+    bool visualize = false;
+    float visualScale = 0.25f;
+};
+
+struct GradientOutputs {
+    cv::Mat dx, dy;          //CV_16SC1, Sobel(src, CV_16S, 1, 0, 3) and (0, 1, 3), or the Scharr equivalents
+    cv::Mat magnitude;
+    cv::Mat orientation;
+    cv::Mat visual;
+};
+
+/* Fused gradient pass
+   Sobel and Scharr are both [a, b, a] smoothing times [-1, 0, 1] differencing (a, b = 1, 2 or 3, 10), so dx and dy
+   come from the same three rows in one sweep:
+   1) Every image row is padded by one pixel (BORDER_REFLECT_101) into a ring of three rows, once per band
+   2) Vertical pass in int16 lanes: s = a*top + b*mid + a*bottom and d = bottom - top
+   3) Horizontal pass: dx = s[x + 1] - s[x - 1] and dy = a*d[x - 1] + b*d[x] + a*d[x + 1], identical to
+      Sobel/Scharr with a CV_16S destination (the sums stay below 2^15 for 8-bit input)
+   4) While dx and dy are still in registers the magnitude, the orientation bin and the 8-bit visualisation are
+      computed and stored, so a consumer gets all of them from one read of the image
+   Rows are split into bands across threads. Only CV_8UC1 input.
+*/
+class GradientEngine {
+public:
+    explicit GradientEngine(const GradientOptions& gradientOptions = GradientOptions()) : options(gradientOptions) {
+        CV_Assert(options.orientationBins >= 0 && options.orientationBins <= 255);
+    }
+
+    const GradientOptions& getOptions() const { return options; }
+
+    void compute(const cv::Mat& src, GradientOutputs& out) const {
+        PROFILE_SCOPE("GradientEngine::compute", src);
+        CV_Assert(src.type() == CV_8UC1 && src.rows >= 2 && src.cols >= 2);
+        const cv::Size size = src.size();
+        out.dx.create(size, CV_16SC1);
+        out.dy.create(size, CV_16SC1);
+        if(options.magnitude == GRADIENT_L1) {
+            out.magnitude.create(size, CV_16SC1);
+        }
+        else if(options.magnitude == GRADIENT_L2) {
+            out.magnitude.create(size, CV_32FC1);
+        }
+        if(options.orientationBins > 0) {
+            out.orientation.create(size, CV_8UC1);
+        }
+        if(options.visualize) {
+            out.visual.create(size, CV_8UC1);
+        }
+
+        const int rows = src.rows, cols = src.cols;
+        const int bandRows = std::max(16, rows / std::max(1, cv::getNumThreads() * 4));
+        const int bands = (rows + bandRows - 1) / bandRows;
+        cv::parallel_for_(cv::Range(0, bands), [&](const cv::Range& range) {
+            std::vector<uchar> ring(3 * (size_t)(cols + 2));
+            std::vector<short> smooth(cols + 2), diff(cols + 2);
+            for(int b = range.start; b < range.end; b++) {
+                const int y0 = b * bandRows, y1 = std::min(rows, y0 + bandRows);
+                for(int y = y0 - 1; y <= y0; y++) {
+                    padRow(src, y, &ring[ringSlot(y) * (cols + 2)]);
+                }
+                for(int y = y0; y < y1; y++) {
+                    padRow(src, y + 1, &ring[ringSlot(y + 1) * (cols + 2)]);
+                    const uchar* top = &ring[ringSlot(y - 1) * (cols + 2)];
+                    const uchar* mid = &ring[ringSlot(y) * (cols + 2)];
+                    const uchar* bottom = &ring[ringSlot(y + 1) * (cols + 2)];
+                    verticalPass(top, mid, bottom, smooth.data(), diff.data(), cols + 2);
+                    gradientRow(smooth.data(), diff.data(), out, y, cols);
+                }
+            }
+        });
+    }
+
+private:
+    //Row y lives in slot (y + 3) % 3 of the ring, y may be -1
+    static int ringSlot(int y) { return (y + 3) % 3; }
+
+    int weightA() const { return options.kernel == GRADIENT_SCHARR ? 3 : 1; }
+    int weightB() const { return options.kernel == GRADIENT_SCHARR ? 10 : 2; }
+
+    static void padRow(const cv::Mat& src, int y, uchar* out) {
+        const uchar* row = src.ptr<uchar>(cv::borderInterpolate(y, src.rows, cv::BORDER_REFLECT_101));
+        std::copy(row, row + src.cols, out + 1);
+        out[0] = row[1];
+        out[src.cols + 1] = row[src.cols - 2];
+    }
+
+    void verticalPass(const uchar* top, const uchar* mid, const uchar* bottom, short* smooth, short* diff, int len) const {
+        const short a = (short)weightA(), b = (short)weightB();
+        int i = 0;
+#if (CV_SIMD || CV_SIMD_SCALABLE)
+        const int lanes = cv::VTraits<cv::v_int16>::vlanes();
+        const cv::v_int16 va = cv::vx_setall_s16(a), vb = cv::vx_setall_s16(b);
+        for(; i <= len - lanes; i += lanes) {
+            cv::v_int16 t = cv::v_reinterpret_as_s16(cv::vx_load_expand(top + i));
+            cv::v_int16 m = cv::v_reinterpret_as_s16(cv::vx_load_expand(mid + i));
+            cv::v_int16 o = cv::v_reinterpret_as_s16(cv::vx_load_expand(bottom + i));
+            cv::v_store(smooth + i, cv::v_add(cv::v_mul(cv::v_add(t, o), va), cv::v_mul(m, vb)));
+            cv::v_store(diff + i, cv::v_sub(o, t));
+        }
+        cv::vx_cleanup();
+#endif
+        for(; i < len; i++) {
+            smooth[i] = (short)(a * (top[i] + bottom[i]) + b * mid[i]);
+            diff[i] = (short)(bottom[i] - top[i]);
+        }
+    }
+
+    //Orientation bin of the gradient, the same polynomial as fastAtan2 and phase()
+    static int orientationBin(float dx, float dy, float binsPerDegree, int bins, bool signedOrientation) {
+        const float p1 = 0.9997878412794807f * (float)(180 / CV_PI), p3 = -0.3258083974640975f * (float)(180 / CV_PI);
+        const float p5 = 0.1555786518463281f * (float)(180 / CV_PI), p7 = -0.04432655554792128f * (float)(180 / CV_PI);
+        float ax = std::abs(dx), ay = std::abs(dy), angle;
+        if(ax >= ay) {
+            float c = ay / (ax + (float)DBL_EPSILON), c2 = c * c;
+            angle = (((p7 * c2 + p5) * c2 + p3) * c2 + p1) * c;
+        }
+        else {
+            float c = ax / (ay + (float)DBL_EPSILON), c2 = c * c;
+            angle = 90.f - (((p7 * c2 + p5) * c2 + p3) * c2 + p1) * c;
+        }
+        if(dx < 0) {
+            angle = 180.f - angle;
+        }
+        if(dy < 0) {
+            angle = 360.f - angle;
+        }
+        if(!signedOrientation && angle >= 180.f) {
+            angle -= 180.f;
+        }
+        return std::min((int)(angle * binsPerDegree), bins - 1);
+    }
+
+    void gradientRow(const short* smooth, const short* diff, GradientOutputs& out, int y, int cols) const {
+        const short a = (short)weightA(), b = (short)weightB();
+        short* dxRow = out.dx.ptr<short>(y);
+        short* dyRow = out.dy.ptr<short>(y);
+        short* l1Row = options.magnitude == GRADIENT_L1 ? out.magnitude.ptr<short>(y) : nullptr;
+        float* l2Row = options.magnitude == GRADIENT_L2 ? out.magnitude.ptr<float>(y) : nullptr;
+        uchar* binRow = options.orientationBins > 0 ? out.orientation.ptr<uchar>(y) : nullptr;
+        uchar* visualRow = options.visualize ? out.visual.ptr<uchar>(y) : nullptr;
+        const int bins = options.orientationBins;
+        const float binsPerDegree = bins / (options.signedOrientation ? 360.f : 180.f);
+        const float visualScale = options.visualScale;
+        int x = 0;
+
+#if (CV_SIMD || CV_SIMD_SCALABLE)
+        const int lanes = cv::VTraits<cv::v_int16>::vlanes(), half = cv::VTraits<cv::v_int32>::vlanes();
+        const cv::v_int16 va = cv::vx_setall_s16(a), vb = cv::vx_setall_s16(b);
+        const cv::v_float32 p1 = cv::vx_setall_f32(0.9997878412794807f * (float)(180 / CV_PI));
+        const cv::v_float32 p3 = cv::vx_setall_f32(-0.3258083974640975f * (float)(180 / CV_PI));
+        const cv::v_float32 p5 = cv::vx_setall_f32(0.1555786518463281f * (float)(180 / CV_PI));
+        const cv::v_float32 p7 = cv::vx_setall_f32(-0.04432655554792128f * (float)(180 / CV_PI));
+        const cv::v_float32 eps = cv::vx_setall_f32((float)DBL_EPSILON), zero = cv::vx_setzero_f32();
+        const cv::v_float32 v90 = cv::vx_setall_f32(90.f), v180 = cv::vx_setall_f32(180.f), v360 = cv::vx_setall_f32(360.f);
+        const cv::v_float32 vbins = cv::vx_setall_f32(binsPerDegree), vscale = cv::vx_setall_f32(visualScale);
+        const cv::v_int32 lastBin = cv::vx_setall_s32(bins - 1);
+
+        //fastAtan2 in lanes, then the bin index
+        auto binOf = [&](const cv::v_float32& fx, const cv::v_float32& fy) {
+            cv::v_float32 ax = cv::v_abs(fx), ay = cv::v_abs(fy);
+            cv::v_float32 xLarger = cv::v_ge(ax, ay);
+            cv::v_float32 c = cv::v_div(cv::v_min(ax, ay), cv::v_add(cv::v_max(ax, ay), eps)), c2 = cv::v_mul(c, c);
+            cv::v_float32 angle = cv::v_mul(cv::v_fma(cv::v_fma(cv::v_fma(p7, c2, p5), c2, p3), c2, p1), c);
+            angle = cv::v_select(xLarger, angle, cv::v_sub(v90, angle));
+            angle = cv::v_select(cv::v_lt(fx, zero), cv::v_sub(v180, angle), angle);
+            angle = cv::v_select(cv::v_lt(fy, zero), cv::v_sub(v360, angle), angle);
+            if(!options.signedOrientation) {
+                angle = cv::v_select(cv::v_ge(angle, v180), cv::v_sub(angle, v180), angle);
+            }
+            return cv::v_min(cv::v_trunc(cv::v_mul(angle, vbins)), lastBin);
+        };
+
+        for(; x <= cols - lanes; x += lanes) {
+            cv::v_int16 sLeft = cv::vx_load(smooth + x), sRight = cv::vx_load(smooth + x + 2);
+            cv::v_int16 dLeft = cv::vx_load(diff + x), dMid = cv::vx_load(diff + x + 1), dRight = cv::vx_load(diff + x + 2);
+            cv::v_int16 gx = cv::v_sub(sRight, sLeft);
+            cv::v_int16 gy = cv::v_add(cv::v_mul(cv::v_add(dLeft, dRight), va), cv::v_mul(dMid, vb));
+            cv::v_store(dxRow + x, gx);
+            cv::v_store(dyRow + x, gy);
+
+            cv::v_int16 l1 = cv::v_reinterpret_as_s16(cv::v_add(cv::v_abs(gx), cv::v_abs(gy)));
+            if(l1Row) {
+                cv::v_store(l1Row + x, l1);
+            }
+            if(!l2Row && !binRow && !visualRow) {
+                continue;
+            }
+
+            cv::v_int32 gx0, gx1, gy0, gy1;
+            cv::v_expand(gx, gx0, gx1);
+            cv::v_expand(gy, gy0, gy1);
+            cv::v_float32 fx0 = cv::v_cvt_f32(gx0), fx1 = cv::v_cvt_f32(gx1), fy0 = cv::v_cvt_f32(gy0), fy1 = cv::v_cvt_f32(gy1);
+            cv::v_float32 m0, m1;
+            if(l2Row) {
+                m0 = cv::v_sqrt(cv::v_muladd(fx0, fx0, cv::v_mul(fy0, fy0)));
+                m1 = cv::v_sqrt(cv::v_muladd(fx1, fx1, cv::v_mul(fy1, fy1)));
+                cv::v_store(l2Row + x, m0);
+                cv::v_store(l2Row + x + half, m1);
+            }
+            else {
+                cv::v_int32 l10, l11;
+                cv::v_expand(l1, l10, l11);
+                m0 = cv::v_cvt_f32(l10);
+                m1 = cv::v_cvt_f32(l11);
+            }
+            if(binRow) {
+                cv::v_int16 bins16 = cv::v_pack(binOf(fx0, fy0), binOf(fx1, fy1));
+                cv::v_pack_u_store(binRow + x, bins16);
+            }
+            if(visualRow) {
+                cv::v_int16 visual16 = cv::v_pack(cv::v_round(cv::v_mul(m0, vscale)), cv::v_round(cv::v_mul(m1, vscale)));
+                cv::v_pack_u_store(visualRow + x, visual16);
+            }
+        }
+        cv::vx_cleanup();
+#endif
+
+        for(; x < cols; x++) {
+            int gx = smooth[x + 2] - smooth[x];
+            int gy = a * (diff[x] + diff[x + 2]) + b * diff[x + 1];
+            dxRow[x] = (short)gx;
+            dyRow[x] = (short)gy;
+            float magnitude = (float)(std::abs(gx) + std::abs(gy));
+            if(l1Row) {
+                l1Row[x] = (short)magnitude;
+            }
+            if(l2Row) {
+                magnitude = std::sqrt((float)gx * gx + (float)gy * gy);
+                l2Row[x] = magnitude;
+            }
+            if(binRow) {
+                binRow[x] = (uchar)orientationBin((float)gx, (float)gy, binsPerDegree, bins, options.signedOrientation);
+            }
+            if(visualRow) {
+                visualRow[x] = cv::saturate_cast<uchar>(magnitude * visualScale);
+            }
+        }
+    }
+
+    GradientOptions options;
+};
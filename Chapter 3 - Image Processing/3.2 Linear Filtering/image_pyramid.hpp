@@ -0,0 +1,301 @@
+#pragma once
+
+#include <opencv2/core.hpp>
+#include <algorithm>
+#include <vector>
+#include "../../Tools/profiler.hpp"
+
+/* Gaussian/Laplacian pyramid with preallocated levels
+   1) setImage() lays out every level (Gaussian levels 1..n-1 in the image type, Laplacian levels 0..n-2 in 16-bit signed)
+      plus the per-thread row buffers in one contiguous arena. The arena is only reallocated when the frame size or type
+      changes, so a video loop over frames of the same size allocates nothing after the first frame. Level 0 is the
+      caller's image, not a copy.
+   2) Levels are computed lazily: gaussian(k) or laplacian(k) only builds the levels up to the one asked for.
+   3) Building a level is one fused pass: while the rows of G(i+1) = REDUCE(G(i)) are produced, the rows of
+      L(i) = G(i) - EXPAND(G(i+1)) that depend on them are produced too, while both are still in cache, instead of a
+      separate pyrUp and subtraction per level.
+   REDUCE is exactly pyrDown, EXPAND is pyrUp (identical for even sizes, odd sizes reflect at the last row/column). Since L(i) is stored exactly,
+   reconstruct() gives back the original image.
+*/
+class ImagePyramid {
+public:
+    explicit ImagePyramid(int levels) : levelCount(levels) {
+        CV_Assert(levels >= 1);
+    }
+
+    int levels() const { return levelCount; }
+    int arenaAllocations() const { return allocations; }
+    size_t arenaBytes() const { return arena.total() * arena.elemSize(); }
+
+    //Starts a new frame, previously computed levels become invalid
+    void setImage(const cv::Mat& src) {
+        PROFILE_SCOPE("ImagePyramid::setImage", src);
+        CV_Assert(!src.empty() && src.depth() == CV_8U);
+        if(src.size() != baseSize || src.type() != baseType || cv::getNumThreads() != layoutThreads) {
+            layout(src.size(), src.type());
+        }
+        gaussianLevels[0] = src;
+        computed = 1;
+    }
+
+    const cv::Mat& gaussian(int level) {
+        CV_Assert(level >= 0 && level < levelCount && computed > 0);
+        while(computed <= level) {
+            buildLevel(computed - 1);
+        }
+        return gaussianLevels[level];
+    }
+
+    //Band-pass level, 0 <= level < levels() - 1. The coarsest band is gaussian(levels() - 1) itself.
+    const cv::Mat& laplacian(int level) {
+        CV_Assert(level >= 0 && level < levelCount - 1 && computed > 0);
+        gaussian(level + 1);
+        return laplacianLevels[level];
+    }
+
+    //G(i) = L(i) + EXPAND(G(i+1)) from the coarsest level down, ping-ponging between two arena buffers
+    void reconstruct(cv::Mat& dst) {
+        gaussian(levelCount - 1);
+        if(levelCount == 1) {
+            gaussianLevels[0].copyTo(dst);
+            return;
+        }
+        cv::Mat current = gaussianLevels[levelCount - 1];
+        for(int level = levelCount - 2; level >= 0; level--) {
+            cv::Mat out;
+            if(level == 0) {
+                dst.create(baseSize, baseType);
+                out = dst;
+            }
+            else {
+                out = cv::Mat(gaussianLevels[level].size(), baseType, scratch[level % 2]);
+            }
+            expandAdd(current, laplacianLevels[level], out);
+            current = out;
+        }
+    }
+
+private:
+    //Per-band row buffers, carved out of the arena
+    struct BandScratch {
+        int* reduced;       //Ring of 5 horizontally reduced fine rows (coarse width)
+        uchar* coarseRow;   //The coarse row being produced
+        short* expandRing;  //Ring of 3 horizontally expanded coarse rows (fine width)
+        int* expanded;      //One fully expanded fine row
+    };
+
+    //Allocates one arena for all levels of a frame of this size and type, every level is a header into it
+    void layout(cv::Size size, int type) {
+        const int cn = CV_MAT_CN(type);
+        std::vector<cv::Size> sizes(1, size);
+        for(int i = 1; i < levelCount; i++) {
+            sizes.push_back(cv::Size((sizes[i - 1].width + 1) / 2, (sizes[i - 1].height + 1) / 2));
+        }
+        auto aligned = [](size_t bytes) { return (bytes + 63) & ~(size_t)63; };
+
+        //Level 0 is the widest, so its row buffers fit every level
+        const size_t fineLen = (size_t)size.width * cn, coarseLen = (size_t)((size.width + 1) / 2) * cn;
+        bandCount = std::max(1, cv::getNumThreads() * 4);
+        bandBytes = aligned(5 * coarseLen * sizeof(int)) + aligned(coarseLen) + aligned(3 * fineLen * sizeof(short))
+                  + aligned(fineLen * sizeof(int));
+        const size_t scratchBytes = levelCount > 2 ? aligned((size_t)sizes[1].area() * cn) : 0;
+
+        size_t total = bandCount * bandBytes + 2 * scratchBytes;
+        for(int i = 1; i < levelCount; i++) {
+            total += aligned((size_t)sizes[i].area() * cn);                 //G(i), 8-bit
+        }
+        for(int i = 0; i < levelCount - 1; i++) {
+            total += aligned((size_t)sizes[i].area() * cn * sizeof(short)); //L(i), 16-bit
+        }
+
+        arena.create(1, (int)(total + 64), CV_8UC1);
+        allocations++;
+        uchar* next = cv::alignPtr(arena.data, 64);
+        gaussianLevels.assign(levelCount, cv::Mat());
+        laplacianLevels.assign(levelCount - 1, cv::Mat());
+        for(int i = 1; i < levelCount; i++) {
+            gaussianLevels[i] = cv::Mat(sizes[i], type, next);
+            next += aligned((size_t)sizes[i].area() * cn);
+        }
+        for(int i = 0; i < levelCount - 1; i++) {
+            laplacianLevels[i] = cv::Mat(sizes[i], CV_MAKETYPE(CV_16S, cn), next);
+            next += aligned((size_t)sizes[i].area() * cn * sizeof(short));
+        }
+        for(int i = 0; i < 2; i++) {
+            scratch[i] = next;
+            next += scratchBytes;
+        }
+        bandScratch.clear();
+        for(int b = 0; b < bandCount; b++) {
+            BandScratch band;
+            band.reduced = reinterpret_cast<int*>(next);
+            band.coarseRow = next + aligned(5 * coarseLen * sizeof(int));
+            band.expandRing = reinterpret_cast<short*>(band.coarseRow + aligned(coarseLen));
+            band.expanded = reinterpret_cast<int*>(reinterpret_cast<uchar*>(band.expandRing) + aligned(3 * fineLen * sizeof(short)));
+            bandScratch.push_back(band);
+            next += bandBytes;
+        }
+        baseSize = size;
+        baseType = type;
+        layoutThreads = cv::getNumThreads();
+    }
+
+    //pyrUp's border rule: which coarse sample stands in for coarse index v when expanding to fineLen samples
+    static int coarseIndex(int v, int fineLen) {
+        return cv::borderInterpolate(2 * v, fineLen, cv::BORDER_REFLECT_101) / 2;
+    }
+
+    //Horizontal half of EXPAND, one coarse row to a fine row (8x scale): even columns 1-6-1, odd columns 4-4
+    static void expandRow(const uchar* coarse, int fineCols, int cn, short* out) {
+        for(int X = 0; X < fineCols; X++) {
+            const int x = X / 2, right = coarseIndex(x + 1, fineCols) * cn;
+            if(X % 2 == 0) {
+                const int left = coarseIndex(x - 1, fineCols) * cn;
+                for(int c = 0; c < cn; c++) {
+                    out[X * cn + c] = (short)(coarse[left + c] + 6 * coarse[x * cn + c] + coarse[right + c]);
+                }
+            }
+            else {
+                for(int c = 0; c < cn; c++) {
+                    out[X * cn + c] = (short)(4 * (coarse[x * cn + c] + coarse[right + c]));
+                }
+            }
+        }
+    }
+
+    //Vertical half of EXPAND for an even (1-6-1) or odd (4-4) fine row, rounded back from the 64x scale
+    static void expandColumn(const short* above, const short* center, const short* below, bool even, int* out, int len) {
+        if(even) {
+            for(int i = 0; i < len; i++) {
+                out[i] = (above[i] + 6 * center[i] + below[i] + 32) >> 6;
+            }
+        }
+        else {
+            for(int i = 0; i < len; i++) {
+                out[i] = (4 * (center[i] + below[i]) + 32) >> 6;
+            }
+        }
+    }
+
+    /* Builds G(level+1) and L(level) in one pass over G(level)
+       The rows of G(level+1) are split into bands across threads. Each band walks the virtual coarse rows r0-1 .. r1:
+       1) Reduce five fine rows into coarse row v, the horizontally reduced fine rows are kept in a ring of 5 so each
+          fine row is only filtered once, and store it if it belongs to this band
+       2) Expand coarse row v horizontally into a ring of 3
+       3) Once rows v-2, v-1, v are in the ring, write Laplacian rows 2(v-1) and 2(v-1)+1
+       The two rows just outside the band are recomputed instead of shared, so bands never wait on each other.
+    */
+    void buildLevel(int level) {
+        const cv::Mat& fine = gaussianLevels[level];
+        cv::Mat& coarse = gaussianLevels[level + 1];
+        cv::Mat& band = laplacianLevels[level];
+        const int cn = fine.channels(), fineRows = fine.rows, fineCols = fine.cols;
+        const int coarseRows = coarse.rows, coarseCols = coarse.cols;
+        const int fineLen = fineCols * cn, coarseLen = coarseCols * cn;
+        const int bands = std::min(bandCount, coarseRows);
+        const int bandRows = (coarseRows + bands - 1) / bands;
+
+        cv::parallel_for_(cv::Range(0, bands), [&](const cv::Range& range) {
+            for(int b = range.start; b < range.end; b++) {
+                const BandScratch& s = bandScratch[b];
+                int reducedRowOf[5];
+                std::fill(reducedRowOf, reducedRowOf + 5, -3);   //No fine row index maps to -3 here
+
+                //Horizontal [1 4 6 4 1] at every other column of fine row y, through the ring
+                auto reducedRow = [&](int y) -> const int* {
+                    y = cv::borderInterpolate(y, fineRows, cv::BORDER_REFLECT_101);
+                    int* out = s.reduced + (size_t)(y % 5) * coarseLen;
+                    if(reducedRowOf[y % 5] == y) {
+                        return out;
+                    }
+                    reducedRowOf[y % 5] = y;
+                    const uchar* src = fine.ptr<uchar>(y);
+                    for(int x = 0; x < coarseCols; x++) {
+                        int sx[5];
+                        for(int j = 0; j < 5; j++) {
+                            sx[j] = cv::borderInterpolate(2 * x - 2 + j, fineCols, cv::BORDER_REFLECT_101) * cn;
+                        }
+                        for(int c = 0; c < cn; c++) {
+                            out[x * cn + c] = src[sx[0] + c] + 4 * src[sx[1] + c] + 6 * src[sx[2] + c] + 4 * src[sx[3] + c] + src[sx[4] + c];
+                        }
+                    }
+                    return out;
+                };
+
+                const int r0 = b * bandRows, r1 = std::min(coarseRows, r0 + bandRows);
+                for(int v = r0 - 1; v <= r1; v++) {
+                    const int r = coarseIndex(v, fineRows);
+                    //Reflected rows are at most two apart, so the five rows never evict each other
+                    const int* rows[5];
+                    for(int j = 0; j < 5; j++) {
+                        rows[j] = reducedRow(2 * r - 2 + j);
+                    }
+                    for(int i = 0; i < coarseLen; i++) {
+                        s.coarseRow[i] = (uchar)((rows[0][i] + 4 * rows[1][i] + 6 * rows[2][i] + 4 * rows[3][i] + rows[4][i] + 128) >> 8);
+                    }
+                    if(v >= r0 && v < r1) {
+                        std::copy(s.coarseRow, s.coarseRow + coarseLen, coarse.ptr<uchar>(v));
+                    }
+                    expandRow(s.coarseRow, fineCols, cn, s.expandRing + (size_t)((v - r0 + 1) % 3) * fineLen);
+
+                    const int center = v - 1;
+                    if(center < r0) {
+                        continue;
+                    }
+                    const short* above = s.expandRing + (size_t)((center - r0) % 3) * fineLen;
+                    const short* middle = s.expandRing + (size_t)((center - r0 + 1) % 3) * fineLen;
+                    const short* below = s.expandRing + (size_t)((center - r0 + 2) % 3) * fineLen;
+                    for(int Y = 2 * center; Y < std::min(2 * center + 2, fineRows); Y++) {
+                        expandColumn(above, middle, below, Y % 2 == 0, s.expanded, fineLen);
+                        const uchar* g = fine.ptr<uchar>(Y);
+                        short* l = band.ptr<short>(Y);
+                        for(int i = 0; i < fineLen; i++) {
+                            l[i] = (short)(g[i] - s.expanded[i]);
+                        }
+                    }
+                }
+            }
+        });
+        computed = level + 2;
+    }
+
+    //out = saturate(L + EXPAND(coarse)), the inverse of one buildLevel step
+    void expandAdd(const cv::Mat& coarse, const cv::Mat& band, cv::Mat& out) const {
+        const int cn = coarse.channels(), fineRows = band.rows, fineCols = band.cols, fineLen = fineCols * cn;
+        const int bands = std::min(bandCount, fineRows);
+        const int bandRows = (fineRows + bands - 1) / bands;
+        cv::parallel_for_(cv::Range(0, bands), [&](const cv::Range& range) {
+            for(int b = range.start; b < range.end; b++) {
+                const BandScratch& s = bandScratch[b];
+                short* above = s.expandRing;
+                short* middle = above + fineLen;
+                short* below = middle + fineLen;
+                for(int Y = b * bandRows; Y < std::min(fineRows, (b + 1) * bandRows); Y++) {
+                    const int r = Y / 2;
+                    expandRow(coarse.ptr<uchar>(coarseIndex(r - 1, fineRows)), fineCols, cn, above);
+                    expandRow(coarse.ptr<uchar>(r), fineCols, cn, middle);
+                    expandRow(coarse.ptr<uchar>(coarseIndex(r + 1, fineRows)), fineCols, cn, below);
+                    expandColumn(above, middle, below, Y % 2 == 0, s.expanded, fineLen);
+                    const short* l = band.ptr<short>(Y);
+                    uchar* dst = out.ptr<uchar>(Y);
+                    for(int i = 0; i < fineLen; i++) {
+                        dst[i] = cv::saturate_cast<uchar>(l[i] + s.expanded[i]);
+                    }
+                }
+            }
+        });
+    }
+
+    int levelCount;
+    int computed = 0;
+    int allocations = 0;
+    cv::Size baseSize;
+    int baseType = -1;
+    int layoutThreads = 0;
+    int bandCount = 1;
+    size_t bandBytes = 0;
+    cv::Mat arena;
+    uchar* scratch[2] = {nullptr, nullptr};
+    std::vector<BandScratch> bandScratch;
+    std::vector<cv::Mat> gaussianLevels, laplacianLevels;
+};
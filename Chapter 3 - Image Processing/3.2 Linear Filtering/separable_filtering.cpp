@@ -1,11 +1,22 @@
 #include <opencv2/opencv.hpp>
 #include <iostream>
+#include <sys/resource.h>
+#include "fused_separable_filter.hpp"
+#include "../../Tools/derived_image_cache.hpp"
 
 using namespace cv;
 using namespace std;
 
+//Peak resident set size of the process so far in MB (ru_maxrss is reported in KB on Linux)
+double peakMemoryMB() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss / 1024.0;
+}
+
 int main() {
-    Mat img = imread("Pictures/truck.jpg", IMREAD_COLOR);
+    //Decoded through the cache, with IMAGE_CACHE=<dir> a rerun maps the pixels instead of decoding. The timings are not cached
+    Mat img = DerivedImageCache::shared().imread("Pictures/truck.jpg", IMREAD_COLOR);
     if(img.empty()) {
         cout << "Failed to read image" << endl;
         return 1;
@@ -15,12 +26,46 @@ int main() {
     Size kernelSize = Size(5,5); //5x5 Gaussian kernel
     double sigma = 1.5;          //Standard deviation
 
+    /* Fused separable filter
+       1) Filter each row along X into a small ring of kernelSize.height rows instead of a full-size image
+       2) Combine the rows in the ring along Y as soon as the window is full, band by band across threads
+       Runs first so the peak memory reading is not inflated by the full-frame temporary below
+    */
+    Mat fusedBlur_img;
+    double memoryBefore = peakMemoryMB();
+    int64 start = getTickCount();
+    size_t ringBytes = fusedGaussianBlur8u(img, fusedBlur_img, kernelSize.width, sigma, sigma);
+    double fusedMs = (getTickCount() - start) * 1000.0 / getTickFrequency();
+    double fusedPeakMB = peakMemoryMB() - memoryBefore;
+
     //First apply Gaussian blur along X-axis
+    memoryBefore = peakMemoryMB();
+    start = getTickCount();
     Mat XgaussianBlur_img;
-    GaussianBlur(img, XgaussianBlur_img, Size(kernelSize.width, 1), sigma, 0);
+    profiled::GaussianBlur(img, XgaussianBlur_img, Size(kernelSize.width, 1), sigma, 0);
 
     //Gaussian blur along Y-axis on XgaussianBlur
-    GaussianBlur(XgaussianBlur_img, gaussianBlur_img, Size(1, kernelSize.height), 0, sigma);
+    profiled::GaussianBlur(XgaussianBlur_img, gaussianBlur_img, Size(1, kernelSize.height), 0, sigma);
+    double twoPassMs = (getTickCount() - start) * 1000.0 / getTickFrequency();
+    double twoPassPeakMB = peakMemoryMB() - memoryBefore;
+
+    /* Generic kernels
+       The fused filter above ran the 5-tap sigma 1.5 kernel through its compile-time specialisation (fixed_kernels.hpp),
+       shifts and adds in 16-bit lanes. The same call with the taps looped over at run time has to give the same image.
+    */
+    Mat genericBlur_img;
+    start = getTickCount();
+    fusedGaussianBlur8u(img, genericBlur_img, kernelSize.width, sigma, sigma, false);
+    double genericMs = (getTickCount() - start) * 1000.0 / getTickFrequency();
+
+    double maxDifference = norm(fusedBlur_img, gaussianBlur_img, NORM_INF);
+    cout << "Two GaussianBlur calls: " << twoPassMs << " ms, full-frame temporary " << XgaussianBlur_img.total() * XgaussianBlur_img.elemSize() / 1024.0
+         << " KB, peak memory growth " << twoPassPeakMB << " MB" << endl;
+    cout << "Fused separable filter: " << fusedMs << " ms, ring buffers " << ringBytes / 1024.0
+         << " KB, peak memory growth " << fusedPeakMB << " MB" << endl;
+    cout << "Fused with generic kernels: " << genericMs << " ms, specialised kernels speedup " << genericMs / fusedMs
+         << "x, max difference " << norm(fusedBlur_img, genericBlur_img, NORM_INF) << endl;
+    cout << (maxDifference == 0 ? "Outputs are identical" : "Outputs differ, max difference " + to_string(maxDifference)) << endl;
 
     /* Overall
        2D filter is said to be separable if it can be divided into two 1D filters, which can make 
@@ -28,7 +73,7 @@ int main() {
        separated into two different 1D  filters to reduce noise and detail.
        GaussianBlur(src Mat, output Mat, kernel size, std x-direction, std y-direction)
     */ 
-    imwrite("Pictures/separableFiltered_img.png", gaussianBlur_img);
+    profiled::imwrite("Pictures/separableFiltered_img.png", fusedBlur_img);
     
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,232 @@
+#pragma once
+
+#include <opencv2/core.hpp>
+#include <opencv2/core/hal/intrin.hpp>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include "../../Tools/profiler.hpp"
+
+/* Steerable filters (Freeman and Adelson)
+   A derivative of a Gaussian at any angle theta is a fixed linear combination of a few basis filters:
+       1st order: G1(theta) = cos(theta)*Gx + sin(theta)*Gy
+       2nd order: G2(theta) = cos^2(theta)*Gxx + 2*cos(theta)*sin(theta)*Gxy + sin^2(theta)*Gyy
+   Convolution is linear, so the same holds for the filtered images. compute() convolves the image with the 2 or 3
+   basis filters once, after that steer() gives the response at any angle as a per-pixel weighted sum, and
+   dominantOrientation() gives the angle of the strongest response in closed form:
+       1st order: theta = atan2(Gy, Gx),                   strength = sqrt(Gx^2 + Gy^2)
+       2nd order: theta = atan2(2*Gxy, Gxx - Gyy) / 2,     strength = sqrt((Gxx - Gyy)^2 + 4*Gxy^2)
+   Angles are in degrees, measured from the x-axis towards the y-axis (down in image coordinates).
+*/
+class SteerableFilter {
+public:
+    SteerableFilter(int order, double sigma) : filterOrder(order) {
+        CV_Assert((order == 1 || order == 2) && sigma > 0);
+        radius = std::max(1, (int)std::ceil(3 * sigma));
+        /* Sampled Gaussian g and its derivatives. The passes below correlate (like filter2D), so the first derivative
+           taps are -g' = x/s^2 g to make the responses the derivatives of the smoothed image. g'' = (x^2/s^2 - 1)/s^2 g
+           is symmetric and needs no flip. */
+        std::vector<float> g(2 * radius + 1), g1(2 * radius + 1), g2(2 * radius + 1);
+        double sum = 0;
+        for(int x = -radius; x <= radius; x++) {
+            sum += std::exp(-x * x / (2 * sigma * sigma));
+        }
+        for(int x = -radius; x <= radius; x++) {
+            double value = std::exp(-x * x / (2 * sigma * sigma)) / sum;
+            g[x + radius] = (float)value;
+            g1[x + radius] = (float)(x / (sigma * sigma) * value);
+            g2[x + radius] = (float)((x * x / (sigma * sigma) - 1) / (sigma * sigma) * value);
+        }
+
+        //Basis filters as (kx, ky) pairs: Gx, Gy for order 1 and Gxx, Gxy, Gyy for order 2
+        if(order == 1) {
+            kernels = {{g1, g}, {g, g1}};
+        }
+        else {
+            kernels = {{g2, g}, {g1, g1}, {g, g2}};
+        }
+    }
+
+    int order() const { return filterOrder; }
+    int kernelSize() const { return 2 * radius + 1; }
+    const std::vector<cv::Mat>& basis() const { return responses; }
+
+    /* Basis responses
+       1) Split the image into bands of rows across threads, each band is converted to float with a BORDER_REFLECT_101
+          border once and reused by every basis filter
+       2) For every row, run each distinct vertical kernel (g, g', g'') once with SIMD
+       3) Run each basis filter's horizontal kernel over the vertical result it needs
+    */
+    void compute(const cv::Mat& src) {
+        PROFILE_SCOPE("SteerableFilter::compute", src);
+        CV_Assert(!src.empty() && src.channels() == 1 && (src.depth() == CV_8U || src.depth() == CV_32F));
+        const int rows = src.rows, cols = src.cols, paddedLen = cols + 2 * radius;
+        responses.resize(kernels.size());
+        for(auto& response : responses) {
+            response.create(src.size(), CV_32FC1);
+        }
+        //Distinct vertical kernels and, for each basis filter, which one it uses
+        std::vector<const std::vector<float>*> verticals;
+        std::vector<int> verticalOf;
+        for(const auto& kernel : kernels) {
+            size_t v = 0;
+            while(v < verticals.size() && *verticals[v] != kernel.second) {
+                v++;
+            }
+            if(v == verticals.size()) {
+                verticals.push_back(&kernel.second);
+            }
+            verticalOf.push_back((int)v);
+        }
+
+        const int bandRows = std::max(16, rows / std::max(1, cv::getNumThreads() * 4));
+        const int bands = (rows + bandRows - 1) / bandRows;
+        cv::parallel_for_(cv::Range(0, bands), [&](const cv::Range& range) {
+            std::vector<float> band((size_t)(bandRows + 2 * radius) * paddedLen);
+            std::vector<std::vector<float>> vertical(verticals.size(), std::vector<float>(paddedLen));
+            for(int b = range.start; b < range.end; b++) {
+                const int y0 = b * bandRows, y1 = std::min(rows, y0 + bandRows);
+                for(int y = y0 - radius; y < y1 + radius; y++) {
+                    float* out = &band[(size_t)(y - y0 + radius) * paddedLen];
+                    int sy = cv::borderInterpolate(y, rows, cv::BORDER_REFLECT_101);
+                    if(src.depth() == CV_8U) {
+                        std::copy(src.ptr<uchar>(sy), src.ptr<uchar>(sy) + cols, out + radius);
+                    }
+                    else {
+                        std::copy(src.ptr<float>(sy), src.ptr<float>(sy) + cols, out + radius);
+                    }
+                    for(int p = 1; p <= radius; p++) {
+                        out[radius - p] = out[radius + cv::borderInterpolate(-p, cols, cv::BORDER_REFLECT_101)];
+                        out[radius + cols - 1 + p] = out[radius + cv::borderInterpolate(cols - 1 + p, cols, cv::BORDER_REFLECT_101)];
+                    }
+                }
+                for(int y = y0; y < y1; y++) {
+                    const float* top = &band[(size_t)(y - y0) * paddedLen];
+                    for(size_t v = 0; v < verticals.size(); v++) {
+                        convolveFloat(top, paddedLen, *verticals[v], vertical[v].data(), paddedLen);
+                    }
+                    for(size_t k = 0; k < kernels.size(); k++) {
+                        convolveFloat(vertical[verticalOf[k]].data(), 1, kernels[k].first, responses[k].ptr<float>(y), cols);
+                    }
+                }
+            }
+        });
+    }
+
+    //Steering weights for the basis filters at the given angle
+    std::vector<float> weights(double angleDegrees) const {
+        double c = std::cos(angleDegrees * CV_PI / 180), s = std::sin(angleDegrees * CV_PI / 180);
+        if(filterOrder == 1) {
+            return {(float)c, (float)s};
+        }
+        return {(float)(c * c), (float)(2 * c * s), (float)(s * s)};
+    }
+
+    //Response at any angle from the basis responses, one multiply-add per basis filter per pixel
+    void steer(double angleDegrees, cv::Mat& dst) const {
+        CV_Assert(!responses.empty());
+        const std::vector<float> w = weights(angleDegrees);
+        const int cols = responses[0].cols;
+        dst.create(responses[0].size(), CV_32FC1);
+        cv::parallel_for_(cv::Range(0, dst.rows), [&](const cv::Range& range) {
+            for(int y = range.start; y < range.end; y++) {
+                float* out = dst.ptr<float>(y);
+                int x = 0;
+#if (CV_SIMD || CV_SIMD_SCALABLE)
+                const int lanes = cv::VTraits<cv::v_float32>::vlanes();
+                for(; x <= cols - lanes; x += lanes) {
+                    cv::v_float32 acc = cv::v_mul(cv::vx_load(responses[0].ptr<float>(y) + x), cv::vx_setall_f32(w[0]));
+                    for(size_t k = 1; k < responses.size(); k++) {
+                        acc = cv::v_fma(cv::vx_load(responses[k].ptr<float>(y) + x), cv::vx_setall_f32(w[k]), acc);
+                    }
+                    cv::v_store(out + x, acc);
+                }
+                cv::vx_cleanup();
+#endif
+                for(; x < cols; x++) {
+                    float acc = 0;
+                    for(size_t k = 0; k < responses.size(); k++) {
+                        acc += w[k] * responses[k].ptr<float>(y)[x];
+                    }
+                    out[x] = acc;
+                }
+            }
+        });
+    }
+
+    //Closed-form dominant orientation (degrees, [0, 360) for order 1 and [0, 180) for order 2) and its strength
+    void dominantOrientation(cv::Mat& angleDegrees, cv::Mat& strength) const {
+        CV_Assert(!responses.empty());
+        angleDegrees.create(responses[0].size(), CV_32FC1);
+        strength.create(responses[0].size(), CV_32FC1);
+        const int cols = responses[0].cols;
+        cv::parallel_for_(cv::Range(0, angleDegrees.rows), [&](const cv::Range& range) {
+            std::vector<float> a(cols), b(cols);
+            cv::Mat aRow(1, cols, CV_32FC1, a.data()), bRow(1, cols, CV_32FC1, b.data());
+            for(int y = range.start; y < range.end; y++) {
+                cv::Mat angleRow = angleDegrees.row(y), strengthRow = strength.row(y);
+                if(filterOrder == 1) {
+                    cv::phase(responses[0].row(y), responses[1].row(y), angleRow, true);
+                    cv::magnitude(responses[0].row(y), responses[1].row(y), strengthRow);
+                    continue;
+                }
+                const float* gxx = responses[0].ptr<float>(y);
+                const float* gxy = responses[1].ptr<float>(y);
+                const float* gyy = responses[2].ptr<float>(y);
+                for(int x = 0; x < cols; x++) {
+                    a[x] = gxx[x] - gyy[x];
+                    b[x] = 2 * gxy[x];
+                }
+                cv::phase(aRow, bRow, angleRow, true);
+                cv::magnitude(aRow, bRow, strengthRow);
+                float* angle = angleDegrees.ptr<float>(y);
+                for(int x = 0; x < cols; x++) {
+                    angle[x] *= 0.5f;
+                }
+            }
+        });
+    }
+
+    //The rotated 2D kernel at the given angle, what a brute-force filter2D per angle would use
+    cv::Mat kernelAt(double angleDegrees) const {
+        const std::vector<float> w = weights(angleDegrees);
+        cv::Mat kernel = cv::Mat::zeros(kernelSize(), kernelSize(), CV_32FC1);
+        for(size_t k = 0; k < kernels.size(); k++) {
+            for(int y = 0; y < kernelSize(); y++) {
+                for(int x = 0; x < kernelSize(); x++) {
+                    kernel.at<float>(y, x) += w[k] * kernels[k].second[y] * kernels[k].first[x];
+                }
+            }
+        }
+        return kernel;
+    }
+
+private:
+    //out[i] = sum_j kernel[j] * in[i + j*step], step is 1 for a horizontal pass and the row length for a vertical one
+    static void convolveFloat(const float* in, int step, const std::vector<float>& kernel, float* out, int len) {
+        int i = 0;
+#if (CV_SIMD || CV_SIMD_SCALABLE)
+        const int lanes = cv::VTraits<cv::v_float32>::vlanes();
+        for(; i <= len - lanes; i += lanes) {
+            cv::v_float32 acc = cv::vx_setzero_f32();
+            for(size_t j = 0; j < kernel.size(); j++) {
+                acc = cv::v_fma(cv::vx_load(in + i + j * step), cv::vx_setall_f32(kernel[j]), acc);
+            }
+            cv::v_store(out + i, acc);
+        }
+        cv::vx_cleanup();
+#endif
+        for(; i < len; i++) {
+            float acc = 0;
+            for(size_t j = 0; j < kernel.size(); j++) {
+                acc += kernel[j] * in[i + j * step];
+            }
+            out[i] = acc;
+        }
+    }
+
+    int filterOrder;
+    int radius;
+    std::vector<std::pair<std::vector<float>, std::vector<float>>> kernels;
+    std::vector<cv::Mat> responses;
+};
@@ -0,0 +1,187 @@
+#pragma once
+
+#include <opencv2/core.hpp>
+#include <opencv2/imgcodecs.hpp>
+#include <condition_variable>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "bounded_queue.hpp"
+#include "image_container.hpp"
+#include "profiler.hpp"
+
+/* Output formats for AsyncImageWriter
+   PNG        the file as named, with the selected zlib compression level
+   PNM        uncompressed binary .pgm/.ppm next to the requested name, no zlib at all
+   CONTAINER  every image goes into one uncompressed .imc file, named by the file name it was written as
+*/
+enum ImageOutputFormat { OUTPUT_PNG, OUTPUT_PNM, OUTPUT_CONTAINER };
+
+/* Background image writer
+   write() only queues the image, a pool of writer threads encodes and stores it, so compute never waits on zlib or
+   the disk. The queue is bounded: if the writers fall far behind, write() blocks instead of holding every frame in
+   memory. wait() returns once everything queued so far is on disk (and any container has its index written), so
+   call it before the program exits or reads the files back. Containers stay open until the writer is destroyed, so
+   writes after a wait() are added to the same file instead of starting it over.
+   The image is not copied, it is shared with the caller like any Mat copy. Write into a new Mat (or pass a clone)
+   rather than modifying a queued image in place.
+*/
+class AsyncImageWriter {
+public:
+    explicit AsyncImageWriter(int threads = 2, size_t maxQueued = 32) : queue(maxQueued) {
+        for(int i = 0; i < std::max(1, threads); i++) {
+            workers.emplace_back([this] { run(); });
+        }
+    }
+
+    ~AsyncImageWriter() {
+        wait();
+        queue.close();
+        for(auto& worker : workers) {
+            worker.join();
+        }
+        for(auto& container : containers) {
+            container.second->close();
+        }
+    }
+
+    AsyncImageWriter(const AsyncImageWriter&) = delete;
+    AsyncImageWriter& operator=(const AsyncImageWriter&) = delete;
+
+    //Format for the following writes, container is the .imc file used by OUTPUT_CONTAINER
+    void setFormat(ImageOutputFormat outputFormat, const std::string& container = "") {
+        CV_Assert(outputFormat != OUTPUT_CONTAINER || !container.empty());
+        std::lock_guard<std::mutex> lock(mutex);
+        format = outputFormat;
+        containerFile = container;
+    }
+
+    //zlib level 0 (store) to 9 (smallest), -1 for the imwrite default
+    void setPngCompression(int level) {
+        CV_Assert(level >= -1 && level <= 9);
+        std::lock_guard<std::mutex> lock(mutex);
+        pngCompression = level;
+    }
+
+    void write(const std::string& filename, const cv::Mat& img) {
+        Job job;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            job.format = format;
+            job.compression = pngCompression;
+            job.container = containerFile;
+            pending++;
+        }
+        job.filename = filename;
+        job.image = img;
+        queue.push(job);
+    }
+
+    //Blocks until every queued image is written, returns false if any write since the last wait() failed
+    bool wait() {
+        std::unique_lock<std::mutex> lock(mutex);
+        idle.wait(lock, [&] { return pending == 0; });
+        bool ok = !failed;
+        for(auto& container : containers) {
+            ok = container.second->flush() && ok;
+        }
+        failed = false;
+        return ok;
+    }
+
+    //File name the image ends up in for a PNM write: the extension replaced by .pgm or .ppm
+    static std::string pnmName(const std::string& filename, int channels) {
+        size_t dot = filename.find_last_of('.'), slash = filename.find_last_of('/');
+        std::string stem = dot == std::string::npos || (slash != std::string::npos && dot < slash) ? filename : filename.substr(0, dot);
+        return stem + (channels == 1 ? ".pgm" : ".ppm");
+    }
+
+private:
+    struct Job {
+        std::string filename;
+        cv::Mat image;
+        ImageOutputFormat format;
+        int compression;
+        std::string container;
+    };
+
+    void run() {
+        Job job;
+        while(queue.pop(job)) {
+            bool ok = false;
+            std::string reason;
+            try {
+                ok = store(job);
+            }
+            catch(const cv::Exception& e) {
+                reason = std::string(": ") + e.what();
+            }
+            job.image.release();
+            std::lock_guard<std::mutex> lock(mutex);
+            if(!ok) {
+                std::cout << "Failed to write " << job.filename << reason << std::endl;
+                failed = true;
+            }
+            if(--pending == 0) {
+                idle.notify_all();
+            }
+        }
+    }
+
+    bool store(const Job& job) {
+        if(job.format == OUTPUT_PNG) {
+            std::vector<int> params;
+            if(job.compression >= 0) {
+                params = {cv::IMWRITE_PNG_COMPRESSION, job.compression};
+            }
+            return profiled::imwrite(job.filename, job.image, params);
+        }
+        if(job.format == OUTPUT_PNM) {
+            return profiled::imwrite(pnmName(job.filename, job.image.channels()), job.image, {cv::IMWRITE_PXM_BINARY, 1});
+        }
+        //One open container per file, entries are appended one at a time under its own lock
+        std::shared_ptr<Container> container;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            std::shared_ptr<Container>& slot = containers[job.container];
+            if(!slot) {
+                slot = std::make_shared<Container>();
+            }
+            container = slot;
+        }
+        std::lock_guard<std::mutex> lock(container->mutex);
+        if(!container->writer.isOpen() && !container->writer.open(job.container)) {
+            return false;
+        }
+        size_t slash = job.filename.find_last_of('/');
+        return container->writer.add(slash == std::string::npos ? job.filename : job.filename.substr(slash + 1), job.image);
+    }
+
+    struct Container {
+        std::mutex mutex;
+        ImageContainerWriter writer;
+        bool flush() {
+            std::lock_guard<std::mutex> lock(mutex);
+            return writer.flush();
+        }
+        bool close() {
+            std::lock_guard<std::mutex> lock(mutex);
+            return writer.close();
+        }
+    };
+
+    BoundedQueue<Job> queue;
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable idle;
+    size_t pending = 0;
+    bool failed = false;
+    ImageOutputFormat format = OUTPUT_PNG;
+    int pngCompression = -1;
+    std::string containerFile;
+    std::map<std::string, std::shared_ptr<Container>> containers;
+};
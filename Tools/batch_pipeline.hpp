@@ -0,0 +1,190 @@
+#pragma once
+
+#include <opencv2/core.hpp>
+#include <opencv2/imgcodecs.hpp>
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "bounded_queue.hpp"
+#include "profiler.hpp"
+
+//One image on its way through the pipeline, process() fills outputs with (name, image) pairs
+struct BatchItem {
+    size_t index = 0;
+    std::string input;
+    cv::Mat image;
+    std::vector<std::pair<std::string, cv::Mat>> outputs;
+};
+
+struct BatchReport {
+    size_t images = 0;
+    size_t failed = 0;
+    size_t outputs = 0;
+    double seconds = 0;
+    double utilisation[3] = {0, 0, 0};  //Busy time / (wall time * workers) of decode, process and encode
+
+    double imagesPerSecond() const { return seconds > 0 ? images / seconds : 0; }
+
+    void print() const {
+        std::cout << images << " images (" << failed << " failed), " << outputs << " outputs in " << seconds << " s, "
+                  << imagesPerSecond() << " images/s" << std::endl;
+        const char* names[3] = {"decode", "process", "encode"};
+        for(int stage = 0; stage < 3; stage++) {
+            std::cout << "  " << names[stage] << " utilisation " << 100 * utilisation[stage] << "%" << std::endl;
+        }
+    }
+};
+
+/* Three-stage batch pipeline: decode -> process -> encode
+   1) Decode workers take the next input path, imread it and push it to the first queue
+   2) Process workers run the operation on it and push the outputs to the second queue
+   3) Encode workers imwrite every output as <output dir>/<input name>_<output name>.png
+   Each stage has its own pool of threads and the queues between them are bounded, so all three overlap and the
+   slowest stage sets the pace. Busy time is measured per stage, a stage well below 100% is waiting on its neighbours
+   and has more workers than it needs.
+*/
+class BatchPipeline {
+public:
+    BatchPipeline(int decoders, int processors, int encoders, size_t queueCapacity)
+        : workers{std::max(1, decoders), std::max(1, processors), std::max(1, encoders)}, capacity(queueCapacity) {}
+
+    //Extra imwrite parameters for the encode stage, e.g. {IMWRITE_PNG_COMPRESSION, 1}
+    void setWriteParams(const std::vector<int>& params) { writeParams = params; }
+
+    BatchReport run(const std::vector<std::string>& inputs, const std::string& outputDir,
+                    const std::function<void(BatchItem&)>& process) {
+        BoundedQueue<BatchItem> decoded(capacity), processed(capacity);
+        std::atomic<size_t> next(0), failed(0), written(0), done(0);
+        std::atomic<long long> busy[3];
+        std::atomic<int> running[2];
+        for(int stage = 0; stage < 3; stage++) {
+            busy[stage] = 0;
+        }
+        running[0] = workers[0];
+        running[1] = workers[1];
+
+        //Time spent inside the stage's own work, not waiting on a queue
+        auto timed = [&](int stage, const std::function<void()>& work) {
+            int64 start = cv::getTickCount();
+            work();
+            busy[stage] += cv::getTickCount() - start;
+        };
+
+        std::vector<std::thread> threads;
+        int64 start = cv::getTickCount();
+        for(int w = 0; w < workers[0]; w++) {
+            threads.emplace_back([&] {
+                for(size_t index = next++; index < inputs.size(); index = next++) {
+                    BatchItem item;
+                    item.index = index;
+                    item.input = inputs[index];
+                    timed(0, [&] {
+                        try {
+                            item.image = profiled::imread(item.input, cv::IMREAD_COLOR);
+                        }
+                        catch(const std::exception& e) {
+                            std::cout << "Failed to decode " << item.input << ": " << e.what() << std::endl;
+                            item.image.release();
+                        }
+                    });
+                    if(item.image.empty()) {
+                        std::cout << "Failed to read " << item.input << std::endl;
+                        failed++;
+                        continue;
+                    }
+                    decoded.push(std::move(item));
+                }
+                if(--running[0] == 0) {
+                    decoded.close();
+                }
+            });
+        }
+        for(int w = 0; w < workers[1]; w++) {
+            threads.emplace_back([&] {
+                BatchItem item;
+                while(decoded.pop(item)) {
+                    bool ok = true;
+                    timed(1, [&] {
+                        try {
+                            process(item);
+                        }
+                        //cv::Exception and anything else, bad_alloc on a huge frame or system_error from the cache, fails
+                        //only this image instead of terminating the batch from a worker thread
+                        catch(const std::exception& e) {
+                            std::cout << "Failed to process " << item.input << ": " << e.what() << std::endl;
+                            ok = false;
+                        }
+                    });
+                    if(!ok) {
+                        failed++;
+                        continue;
+                    }
+                    item.image.release();
+                    processed.push(std::move(item));
+                }
+                if(--running[1] == 0) {
+                    processed.close();
+                }
+            });
+        }
+        for(int w = 0; w < workers[2]; w++) {
+            threads.emplace_back([&] {
+                BatchItem item;
+                while(processed.pop(item)) {
+                    bool ok = true;
+                    timed(2, [&] {
+                        const std::string stem = baseName(item.input);
+                        for(const auto& output : item.outputs) {
+                            try {
+                                ok = profiled::imwrite(outputDir + "/" + stem + "_" + output.first + ".png", output.second, writeParams) && ok;
+                                written++;
+                            }
+                            catch(const std::exception& e) {
+                                std::cout << "Failed to write " << stem << "_" << output.first << ": " << e.what() << std::endl;
+                                ok = false;
+                            }
+                        }
+                    });
+                    if(!ok) {
+                        std::cout << "Failed to write the outputs of " << item.input << std::endl;
+                        failed++;
+                    }
+                    done++;
+                }
+            });
+        }
+        for(auto& thread : threads) {
+            thread.join();
+        }
+
+        BatchReport report;
+        report.seconds = (cv::getTickCount() - start) / cv::getTickFrequency();
+        report.images = done;
+        report.failed = failed;
+        report.outputs = written;
+        for(int stage = 0; stage < 3; stage++) {
+            report.utilisation[stage] = busy[stage] / cv::getTickFrequency() / std::max(1e-9, report.seconds * workers[stage]);
+        }
+        return report;
+    }
+
+private:
+    //File name without directory and extension
+    static std::string baseName(const std::string& path) {
+        size_t slash = path.find_last_of('/');
+        std::string name = slash == std::string::npos ? path : path.substr(slash + 1);
+        size_t dot = name.find_last_of('.');
+        return dot == std::string::npos ? name : name.substr(0, dot);
+    }
+
+    int workers[3];
+    size_t capacity;
+    std::vector<int> writeParams;
+};
@@ -0,0 +1,224 @@
+#include <opencv2/opencv.hpp>
+#include <iostream>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <sys/stat.h>
+#include "batch_pipeline.hpp"
+#include "derived_image_cache.hpp"
+#include "operation_graph.hpp"
+
+using namespace cv;
+using namespace std;
+
+typedef vector<pair<string, Mat>> Outputs;
+typedef function<void(const Mat&, Outputs&)> Operation;
+
+/* Operations the batch driver can run
+   Each one is a small graph over the operation library (operation_library.hpp), the same calls and parameters as the
+   single-image programs. Its input "image" is the decoded BGR image, its outputs are named like the imwrite names of
+   those programs.
+   With --cache the outputs are keyed by the whole graph text, every node with its parameters, so changing what an
+   operation computes misses the entries of the old graph instead of returning them.
+*/
+map<string, string> operationGraphs() {
+    map<string, string> graphs;
+    graphs["gray"] = "input image\n"
+                     "gray_img = gray image\n"
+                     "output gray_img\n";
+    graphs["hsv"] = "input image\n"
+                    "hsv_img = hsv image\n"
+                    "output hsv_img\n";
+    graphs["threshold"] = "input image\n"
+                          "gray = gray image\n"
+                          "binaryThresholded_img = threshold gray thresh=127 maxval=255 type=0\n"
+                          "output binaryThresholded_img\n";
+    graphs["equalize"] = "input image\n"
+                         "gray = gray image\n"
+                         "histEqualization_img = equalize gray\n"
+                         "output histEqualization_img\n";
+    graphs["sobel"] = "input image\n"
+                      "gray = gray image\n"
+                      "dx_sobel_img = sobel gray dx=0 dy=1 ksize=3 scale=1 delta=1\n"
+                      "dy_sobel_img = sobel gray dx=1 dy=0 ksize=3 scale=1 delta=1\n"
+                      "laplacian_img = laplacian gray ksize=1 scale=1 delta=1\n"
+                      "output dx_sobel_img dy_sobel_img laplacian_img\n";
+    graphs["pyramid"] = "input image\n"
+                        "gray = gray image\n"
+                        "level1 = pyrdown gray\n"
+                        "level2 = pyrdown level1\n"
+                        "level3 = pyrdown level2\n"
+                        "lowerRes_img = pyrdown level3\n"
+                        "laplacianPyramid0_img = pyrlaplacian gray level=0 offset=128\n"
+                        "output lowerRes_img laplacianPyramid0_img\n";
+    graphs["rotate"] = "input image\n"
+                       "rotated_img = rotate image angle=45 scale=1\n"
+                       "output rotated_img\n";
+    return graphs;
+}
+
+//The graph run on the calling worker, every worker shares the parsed graph
+Operation graphOperation(const string& text) {
+    shared_ptr<OperationGraph> graph = make_shared<OperationGraph>();
+    string error;
+    CV_Assert(graph->parse(text, error));
+    return [graph](const Mat& img, Outputs& out) {
+        graph->evaluate({{"image", img}}, out);
+    };
+}
+
+bool isDirectory(const string& path) {
+    struct stat info;
+    return stat(path.c_str(), &info) == 0 && S_ISDIR(info.st_mode);
+}
+
+/* Input list
+   A directory is searched (not recursively) for image files, anything else is read as a text file with one image
+   path per line.
+*/
+vector<string> listInputs(const string& input) {
+    vector<string> inputs;
+    if(isDirectory(input)) {
+        const string extensions[] = {".jpg", ".jpeg", ".png", ".bmp", ".tif", ".tiff", ".ppm", ".pgm", ".webp"};
+        vector<string> files;
+        glob(input + "/*", files, false);
+        for(const string& file : files) {
+            string lower = file;
+            transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+            for(const string& extension : extensions) {
+                if(lower.size() > extension.size() && lower.compare(lower.size() - extension.size(), extension.size(), extension) == 0) {
+                    inputs.push_back(file);
+                    break;
+                }
+            }
+        }
+        return inputs;
+    }
+    ifstream list(input);
+    string line;
+    while(getline(list, line)) {
+        if(!line.empty()) {
+            inputs.push_back(line);
+        }
+    }
+    return inputs;
+}
+
+int main(int argc, char** argv) {
+    map<string, string> ops = operationGraphs();
+    if(argc < 4) {
+        cout << "Usage: " << argv[0] << " <input dir | file list> <output dir> <operation>[,<operation>...]" << endl;
+        cout << "       [--decoders N] [--workers N] [--encoders N] [--queue N] [--compression 0-9] [--profile trace.json]" << endl;
+        cout << "       [--cache dir] [--cache-mb N]" << endl;
+        cout << "Operations:";
+        for(const auto& op : ops) {
+            cout << " " << op.first;
+        }
+        cout << endl;
+        return 1;
+    }
+
+    //Requested operations, run one after the other on every image, profiled under their names and cached under their graphs
+    vector<pair<const char*, Operation>> selected;
+    vector<string> cacheKeys;
+    stringstream names(argv[3]);
+    string name;
+    while(getline(names, name, ',')) {
+        if(ops.find(name) == ops.end()) {
+            cout << "Unknown operation " << name << endl;
+            return 1;
+        }
+        selected.push_back(make_pair(Profiler::get().intern(name), graphOperation(ops[name])));
+        cacheKeys.push_back("batch " + ops[name]);
+    }
+
+    /* Pool sizes
+       Decoding and encoding each get a quarter of the cores by default, processing gets the rest. OpenCV's own
+       threading is switched off, the batch is already parallel across images.
+    */
+    const int cores = max(1, getNumberOfCPUs());
+    int decoders = max(1, cores / 4), encoders = max(1, cores / 4), workers = max(1, cores - decoders - encoders);
+    int queue = 2 * cores, compression = -1, cacheMB = 4096;
+    string profile, cacheDir;
+    for(int i = 4; i + 1 < argc; i += 2) {
+        string option = argv[i];
+        int value = atoi(argv[i + 1]);
+        if(option == "--profile") profile = argv[i + 1];
+        else if(option == "--decoders") decoders = value;
+        else if(option == "--workers") workers = value;
+        else if(option == "--encoders") encoders = value;
+        else if(option == "--queue") queue = value;
+        else if(option == "--compression") compression = value;
+        else if(option == "--cache") cacheDir = argv[i + 1];
+        else if(option == "--cache-mb") cacheMB = value;
+        else {
+            cout << "Unknown option " << option << endl;
+            return 1;
+        }
+    }
+
+    vector<string> inputs = listInputs(argv[1]);
+    if(inputs.empty()) {
+        cout << "No input images found in " << argv[1] << endl;
+        return 1;
+    }
+    const string outputDir = argv[2];
+    if(!isDirectory(outputDir) && mkdir(outputDir.c_str(), 0755) != 0) {
+        cout << "Failed to create output directory " << outputDir << endl;
+        return 1;
+    }
+
+    /* Derived image cache
+       Outputs are stored in cacheDir by the content of the decoded image and the operation, so reprocessing a batch
+       only maps the stored results of every image that did not change. Each image is seen once per run, so there is
+       no memory tier: every hit comes from the directory.
+    */
+    unique_ptr<DerivedImageCache> cache;
+    if(!cacheDir.empty()) {
+        cache.reset(new DerivedImageCache(0));
+        if(!cache->setDirectory(cacheDir, (size_t)max(1, cacheMB) << 20)) {
+            cout << "Failed to create cache directory " << cacheDir << endl;
+            return 1;
+        }
+    }
+
+    setNumThreads(1);
+    if(!profile.empty()) {
+        Profiler::get().enable();
+    }
+    BatchPipeline pipeline(decoders, workers, encoders, queue);
+    if(compression >= 0) {
+        pipeline.setWriteParams({IMWRITE_PNG_COMPRESSION, compression});
+    }
+    cout << inputs.size() << " images, " << decoders << " decoders, " << workers << " workers, " << encoders << " encoders" << endl;
+    BatchReport report = pipeline.run(inputs, outputDir, [&](BatchItem& item) {
+        //Hashed once, every operation on the image shares the hash
+        const uint64_t imageHash = cache ? cache->hash(item.image) : 0;
+        for(size_t i = 0; i < selected.size(); i++) {
+            const auto& op = selected[i];
+            PROFILE_SCOPE(op.first, item.image);
+            if(cache) {
+                Outputs outputs = cache->getByHash(vector<uint64_t>(1, imageHash), cacheKeys[i], [&](Outputs& out) {
+                    op.second(item.image, out);
+                });
+                item.outputs.insert(item.outputs.end(), outputs.begin(), outputs.end());
+            }
+            else {
+                op.second(item.image, item.outputs);
+            }
+        }
+    });
+    report.print();
+    if(cache) {
+        cache->getStats().print();
+    }
+    if(!profile.empty()) {
+        Profiler::get().printSummary();
+        if(!Profiler::get().writeChromeTrace(profile)) {
+            cout << "Failed to write " << profile << endl;
+        }
+    }
+
+    return report.failed == 0 ? 0 : 1;
+}
\ No newline at end of file
@@ -0,0 +1,212 @@
+#include <opencv2/opencv.hpp>
+#include <iostream>
+#include "kernel_benchmarks.hpp"
+
+using namespace cv;
+using namespace std;
+
+//Comma separated list of an option's values
+vector<string> splitList(const string& text) {
+    vector<string> items;
+    istringstream cells(text);
+    for(string cell; getline(cells, cell, ',');) {
+        if(!cell.empty()) {
+            items.push_back(cell);
+        }
+    }
+    return items;
+}
+
+//vga, 720p, 1080p, 4k, 12mp, 50mp or WIDTHxHEIGHT, an empty size if the name is neither
+Size parseSize(const string& name) {
+    static const map<string, Size> presets = {{"vga", Size(640, 480)}, {"720p", Size(1280, 720)}, {"1080p", Size(1920, 1080)},
+                                              {"4k", Size(3840, 2160)}, {"12mp", Size(4000, 3000)}, {"50mp", Size(8160, 6120)}};
+    auto it = presets.find(name);
+    if(it != presets.end()) {
+        return it->second;
+    }
+    int width = 0, height = 0;
+    char x = 0;
+    istringstream text(name);
+    if(text >> width >> x >> height && x == 'x' && width > 0 && height > 0) {
+        return Size(width, height);
+    }
+    return Size();
+}
+
+/* Synthetic input
+   Smooth random structure (a coarse random grid, upsampled) with fine noise on top, so the histogram is spread like a
+   photo's and no kernel hits a fast path a flat or purely random image would. Fixed seed, the same image every run.
+*/
+Mat syntheticImage(Size size) {
+    RNG rng(0x5eed);
+    Mat coarse(max(2, size.height / 32), max(2, size.width / 32), CV_8UC3), noise(size, CV_8UC3), img;
+    rng.fill(coarse, RNG::UNIFORM, 0, 256);
+    resize(coarse, img, size, 0, 0, INTER_CUBIC);
+    rng.fill(noise, RNG::NORMAL, 128, 8);
+    addWeighted(img, 1, noise, 1, -128, img);
+    return img;
+}
+
+//Time of one run in ms, repeated until minSeconds have passed (at least 3 and at most 100 runs) after a warm-up
+BenchmarkResult timeKernel(const function<void()>& kernel, double minSeconds) {
+    kernel();
+    vector<double> times;
+    double total = 0;
+    while(times.size() < 3 || (total < minSeconds && times.size() < 100)) {
+        int64 start = getTickCount();
+        kernel();
+        double ms = (getTickCount() - start) * 1000.0 / getTickFrequency();
+        times.push_back(ms);
+        total += ms / 1000;
+    }
+    sort(times.begin(), times.end());
+    BenchmarkResult result;
+    result.repeats = (int)times.size();
+    result.medianMs = times[times.size() / 2];
+    result.minMs = times[0];
+    return result;
+}
+
+int main(int argc, char** argv) {
+    if(argc >= 2 && string(argv[1]) == "--compare") {
+        if(argc < 4) {
+            cout << "Usage: " << argv[0] << " --compare <base.csv> <current.csv> [--tolerance percent]" << endl;
+            return 1;
+        }
+        double tolerance = 5;
+        for(int i = 4; i < argc; i++) {
+            string option = argv[i];
+            if(option == "--tolerance" && i + 1 < argc) tolerance = atof(argv[++i]);
+            else {
+                cout << "Unknown option " << option << endl;
+                return 1;
+            }
+        }
+        vector<BenchmarkResult> base, current;
+        string error;
+        if(!loadBenchmarkResults(argv[2], base, error) || !loadBenchmarkResults(argv[3], current, error)) {
+            cout << "Invalid results, " << error << endl;
+            return 1;
+        }
+        //Non-zero exit status on any slowdown, so a script can fail on it
+        return compareBenchmarkResults(base, current, tolerance / 100) > 0 ? 2 : 0;
+    }
+
+    //Thread counts default to 1, the powers of two below the core count and the core count
+    vector<int> threads;
+    for(int t = 1; t < getNumberOfCPUs(); t *= 2) {
+        threads.push_back(t);
+    }
+    threads.push_back(getNumberOfCPUs());
+    vector<string> sizeNames = {"vga", "720p", "1080p", "4k", "12mp", "50mp"}, inputs = {"synthetic", "pictures"};
+    string pictures = "Pictures", filter, output;
+    double minSeconds = 0.5;
+    for(int i = 1; i < argc; i++) {
+        string option = argv[i];
+        if(option == "--list") {
+            for(const KernelBenchmark& benchmark : kernelBenchmarks()) {
+                cout << benchmark.name << endl;
+            }
+            return 0;
+        }
+        else if(option == "--sizes" && i + 1 < argc) sizeNames = splitList(argv[++i]);
+        else if(option == "--inputs" && i + 1 < argc) inputs = splitList(argv[++i]);
+        else if(option == "--pictures" && i + 1 < argc) pictures = argv[++i];
+        else if(option == "--filter" && i + 1 < argc) filter = argv[++i];
+        else if(option == "--min-time" && i + 1 < argc) minSeconds = atof(argv[++i]);
+        else if(option == "--output" && i + 1 < argc) output = argv[++i];
+        else if(option == "--threads" && i + 1 < argc) {
+            threads.clear();
+            for(const string& count : splitList(argv[++i])) {
+                threads.push_back(max(1, atoi(count.c_str())));
+            }
+        }
+        else {
+            cout << "Usage: " << argv[0] << " [--sizes vga,720p,1080p,4k,12mp,50mp,WxH] [--threads 1,2,4] [--inputs synthetic,pictures]"
+                 << " [--pictures dir] [--filter name] [--min-time seconds] [--output results.csv] [--list]" << endl;
+            cout << "       " << argv[0] << " --compare <base.csv> <current.csv> [--tolerance percent]" << endl;
+            return 1;
+        }
+    }
+
+    vector<Size> sizes;
+    for(const string& name : sizeNames) {
+        sizes.push_back(parseSize(name));
+        if(sizes.back().area() == 0) {
+            cout << "Unknown size " << name << endl;
+            return 1;
+        }
+    }
+    //Every picture is read once and stretched to each size below
+    vector<pair<string, Mat>> sources;
+    for(const string& input : inputs) {
+        if(input == "synthetic") {
+            sources.push_back(make_pair(input, Mat()));
+        }
+        else if(input == "pictures") {
+            vector<string> files;
+            glob(pictures + "/*", files);
+            for(const string& file : files) {
+                Mat img = imread(file, IMREAD_COLOR);
+                if(!img.empty()) {
+                    string stem = file.substr(file.find_last_of('/') + 1);
+                    sources.push_back(make_pair(stem.substr(0, stem.find('.')), img));
+                }
+            }
+        }
+        else {
+            cout << "Unknown input " << input << endl;
+            return 1;
+        }
+    }
+    if(sources.empty()) {
+        cout << "No inputs" << endl;
+        return 1;
+    }
+
+    ofstream file;
+    if(!output.empty()) {
+        file.open(output);
+        if(!file) {
+            cout << "Failed to write " << output << endl;
+            return 1;
+        }
+        file << BENCHMARK_CSV_HEADER << endl;
+    }
+    cout << BENCHMARK_CSV_HEADER << endl;
+    const int defaultThreads = getNumThreads();
+    for(Size size : sizes) {
+        for(const auto& source : sources) {
+            Mat img;
+            if(source.second.empty()) {
+                img = syntheticImage(size);
+            }
+            else {
+                resize(source.second, img, size, 0, 0, size.area() < source.second.size().area() ? INTER_AREA : INTER_CUBIC);
+            }
+            for(const KernelBenchmark& benchmark : kernelBenchmarks()) {
+                if(!filter.empty() && benchmark.name.find(filter) == string::npos) {
+                    continue;
+                }
+                //Inputs are built once per size, the thread counts share them
+                setNumThreads(defaultThreads);
+                function<void()> kernel = benchmark.prepare(img);
+                for(int count : threads) {
+                    setNumThreads(count);
+                    BenchmarkResult result = timeKernel(kernel, minSeconds);
+                    result.benchmark = benchmark.name;
+                    result.input = source.first;
+                    result.size = size;
+                    result.threads = count;
+                    cout << formatBenchmarkResult(result) << endl;
+                    if(file.is_open()) {
+                        file << formatBenchmarkResult(result) << endl;
+                    }
+                }
+            }
+        }
+    }
+    setNumThreads(defaultThreads);
+    return 0;
+}
\ No newline at end of file
@@ -0,0 +1,644 @@
+#pragma once
+
+#include <opencv2/core.hpp>
+#include <opencv2/imgcodecs.hpp>
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <functional>
+#include <iostream>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+typedef std::vector<std::pair<std::string, cv::Mat>> NamedImages;
+
+/* 64-bit content hash
+   Four independent lanes of 8-byte words so the multiplies overlap and the hash keeps up with memory. Images are
+   hashed row by row with their size and type, so the hash depends on the pixels only, not on the row padding or
+   whether the Mat is a view. Not cryptographic: two different inputs colliding by accident is a 2^-64 event.
+*/
+inline uint64_t hashMix(uint64_t h, uint64_t v) {
+    h ^= v * 0x9e3779b97f4a7c15ull;
+    h = (h << 31) | (h >> 33);
+    return h * 0xbf58476d1ce4e5b9ull;
+}
+
+inline uint64_t hashFinish(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ull;
+    return h ^ (h >> 33);
+}
+
+inline uint64_t hashBytes(const void* data, size_t length, uint64_t seed) {
+    const uchar* bytes = static_cast<const uchar*>(data);
+    uint64_t lanes[4] = {seed, seed ^ 0x5851f42d4c957f2dull, seed ^ 0x14057b7ef767814full, seed ^ 0x2545f4914f6cdd1dull};
+    size_t i = 0;
+    for(; i + 32 <= length; i += 32) {
+        for(int k = 0; k < 4; k++) {
+            uint64_t word;
+            memcpy(&word, bytes + i + 8 * k, 8);
+            lanes[k] = hashMix(lanes[k], word);
+        }
+    }
+    uint64_t h = hashMix(hashMix(hashMix(hashMix(length, lanes[0]), lanes[1]), lanes[2]), lanes[3]);
+    for(; i < length; i += 8) {
+        uint64_t word = 0;
+        memcpy(&word, bytes + i, std::min<size_t>(8, length - i));
+        h = hashMix(h, word);
+    }
+    return h;
+}
+
+inline uint64_t hashImage(const cv::Mat& img) {
+    CV_Assert(img.dims <= 2);
+    uint64_t h = hashMix(hashMix(hashMix(0, img.rows), img.cols), img.type());
+    const size_t rowBytes = img.cols * img.elemSize();
+    for(int y = 0; y < img.rows; y++) {
+        h = hashBytes(img.ptr(y), rowBytes, h);
+    }
+    return hashFinish(h);
+}
+
+/* Cache entry format (.dic)
+   One file per entry, named by its key in hex. The outputs of one operation, uncompressed, the same layout as the
+   .imc container with the index in front so a reader needs a single mapping:
+       [0..63]   magic "DIC1", uint32 version (1), uint64 key, uint32 image count, uint32 operation length,
+                 uint64 file size, zero
+       [64..]    the operation, then per image: uint32 name length, name, int32 rows, cols, type, uint64 content
+                 hash, uint64 offset
+       [...]     image data, each image's rows packed and starting on a 64 byte boundary
+   The operation is kept to tell two keys that collide apart, the file size to reject a truncated file.
+*/
+struct DerivedImageHeader {
+    char magic[4];
+    uint32_t version;
+    uint64_t key;
+    uint32_t count;
+    uint32_t operationLength;
+    uint64_t fileSize;
+    char reserved[32];
+};
+
+static const char DERIVED_IMAGE_MAGIC[4] = {'D', 'I', 'C', '1'};
+static const uint32_t DERIVED_IMAGE_VERSION = 1;
+
+/* Mats over a file mapping
+   Every image of a mapped entry shares one UMatData whose refcount counts the Mats, the last one released unmaps the
+   file. The mapping is private and writable, so writing into a result never reaches the file, but results are shared
+   with the cache and must be treated as read-only anyway. Only wraps, new buffers come from the standard allocator.
+*/
+class MappedFileAllocator : public cv::MatAllocator {
+public:
+    static MappedFileAllocator* get() {
+        static MappedFileAllocator* allocator = new MappedFileAllocator();   //Never destroyed, Mats may outlive main()
+        return allocator;
+    }
+
+    //Headers for the images at offsets inside [base, base + length), the mapping is handed over to them
+    std::vector<cv::Mat> wrap(void* base, size_t length, const std::vector<cv::Vec3i>& shapes, const std::vector<size_t>& offsets) const {
+        std::vector<cv::Mat> images;
+        if(shapes.empty()) {
+            munmap(base, length);
+            return images;
+        }
+        cv::UMatData* u = new cv::UMatData(this);
+        u->data = u->origdata = static_cast<uchar*>(base);
+        u->size = length;
+        u->handle = base;
+        for(size_t i = 0; i < shapes.size(); i++) {
+            cv::Mat img(shapes[i][0], shapes[i][1], shapes[i][2], static_cast<uchar*>(base) + offsets[i]);
+            img.u = u;
+            u->refcount++;
+            images.push_back(img);
+        }
+        return images;
+    }
+
+    cv::UMatData* allocate(int dims, const int* sizes, int type, void* data, size_t* step, cv::AccessFlag flags,
+                           cv::UMatUsageFlags usageFlags) const override {
+        return cv::Mat::getStdAllocator()->allocate(dims, sizes, type, data, step, flags, usageFlags);
+    }
+
+    bool allocate(cv::UMatData* data, cv::AccessFlag accessFlags, cv::UMatUsageFlags usageFlags) const override {
+        return cv::Mat::getStdAllocator()->allocate(data, accessFlags, usageFlags);
+    }
+
+    void deallocate(cv::UMatData* u) const override {
+        if(u) {
+            munmap(u->handle, u->size);
+            delete u;
+        }
+    }
+};
+
+struct DerivedCacheStats {
+    size_t memoryHits = 0;
+    size_t diskHits = 0;
+    size_t misses = 0;
+    size_t memoryEvictions = 0;
+    size_t diskEvictions = 0;
+    size_t memoryEntries = 0;
+    size_t memoryBytes = 0;
+    size_t diskBytes = 0;
+    double computeSeconds = 0;          //Spent computing the misses
+
+    void print() const {
+        const size_t lookups = memoryHits + diskHits + misses;
+        std::cout << lookups << " lookups: " << memoryHits << " memory hits, " << diskHits << " disk hits, " << misses
+                  << " misses (" << (lookups ? 100.0 * (memoryHits + diskHits) / lookups : 0) << "% hit rate), "
+                  << computeSeconds * 1000 << " ms computing" << std::endl;
+        std::cout << "  memory " << memoryEntries << " entries, " << memoryBytes / (1024.0 * 1024.0) << " MB, "
+                  << memoryEvictions << " evicted; disk " << diskBytes / (1024.0 * 1024.0) << " MB, " << diskEvictions
+                  << " evicted" << std::endl;
+    }
+};
+
+/* Content-addressed cache of derived images
+   A result is keyed by the content hash of its inputs and the operation that made it, a string holding the name and
+   every parameter ("gaussian ksize=5 sigma=1.5"). Asking again for the same operation on the same pixels is a lookup:
+   1) Memory: an LRU list of entries up to a byte limit, a hit returns the stored Mats without copying
+   2) Disk (after setDirectory): one .dic file per entry up to its own byte limit. A hit maps the file and returns Mats
+      over the mapping, nothing is decoded or copied, and moves the entry into memory. Files are written to a temporary
+      name and renamed, so several processes can share a directory. The least recently used files, by modification
+      time, which a hit refreshes, are deleted when the directory grows past its limit.
+   3) Miss: compute() runs outside the lock and its outputs are stored in both tiers
+   The content hash of every image the cache holds is remembered, so chaining operations on cached results (gray of an
+   imread, pyrdown of that gray) does not hash their pixels again. Results are shared between callers: never write into
+   one. Two threads missing on the same key at once both compute it, the outputs are the same.
+*/
+class DerivedImageCache {
+public:
+    explicit DerivedImageCache(size_t memoryLimitBytes = (size_t)512 << 20) : memoryLimit(memoryLimitBytes) {}
+    DerivedImageCache(const DerivedImageCache&) = delete;
+    DerivedImageCache& operator=(const DerivedImageCache&) = delete;
+
+    /* One cache per process for the chapter programs
+       Memory only, unless IMAGE_CACHE=<dir> is set in the environment, then results also persist in that directory
+       (IMAGE_CACHE_MB sets its size limit) and a rerun, or another program on the same picture, finds them there.
+       With the directory set the statistics are printed at exit.
+    */
+    static DerivedImageCache& shared() {
+        static DerivedImageCache cache;
+        static const bool disk = [] {
+            const char* directory = std::getenv("IMAGE_CACHE");
+            const char* megabytes = std::getenv("IMAGE_CACHE_MB");
+            if(!directory || !*directory ||
+               !cache.setDirectory(directory, megabytes ? (size_t)std::atoll(megabytes) << 20 : (size_t)4 << 30)) {
+                return false;
+            }
+            //Registered once the cache is fully constructed, so the exit handler runs before its destructor
+            std::atexit([] { shared().getStats().print(); });
+            return true;
+        }();
+        (void)disk;
+        return cache;
+    }
+
+    /* Adds the disk tier, creating the directory if needed
+       Existing entries in it are kept and counted, the oldest trimmed as evictDisk() would if they are over the limit.
+       Temporaries left behind by a writer that died are removed.
+    */
+    bool setDirectory(const std::string& path, size_t diskLimitBytes = (size_t)4 << 30) {
+        struct stat info;
+        if(!(stat(path.c_str(), &info) == 0 && S_ISDIR(info.st_mode)) && mkdir(path.c_str(), 0755) != 0) {
+            return false;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            directory = path;
+            diskLimit = diskLimitBytes;
+        }
+        evictDisk();
+        return true;
+    }
+
+    void setMemoryLimit(size_t bytes) {
+        std::lock_guard<std::mutex> lock(mutex);
+        memoryLimit = bytes;
+        evictMemory();
+    }
+
+    //Content hash of an image, free for an image the cache holds
+    uint64_t hash(const cv::Mat& img) const {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto it = knownHashes.find(img.data);
+            if(it != knownHashes.end() && it->second.matches(img)) {
+                return it->second.hash;
+            }
+        }
+        return hashImage(img);
+    }
+
+    //Key of an operation on inputs with these content hashes
+    static uint64_t key(const std::vector<uint64_t>& inputHashes, const std::string& operation) {
+        uint64_t h = hashBytes(operation.data(), operation.size(), inputHashes.size());
+        for(uint64_t inputHash : inputHashes) {
+            h = hashMix(h, inputHash);
+        }
+        return hashFinish(h);
+    }
+
+    //Every named output of operation on the inputs with these hashes, compute() fills them on a miss
+    NamedImages getByHash(const std::vector<uint64_t>& inputHashes, const std::string& operation,
+                          const std::function<void(NamedImages&)>& compute) {
+        const uint64_t entryKey = key(inputHashes, operation);
+        NamedImages images;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto it = index.find(entryKey);
+            if(it != index.end() && it->second->operation == operation) {
+                lru.splice(lru.begin(), lru, it->second);
+                stats.memoryHits++;
+                return it->second->images;
+            }
+        }
+        std::vector<uint64_t> hashes;
+        const std::string path = entryPath(entryKey);
+        if(!path.empty() && loadEntry(path, entryKey, operation, images, hashes)) {
+            utimensat(AT_FDCWD, path.c_str(), nullptr, 0);
+            std::lock_guard<std::mutex> lock(mutex);
+            stats.diskHits++;
+            remember(entryKey, operation, images, hashes);
+            return images;
+        }
+
+        const int64 start = cv::getTickCount();
+        compute(images);
+        const double seconds = (cv::getTickCount() - start) / cv::getTickFrequency();
+        for(const auto& image : images) {
+            hashes.push_back(hashImage(image.second));
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stats.misses++;
+            stats.computeSeconds += seconds;
+            remember(entryKey, operation, images, hashes);
+        }
+        if(!path.empty()) {
+            const size_t written = storeEntry(path, entryKey, operation, images, hashes);
+            bool trim = false;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                diskBytes += written;
+                trim = diskBytes > diskLimit;
+            }
+            if(trim) {
+                evictDisk();
+            }
+        }
+        return images;
+    }
+
+    NamedImages get(const std::vector<cv::Mat>& inputs, const std::string& operation, const std::function<void(NamedImages&)>& compute) {
+        std::vector<uint64_t> inputHashes;
+        for(const cv::Mat& input : inputs) {
+            inputHashes.push_back(hash(input));
+        }
+        return getByHash(inputHashes, operation, compute);
+    }
+
+    //The single output of operation on input
+    cv::Mat get(const cv::Mat& input, const std::string& operation, const std::function<void(const cv::Mat&, cv::Mat&)>& compute) {
+        NamedImages images = get(std::vector<cv::Mat>(1, input), operation, [&](NamedImages& out) {
+            cv::Mat dst;
+            compute(input, dst);
+            out.push_back(std::make_pair(std::string(), dst));
+        });
+        return images.empty() ? cv::Mat() : images[0].second;
+    }
+
+    /* imread through the cache
+       The key is the hash of the file's bytes and the flags, so a hit skips the decoding and an edited file misses.
+       Returns an empty Mat like imread when the file cannot be read or decoded.
+    */
+    cv::Mat imread(const std::string& filename, int flags = cv::IMREAD_COLOR) {
+        std::vector<uchar> bytes;
+        FILE* file = fopen(filename.c_str(), "rb");
+        if(!file) {
+            return cv::Mat();
+        }
+        bool ok = fseek(file, 0, SEEK_END) == 0;
+        const long length = ftell(file);
+        ok = ok && length > 0 && fseek(file, 0, SEEK_SET) == 0;
+        if(ok) {
+            bytes.resize((size_t)length);
+            ok = fread(bytes.data(), 1, bytes.size(), file) == bytes.size();
+        }
+        fclose(file);
+        if(!ok) {
+            return cv::Mat();
+        }
+        const uint64_t fileHash = hashFinish(hashBytes(bytes.data(), bytes.size(), 0));
+        NamedImages images = getByHash(std::vector<uint64_t>(1, fileHash), "imread flags=" + std::to_string(flags), [&](NamedImages& out) {
+            cv::Mat img = cv::imdecode(bytes, flags);
+            if(!img.empty()) {
+                out.push_back(std::make_pair(std::string(), img));
+            }
+        });
+        return images.empty() ? cv::Mat() : images[0].second;
+    }
+
+    DerivedCacheStats getStats() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        DerivedCacheStats current = stats;
+        current.memoryEntries = lru.size();
+        current.memoryBytes = memoryBytes;
+        current.diskBytes = diskBytes;
+        return current;
+    }
+
+    //Drops the memory tier, the disk tier is kept
+    void clearMemory() {
+        std::lock_guard<std::mutex> lock(mutex);
+        while(!lru.empty()) {
+            dropBack();
+        }
+    }
+
+private:
+    struct Entry {
+        uint64_t key;
+        std::string operation;
+        NamedImages images;
+        size_t bytes;
+    };
+
+    struct KnownHash {
+        int rows, cols, type;
+        size_t step;
+        uint64_t hash;
+        bool matches(const cv::Mat& img) const {
+            return img.rows == rows && img.cols == cols && img.type() == type && (img.rows <= 1 || img.step[0] == step);
+        }
+    };
+
+    //Called with the lock held
+    void remember(uint64_t entryKey, const std::string& operation, const NamedImages& images, const std::vector<uint64_t>& hashes) {
+        if(index.count(entryKey)) {
+            return;
+        }
+        Entry entry = {entryKey, operation, images, 0};
+        for(const auto& image : images) {
+            entry.bytes += image.second.total() * image.second.elemSize();
+        }
+        if(entry.bytes > memoryLimit) {
+            return;
+        }
+        for(size_t i = 0; i < images.size(); i++) {
+            const cv::Mat& img = images[i].second;
+            knownHashes[img.data] = KnownHash{img.rows, img.cols, img.type(), img.step[0], hashes[i]};
+        }
+        lru.push_front(entry);
+        index[entryKey] = lru.begin();
+        memoryBytes += entry.bytes;
+        evictMemory();
+    }
+
+    void evictMemory() {
+        while(memoryBytes > memoryLimit && !lru.empty()) {
+            dropBack();
+            stats.memoryEvictions++;
+        }
+    }
+
+    void dropBack() {
+        const Entry& entry = lru.back();
+        for(const auto& image : entry.images) {
+            knownHashes.erase(image.second.data);
+        }
+        memoryBytes -= entry.bytes;
+        index.erase(entry.key);
+        lru.pop_back();
+    }
+
+    std::string entryPath(uint64_t entryKey) const {
+        std::lock_guard<std::mutex> lock(mutex);
+        if(directory.empty()) {
+            return std::string();
+        }
+        char name[32];
+        snprintf(name, sizeof(name), "/%016llx.dic", (unsigned long long)entryKey);
+        return directory + name;
+    }
+
+    //Name of a file storeEntry() is still writing, or one its process left behind when it died
+    static bool isTemporary(const std::string& name) {
+        return name.find(".dic.tmp", name.rfind('/') + 1) != std::string::npos;
+    }
+
+    //The .dic files and the temporaries of the directory with their size and modification time
+    static std::vector<std::pair<std::string, std::pair<size_t, int64_t>>> listEntries(const std::string& directory) {
+        std::vector<std::pair<std::string, std::pair<size_t, int64_t>>> files;
+        DIR* dir = opendir(directory.c_str());
+        if(!dir) {
+            return files;
+        }
+        while(dirent* item = readdir(dir)) {
+            const std::string name = item->d_name;
+            struct stat info;
+            const bool entry = name.size() > 4 && name.compare(name.size() - 4, 4, ".dic") == 0;
+            if((entry || isTemporary(name)) && stat((directory + "/" + name).c_str(), &info) == 0) {
+                files.push_back(std::make_pair(directory + "/" + name, std::make_pair((size_t)info.st_size,
+                                (int64_t)info.st_mtim.tv_sec * 1000000000 + info.st_mtim.tv_nsec)));
+            }
+        }
+        closedir(dir);
+        return files;
+    }
+
+    /* Deletes the least recently used files down to 90% of the limit, one process-wide scan at a time
+       Temporaries older than a minute are deleted first whatever the size, a writer renames its file into place well
+       before that. Younger ones count towards the size but are left to their writer.
+    */
+    void evictDisk() {
+        std::lock_guard<std::mutex> trimming(diskMutex);
+        std::string path;
+        size_t limit;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            path = directory;
+            limit = diskLimit / 10 * 9;
+        }
+        std::vector<std::pair<std::string, std::pair<size_t, int64_t>>> files = listEntries(path);
+        std::sort(files.begin(), files.end(), [](const std::pair<std::string, std::pair<size_t, int64_t>>& a,
+                                                 const std::pair<std::string, std::pair<size_t, int64_t>>& b) {
+            return a.second.second < b.second.second;
+        });
+        const int64_t stale = ((int64_t)std::time(nullptr) - 60) * 1000000000;
+        size_t total = 0;
+        for(auto& file : files) {
+            if(isTemporary(file.first) && file.second.second < stale && unlink(file.first.c_str()) == 0) {
+                file.first.clear();
+            }
+            else {
+                total += file.second.first;
+            }
+        }
+        size_t evicted = 0;
+        for(size_t i = 0; i < files.size() && total > limit; i++) {
+            if(!files[i].first.empty() && !isTemporary(files[i].first) && unlink(files[i].first.c_str()) == 0) {
+                total -= files[i].second.first;
+                evicted++;
+            }
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        diskBytes = total;
+        stats.diskEvictions += evicted;
+    }
+
+    //Writes the entry under a temporary name and renames it into place, returns the bytes written or 0 on failure
+    static size_t storeEntry(const std::string& path, uint64_t entryKey, const std::string& operation, const NamedImages& images,
+                             const std::vector<uint64_t>& hashes) {
+        static std::atomic<unsigned> counter(0);
+        const std::string temporary = path + ".tmp" + std::to_string(getpid()) + "_" + std::to_string(counter++);
+        FILE* file = fopen(temporary.c_str(), "wb");
+        if(!file) {
+            return 0;
+        }
+        //Index size first, every offset depends on it
+        size_t position = sizeof(DerivedImageHeader) + operation.size();
+        for(const auto& image : images) {
+            position += sizeof(uint32_t) + image.first.size() + 3 * sizeof(int32_t) + 2 * sizeof(uint64_t);
+        }
+        std::vector<uint64_t> offsets;
+        for(const auto& image : images) {
+            position += (64 - position % 64) % 64;
+            offsets.push_back(position);
+            position += image.second.total() * image.second.elemSize();
+        }
+
+        DerivedImageHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, DERIVED_IMAGE_MAGIC, 4);
+        header.version = DERIVED_IMAGE_VERSION;
+        header.key = entryKey;
+        header.count = (uint32_t)images.size();
+        header.operationLength = (uint32_t)operation.size();
+        header.fileSize = position;
+        bool ok = fwrite(&header, sizeof(header), 1, file) == 1 && fwrite(operation.data(), 1, operation.size(), file) == operation.size();
+        for(size_t i = 0; i < images.size() && ok; i++) {
+            const cv::Mat& img = images[i].second;
+            const uint32_t length = (uint32_t)images[i].first.size();
+            const int32_t shape[3] = {img.rows, img.cols, img.type()};
+            ok = fwrite(&length, sizeof(length), 1, file) == 1 && fwrite(images[i].first.data(), 1, length, file) == length &&
+                 fwrite(shape, sizeof(shape), 1, file) == 1 && fwrite(&hashes[i], sizeof(uint64_t), 1, file) == 1 &&
+                 fwrite(&offsets[i], sizeof(uint64_t), 1, file) == 1;
+        }
+        static const char zeros[64] = {0};
+        size_t at = sizeof(DerivedImageHeader) + operation.size();
+        for(const auto& image : images) {
+            at += sizeof(uint32_t) + image.first.size() + 3 * sizeof(int32_t) + 2 * sizeof(uint64_t);
+        }
+        for(size_t i = 0; i < images.size() && ok; i++) {
+            const cv::Mat& img = images[i].second;
+            const size_t padding = (size_t)offsets[i] - at;
+            ok = fwrite(zeros, 1, padding, file) == padding;
+            const size_t rowBytes = img.cols * img.elemSize();
+            for(int y = 0; y < img.rows && ok; y++) {
+                ok = fwrite(img.ptr(y), 1, rowBytes, file) == rowBytes;
+            }
+            at = (size_t)offsets[i] + rowBytes * img.rows;
+        }
+        ok = fclose(file) == 0 && ok;
+        if(!ok || rename(temporary.c_str(), path.c_str()) != 0) {
+            unlink(temporary.c_str());
+            return 0;
+        }
+        return position;
+    }
+
+    //Maps an entry and checks it is complete and belongs to this key and operation
+    static bool loadEntry(const std::string& path, uint64_t entryKey, const std::string& operation, NamedImages& images,
+                          std::vector<uint64_t>& hashes) {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if(fd < 0) {
+            return false;
+        }
+        struct stat info;
+        if(fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(DerivedImageHeader)) {
+            ::close(fd);
+            return false;
+        }
+        const size_t length = (size_t)info.st_size;
+        void* mapping = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if(mapping == MAP_FAILED) {
+            return false;
+        }
+        const char* base = static_cast<const char*>(mapping);
+        const DerivedImageHeader* header = reinterpret_cast<const DerivedImageHeader*>(base);
+        size_t at = sizeof(DerivedImageHeader);
+        auto read = [&](void* dst, size_t bytes) {
+            if(bytes > length - at) {
+                return false;
+            }
+            memcpy(dst, base + at, bytes);
+            at += bytes;
+            return true;
+        };
+        bool ok = memcmp(header->magic, DERIVED_IMAGE_MAGIC, 4) == 0 && header->version == DERIVED_IMAGE_VERSION &&
+                  header->key == entryKey && header->fileSize == length && header->operationLength == operation.size() &&
+                  header->operationLength <= length - at && operation.compare(0, operation.size(), base + at, operation.size()) == 0;
+        at += ok ? operation.size() : 0;
+        std::vector<std::string> names;
+        std::vector<cv::Vec3i> shapes;
+        std::vector<size_t> offsets;
+        for(uint32_t i = 0; ok && i < header->count; i++) {
+            uint32_t nameLength = 0;
+            int32_t shape[3];
+            uint64_t imageHash, offset;
+            ok = read(&nameLength, sizeof(nameLength)) && nameLength <= length - at;
+            if(ok) {
+                names.push_back(std::string(base + at, nameLength));
+                at += nameLength;
+                ok = read(shape, sizeof(shape)) && read(&imageHash, sizeof(imageHash)) && read(&offset, sizeof(offset));
+            }
+            //The image has to lie inside the file
+            ok = ok && shape[0] >= 0 && shape[1] >= 0 && shape[2] >= 0 && shape[2] < CV_DEPTH_MAX * CV_CN_MAX && offset <= length &&
+                 (uint64_t)shape[0] * shape[1] * CV_ELEM_SIZE(shape[2]) <= length - offset;
+            if(ok) {
+                shapes.push_back(cv::Vec3i(shape[0], shape[1], shape[2]));
+                offsets.push_back((size_t)offset);
+                hashes.push_back(imageHash);
+            }
+        }
+        if(!ok) {
+            munmap(mapping, length);
+            hashes.clear();
+            return false;
+        }
+        std::vector<cv::Mat> mats = MappedFileAllocator::get()->wrap(mapping, length, shapes, offsets);
+        for(size_t i = 0; i < mats.size(); i++) {
+            images.push_back(std::make_pair(names[i], mats[i]));
+        }
+        return true;
+    }
+
+    mutable std::mutex mutex;
+    std::mutex diskMutex;
+    std::list<Entry> lru;                                           //Most recently used first
+    std::unordered_map<uint64_t, std::list<Entry>::iterator> index;
+    std::unordered_map<const uchar*, KnownHash> knownHashes;        //Content hash of every image in lru, by its data
+    size_t memoryLimit;
+    size_t memoryBytes = 0;
+    std::string directory;
+    size_t diskLimit = 0;
+    size_t diskBytes = 0;
+    DerivedCacheStats stats;
+};
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+#include <algorithm>
+#include <vector>
+#include "profiler.hpp"
+
+/* Fixed-point affine warp
+   warpAffine() up to OpenCV 4.10 maps every output pixel back with the inverse matrix in 10-bit fixed point, keeps 5
+   bits of the fraction for the interpolation table and remaps. affineWarpMaps() does that arithmetic for any
+   rectangle of the output in global coordinates, so a tile gets exactly the maps the whole image has there. Later
+   releases compute warpAffine() in float with a column-dependent tail and differ from this by a few grey levels,
+   mostly along the image border. fixedPointWarpAffine() is the same on every version, so the whole-image rotate of
+   the chapter programs, the operation library and the tiled executor (tiled_executor.hpp) all go through it and
+   their outputs agree exactly.
+*/
+//The inverse warpAffine() computes for M, in the same order of operations
+inline cv::Matx23d invertAffineWarp(const cv::Mat& M) {
+    CV_Assert(M.rows == 2 && M.cols == 3);
+    cv::Mat M64;
+    M.convertTo(M64, CV_64F);
+    cv::Matx23d m(M64.ptr<double>());
+    double D = m(0, 0) * m(1, 1) - m(0, 1) * m(1, 0);
+    D = D != 0 ? 1. / D : 0;
+    const double A11 = m(1, 1) * D, A22 = m(0, 0) * D;
+    m(0, 0) = A11; m(0, 1) *= -D;
+    m(1, 0) *= -D; m(1, 1) = A22;
+    const double b1 = -m(0, 0) * m(0, 2) - m(0, 1) * m(1, 2);
+    const double b2 = -m(1, 0) * m(0, 2) - m(1, 1) * m(1, 2);
+    m(0, 2) = b1; m(1, 2) = b2;
+    return m;
+}
+
+//remap() tables for the output pixels of rect, the source positions relative to origin. fraction stays empty for INTER_NEAREST
+inline void affineWarpMaps(const cv::Matx23d& inverse, const cv::Rect& rect, cv::Point origin, int interpolation, cv::Mat& xy, cv::Mat& fraction) {
+    const int AB_BITS = std::max(10, (int)cv::INTER_BITS), AB_SCALE = 1 << AB_BITS;
+    const bool nearest = interpolation == cv::INTER_NEAREST;
+    const int roundDelta = nearest ? AB_SCALE / 2 : AB_SCALE / cv::INTER_TAB_SIZE / 2;
+    xy.create(rect.size(), CV_16SC2);
+    if(nearest) {
+        fraction.release();
+    }
+    else {
+        fraction.create(rect.size(), CV_16UC1);
+    }
+    std::vector<int> adelta(rect.width), bdelta(rect.width);
+    for(int x = 0; x < rect.width; x++) {
+        adelta[x] = cv::saturate_cast<int>(inverse(0, 0) * (rect.x + x) * AB_SCALE);
+        bdelta[x] = cv::saturate_cast<int>(inverse(1, 0) * (rect.x + x) * AB_SCALE);
+    }
+    for(int y = 0; y < rect.height; y++) {
+        const int X0 = cv::saturate_cast<int>((inverse(0, 1) * (rect.y + y) + inverse(0, 2)) * AB_SCALE) + roundDelta;
+        const int Y0 = cv::saturate_cast<int>((inverse(1, 1) * (rect.y + y) + inverse(1, 2)) * AB_SCALE) + roundDelta;
+        short* positions = xy.ptr<short>(y);
+        for(int x = 0; x < rect.width; x++) {
+            if(nearest) {
+                positions[2 * x] = cv::saturate_cast<short>(((X0 + adelta[x]) >> AB_BITS) - origin.x);
+                positions[2 * x + 1] = cv::saturate_cast<short>(((Y0 + bdelta[x]) >> AB_BITS) - origin.y);
+            }
+            else {
+                const int X = (X0 + adelta[x]) >> (AB_BITS - cv::INTER_BITS), Y = (Y0 + bdelta[x]) >> (AB_BITS - cv::INTER_BITS);
+                positions[2 * x] = cv::saturate_cast<short>((X >> cv::INTER_BITS) - origin.x);
+                positions[2 * x + 1] = cv::saturate_cast<short>((Y >> cv::INTER_BITS) - origin.y);
+                fraction.ptr<ushort>(y)[x] = (ushort)((Y & (cv::INTER_TAB_SIZE - 1)) * cv::INTER_TAB_SIZE + (X & (cv::INTER_TAB_SIZE - 1)));
+            }
+        }
+    }
+}
+
+//Drop-in for warpAffine(src, dst, M, dsize, interpolation) with a constant black border
+inline void fixedPointWarpAffine(const cv::Mat& src, cv::Mat& dst, const cv::Mat& M, cv::Size dsize, int interpolation = cv::INTER_LINEAR) {
+    ProfileScope scope("fixedPointWarpAffine", src);
+    cv::Mat xy, fraction;
+    affineWarpMaps(invertAffineWarp(M), cv::Rect(cv::Point(), dsize), cv::Point(), interpolation, xy, fraction);
+    cv::remap(src, dst, xy, fraction, interpolation, cv::BORDER_CONSTANT);
+    scope.output(dst);
+}
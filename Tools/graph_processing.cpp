@@ -0,0 +1,130 @@
+#include <opencv2/opencv.hpp>
+#include <iostream>
+#include <sys/stat.h>
+#include "operation_graph.hpp"
+
+using namespace cv;
+using namespace std;
+
+/* The same graph the way the chapter programs chain today
+   Every node is its own program: it decodes its inputs from PNG, runs and encodes its result to PNG for the next one.
+   Nodes run one after the other. The encode/decode is done in memory, so the disk itself is not even counted.
+*/
+map<string, Mat> runAsPrograms(const OperationGraph& graph, const Mat& img, double& seconds) {
+    map<string, vector<uchar>> files;
+    map<string, Mat> results;
+    int64 start = getTickCount();
+    for(const GraphNode& node : graph.nodes()) {
+        vector<uchar> file;
+        if(node.operation.empty()) {
+            imencode(".png", img, file);
+        }
+        else {
+            vector<Mat> src;
+            for(int in : node.inputs) {
+                src.push_back(imdecode(files[graph.nodes()[in].name], IMREAD_UNCHANGED));
+            }
+            Mat dst;
+            operationLibrary().at(node.operation).run(src, dst, node.params);
+            imencode(".png", dst, file);
+            results[node.name] = dst;
+        }
+        files[node.name] = file;
+    }
+    seconds = (getTickCount() - start) / getTickFrequency();
+    return results;
+}
+
+int main(int argc, char** argv) {
+    if(argc < 4) {
+        cout << "Usage: " << argv[0] << " <graph file> <input image> <output dir> [--workers N] [--repeat N] [--benchmark] [--profile trace.json]" << endl;
+        cout << "Operations:";
+        for(const auto& op : operationLibrary()) {
+            cout << " " << op.first;
+        }
+        cout << endl;
+        return 1;
+    }
+
+    OperationGraph graph;
+    string error;
+    if(!graph.load(argv[1], error)) {
+        cout << "Invalid graph " << argv[1] << ", " << error << endl;
+        return 1;
+    }
+    int workers = max(1, getNumberOfCPUs()), repeat = 1;
+    bool benchmark = false;
+    string profile;
+    for(int i = 4; i < argc; i++) {
+        string option = argv[i];
+        if(option == "--benchmark") benchmark = true;
+        else if(option == "--workers" && i + 1 < argc) workers = atoi(argv[++i]);
+        else if(option == "--repeat" && i + 1 < argc) repeat = max(1, atoi(argv[++i]));
+        else if(option == "--profile" && i + 1 < argc) profile = argv[++i];
+        else {
+            cout << "Unknown option " << option << endl;
+            return 1;
+        }
+    }
+
+    //A graph of the programs has a single input, the image
+    map<string, Mat> inputs;
+    Mat img = imread(argv[2], IMREAD_COLOR);
+    if(img.empty()) {
+        cout << "Failed to read " << argv[2] << endl;
+        return 1;
+    }
+    for(const GraphNode& node : graph.nodes()) {
+        if(node.operation.empty()) {
+            inputs[node.name] = img;
+        }
+    }
+
+    //The first run allocates, the ones after it find every buffer in the pool
+    if(!profile.empty()) {
+        Profiler::get().enable();
+    }
+    WorkStealingPool pool(workers);
+    map<string, Mat> outputs;
+    for(int r = 0; r < repeat; r++) {
+        GraphReport report = graph.run(inputs, outputs, pool);
+        cout << "Run " << r + 1 << ": ";
+        report.print();
+    }
+
+    const string outputDir = argv[3];
+    struct stat info;
+    if(!(stat(outputDir.c_str(), &info) == 0 && S_ISDIR(info.st_mode)) && mkdir(outputDir.c_str(), 0755) != 0) {
+        cout << "Failed to create output directory " << outputDir << endl;
+        return 1;
+    }
+    for(const auto& output : outputs) {
+        profiled::imwrite(outputDir + "/" + output.first + "_img.png", output.second);
+    }
+    //The benchmark below is not part of the profile
+    if(!profile.empty()) {
+        Profiler::get().enable(false);
+        Profiler::get().printSummary();
+        if(!Profiler::get().writeChromeTrace(profile)) {
+            cout << "Failed to write " << profile << endl;
+        }
+    }
+
+    if(benchmark) {
+        double programs = 0;
+        map<string, Mat> expected = runAsPrograms(graph, img, programs);
+        double graphSeconds = 0, maxDiff = 0;
+        for(int r = 0; r < repeat; r++) {
+            graphSeconds += graph.run(inputs, outputs, pool).seconds;
+        }
+        graphSeconds /= repeat;
+        for(const auto& output : outputs) {
+            maxDiff = max(maxDiff, norm(output.second, expected[output.first], NORM_INF));
+        }
+        cout << "Separate programs (PNG between nodes): " << programs * 1000 << " ms" << endl;
+        cout << "Graph, " << pool.size() << " workers: " << graphSeconds * 1000 << " ms, speedup " << programs / graphSeconds
+             << "x, max output difference " << maxDiff << endl;
+    }
+
+    return 0;
+}
\ No newline at end of file
@@ -0,0 +1,248 @@
+#pragma once
+
+#include <opencv2/core.hpp>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* Image container format (.imc)
+   Several named, uncompressed images in one file, like a PNM file that holds many images plus an index:
+       [0..3]    magic "IMC1"
+       [4..7]    uint32 version (1)
+       [8..15]   uint64 offset of the index, 0 while the file is still being written
+       [16..]    image data, each image's rows packed without padding and starting on a 64 byte boundary
+       [index]   uint32 count, then per image: uint32 name length, name, int32 rows, cols, type, uint64 offset
+   Writing is a single sequential stream with no compression, so it costs little more than the memcpy. A reader maps
+   the file and returns each image as a Mat pointing into the mapping, nothing is decoded or copied.
+*/
+struct ImageContainerHeader {
+    char magic[4];
+    uint32_t version;
+    uint64_t indexOffset;
+};
+
+static const char IMAGE_CONTAINER_MAGIC[4] = {'I', 'M', 'C', '1'};
+static const uint32_t IMAGE_CONTAINER_VERSION = 1;
+
+/* Sequential writer
+   1) open() writes a header with no index
+   2) add() appends one image
+   3) close() appends the index and patches its offset into the header, a file without an index was not closed
+*/
+class ImageContainerWriter {
+public:
+    ImageContainerWriter() {}
+    ~ImageContainerWriter() { close(); }
+    ImageContainerWriter(const ImageContainerWriter&) = delete;
+    ImageContainerWriter& operator=(const ImageContainerWriter&) = delete;
+
+    bool open(const std::string& filename) {
+        close();
+        file = fopen(filename.c_str(), "wb");
+        if(!file) {
+            return false;
+        }
+        entries.clear();
+        position = 0;
+        ok = writeHeader(0);
+        return ok;
+    }
+
+    bool isOpen() const { return file != nullptr; }
+
+    bool add(const std::string& name, const cv::Mat& img) {
+        if(!file || !ok || img.empty() || img.dims != 2) {
+            return false;
+        }
+        //Pad to the next 64 byte boundary so mapped images are aligned for SIMD loads
+        static const char zeros[64] = {0};
+        const size_t padding = (64 - position % 64) % 64;
+        ok = fwrite(zeros, 1, padding, file) == padding;
+        position += padding;
+
+        Entry entry = {name, img.rows, img.cols, img.type(), (uint64_t)position};
+        const size_t rowBytes = img.cols * img.elemSize();
+        for(int y = 0; y < img.rows && ok; y++) {
+            ok = fwrite(img.ptr(y), 1, rowBytes, file) == rowBytes;
+        }
+        position += rowBytes * img.rows;
+        entries.push_back(entry);
+        return ok;
+    }
+
+    /* Makes the file readable as it is now: writes the index and header for every image added so far and keeps the
+       file open. The next add() goes where the index was, so it is overwritten and written again by the next flush()
+       or close(). Returns false if any write failed
+    */
+    bool flush() {
+        if(!file) {
+            return ok;
+        }
+        const size_t dataEnd = position;
+        ok = writeIndex() && fflush(file) == 0 && fseek(file, (long)dataEnd, SEEK_SET) == 0;
+        position = dataEnd;
+        return ok;
+    }
+
+    //Returns false if any write failed
+    bool close() {
+        if(!file) {
+            return ok;
+        }
+        ok = writeIndex();
+        ok = fclose(file) == 0 && ok;
+        file = nullptr;
+        return ok;
+    }
+
+private:
+    struct Entry {
+        std::string name;
+        int32_t rows, cols, type;
+        uint64_t offset;
+    };
+
+    //Index after the last image, then the header pointing at it
+    bool writeIndex() {
+        const uint64_t indexOffset = position;
+        const uint32_t count = (uint32_t)entries.size();
+        bool written = ok && fwrite(&count, sizeof(count), 1, file) == 1;
+        for(const Entry& entry : entries) {
+            const uint32_t length = (uint32_t)entry.name.size();
+            const int32_t shape[3] = {entry.rows, entry.cols, entry.type};
+            written = written && fwrite(&length, sizeof(length), 1, file) == 1 && fwrite(entry.name.data(), 1, length, file) == length &&
+                      fwrite(shape, sizeof(shape), 1, file) == 1 && fwrite(&entry.offset, sizeof(entry.offset), 1, file) == 1;
+        }
+        return written && fseek(file, 0, SEEK_SET) == 0 && writeHeader(indexOffset);
+    }
+
+    bool writeHeader(uint64_t indexOffset) {
+        ImageContainerHeader header;
+        memcpy(header.magic, IMAGE_CONTAINER_MAGIC, 4);
+        header.version = IMAGE_CONTAINER_VERSION;
+        header.indexOffset = indexOffset;
+        position = sizeof(header);
+        return fwrite(&header, sizeof(header), 1, file) == 1;
+    }
+
+    FILE* file = nullptr;
+    std::vector<Entry> entries;
+    size_t position = 0;
+    bool ok = true;
+};
+
+/* Zero-copy reader
+   The file is mapped read-only and the index parsed once, image() returns a Mat header over the mapping that stays
+   valid as long as the reader is open.
+*/
+class MappedImageContainer {
+public:
+    MappedImageContainer() {}
+    explicit MappedImageContainer(const std::string& filename) { open(filename); }
+    ~MappedImageContainer() { close(); }
+    MappedImageContainer(const MappedImageContainer&) = delete;
+    MappedImageContainer& operator=(const MappedImageContainer&) = delete;
+
+    bool open(const std::string& filename) {
+        close();
+        int fd = ::open(filename.c_str(), O_RDONLY);
+        if(fd < 0) {
+            return false;
+        }
+        struct stat info;
+        if(fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(ImageContainerHeader)) {
+            ::close(fd);
+            return false;
+        }
+        void* mapping = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if(mapping == MAP_FAILED) {
+            return false;
+        }
+        base = static_cast<const char*>(mapping);
+        length = (size_t)info.st_size;
+        if(!parseIndex()) {
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    void close() {
+        if(base) {
+            munmap(const_cast<char*>(base), length);
+        }
+        base = nullptr;
+        length = 0;
+        images.clear();
+    }
+
+    bool empty() const { return base == nullptr; }
+
+    std::vector<std::string> names() const {
+        std::vector<std::string> result;
+        for(const auto& image : images) {
+            result.push_back(image.first);
+        }
+        return result;
+    }
+
+    //The named image, or an empty Mat if there is none
+    cv::Mat image(const std::string& name) const {
+        auto found = images.find(name);
+        return found == images.end() ? cv::Mat() : found->second;
+    }
+
+private:
+    //Reads the index, checking every entry lies inside the file
+    bool parseIndex() {
+        const ImageContainerHeader* header = reinterpret_cast<const ImageContainerHeader*>(base);
+        if(memcmp(header->magic, IMAGE_CONTAINER_MAGIC, 4) != 0 || header->version != IMAGE_CONTAINER_VERSION ||
+           header->indexOffset < sizeof(ImageContainerHeader) || header->indexOffset > length - sizeof(uint32_t)) {
+            return false;
+        }
+        size_t at = (size_t)header->indexOffset;
+        auto read = [&](void* dst, size_t bytes) {
+            if(bytes > length - at) {
+                return false;
+            }
+            memcpy(dst, base + at, bytes);
+            at += bytes;
+            return true;
+        };
+        uint32_t count;
+        if(!read(&count, sizeof(count))) {
+            return false;
+        }
+        for(uint32_t i = 0; i < count; i++) {
+            uint32_t nameLength;
+            int32_t shape[3];
+            uint64_t offset;
+            if(!read(&nameLength, sizeof(nameLength)) || nameLength > length - at) {
+                return false;
+            }
+            std::string name(base + at, nameLength);
+            at += nameLength;
+            if(!read(shape, sizeof(shape)) || !read(&offset, sizeof(offset)) || shape[0] <= 0 || shape[1] <= 0) {
+                return false;
+            }
+            const uint64_t bytes = (uint64_t)shape[0] * shape[1] * CV_ELEM_SIZE(shape[2]);
+            if(offset > header->indexOffset || bytes > header->indexOffset - offset) {
+                return false;
+            }
+            images[name] = cv::Mat(shape[0], shape[1], shape[2], const_cast<char*>(base + offset));
+        }
+        return true;
+    }
+
+    const char* base = nullptr;
+    size_t length = 0;
+    std::map<std::string, cv::Mat> images;
+};
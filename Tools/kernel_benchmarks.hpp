@@ -0,0 +1,399 @@
+#pragma once
+
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <tuple>
+#include <vector>
+#include "../Chapter 2 - Image Formation/2.1 Geometric primitives and transformations/point_rasterizer.hpp"
+#include "../Chapter 2 - Image Formation/2.1 Geometric primitives and transformations/point_transforms.hpp"
+#include "../Chapter 2 - Image Formation/2.1 Geometric primitives and transformations/warp_engine.hpp"
+#include "../Chapter 2 - Image Formation/2.2 Photometric image formation/environment_lighting.hpp"
+#include "../Chapter 2 - Image Formation/2.2 Photometric image formation/shading_renderer.hpp"
+#include "../Chapter 2 - Image Formation/2.3 The digital camera/color_converter.hpp"
+#include "../Chapter 2 - Image Formation/2.3 The digital camera/downscaler.hpp"
+#include "../Chapter 3 - Image Processing/3.1 Point Operators/histogram_engine.hpp"
+#include "../Chapter 3 - Image Processing/3.1 Point Operators/point_operator_pipeline.hpp"
+#include "../Chapter 3 - Image Processing/3.2 Linear Filtering/derivative_filter_bank.hpp"
+#include "../Chapter 3 - Image Processing/3.2 Linear Filtering/fused_separable_filter.hpp"
+#include "../Chapter 3 - Image Processing/3.2 Linear Filtering/gradient_engine.hpp"
+#include "../Chapter 3 - Image Processing/3.2 Linear Filtering/image_pyramid.hpp"
+#include "../Chapter 3 - Image Processing/3.2 Linear Filtering/steerable_filters.hpp"
+
+/* One kernel of the suite
+   prepare() builds everything the kernel reads from a BGR input (gray planes, point clouds, normal maps, cached
+   tables) outside the timing and returns the call that is timed. The call may be run any number of times and its
+   state lives as long as it does, so engines that cache per size (WarpEngine, ImagePyramid, Downscaler) are measured
+   warm, the way a video or a folder of photos runs them. Throughput is always input pixels per second, for the point
+   cloud kernels that is one point per pixel.
+*/
+struct KernelBenchmark {
+    std::string name;
+    std::function<std::function<void()>(const cv::Mat& bgr)> prepare;
+};
+
+inline cv::Mat benchmarkGray(const cv::Mat& bgr) {
+    cv::Mat gray;
+    cv::cvtColor(bgr, gray, cv::COLOR_BGR2GRAY);
+    return gray;
+}
+
+//One point per pixel at (x, y, gray / 255 * 64), the image as a height field
+inline std::vector<cv::Point3f> benchmarkPoints(const cv::Mat& bgr) {
+    const cv::Mat gray = benchmarkGray(bgr);
+    std::vector<cv::Point3f> points;
+    points.reserve(gray.total());
+    for(int y = 0; y < gray.rows; y++) {
+        const uchar* g = gray.ptr<uchar>(y);
+        for(int x = 0; x < gray.cols; x++) {
+            points.push_back(cv::Point3f((float)x, (float)-y, g[x] * (64.f / 255)));
+        }
+    }
+    return points;
+}
+
+//Normals of the gray image taken as a height field, the surface in the z = 0 plane at (x/width, y/height)
+inline ShadingMaps benchmarkShadingMaps(const cv::Mat& bgr) {
+    const cv::Mat gray = benchmarkGray(bgr);
+    ShadingMaps maps;
+    cv::Sobel(gray, maps.normal[0], CV_32F, 1, 0, 3, -1 / 255.0);
+    cv::Sobel(gray, maps.normal[1], CV_32F, 0, 1, 3, -1 / 255.0);
+    maps.normal[2] = cv::Mat::ones(gray.size(), CV_32FC1);
+    for(int c = 0; c < 3; c++) {
+        maps.position[c].create(gray.size(), CV_32FC1);
+    }
+    for(int y = 0; y < gray.rows; y++) {
+        float* px = maps.position[0].ptr<float>(y);
+        float* py = maps.position[1].ptr<float>(y);
+        float* pz = maps.position[2].ptr<float>(y);
+        for(int x = 0; x < gray.cols; x++) {
+            px[x] = x / (float)gray.cols;
+            py[x] = y / (float)gray.rows;
+            pz[x] = 0;
+        }
+    }
+    return maps;
+}
+
+//The red Phong material of reflectance_and_shading.cpp under two directional lights and one point light
+inline ShadingRenderer benchmarkRenderer() {
+    ShadingMaterial material;
+    material.diffuse = cv::Vec3f(0, 0, 1);
+    material.specular = cv::Vec3f(1, 1, 1);
+    material.shininess = 20;
+    ShadingRenderer renderer(material, cv::Vec3f(2, 2, 4));
+    renderer.addLight(ShadingLight::directional(cv::Vec3f(1, 1, 1), 0.4f));
+    renderer.addLight(ShadingLight::directional(cv::Vec3f(-1, 0.5f, 1), 0.3f));
+    renderer.addLight(ShadingLight::point(cv::Vec3f(0.5f, 0.5f, 1), 0.3f));
+    return renderer;
+}
+
+/* Every chapter kernel, grouped by section, followed by the OpenCV calls the chapter programs started from
+   The opencv/ entries are the baselines: a chapter kernel that falls behind its baseline is a regression too. The
+   _generic entries run the same filters with the compile-time specialised kernels turned off.
+*/
+inline const std::vector<KernelBenchmark>& kernelBenchmarks() {
+    static const std::vector<KernelBenchmark> benchmarks = [] {
+        std::vector<KernelBenchmark> list;
+        auto add = [&](const char* name, decltype(KernelBenchmark::prepare) prepare) {
+            list.push_back(KernelBenchmark{name, prepare});
+        };
+
+        //2.1 Geometric primitives and transformations
+        add("2.1/point_transform", [](const cv::Mat& bgr) -> std::function<void()> {
+            auto src = std::make_shared<std::vector<cv::Point3f>>(benchmarkPoints(bgr));
+            auto dst = std::make_shared<std::vector<cv::Point3f>>(src->size());
+            const PointTransform transform = PointTransform::rotateZ(30).then(PointTransform::translate(1, 2, 3)).then(PointTransform::scale(2, 2, 2));
+            return [src, dst, transform] { transform.apply(src->data(), dst->data(), src->size()); };
+        });
+        add("2.1/point_rasterizer", [](const cv::Mat& bgr) -> std::function<void()> {
+            auto points = std::make_shared<std::vector<cv::Point3f>>(benchmarkPoints(bgr));
+            auto intensities = std::make_shared<std::vector<uchar>>();
+            const cv::Mat gray = benchmarkGray(bgr);
+            intensities->assign(gray.datastart, gray.dataend);
+            auto rasterizer = std::make_shared<PointRasterizer>(bgr.size(), RasterViewport::fit(*points, bgr.size()));
+            auto depth = std::make_shared<cv::Mat>(), image = std::make_shared<cv::Mat>();
+            return [=] { rasterizer->render(*points, *intensities, *depth, *image); };
+        });
+        add("2.1/warp_rotate", [](const cv::Mat& bgr) -> std::function<void()> {
+            auto engine = std::make_shared<WarpEngine>();
+            auto dst = std::make_shared<cv::Mat>();
+            const PlanarTransform transform = PlanarTransform::rotate(cv::Point2f(bgr.cols / 2.f, bgr.rows / 2.f), 30);
+            return [=] { engine->warp(bgr, *dst, transform); };
+        });
+        add("2.1/warp_perspective", [](const cv::Mat& bgr) -> std::function<void()> {
+            const float w = (float)bgr.cols, h = (float)bgr.rows;
+            const cv::Point2f from[4] = {cv::Point2f(0, 0), cv::Point2f(w, 0), cv::Point2f(w, h), cv::Point2f(0, h)};
+            const cv::Point2f to[4] = {cv::Point2f(0.1f * w, 0.05f * h), cv::Point2f(0.9f * w, 0), cv::Point2f(w, h), cv::Point2f(0, 0.95f * h)};
+            const cv::Mat perspective = cv::getPerspectiveTransform(from, to);
+            auto dst = std::make_shared<cv::Mat>();
+            return [=] { tiledWarpPerspective(bgr, *dst, perspective); };
+        });
+
+        //2.2 Photometric image formation
+        add("2.2/shading", [](const cv::Mat& bgr) -> std::function<void()> {
+            auto maps = std::make_shared<ShadingMaps>(benchmarkShadingMaps(bgr));
+            auto renderer = std::make_shared<ShadingRenderer>(benchmarkRenderer());
+            auto dst = std::make_shared<cv::Mat>();
+            return [=] { renderer->render(*maps, *dst); };
+        });
+        add("2.2/environment_lighting", [](const cv::Mat& bgr) -> std::function<void()> {
+            auto maps = std::make_shared<ShadingMaps>(benchmarkShadingMaps(bgr));
+            auto renderer = std::make_shared<ShadingRenderer>(benchmarkRenderer());
+            auto environment = std::make_shared<EnvironmentLighting>();
+            environment->fromLights(renderer->getLights(), cv::Vec3f(0.5f, 0.5f, 0));
+            auto dst = std::make_shared<cv::Mat>();
+            return [=] { environment->render(*maps, *renderer, *dst); };
+        });
+
+        //2.3 The digital camera
+        add("2.3/colors_gray", [](const cv::Mat& bgr) -> std::function<void()> {
+            auto out = std::make_shared<ColorOutputs>();
+            return [=] { convertColors(bgr, *out, COLOR_PLANE_GRAY); };
+        });
+        add("2.3/colors_all", [](const cv::Mat& bgr) -> std::function<void()> {
+            auto out = std::make_shared<ColorOutputs>();
+            return [=] { convertColors(bgr, *out, COLOR_PLANE_ALL); };
+        });
+        add("2.3/downscale_mip", [](const cv::Mat& bgr) -> std::function<void()> {
+            auto downscaler = std::make_shared<Downscaler>(DOWNSCALE_LANCZOS);
+            auto levels = std::make_shared<std::vector<cv::Mat>>();
+            return [=] { downscaler->mipChain(bgr, *levels, 3); };
+        });
+
+        //3.1 Point operators
+        add("3.1/point_pipeline", [](const cv::Mat& bgr) -> std::function<void()> {
+            auto pipeline = std::make_shared<PointOperatorPipeline>();
+            pipeline->grayscale().linear(1.2, 10).gamma(0.8).threshold(200, 255, cv::THRESH_TRUNC);
+            auto dst = std::make_shared<cv::Mat>();
+            return [=] { pipeline->apply(bgr, *dst); };
+        });
+        add("3.1/point_pipeline_equalize", [](const cv::Mat& bgr) -> std::function<void()> {
+            auto pipeline = std::make_shared<PointOperatorPipeline>();
+            pipeline->grayscale().equalize();
+            auto dst = std::make_shared<cv::Mat>();
+            return [=] { pipeline->apply(bgr, *dst); };
+        });
+        add("3.1/equalize", [](const cv::Mat& bgr) -> std::function<void()> {
+            const cv::Mat gray = benchmarkGray(bgr);
+            auto dst = std::make_shared<cv::Mat>();
+            return [=] { parallelEqualizeHist(gray, *dst); };
+        });
+        add("3.1/adaptive_equalize", [](const cv::Mat& bgr) -> std::function<void()> {
+            const cv::Mat gray = benchmarkGray(bgr);
+            auto equalizer = std::make_shared<AdaptiveEqualizer>();
+            auto dst = std::make_shared<cv::Mat>();
+            return [=] { equalizer->apply(gray, *dst); };
+        });
+
+        //3.2 Linear filtering
+        add("3.2/gaussian5", [](const cv::Mat& bgr) -> std::function<void()> {
+            auto dst = std::make_shared<cv::Mat>();
+            return [=] { fusedGaussianBlur8u(bgr, *dst, 5, 1.5, 1.5); };
+        });
+        add("3.2/gaussian5_generic", [](const cv::Mat& bgr) -> std::function<void()> {
+            auto dst = std::make_shared<cv::Mat>();
+            return [=] { fusedGaussianBlur8u(bgr, *dst, 5, 1.5, 1.5, false); };
+        });
+        add("3.2/derivative_bank", [](const cv::Mat& bgr) -> std::function<void()> {
+            const cv::Mat gray = benchmarkGray(bgr);
+            auto bank = std::make_shared<DerivativeFilterBank>();
+            bank->add(DerivativeRequest::sobel(1, 0));
+            bank->add(DerivativeRequest::sobel(0, 1));
+            bank->add(DerivativeRequest::laplacian(1));
+            auto outputs = std::make_shared<std::vector<cv::Mat>>();
+            return [=] { bank->apply(gray, *outputs); };
+        });
+        add("3.2/derivative_bank_generic", [](const cv::Mat& bgr) -> std::function<void()> {
+            const cv::Mat gray = benchmarkGray(bgr);
+            auto bank = std::make_shared<DerivativeFilterBank>();
+            bank->add(DerivativeRequest::sobel(1, 0));
+            bank->add(DerivativeRequest::sobel(0, 1));
+            bank->add(DerivativeRequest::laplacian(1));
+            bank->setFixedKernels(false);
+            auto outputs = std::make_shared<std::vector<cv::Mat>>();
+            return [=] { bank->apply(gray, *outputs); };
+        });
+        add("3.2/gradient", [](const cv::Mat& bgr) -> std::function<void()> {
+            const cv::Mat gray = benchmarkGray(bgr);
+            GradientOptions options;
+            options.orientationBins = 9;
+            auto engine = std::make_shared<GradientEngine>(options);
+            auto out = std::make_shared<GradientOutputs>();
+            return [=] { engine->compute(gray, *out); };
+        });
+        add("3.2/pyramid", [](const cv::Mat& bgr) -> std::function<void()> {
+            auto pyramid = std::make_shared<ImagePyramid>(5);
+            return [=] {
+                pyramid->setImage(bgr);
+                for(int level = 0; level < pyramid->levels() - 1; level++) {
+                    pyramid->laplacian(level);
+                }
+            };
+        });
+        add("3.2/steerable", [](const cv::Mat& bgr) -> std::function<void()> {
+            const cv::Mat gray = benchmarkGray(bgr);
+            auto filter = std::make_shared<SteerableFilter>(2, 1.5);
+            return [=] { filter->compute(gray); };
+        });
+
+        //Baselines
+        add("opencv/cvtColor_gray", [](const cv::Mat& bgr) -> std::function<void()> {
+            auto dst = std::make_shared<cv::Mat>();
+            return [=] { cv::cvtColor(bgr, *dst, cv::COLOR_BGR2GRAY); };
+        });
+        add("opencv/warpAffine", [](const cv::Mat& bgr) -> std::function<void()> {
+            const cv::Mat rotate_matrix = cv::getRotationMatrix2D(cv::Point2f(bgr.cols / 2.f, bgr.rows / 2.f), 30, 1.0);
+            auto dst = std::make_shared<cv::Mat>();
+            return [=] { cv::warpAffine(bgr, *dst, rotate_matrix, bgr.size()); };
+        });
+        add("opencv/equalizeHist", [](const cv::Mat& bgr) -> std::function<void()> {
+            const cv::Mat gray = benchmarkGray(bgr);
+            auto dst = std::make_shared<cv::Mat>();
+            return [=] { cv::equalizeHist(gray, *dst); };
+        });
+        add("opencv/GaussianBlur", [](const cv::Mat& bgr) -> std::function<void()> {
+            auto dst = std::make_shared<cv::Mat>();
+            return [=] { cv::GaussianBlur(bgr, *dst, cv::Size(5, 5), 1.5, 1.5); };
+        });
+        add("opencv/Sobel", [](const cv::Mat& bgr) -> std::function<void()> {
+            const cv::Mat gray = benchmarkGray(bgr);
+            auto dst = std::make_shared<cv::Mat>();
+            return [=] { cv::Sobel(gray, *dst, CV_8U, 1, 0, 3); };
+        });
+        add("opencv/Laplacian", [](const cv::Mat& bgr) -> std::function<void()> {
+            const cv::Mat gray = benchmarkGray(bgr);
+            auto dst = std::make_shared<cv::Mat>();
+            return [=] { cv::Laplacian(gray, *dst, CV_8U, 1); };
+        });
+        add("opencv/pyrDown", [](const cv::Mat& bgr) -> std::function<void()> {
+            auto dst = std::make_shared<cv::Mat>();
+            return [=] { cv::pyrDown(bgr, *dst); };
+        });
+        return list;
+    }();
+    return benchmarks;
+}
+
+/* One line of a result file
+   The file is CSV with a header line, one row per benchmark, input, size and thread count:
+       benchmark,input,width,height,threads,repeats,median_ms,min_ms,mpix_per_s
+*/
+struct BenchmarkResult {
+    std::string benchmark;
+    std::string input;
+    cv::Size size;
+    int threads = 1;
+    int repeats = 0;
+    double medianMs = 0;
+    double minMs = 0;
+
+    double mpixPerSecond() const { return medianMs > 0 ? size.area() / (medianMs * 1000.0) : 0; }
+
+    std::tuple<std::string, std::string, int, int, int> key() const {
+        return std::make_tuple(benchmark, input, size.width, size.height, threads);
+    }
+};
+
+static const char* const BENCHMARK_CSV_HEADER = "benchmark,input,width,height,threads,repeats,median_ms,min_ms,mpix_per_s";
+
+inline std::string formatBenchmarkResult(const BenchmarkResult& result) {
+    std::ostringstream line;
+    line << result.benchmark << "," << result.input << "," << result.size.width << "," << result.size.height << ","
+         << result.threads << "," << result.repeats << "," << std::fixed << std::setprecision(4) << result.medianMs << ","
+         << result.minMs << "," << std::setprecision(2) << result.mpixPerSecond();
+    return line.str();
+}
+
+//Reads a file written by the suite. On failure error names the line
+inline bool loadBenchmarkResults(const std::string& filename, std::vector<BenchmarkResult>& results, std::string& error) {
+    std::ifstream file(filename);
+    if(!file) {
+        error = "cannot read " + filename;
+        return false;
+    }
+    results.clear();
+    std::string line;
+    for(int number = 1; std::getline(file, line); number++) {
+        if(line.empty() || line == BENCHMARK_CSV_HEADER) {
+            continue;
+        }
+        std::vector<std::string> fields;
+        std::istringstream cells(line);
+        for(std::string cell; std::getline(cells, cell, ',');) {
+            fields.push_back(cell);
+        }
+        try {
+            CV_Assert(fields.size() == 9);
+            BenchmarkResult result;
+            result.benchmark = fields[0];
+            result.input = fields[1];
+            result.size = cv::Size(std::stoi(fields[2]), std::stoi(fields[3]));
+            result.threads = std::stoi(fields[4]);
+            result.repeats = std::stoi(fields[5]);
+            result.medianMs = std::stod(fields[6]);
+            result.minMs = std::stod(fields[7]);
+            results.push_back(result);
+        }
+        catch(const std::exception&) {
+            error = filename + " line " + std::to_string(number) + ": " + line;
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Matches the rows of two result files and prints the throughput change of each
+   A row is flagged SLOWER when its throughput dropped by more than tolerance (a fraction, 0.05 for 5%) and faster
+   when it rose by as much, everything in between is noise. Rows found in only one file are listed. Returns the
+   number of slowdowns.
+*/
+inline int compareBenchmarkResults(const std::vector<BenchmarkResult>& base, const std::vector<BenchmarkResult>& current,
+                                   double tolerance, std::ostream& out = std::cout) {
+    std::map<std::tuple<std::string, std::string, int, int, int>, const BenchmarkResult*> before;
+    for(const BenchmarkResult& result : base) {
+        before[result.key()] = &result;
+    }
+    int slower = 0, faster = 0, matched = 0;
+    out << std::fixed << std::setprecision(2);
+    for(const BenchmarkResult& result : current) {
+        auto it = before.find(result.key());
+        if(it == before.end()) {
+            out << "  new      " << result.benchmark << " " << result.input << " " << result.size.width << "x"
+                << result.size.height << " " << result.threads << " threads" << std::endl;
+            continue;
+        }
+        const double old = it->second->mpixPerSecond(), now = result.mpixPerSecond();
+        const double change = old > 0 ? now / old - 1 : 0;
+        before.erase(it);
+        matched++;
+        const char* flag = "         ";
+        if(change < -tolerance) {
+            flag = "  SLOWER ";
+            slower++;
+        }
+        else if(change > tolerance) {
+            flag = "  faster ";
+            faster++;
+        }
+        out << flag << result.benchmark << " " << result.input << " " << result.size.width << "x" << result.size.height
+            << " " << result.threads << " threads: " << old << " -> " << now << " MPix/s (" << std::showpos << change * 100
+            << std::noshowpos << "%)" << std::endl;
+    }
+    for(const auto& missing : before) {
+        const BenchmarkResult& result = *missing.second;
+        out << "  missing  " << result.benchmark << " " << result.input << " " << result.size.width << "x"
+            << result.size.height << " " << result.threads << " threads" << std::endl;
+    }
+    out << matched << " matched, " << slower << " slower, " << faster << " faster by more than " << tolerance * 100 << "%" << std::endl;
+    return slower;
+}
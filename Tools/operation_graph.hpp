@@ -0,0 +1,393 @@
+#pragma once
+
+#include <opencv2/core.hpp>
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <tuple>
+#include <vector>
+#include "operation_library.hpp"
+#include "work_stealing_pool.hpp"
+
+struct GraphNode {
+    std::string name;
+    std::string operation;              //Empty for an input
+    std::vector<int> inputs;
+    OperationParams params;
+};
+
+struct GraphReport {
+    size_t nodes = 0;
+    double seconds = 0;
+    size_t allocations = 0;             //Buffers the pool had to allocate
+    size_t reused = 0;                  //Buffers handed out again from the pool
+    size_t inPlace = 0;                 //Nodes that wrote over their dead input
+    size_t peakBytes = 0;               //Intermediates alive at the same time, at most
+    size_t totalBytes = 0;              //All intermediates together, the cost of keeping every one
+
+    void print() const {
+        std::cout << nodes << " nodes in " << seconds * 1000 << " ms, " << allocations << " allocations, " << reused
+                  << " reused buffers, " << inPlace << " in place" << std::endl;
+        std::cout << "  peak " << peakBytes / (1024.0 * 1024.0) << " MB of intermediates alive, "
+                  << totalBytes / (1024.0 * 1024.0) << " MB if none were reused" << std::endl;
+    }
+};
+
+/* Free intermediate buffers by size and type
+   A buffer goes back to the pool only when nothing else holds a reference to it, so a view or a Mat the caller kept
+   is never handed out twice. The pool outlives a run, a graph run again on a frame of the same size (video) finds
+   every buffer it needs and allocates nothing.
+*/
+class BufferPool {
+public:
+    cv::Mat acquire(cv::Size size, int type, bool& reused) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = free.find(std::make_tuple(size.height, size.width, type));
+        reused = it != free.end() && !it->second.empty();
+        if(!reused) {
+            return cv::Mat(size, type);
+        }
+        cv::Mat buffer = it->second.back();
+        it->second.pop_back();
+        return buffer;
+    }
+
+    void release(cv::Mat& buffer) {
+        if(!buffer.empty() && buffer.u && buffer.u->refcount == 1 && !buffer.isSubmatrix()) {
+            std::lock_guard<std::mutex> lock(mutex);
+            free[std::make_tuple(buffer.rows, buffer.cols, buffer.type())].push_back(buffer);
+        }
+        buffer.release();
+    }
+
+    void clear() {
+        std::lock_guard<std::mutex> lock(mutex);
+        free.clear();
+    }
+
+private:
+    std::mutex mutex;
+    std::map<std::tuple<int, int, int>, std::vector<cv::Mat>> free;
+};
+
+/* Operation graph
+   Nodes are operations from the library, edges pass cv::Mat headers, so a result is never copied between nodes. A
+   node can only name inputs declared before it, which keeps every graph acyclic and its declaration order a
+   topological order.
+
+   run() executes the nodes on a work-stealing pool as soon as their inputs are ready, so independent branches run
+   side by side. Liveness drives the memory: every intermediate counts the consumers that still have to read it, and
+   when the last one is done its buffer returns to the pool for the next node of that size and type. An in-place
+   operation whose input dies with it writes straight over that input. Peak memory therefore follows the widest cut
+   of the graph rather than its node count. Nodes no output depends on are not run.
+
+   Text form, one statement per line, # starts a comment:
+       input image
+       gray = gray image
+       edges = sobel gray dx=1 dy=0
+       output edges
+*/
+class OperationGraph {
+public:
+    int input(const std::string& name) {
+        return addNode(name, "", {}, {});
+    }
+
+    int add(const std::string& name, const std::string& operation, const std::vector<std::string>& inputs,
+            const OperationParams& params = OperationParams()) {
+        auto it = operationLibrary().find(operation);
+        CV_Assert(it != operationLibrary().end() && (int)inputs.size() == it->second.inputs);
+        return addNode(name, operation, inputs, params);
+    }
+
+    void output(const std::string& name) {
+        CV_Assert(index.count(name));
+        if(std::find(outputNodes.begin(), outputNodes.end(), index[name]) == outputNodes.end()) {
+            outputNodes.push_back(index[name]);
+        }
+    }
+
+    const std::vector<GraphNode>& nodes() const { return graphNodes; }
+
+    //Parses the text form, appending to the graph. On failure error names the line
+    bool parse(const std::string& text, std::string& error) {
+        std::istringstream lines(text);
+        std::string line;
+        for(int number = 1; std::getline(lines, line); number++) {
+            line = line.substr(0, line.find('#'));
+            std::istringstream words(line);
+            std::vector<std::string> tokens;
+            for(std::string token; words >> token;) {
+                tokens.push_back(token);
+            }
+            if(tokens.empty()) {
+                continue;
+            }
+            try {
+                if(tokens[0] == "input" || tokens[0] == "output") {
+                    CV_Assert(tokens.size() > 1);
+                    for(size_t t = 1; t < tokens.size(); t++) {
+                        if(tokens[0] == "input") input(tokens[t]);
+                        else output(tokens[t]);
+                    }
+                }
+                else {
+                    CV_Assert(tokens.size() >= 3 && tokens[1] == "=");
+                    std::vector<std::string> inputs;
+                    OperationParams params;
+                    for(size_t t = 3; t < tokens.size(); t++) {
+                        const size_t equals = tokens[t].find('=');
+                        if(equals == std::string::npos) {
+                            inputs.push_back(tokens[t]);
+                        }
+                        else {
+                            params[tokens[t].substr(0, equals)] = std::stod(tokens[t].substr(equals + 1));
+                        }
+                    }
+                    add(tokens[0], tokens[2], inputs, params);
+                }
+            }
+            catch(const std::exception&) {
+                error = "line " + std::to_string(number) + ": " + line;
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool load(const std::string& filename, std::string& error) {
+        std::ifstream file(filename);
+        if(!file) {
+            error = "cannot read " + filename;
+            return false;
+        }
+        std::stringstream text;
+        text << file.rdbuf();
+        return parse(text.str(), error);
+    }
+
+    /* Runs the graph on the named inputs and returns the outputs by node name
+       Without declared outputs every node nobody reads is an output. Only the inputs an output depends on have to be
+       given. One run at a time per graph, the buffer pool is shared between runs. The outputs of the previous run
+       passed back in outputs are recycled through the pool, so a caller that keeps handing the same map back (and no
+       other reference to its images) gets every output written into last run's buffers.
+    */
+    GraphReport run(const std::map<std::string, cv::Mat>& inputs, std::map<std::string, cv::Mat>& outputs, WorkStealingPool& pool) {
+        PROFILE_SCOPE("OperationGraph::run");
+        const int n = (int)graphNodes.size();
+        std::vector<int> waiting(n, 0), uses(n, 0);
+        std::vector<std::vector<int>> consumers;
+        std::vector<char> isOutput, needed;
+        std::vector<cv::Mat> values(n);
+        std::vector<size_t> sizes(n, 0);
+        liveNodes(consumers, isOutput, needed);
+        for(int i = 0; i < n; i++) {
+            waiting[i] = (int)graphNodes[i].inputs.size();
+            uses[i] = (int)consumers[i].size();
+        }
+        for(auto& output : outputs) {
+            buffers.release(output.second);
+        }
+        outputs.clear();
+
+        GraphReport report;
+        std::mutex mutex;
+        size_t liveBytes = 0;
+        const int64 start = cv::getTickCount();
+
+        std::function<void(int)> execute;
+        //Called with the lock held once node i has its value: frees dead inputs and collects consumers that became ready
+        auto finish = [&](int i, std::vector<int>& ready) {
+            for(int in : graphNodes[i].inputs) {
+                if(--uses[in] == 0 && !isOutput[in] && !graphNodes[in].operation.empty() && !values[in].empty()) {
+                    liveBytes -= sizes[in];
+                    buffers.release(values[in]);
+                }
+            }
+            for(int c : consumers[i]) {
+                if(--waiting[c] == 0) {
+                    ready.push_back(c);
+                }
+            }
+        };
+        execute = [&](int i) {
+            const GraphNode& node = graphNodes[i];
+            const LibraryOperation& op = operationLibrary().at(node.operation);
+            std::vector<cv::Mat> src;
+            cv::Mat dst;
+            bool overwrite = false;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                for(int in : node.inputs) {
+                    src.push_back(values[in]);
+                }
+                //The input dies with this node: take over its buffer, its bytes stay live under the new owner
+                const int first = node.inputs[0];
+                if(op.inPlace && uses[first] == 1 && !isOutput[first] && !graphNodes[first].operation.empty()) {
+                    overwrite = true;
+                    dst = values[first];
+                    values[first].release();
+                    std::swap(sizes[i], sizes[first]);
+                    report.inPlace++;
+                }
+            }
+            if(!overwrite) {
+                cv::Size size;
+                int type;
+                bool reused;
+                op.shape(src, node.params, size, type);
+                dst = buffers.acquire(size, type, reused);
+                //Live from here on, while the node is still writing it
+                std::lock_guard<std::mutex> lock(mutex);
+                (reused ? report.reused : report.allocations)++;
+                sizes[i] = dst.total() * dst.elemSize();
+                liveBytes += sizes[i];
+                report.totalBytes += sizes[i];
+                report.peakBytes = std::max(report.peakBytes, liveBytes);
+            }
+            op.run(src, dst, node.params);
+            src.clear();
+
+            std::vector<int> ready;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                values[i] = dst;
+                dst.release();
+                finish(i, ready);
+            }
+            for(int c : ready) {
+                pool.submit([&execute, c] { execute(c); });
+            }
+        };
+
+        //Inputs are bound first, then every node they made ready is submitted
+        std::vector<int> ready;
+        for(int i = 0; i < n; i++) {
+            if(graphNodes[i].operation.empty()) {
+                if(!needed[i]) {
+                    continue;
+                }
+                auto it = inputs.find(graphNodes[i].name);
+                CV_Assert(it != inputs.end() && !it->second.empty());
+                values[i] = it->second;
+                finish(i, ready);
+            }
+            else if(needed[i] && graphNodes[i].inputs.empty()) {
+                ready.push_back(i);
+            }
+        }
+        for(int i = 0; i < n; i++) {
+            report.nodes += needed[i] && !graphNodes[i].operation.empty() ? 1 : 0;
+        }
+        for(int c : ready) {
+            pool.submit([&execute, c] { execute(c); });
+        }
+        pool.wait();
+        report.seconds = (cv::getTickCount() - start) / cv::getTickFrequency();
+
+        for(int i = 0; i < n; i++) {
+            if(isOutput[i]) {
+                outputs[graphNodes[i].name] = values[i];
+            }
+        }
+        return report;
+    }
+
+    /* Runs the graph on the calling thread, node after node in declaration order
+       For callers that are already parallel across images, like the batch driver, where a pool per image would only
+       add overhead. Intermediates are released as soon as their last consumer has run, the outputs are new buffers.
+    */
+    void evaluate(const std::map<std::string, cv::Mat>& inputs, std::vector<std::pair<std::string, cv::Mat>>& outputs) const {
+        const int n = (int)graphNodes.size();
+        std::vector<std::vector<int>> consumers;
+        std::vector<char> isOutput, needed;
+        liveNodes(consumers, isOutput, needed);
+        std::vector<int> uses(n, 0);
+        std::vector<cv::Mat> values(n);
+        for(int i = 0; i < n; i++) {
+            uses[i] = (int)consumers[i].size();
+        }
+        for(int i = 0; i < n; i++) {
+            const GraphNode& node = graphNodes[i];
+            if(!needed[i]) {
+                continue;
+            }
+            if(node.operation.empty()) {
+                auto it = inputs.find(node.name);
+                CV_Assert(it != inputs.end() && !it->second.empty());
+                values[i] = it->second;
+                continue;
+            }
+            std::vector<cv::Mat> src;
+            for(int in : node.inputs) {
+                src.push_back(values[in]);
+                if(--uses[in] == 0 && !isOutput[in]) {
+                    values[in].release();
+                }
+            }
+            operationLibrary().at(node.operation).run(src, values[i], node.params);
+        }
+        for(int i = 0; i < n; i++) {
+            if(isOutput[i]) {
+                outputs.push_back(std::make_pair(graphNodes[i].name, values[i]));
+            }
+        }
+    }
+
+    //Drops the pooled buffers kept between runs
+    void releaseBuffers() { buffers.clear(); }
+
+private:
+    //Consumers of every node that are needed, the outputs and everything an output depends on
+    void liveNodes(std::vector<std::vector<int>>& consumers, std::vector<char>& isOutput, std::vector<char>& needed) const {
+        const int n = (int)graphNodes.size();
+        consumers.assign(n, std::vector<int>());
+        isOutput.assign(n, 0);
+        needed.assign(n, 0);
+        for(int i = 0; i < n; i++) {
+            for(int in : graphNodes[i].inputs) {
+                consumers[in].push_back(i);
+            }
+        }
+        for(int i = 0; i < n; i++) {
+            isOutput[i] = outputNodes.empty() ? consumers[i].empty() : std::find(outputNodes.begin(), outputNodes.end(), i) != outputNodes.end();
+        }
+        //Walked backwards in reverse declaration order
+        for(int i = n - 1; i >= 0; i--) {
+            if(isOutput[i] || needed[i]) {
+                needed[i] = 1;
+                for(int in : graphNodes[i].inputs) {
+                    needed[in] = 1;
+                }
+            }
+        }
+        for(int i = 0; i < n; i++) {
+            consumers[i].erase(std::remove_if(consumers[i].begin(), consumers[i].end(), [&](int c) { return !needed[c]; }), consumers[i].end());
+        }
+    }
+
+    int addNode(const std::string& name, const std::string& operation, const std::vector<std::string>& inputs,
+                const OperationParams& params) {
+        CV_Assert(!name.empty() && name != "=" && !index.count(name));
+        GraphNode node;
+        node.name = name;
+        node.operation = operation;
+        node.params = params;
+        for(const std::string& in : inputs) {
+            CV_Assert(index.count(in));
+            node.inputs.push_back(index[in]);
+        }
+        index[name] = (int)graphNodes.size();
+        graphNodes.push_back(node);
+        return index[name];
+    }
+
+    std::vector<GraphNode> graphNodes;
+    std::map<std::string, int> index;
+    std::vector<int> outputNodes;
+    BufferPool buffers;
+};
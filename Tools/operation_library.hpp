@@ -0,0 +1,150 @@
+#pragma once
+
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+#include "../Chapter 2 - Image Formation/2.3 The digital camera/color_converter.hpp"
+#include "../Chapter 3 - Image Processing/3.1 Point Operators/histogram_engine.hpp"
+#include "../Chapter 3 - Image Processing/3.1 Point Operators/point_operator_pipeline.hpp"
+#include "../Chapter 3 - Image Processing/3.2 Linear Filtering/image_pyramid.hpp"
+#include "fixed_point_warp.hpp"
+#include "profiler.hpp"
+
+typedef std::map<std::string, double> OperationParams;
+
+//params[key], or fallback when the key is missing
+inline double param(const OperationParams& params, const std::string& key, double fallback) {
+    auto it = params.find(key);
+    return it == params.end() ? fallback : it->second;
+}
+
+/* One reusable image operation
+   run() is the call the chapter program makes, with its constants turned into named parameters that default to the
+   program's values. shape() gives the output size and type up front so a caller can hand run() a buffer that is
+   already allocated, run() then writes into it through create() without allocating. inPlace marks operations that
+   are correct with dst sharing the buffer of src[0].
+*/
+struct LibraryOperation {
+    int inputs = 1;
+    bool inPlace = false;
+    std::function<void(const std::vector<cv::Mat>& src, cv::Mat& dst, const OperationParams& params)> run;
+    std::function<void(const std::vector<cv::Mat>& src, const OperationParams& params, cv::Size& size, int& type)> shape;
+};
+
+/* The operations of the chapter programs, by name
+   gray, hsv       cvtColor through the fused converter of 2.3, bit-identical
+   threshold       thresh=127 maxval=255 type=THRESH_BINARY, as a point operator table
+   equalize        equalizeHist with the parallel histogram engine, bit-identical
+   gaussian        GaussianBlur ksize=5 sigma=1.5
+   sobel           Sobel dx=1 dy=1 ksize=3 into 8 bits
+   laplacian       Laplacian ksize=1 into 8 bits
+   pyrdown, pyrup  one pyramid level
+   pyrlaplacian    Laplacian pyramid level=0 of ImagePyramid, shifted by offset=128 into the input depth
+   rotate          fixedPointWarpAffine angle=45 scale=1 about the centre, same size, as the tiled rotate
+   blend           addWeighted alpha=0.5 beta=0.5 of two inputs
+   absdiff         absdiff of two inputs
+*/
+inline const std::map<std::string, LibraryOperation>& operationLibrary() {
+    static const std::map<std::string, LibraryOperation> library = [] {
+        std::map<std::string, LibraryOperation> ops;
+        auto sameShape = [](const std::vector<cv::Mat>& src, const OperationParams&, cv::Size& size, int& type) {
+            size = src[0].size();
+            type = src[0].type();
+        };
+        auto grayShape = [](const std::vector<cv::Mat>& src, const OperationParams&, cv::Size& size, int& type) {
+            size = src[0].size();
+            type = CV_MAKETYPE(src[0].depth(), 1);
+        };
+        //Every operation is profiled under its library name
+        auto add = [&](const char* name, int inputs, bool inPlace, decltype(LibraryOperation::run) run,
+                       decltype(LibraryOperation::shape) shape) {
+            LibraryOperation op;
+            op.inputs = inputs;
+            op.inPlace = inPlace;
+            op.run = [name, run](const std::vector<cv::Mat>& src, cv::Mat& dst, const OperationParams& params) {
+                ProfileScope scope(name, src);
+                run(src, dst, params);
+                scope.output(dst);
+            };
+            op.shape = shape;
+            ops[name] = op;
+        };
+
+        add("gray", 1, false, [](const std::vector<cv::Mat>& src, cv::Mat& dst, const OperationParams&) {
+            if(src[0].type() == CV_8UC3) {
+                ColorOutputs out;
+                out.gray = dst;
+                convertColors(src[0], out, COLOR_PLANE_GRAY);
+                dst = out.gray;
+            }
+            else {
+                profiled::cvtColor(src[0], dst, cv::COLOR_BGR2GRAY);
+            }
+        }, grayShape);
+        add("hsv", 1, false, [](const std::vector<cv::Mat>& src, cv::Mat& dst, const OperationParams&) {
+            CV_Assert(src[0].type() == CV_8UC3);
+            ColorOutputs out;
+            out.hsv = dst;
+            convertColors(src[0], out, COLOR_PLANE_HSV);
+            dst = out.hsv;
+        }, sameShape);
+        add("threshold", 1, true, [](const std::vector<cv::Mat>& src, cv::Mat& dst, const OperationParams& p) {
+            PointOperatorPipeline().threshold(param(p, "thresh", 127), param(p, "maxval", 255), (int)param(p, "type", cv::THRESH_BINARY))
+                .apply(src[0], dst);
+        }, sameShape);
+        add("equalize", 1, true, [](const std::vector<cv::Mat>& src, cv::Mat& dst, const OperationParams&) {
+            parallelEqualizeHist(src[0], dst);
+        }, sameShape);
+        add("gaussian", 1, false, [](const std::vector<cv::Mat>& src, cv::Mat& dst, const OperationParams& p) {
+            const int ksize = (int)param(p, "ksize", 5);
+            const double sigma = param(p, "sigma", 1.5);
+            profiled::GaussianBlur(src[0], dst, cv::Size(ksize, ksize), sigma, sigma);
+        }, sameShape);
+        add("sobel", 1, false, [](const std::vector<cv::Mat>& src, cv::Mat& dst, const OperationParams& p) {
+            profiled::Sobel(src[0], dst, CV_8U, (int)param(p, "dx", 1), (int)param(p, "dy", 1), (int)param(p, "ksize", 3),
+                      param(p, "scale", 1), param(p, "delta", 1));
+        }, sameShape);
+        add("laplacian", 1, false, [](const std::vector<cv::Mat>& src, cv::Mat& dst, const OperationParams& p) {
+            profiled::Laplacian(src[0], dst, -1, (int)param(p, "ksize", 1), param(p, "scale", 1), param(p, "delta", 1));
+        }, sameShape);
+        add("pyrdown", 1, false, [](const std::vector<cv::Mat>& src, cv::Mat& dst, const OperationParams&) {
+            profiled::pyrDown(src[0], dst);
+        }, [](const std::vector<cv::Mat>& src, const OperationParams&, cv::Size& size, int& type) {
+            size = cv::Size((src[0].cols + 1) / 2, (src[0].rows + 1) / 2);
+            type = src[0].type();
+        });
+        add("pyrup", 1, false, [](const std::vector<cv::Mat>& src, cv::Mat& dst, const OperationParams&) {
+            profiled::pyrUp(src[0], dst);
+        }, [](const std::vector<cv::Mat>& src, const OperationParams&, cv::Size& size, int& type) {
+            size = cv::Size(src[0].cols * 2, src[0].rows * 2);
+            type = src[0].type();
+        });
+        add("pyrlaplacian", 1, false, [](const std::vector<cv::Mat>& src, cv::Mat& dst, const OperationParams& p) {
+            const int level = (int)param(p, "level", 0);
+            ImagePyramid pyramid(level + 2);
+            pyramid.setImage(src[0]);
+            pyramid.laplacian(level).convertTo(dst, src[0].depth(), 1, param(p, "offset", 128));
+        }, [](const std::vector<cv::Mat>& src, const OperationParams& p, cv::Size& size, int& type) {
+            size = src[0].size();
+            for(int level = 0; level < (int)param(p, "level", 0); level++) {
+                size = cv::Size((size.width + 1) / 2, (size.height + 1) / 2);
+            }
+            type = src[0].type();
+        });
+        add("rotate", 1, false, [](const std::vector<cv::Mat>& src, cv::Mat& dst, const OperationParams& p) {
+            cv::Mat rotate_matrix = cv::getRotationMatrix2D(cv::Point2f(src[0].cols/2.0, src[0].rows/2.0), param(p, "angle", 45), param(p, "scale", 1.0));
+            fixedPointWarpAffine(src[0], dst, rotate_matrix, src[0].size());
+        }, sameShape);
+        add("blend", 2, true, [](const std::vector<cv::Mat>& src, cv::Mat& dst, const OperationParams& p) {
+            cv::addWeighted(src[0], param(p, "alpha", 0.5), src[1], param(p, "beta", 0.5), param(p, "gamma", 0), dst);
+        }, sameShape);
+        add("absdiff", 2, true, [](const std::vector<cv::Mat>& src, cv::Mat& dst, const OperationParams&) {
+            cv::absdiff(src[0], src[1], dst);
+        }, sameShape);
+        return ops;
+    }();
+    return library;
+}
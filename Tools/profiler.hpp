@@ -0,0 +1,385 @@
+#pragma once
+
+#include <opencv2/core.hpp>
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/imgproc.hpp>
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+/* One timed call
+   name has to outlive the profiler: a string literal, or a name from Profiler::intern(). Times are in ticks of
+   cv::getTickCount().
+*/
+struct ProfileEvent {
+    const char* name;
+    int64 start, end;
+    size_t bytesIn, bytesOut;
+    int allocations;
+    int thread;
+};
+
+/* Mat allocator that counts
+   Wraps OpenCV's standard allocator and counts, per thread, every buffer a Mat allocates. The buffer itself belongs to
+   the standard allocator, so freeing it never comes back here. Installed only while the profiler is enabled.
+*/
+class CountingMatAllocator : public cv::MatAllocator {
+public:
+    static int& threadCount() {
+        static thread_local int count = 0;
+        return count;
+    }
+
+    cv::UMatData* allocate(int dims, const int* sizes, int type, void* data, size_t* step, cv::AccessFlag flags,
+                           cv::UMatUsageFlags usageFlags) const override {
+        if(!data) {
+            threadCount()++;
+        }
+        return cv::Mat::getStdAllocator()->allocate(dims, sizes, type, data, step, flags, usageFlags);
+    }
+
+    bool allocate(cv::UMatData* data, cv::AccessFlag accessFlags, cv::UMatUsageFlags usageFlags) const override {
+        return cv::Mat::getStdAllocator()->allocate(data, accessFlags, usageFlags);
+    }
+
+    void deallocate(cv::UMatData* data) const override {
+        cv::Mat::getStdAllocator()->deallocate(data);
+    }
+};
+
+/* Process-wide profiler
+   Disabled, a profiled call costs one relaxed atomic load. Enabled, every thread appends its events to its own buffer
+   without locking, the buffers are only merged on export, which should happen once the work is done and the worker
+   threads are idle. Setting PROFILE_TRACE=<file.json> in the environment enables it at startup, before main(), and
+   writes the Chrome trace and the summary at exit, so any program can be profiled without changing it.
+*/
+class Profiler {
+public:
+    static Profiler& get() {
+        static Profiler profiler;
+        //Registered once the profiler is fully constructed, so the exit handler runs before its destructor
+        static const bool traced = profiler.traceAtExit();
+        (void)traced;
+        return profiler;
+    }
+
+    static bool enabled() { return get().active.load(std::memory_order_relaxed); }
+
+    void enable(bool on = true) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if(on == active.load()) {
+            return;
+        }
+        if(on) {
+            previousAllocator = cv::Mat::getDefaultAllocator();
+            cv::Mat::setDefaultAllocator(&allocator);
+            if(origin == 0) {
+                origin = cv::getTickCount();
+            }
+        }
+        else {
+            cv::Mat::setDefaultAllocator(previousAllocator);
+        }
+        active = on;
+    }
+
+    //Drops every recorded event, the time origin restarts at the next enable()
+    void reset() {
+        std::lock_guard<std::mutex> lock(mutex);
+        for(auto& buffer : buffers) {
+            buffer->events.clear();
+        }
+        origin = active ? cv::getTickCount() : 0;
+    }
+
+    void record(const ProfileEvent& event) {
+        threadBuffer().events.push_back(event);
+    }
+
+    //A copy of name that lives as long as the profiler, for event names built at run time
+    const char* intern(const std::string& name) {
+        std::lock_guard<std::mutex> lock(mutex);
+        return names.insert(name).first->c_str();
+    }
+
+    //Small sequential id of the calling thread, stable for its lifetime
+    int threadId() { return threadBuffer().id; }
+
+    std::vector<ProfileEvent> events() {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::vector<ProfileEvent> all;
+        for(auto& buffer : buffers) {
+            all.insert(all.end(), buffer->events.begin(), buffer->events.end());
+        }
+        std::sort(all.begin(), all.end(), [](const ProfileEvent& a, const ProfileEvent& b) { return a.start < b.start; });
+        return all;
+    }
+
+    /* Chrome trace-event JSON, open in chrome://tracing or ui.perfetto.dev
+       Every call is a complete ("X") event on the row of its thread, nested calls stack under their caller. Bytes and
+       allocations are in the event arguments.
+    */
+    bool writeChromeTrace(const std::string& filename) {
+        FILE* file = fopen(filename.c_str(), "w");
+        if(!file) {
+            return false;
+        }
+        const double usPerTick = 1e6 / cv::getTickFrequency();
+        fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+        const std::vector<ProfileEvent> all = events();
+        for(size_t i = 0; i < all.size(); i++) {
+            const ProfileEvent& e = all[i];
+            fprintf(file, "{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,"
+                          "\"args\":{\"bytesIn\":%zu,\"bytesOut\":%zu,\"allocations\":%d}}%s\n",
+                    e.name, e.thread, (e.start - origin) * usPerTick, (e.end - e.start) * usPerTick, e.bytesIn, e.bytesOut,
+                    e.allocations, i + 1 < all.size() ? "," : "");
+        }
+        fprintf(file, "]}\n");
+        return fclose(file) == 0;
+    }
+
+    /* Summary per operation name, the most expensive first
+       Total time includes nested calls, so an operation that calls other profiled operations also counts their time.
+       Throughput is input megabytes per second of the operation's own wall time.
+    */
+    void printSummary(std::ostream& out = std::cout) {
+        struct Row {
+            size_t calls = 0, bytesIn = 0, bytesOut = 0, allocations = 0;
+            int64 total = 0, longest = 0;
+            std::vector<char> threads;
+        };
+        std::map<std::string, Row> rows;
+        int64 first = 0, last = 0;
+        const std::vector<ProfileEvent> all = events();
+        for(const ProfileEvent& e : all) {
+            Row& row = rows[e.name];
+            row.calls++;
+            row.total += e.end - e.start;
+            row.longest = std::max(row.longest, e.end - e.start);
+            row.bytesIn += e.bytesIn;
+            row.bytesOut += e.bytesOut;
+            row.allocations += e.allocations;
+            row.threads.resize(std::max(row.threads.size(), (size_t)e.thread + 1), 0);
+            row.threads[e.thread] = 1;
+            first = first == 0 ? e.start : std::min(first, e.start);
+            last = std::max(last, e.end);
+        }
+        std::vector<std::pair<std::string, Row>> sorted(rows.begin(), rows.end());
+        std::sort(sorted.begin(), sorted.end(), [](const std::pair<std::string, Row>& a, const std::pair<std::string, Row>& b) {
+            return a.second.total > b.second.total;
+        });
+        const double msPerTick = 1000.0 / cv::getTickFrequency();
+        out << all.size() << " calls over " << (last - first) * msPerTick << " ms" << std::endl;
+        out << std::left << std::setw(28) << "operation" << std::right << std::setw(8) << "calls" << std::setw(12) << "total ms"
+            << std::setw(10) << "mean ms" << std::setw(10) << "max ms" << std::setw(10) << "MB in" << std::setw(10) << "MB out"
+            << std::setw(10) << "MB/s" << std::setw(8) << "allocs" << std::setw(8) << "threads" << std::endl;
+        out << std::fixed << std::setprecision(2);
+        for(const auto& entry : sorted) {
+            const Row& row = entry.second;
+            const double ms = row.total * msPerTick;
+            out << std::left << std::setw(28) << entry.first << std::right << std::setw(8) << row.calls << std::setw(12) << ms
+                << std::setw(10) << ms / row.calls << std::setw(10) << row.longest * msPerTick
+                << std::setw(10) << row.bytesIn / 1048576.0 << std::setw(10) << row.bytesOut / 1048576.0
+                << std::setw(10) << (ms > 0 ? row.bytesIn / 1048576.0 / (ms / 1000) : 0) << std::setw(8) << row.allocations
+                << std::setw(8) << std::count(row.threads.begin(), row.threads.end(), 1) << std::endl;
+        }
+        out.unsetf(std::ios::floatfield);
+        out << std::setprecision(6);
+    }
+
+private:
+    struct ThreadBuffer {
+        int id = 0;
+        std::vector<ProfileEvent> events;
+    };
+
+    Profiler() {}
+
+    bool traceAtExit() {
+        const char* trace = std::getenv("PROFILE_TRACE");
+        if(!trace || !*trace) {
+            return false;
+        }
+        traceFile = trace;
+        enable();
+        std::atexit([] {
+            Profiler& profiler = get();
+            profiler.printSummary();
+            if(!profiler.writeChromeTrace(profiler.traceFile)) {
+                std::cout << "Failed to write " << profiler.traceFile << std::endl;
+            }
+        });
+        return true;
+    }
+
+    //Each thread registers its buffer once, the profiler keeps it after the thread exits
+    ThreadBuffer& threadBuffer() {
+        static thread_local ThreadBuffer* buffer = nullptr;
+        if(!buffer) {
+            std::lock_guard<std::mutex> lock(mutex);
+            buffers.emplace_back(new ThreadBuffer());
+            buffer = buffers.back().get();
+            buffer->id = (int)buffers.size() - 1;
+        }
+        return *buffer;
+    }
+
+    std::atomic<bool> active{false};
+    std::mutex mutex;
+    std::vector<std::unique_ptr<ThreadBuffer>> buffers;
+    std::set<std::string> names;
+    CountingMatAllocator allocator;
+    cv::MatAllocator* previousAllocator = nullptr;
+    int64 origin = 0;
+    std::string traceFile;
+};
+
+/* Times the enclosing block as one event
+   bytesIn and output() are optional, they feed the byte columns. Nothing is touched while the profiler is disabled.
+*/
+class ProfileScope {
+public:
+    explicit ProfileScope(const char* name, size_t bytesIn = 0) {
+        if(!Profiler::enabled()) {
+            return;
+        }
+        active = true;
+        event.name = name;
+        event.bytesIn = bytesIn;
+        event.bytesOut = 0;
+        event.allocations = -CountingMatAllocator::threadCount();
+        event.start = cv::getTickCount();
+    }
+
+    ProfileScope(const char* name, const cv::Mat& input) : ProfileScope(name, input.total() * input.elemSize()) {}
+
+    ProfileScope(const char* name, const std::vector<cv::Mat>& inputs) : ProfileScope(name, (size_t)0) {
+        for(size_t i = 0; active && i < inputs.size(); i++) {
+            event.bytesIn += inputs[i].total() * inputs[i].elemSize();
+        }
+    }
+
+    void output(const cv::Mat& result) {
+        if(active) {
+            event.bytesOut += result.total() * result.elemSize();
+        }
+    }
+
+    ~ProfileScope() {
+        if(active) {
+            event.end = cv::getTickCount();
+            event.allocations += CountingMatAllocator::threadCount();
+            Profiler& profiler = Profiler::get();
+            event.thread = profiler.threadId();
+            profiler.record(event);
+        }
+    }
+
+    ProfileScope(const ProfileScope&) = delete;
+    ProfileScope& operator=(const ProfileScope&) = delete;
+
+private:
+    bool active = false;
+    ProfileEvent event;
+};
+
+//Reads PROFILE_TRACE during static initialisation of every program that includes the profiler
+namespace {
+const bool profileTraceAtStartup = (Profiler::get(), true);
+}
+
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+//PROFILE_SCOPE("name") or PROFILE_SCOPE("name", inputMat) times the rest of the enclosing block
+#define PROFILE_SCOPE(...) ProfileScope PROFILE_CONCAT(profileScope, __LINE__)(__VA_ARGS__)
+
+/* Profiled drop-in versions of the OpenCV calls the programs make
+   Same arguments and results as the cv:: function, recorded under its name with the bytes read and written.
+*/
+namespace profiled {
+
+inline cv::Mat imread(const std::string& filename, int flags = cv::IMREAD_COLOR) {
+    ProfileScope scope("imread");
+    cv::Mat img = cv::imread(filename, flags);
+    scope.output(img);
+    return img;
+}
+
+inline bool imwrite(const std::string& filename, const cv::Mat& img, const std::vector<int>& params = std::vector<int>()) {
+    ProfileScope scope("imwrite", img);
+    return cv::imwrite(filename, img, params);
+}
+
+inline void cvtColor(const cv::Mat& src, cv::Mat& dst, int code) {
+    ProfileScope scope("cvtColor", src);
+    cv::cvtColor(src, dst, code);
+    scope.output(dst);
+}
+
+inline double threshold(const cv::Mat& src, cv::Mat& dst, double thresh, double maxval, int type) {
+    ProfileScope scope("threshold", src);
+    const double result = cv::threshold(src, dst, thresh, maxval, type);
+    scope.output(dst);
+    return result;
+}
+
+inline void equalizeHist(const cv::Mat& src, cv::Mat& dst) {
+    ProfileScope scope("equalizeHist", src);
+    cv::equalizeHist(src, dst);
+    scope.output(dst);
+}
+
+inline void GaussianBlur(const cv::Mat& src, cv::Mat& dst, cv::Size ksize, double sigmaX, double sigmaY = 0) {
+    ProfileScope scope("GaussianBlur", src);
+    cv::GaussianBlur(src, dst, ksize, sigmaX, sigmaY);
+    scope.output(dst);
+}
+
+inline void Sobel(const cv::Mat& src, cv::Mat& dst, int ddepth, int dx, int dy, int ksize = 3, double scale = 1, double delta = 0) {
+    ProfileScope scope("Sobel", src);
+    cv::Sobel(src, dst, ddepth, dx, dy, ksize, scale, delta);
+    scope.output(dst);
+}
+
+inline void Laplacian(const cv::Mat& src, cv::Mat& dst, int ddepth, int ksize = 1, double scale = 1, double delta = 0) {
+    ProfileScope scope("Laplacian", src);
+    cv::Laplacian(src, dst, ddepth, ksize, scale, delta);
+    scope.output(dst);
+}
+
+inline void pyrDown(const cv::Mat& src, cv::Mat& dst, cv::Size dstsize = cv::Size()) {
+    ProfileScope scope("pyrDown", src);
+    cv::pyrDown(src, dst, dstsize);
+    scope.output(dst);
+}
+
+inline void pyrUp(const cv::Mat& src, cv::Mat& dst, cv::Size dstsize = cv::Size()) {
+    ProfileScope scope("pyrUp", src);
+    cv::pyrUp(src, dst, dstsize);
+    scope.output(dst);
+}
+
+inline void warpAffine(const cv::Mat& src, cv::Mat& dst, const cv::Mat& M, cv::Size dsize, int flags = cv::INTER_LINEAR,
+                       int borderMode = cv::BORDER_CONSTANT) {
+    ProfileScope scope("warpAffine", src);
+    cv::warpAffine(src, dst, M, dsize, flags, borderMode);
+    scope.output(dst);
+}
+
+inline void warpPerspective(const cv::Mat& src, cv::Mat& dst, const cv::Mat& M, cv::Size dsize, int flags = cv::INTER_LINEAR,
+                            int borderMode = cv::BORDER_CONSTANT) {
+    ProfileScope scope("warpPerspective", src);
+    cv::warpPerspective(src, dst, M, dsize, flags, borderMode);
+    scope.output(dst);
+}
+
+}
@@ -0,0 +1,253 @@
+#pragma once
+
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+#include <algorithm>
+#include <atomic>
+#include <cfloat>
+#include <exception>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "fixed_point_warp.hpp"
+#include "profiler.hpp"
+#include "tiled_image.hpp"
+#include "../Chapter 3 - Image Processing/3.1 Point Operators/histogram_engine.hpp"
+
+/* Operation on one output tile
+   region() names the input rectangle the tile depends on, apply() turns that input into the tile. A neighbourhood
+   filter needs the tile plus a halo of its kernel radius, a warp needs the bounding box of the tile mapped back into
+   the input. Input outside the image is filled by the reader with borderType, the same rule the whole-image call uses
+   at its edges, so every tile sees exactly the pixels the whole-image call would and the tiles join without seams.
+*/
+struct TiledOperation {
+    std::string name;
+    int outputType = -1;                //-1 keeps the input type
+    cv::Size outputSize;                //Empty keeps the input size
+    int borderType = cv::BORDER_REFLECT_101;
+    cv::Scalar borderValue;
+    std::function<cv::Rect(const cv::Rect& tile)> region;
+    //dst has to come out as tile.size() with outputType, it may be a view into a larger buffer
+    std::function<void(const cv::Mat& src, const cv::Rect& region, const cv::Rect& tile, cv::Mat& dst)> apply;
+
+    //Neighbourhood operation: filter(src, dst) runs on the tile grown by halo and the result is cropped back
+    static TiledOperation local(const std::string& name, int halo, const std::function<void(const cv::Mat&, cv::Mat&)>& filter,
+                                int outputType = -1) {
+        CV_Assert(halo >= 0);
+        TiledOperation op;
+        op.name = name;
+        op.outputType = outputType;
+        op.region = [halo](const cv::Rect& tile) {
+            return cv::Rect(tile.x - halo, tile.y - halo, tile.width + 2 * halo, tile.height + 2 * halo);
+        };
+        op.apply = [filter](const cv::Mat& src, const cv::Rect& region, const cv::Rect& tile, cv::Mat& dst) {
+            cv::Mat filtered;
+            filter(src, filtered);
+            dst = filtered(cv::Rect(tile.x - region.x, tile.y - region.y, tile.width, tile.height));
+        };
+        return op;
+    }
+
+    /* fixedPointWarpAffine(src, dst, M, outputSize, interpolation) one output tile at a time
+       Each tile reads the bounding box of its corners mapped through the inverse of M, plus the interpolation support,
+       clipped to the input, and remaps it with coordinate maps built from the global matrix and the global output
+       coordinates (affineWarpMaps()), only shifted to the region's origin. Every output pixel therefore samples the same
+       position with the same fixed-point fraction as the whole-image warp and the tiles match it bit for bit. Strong
+       downscaling makes the input region of a tile larger than the tile.
+    */
+    static TiledOperation warp(const cv::Mat& M, cv::Size inputSize, cv::Size outputSize, int interpolation = cv::INTER_LINEAR) {
+        const cv::Matx23d inverse = invertAffineWarp(M);
+        const int support = interpolation == cv::INTER_CUBIC ? 2 : interpolation == cv::INTER_LANCZOS4 ? 4 : 1;
+        TiledOperation op;
+        op.name = "warp";
+        op.outputSize = outputSize;
+        op.borderType = cv::BORDER_CONSTANT;
+        op.region = [inverse, support, inputSize](const cv::Rect& tile) {
+            double x0 = DBL_MAX, y0 = DBL_MAX, x1 = -DBL_MAX, y1 = -DBL_MAX;
+            for(int corner = 0; corner < 4; corner++) {
+                const double x = tile.x + (corner & 1 ? tile.width - 1 : 0), y = tile.y + (corner & 2 ? tile.height - 1 : 0);
+                const double u = inverse(0, 0) * x + inverse(0, 1) * y + inverse(0, 2), v = inverse(1, 0) * x + inverse(1, 1) * y + inverse(1, 2);
+                x0 = std::min(x0, u); x1 = std::max(x1, u);
+                y0 = std::min(y0, v); y1 = std::max(y1, v);
+            }
+            //Outside the input remap() fills the border itself, as the whole-image warp does
+            const int left = cvFloor(x0) - support, top = cvFloor(y0) - support;
+            const cv::Rect region = cv::Rect(left, top, cvCeil(x1) + support + 1 - left, cvCeil(y1) + support + 1 - top) & cv::Rect(cv::Point(), inputSize);
+            //A tile that maps entirely outside still needs a source, every sample of it is border
+            return region.empty() ? cv::Rect(0, 0, 1, 1) : region;
+        };
+        op.apply = [inverse, interpolation](const cv::Mat& src, const cv::Rect& region, const cv::Rect& tile, cv::Mat& dst) {
+            cv::Mat xy, fraction;
+            affineWarpMaps(inverse, tile, region.tl(), interpolation, xy, fraction);
+            cv::remap(src, dst, xy, fraction, interpolation, cv::BORDER_CONSTANT);
+        };
+        return op;
+    }
+};
+
+struct TiledReport {
+    size_t tiles = 0;
+    int workers = 0;
+    double seconds = 0;
+    size_t peakWorkerBytes = 0;         //Largest input + output buffer a worker held for one tile
+
+    void print() const {
+        std::cout << tiles << " tiles on " << workers << " workers in " << seconds << " s, at most "
+                  << peakWorkerBytes / (1024.0 * 1024.0) << " MB per worker (" << workers * peakWorkerBytes / (1024.0 * 1024.0)
+                  << " MB in flight)" << std::endl;
+    }
+};
+
+/* Out-of-core tile executor
+   A fixed pool of workers pulls tile indices from a shared counter. Per tile a worker reads the input region from the
+   tiled file, applies the operation and writes the tile straight to its slot in the output file, then drops both
+   buffers. Nothing else is kept, so memory is bounded by workers x (input region + output tile) whatever the image
+   size. OpenCV's own threading is best switched off with setNumThreads(1), the parallelism is across tiles.
+*/
+class TiledExecutor {
+public:
+    explicit TiledExecutor(int workers = std::max(1, cv::getNumberOfCPUs())) : workers(std::max(1, workers)) {}
+
+    int getWorkers() const { return workers; }
+
+    //Runs op over every tile of input into output, which has to be created with the operation's size and type
+    TiledReport run(const TiledImageReader& input, TiledImageWriter& output, const TiledOperation& op) const {
+        CV_Assert(input.isOpen() && output.isOpen());
+        CV_Assert(output.size() == (op.outputSize.empty() ? input.size() : op.outputSize));
+        CV_Assert(output.type() == (op.outputType < 0 ? input.type() : op.outputType));
+        std::atomic<size_t> peak(0);
+        const char* name = Profiler::get().intern(op.name);
+        return forEachIndex(output.tileCount(), [&](int index, int) {
+            const int tx = index % output.tilesX(), ty = index / output.tilesX();
+            const cv::Rect tile = output.tileRect(tx, ty), region = op.region(tile);
+            cv::Mat src, dst;
+            {
+                PROFILE_SCOPE("readRegion");
+                input.readRegion(region, src, op.borderType, op.borderValue);
+            }
+            {
+                ProfileScope scope(name, src);
+                op.apply(src, region, tile, dst);
+                scope.output(dst);
+            }
+            CV_Assert(dst.size() == tile.size() && dst.type() == output.type());
+            PROFILE_SCOPE("writeTile", dst);
+            CV_Assert(output.writeTile(tx, ty, dst));
+            //dst may be a view, its whole buffer counts
+            const size_t bytes = src.total() * src.elemSize() + (size_t)(dst.datalimit - dst.datastart);
+            size_t seen = peak.load();
+            while(bytes > seen && !peak.compare_exchange_weak(seen, bytes)) {}
+        }, peak);
+    }
+
+    //Creates output next to the input's tile size and runs op into it
+    TiledReport run(const TiledImageReader& input, const std::string& output, const TiledOperation& op) const {
+        TiledImageWriter writer;
+        CV_Assert(writer.create(output, op.outputSize.empty() ? input.size() : op.outputSize,
+                                op.outputType < 0 ? input.type() : op.outputType, input.tileSize()));
+        TiledReport report = run(input, writer, op);
+        CV_Assert(writer.close());
+        return report;
+    }
+
+    //Calls fn(tile image, tile rect, worker index) for every input tile, for reductions kept per worker
+    TiledReport forEachTile(const TiledImageReader& input, const std::function<void(const cv::Mat&, const cv::Rect&, int)>& fn) const {
+        CV_Assert(input.isOpen());
+        std::atomic<size_t> peak(0);
+        return forEachIndex(input.tileCount(), [&](int index, int worker) {
+            const cv::Rect tile = input.tileRect(index % input.tilesX(), index / input.tilesX());
+            cv::Mat src;
+            {
+                PROFILE_SCOPE("readRegion");
+                input.readRegion(tile, src);
+            }
+            fn(src, tile, worker);
+            const size_t bytes = src.total() * src.elemSize();
+            size_t seen = peak.load();
+            while(bytes > seen && !peak.compare_exchange_weak(seen, bytes)) {}
+        }, peak);
+    }
+
+    /* Histogram equalization of a tiled image, identical to equalizeHist on the whole image
+       1) A reduction pass counts every tile into its worker's 64-bit histogram (an image past 2^31 pixels overflows int)
+       2) The merged histogram gives the table equalizeHist would build
+       3) The returned operation applies that table tile by tile, it needs no halo
+       Colour input is converted to gray in both passes, like the equalize of the batch driver.
+    */
+    TiledOperation equalization(const TiledImageReader& input) const {
+        CV_Assert(input.type() == CV_8UC1 || input.type() == CV_8UC3);
+        const bool colour = input.type() == CV_8UC3;
+        std::vector<int64> hists((size_t)workers * 256, 0);
+        forEachTile(input, [&](const cv::Mat& tile, const cv::Rect&, int worker) {
+            cv::Mat gray_img = tile;
+            if(colour) {
+                cv::cvtColor(tile, gray_img, cv::COLOR_BGR2GRAY);
+            }
+            int hist[256] = {0};
+            privatizedHistogram(gray_img, hist);
+            for(int v = 0; v < 256; v++) {
+                hists[(size_t)worker * 256 + v] += hist[v];
+            }
+        });
+        int64 hist[256] = {0};
+        for(int w = 0; w < workers; w++) {
+            for(int v = 0; v < 256; v++) {
+                hist[v] += hists[(size_t)w * 256 + v];
+            }
+        }
+        const std::vector<int> lut = equalizationTable<int64>(hist, (int64)input.size().width * input.size().height);
+        return TiledOperation::local("equalize", 0, [lut, colour](const cv::Mat& src, cv::Mat& dst) {
+            if(colour) {
+                cv::cvtColor(src, dst, cv::COLOR_BGR2GRAY);
+                applyTable(dst, dst, lut.data());
+            }
+            else {
+                applyTable(src, dst, lut.data());
+            }
+        }, CV_8UC1);
+    }
+
+private:
+    template<typename Fn>
+    TiledReport forEachIndex(int count, const Fn& fn, const std::atomic<size_t>& peak) const {
+        TiledReport report;
+        report.tiles = count;
+        report.workers = std::min(workers, std::max(1, count));
+        const int64 start = cv::getTickCount();
+        std::atomic<int> next(0);
+        std::exception_ptr error;
+        std::mutex errorMutex;
+        std::vector<std::thread> threads;
+        for(int w = 0; w < report.workers; w++) {
+            threads.emplace_back([&, w]() {
+                for(int index = next++; index < count; index = next++) {
+                    try {
+                        fn(index, w);
+                    }
+                    catch(...) {
+                        //The first failure stops the other workers and is rethrown to the caller
+                        std::lock_guard<std::mutex> lock(errorMutex);
+                        if(!error) {
+                            error = std::current_exception();
+                        }
+                        next = count;
+                    }
+                }
+            });
+        }
+        for(std::thread& thread : threads) {
+            thread.join();
+        }
+        if(error) {
+            std::rethrow_exception(error);
+        }
+        report.seconds = (cv::getTickCount() - start) / cv::getTickFrequency();
+        report.peakWorkerBytes = peak.load();
+        return report;
+    }
+
+    int workers;
+};
@@ -0,0 +1,271 @@
+#pragma once
+
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* Tiled image format (.tim)
+   An uncompressed image stored as square tiles, so any rectangle can be read without touching the rest of the file:
+       [0..3]    magic "TIM1"
+       [4..7]    uint32 version (1)
+       [8..23]   int32 rows, cols, type, tile size
+       [24..63]  zero
+       [64..]    tiles in row-major tile order, every tile a full tileSize x tileSize block of packed rows (the tiles
+                 on the right and bottom edge are padded), so tile (tx, ty) starts at 64 + (ty * tilesX + tx) * tileBytes
+   Reads and writes go through pread/pwrite on one descriptor, which is safe from several threads at once and keeps
+   only the buffers the caller passes in memory, unlike a mapping whose pages stay resident.
+*/
+struct TiledImageHeader {
+    char magic[4];
+    uint32_t version;
+    int32_t rows, cols, type, tileSize;
+    char reserved[40];
+};
+
+static const char TILED_IMAGE_MAGIC[4] = {'T', 'I', 'M', '1'};
+static const uint32_t TILED_IMAGE_VERSION = 1;
+
+//Tile grid of an image, shared by the reader and the writer
+class TiledLayout {
+public:
+    cv::Size size() const { return cv::Size(header.cols, header.rows); }
+    int type() const { return header.type; }
+    int tileSize() const { return header.tileSize; }
+    int tilesX() const { return (header.cols + header.tileSize - 1) / header.tileSize; }
+    int tilesY() const { return (header.rows + header.tileSize - 1) / header.tileSize; }
+    int tileCount() const { return tilesX() * tilesY(); }
+
+    //Pixels of tile (tx, ty) inside the image, smaller than tileSize on the right and bottom edge
+    cv::Rect tileRect(int tx, int ty) const {
+        return cv::Rect(tx * header.tileSize, ty * header.tileSize, header.tileSize, header.tileSize) & cv::Rect(cv::Point(), size());
+    }
+
+protected:
+    size_t pixelBytes() const { return CV_ELEM_SIZE(header.type); }
+    size_t tileRowBytes() const { return header.tileSize * pixelBytes(); }
+    size_t tileBytes() const { return header.tileSize * tileRowBytes(); }
+    off_t tileOffset(int tx, int ty) const { return (off_t)sizeof(TiledImageHeader) + (off_t)(ty * tilesX() + tx) * (off_t)tileBytes(); }
+
+    TiledImageHeader header = TiledImageHeader();
+    int fd = -1;
+};
+
+/* Random access reader
+   readRegion() returns any rectangle, also one reaching past the image edges, which is filled with the border rule
+   the whole-image OpenCV call would use. That is how a tile gets the halo a filter needs.
+*/
+class TiledImageReader : public TiledLayout {
+public:
+    TiledImageReader() {}
+    explicit TiledImageReader(const std::string& filename) { open(filename); }
+    ~TiledImageReader() { close(); }
+    TiledImageReader(const TiledImageReader&) = delete;
+    TiledImageReader& operator=(const TiledImageReader&) = delete;
+
+    bool open(const std::string& filename) {
+        close();
+        fd = ::open(filename.c_str(), O_RDONLY);
+        if(fd < 0) {
+            return false;
+        }
+        struct stat info;
+        if(pread(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header) || memcmp(header.magic, TILED_IMAGE_MAGIC, 4) != 0 ||
+           header.version != TILED_IMAGE_VERSION || header.rows <= 0 || header.cols <= 0 || header.tileSize <= 0 ||
+           fstat(fd, &info) != 0 || info.st_size < tileOffset(0, tilesY())) {
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    bool isOpen() const { return fd >= 0; }
+
+    void close() {
+        if(fd >= 0) {
+            ::close(fd);
+        }
+        fd = -1;
+    }
+
+    /* Reads region into dst (region.size(), type())
+       1) The part inside the image is read tile by tile, one pread per tile for the rows it contributes
+       2) Regions reaching past the edge are read into a separate buffer that copyMakeBorder pads. For
+          BORDER_REFLECT_101 the inside part has to be wider and taller than the border it mirrors, which holds
+          whenever the halo is smaller than the tile size
+    */
+    void readRegion(const cv::Rect& region, cv::Mat& dst, int borderType = cv::BORDER_REFLECT_101,
+                    const cv::Scalar& borderValue = cv::Scalar()) const {
+        CV_Assert(isOpen() && region.width > 0 && region.height > 0);
+        dst.create(region.size(), type());
+        const cv::Rect inside = region & cv::Rect(cv::Point(), size());
+        if(inside.empty()) {
+            CV_Assert(borderType == cv::BORDER_CONSTANT);
+            dst.setTo(borderValue);
+            return;
+        }
+        const int top = inside.y - region.y, left = inside.x - region.x;
+        const int bottom = region.y + region.height - (inside.y + inside.height), right = region.x + region.width - (inside.x + inside.width);
+        if(borderType != cv::BORDER_CONSTANT) {
+            CV_Assert(std::max(top, bottom) < inside.height && std::max(left, right) < inside.width);
+        }
+
+        const bool border = top > 0 || bottom > 0 || left > 0 || right > 0;
+        cv::Mat inner = border ? cv::Mat(inside.size(), type()) : dst;
+        std::vector<uchar> block;
+        const int ts = tileSize();
+        for(int ty = inside.y / ts; ty <= (inside.y + inside.height - 1) / ts; ty++) {
+            for(int tx = inside.x / ts; tx <= (inside.x + inside.width - 1) / ts; tx++) {
+                const cv::Rect part = tileRect(tx, ty) & inside;
+                const int firstRow = part.y - ty * ts;
+                block.resize(part.height * tileRowBytes());
+                CV_Assert(pread(fd, block.data(), block.size(), tileOffset(tx, ty) + (off_t)(firstRow * tileRowBytes())) == (ssize_t)block.size());
+                const size_t offset = (part.x - tx * ts) * pixelBytes(), bytes = part.width * pixelBytes();
+                for(int y = 0; y < part.height; y++) {
+                    memcpy(inner.ptr(part.y - inside.y + y) + (part.x - inside.x) * pixelBytes(), block.data() + y * tileRowBytes() + offset, bytes);
+                }
+            }
+        }
+        if(border) {
+            cv::copyMakeBorder(inner, dst, top, bottom, left, right, borderType, borderValue);
+        }
+    }
+};
+
+/* Tile writer
+   create() sizes the file up front, after that writeTile() from any thread puts one tile in its fixed slot.
+*/
+class TiledImageWriter : public TiledLayout {
+public:
+    TiledImageWriter() {}
+    ~TiledImageWriter() { close(); }
+    TiledImageWriter(const TiledImageWriter&) = delete;
+    TiledImageWriter& operator=(const TiledImageWriter&) = delete;
+
+    bool create(const std::string& filename, cv::Size imageSize, int imageType, int tile = 512) {
+        close();
+        CV_Assert(imageSize.width > 0 && imageSize.height > 0 && tile > 0);
+        header = TiledImageHeader();
+        memcpy(header.magic, TILED_IMAGE_MAGIC, 4);
+        header.version = TILED_IMAGE_VERSION;
+        header.rows = imageSize.height;
+        header.cols = imageSize.width;
+        header.type = imageType;
+        header.tileSize = tile;
+        fd = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if(fd < 0) {
+            return false;
+        }
+        ok = pwrite(fd, &header, sizeof(header), 0) == (ssize_t)sizeof(header) && ftruncate(fd, tileOffset(0, tilesY())) == 0;
+        return ok;
+    }
+
+    bool isOpen() const { return fd >= 0; }
+
+    //img must be tileRect(tx, ty).size() and type()
+    bool writeTile(int tx, int ty, const cv::Mat& img) {
+        CV_Assert(isOpen() && img.size() == tileRect(tx, ty).size() && img.type() == type());
+        const size_t bytes = img.cols * pixelBytes();
+        bool written = true;
+        if(img.cols == tileSize() && img.isContinuous()) {
+            written = pwrite(fd, img.data, bytes * img.rows, tileOffset(tx, ty)) == (ssize_t)(bytes * img.rows);
+        }
+        else {
+            for(int y = 0; y < img.rows && written; y++) {
+                written = pwrite(fd, img.ptr(y), bytes, tileOffset(tx, ty) + (off_t)(y * tileRowBytes())) == (ssize_t)bytes;
+            }
+        }
+        if(!written) {
+            ok = false;
+        }
+        return written;
+    }
+
+    //Returns false if any write failed
+    bool close() {
+        if(fd >= 0) {
+            ok = ::close(fd) == 0 && ok;
+        }
+        fd = -1;
+        return ok;
+    }
+
+private:
+    bool ok = true;
+};
+
+//Stores an in-memory image as a tiled file, for tests and small inputs
+inline bool saveTiledImage(const std::string& filename, const cv::Mat& img, int tileSize = 512) {
+    TiledImageWriter writer;
+    if(!writer.create(filename, img.size(), img.type(), tileSize)) {
+        return false;
+    }
+    for(int ty = 0; ty < writer.tilesY(); ty++) {
+        for(int tx = 0; tx < writer.tilesX(); tx++) {
+            writer.writeTile(tx, ty, img(writer.tileRect(tx, ty)));
+        }
+    }
+    return writer.close();
+}
+
+//Reads a whole tiled file into memory, only for images that fit
+inline bool loadTiledImage(const std::string& filename, cv::Mat& img) {
+    TiledImageReader reader(filename);
+    if(!reader.isOpen()) {
+        return false;
+    }
+    reader.readRegion(cv::Rect(cv::Point(), reader.size()), img);
+    return true;
+}
+
+/* Striped source: binary PGM (P5) or PPM (P6) with 8-bit samples
+   The pixels are read one stripe of tileSize rows at a time and written out as that stripe's tiles, so converting
+   an image larger than memory only ever holds one stripe. PPM is RGB on disk and becomes BGR like imread.
+*/
+inline bool convertPnmToTiled(const std::string& input, const std::string& output, int tileSize = 512) {
+    FILE* file = fopen(input.c_str(), "rb");
+    if(!file) {
+        return false;
+    }
+    char magic[3] = {0};
+    int cols = 0, rows = 0, maxValue = 0;
+    bool ok = fscanf(file, "%2s", magic) == 1 && (strcmp(magic, "P5") == 0 || strcmp(magic, "P6") == 0);
+    //Header fields may be separated by comments
+    for(int* field : {&cols, &rows, &maxValue}) {
+        int c;
+        while(ok && (c = fgetc(file)) != EOF && (isspace(c) || c == '#')) {
+            if(c == '#') {
+                while((c = fgetc(file)) != EOF && c != '\n') {}
+            }
+        }
+        ok = ok && ungetc(c, file) != EOF && fscanf(file, "%d", field) == 1;
+    }
+    ok = ok && fgetc(file) != EOF && cols > 0 && rows > 0 && maxValue > 0 && maxValue < 256;
+    const int type = magic[1] == '5' ? CV_8UC1 : CV_8UC3;
+
+    TiledImageWriter writer;
+    ok = ok && writer.create(output, cv::Size(cols, rows), type, tileSize);
+    cv::Mat stripe;
+    for(int ty = 0; ok && ty < writer.tilesY(); ty++) {
+        const int stripeRows = std::min(tileSize, rows - ty * tileSize);
+        stripe.create(stripeRows, cols, type);
+        ok = fread(stripe.data, stripe.elemSize() * cols, stripeRows, file) == (size_t)stripeRows;
+        if(type == CV_8UC3) {
+            cv::cvtColor(stripe, stripe, cv::COLOR_RGB2BGR);
+        }
+        for(int tx = 0; ok && tx < writer.tilesX(); tx++) {
+            cv::Rect tile = writer.tileRect(tx, ty);
+            ok = writer.writeTile(tx, ty, stripe(cv::Rect(tile.x, 0, tile.width, tile.height)));
+        }
+    }
+    fclose(file);
+    return writer.close() && ok;
+}
@@ -0,0 +1,171 @@
+#include <opencv2/opencv.hpp>
+#include <iostream>
+#include <map>
+#include <cstdio>
+#include "tiled_executor.hpp"
+
+using namespace cv;
+using namespace std;
+
+typedef function<TiledOperation(const TiledImageReader&, const TiledExecutor&)> TiledFactory;
+
+/* Operations the tiled driver can run
+   The same calls and parameters as the single-image programs and the batch driver, each wrapped with the halo its
+   kernel needs. equalize runs its histogram pass when it is built, the others are pure neighbourhood operations.
+*/
+map<string, TiledFactory> tiledOperations() {
+    map<string, TiledFactory> ops;
+    ops["gaussian"] = [](const TiledImageReader&, const TiledExecutor&) {
+        return TiledOperation::local("gaussian", 2, [](const Mat& src, Mat& dst) { GaussianBlur(src, dst, Size(5, 5), 1.5, 1.5); });
+    };
+    ops["sobel"] = [](const TiledImageReader&, const TiledExecutor&) {
+        return TiledOperation::local("sobel", 1, [](const Mat& src, Mat& dst) { Sobel(src, dst, CV_8U, 1, 1, 3, 1, 1); });
+    };
+    ops["laplacian"] = [](const TiledImageReader&, const TiledExecutor&) {
+        return TiledOperation::local("laplacian", 1, [](const Mat& src, Mat& dst) { Laplacian(src, dst, -1, 1, 1, 1); });
+    };
+    ops["equalize"] = [](const TiledImageReader& input, const TiledExecutor& executor) {
+        return executor.equalization(input);
+    };
+    ops["rotate"] = [](const TiledImageReader& input, const TiledExecutor&) {
+        Mat rotate_matrix = getRotationMatrix2D(Point2f(input.size().width/2.0, input.size().height/2.0), 45, 1.0);
+        return TiledOperation::warp(rotate_matrix, input.size(), input.size());
+    };
+    return ops;
+}
+
+//The whole-image call each tiled operation has to reproduce
+void wholeImage(const string& name, const Mat& img, Mat& dst) {
+    if(name == "gaussian") GaussianBlur(img, dst, Size(5, 5), 1.5, 1.5);
+    else if(name == "sobel") Sobel(img, dst, CV_8U, 1, 1, 3, 1, 1);
+    else if(name == "laplacian") Laplacian(img, dst, -1, 1, 1, 1);
+    else if(name == "equalize") {
+        Mat gray_img = img;
+        if(img.channels() == 3) {
+            cvtColor(img, gray_img, COLOR_BGR2GRAY);
+        }
+        equalizeHist(gray_img, dst);
+    }
+    else if(name == "rotate") {
+        Mat rotate_matrix = getRotationMatrix2D(Point2f(img.cols/2.0, img.rows/2.0), 45, 1.0);
+        //The rotate of the operation library and the batch driver, see fixed_point_warp.hpp
+        fixedPointWarpAffine(img, dst, rotate_matrix, img.size());
+    }
+}
+
+/* Seam check
+   Every operation runs once tiled through temporary files and once on the whole image in memory, the outputs are
+   compared pixel for pixel. A halo that is too small shows up as differences along the tile edges. The tile size is
+   kept small so the image has many seams.
+*/
+int verify(const Mat& img, int tileSize, int workers) {
+    const string input = "tiled_verify_input.tim", output = "tiled_verify_output.tim";
+    CV_Assert(saveTiledImage(input, img, tileSize));
+    TiledImageReader reader(input);
+    TiledExecutor executor(workers);
+    int failed = 0;
+    for(const auto& op : tiledOperations()) {
+        TiledReport report = executor.run(reader, output, op.second(reader, executor));
+        Mat tiled_img, whole_img;
+        loadTiledImage(output, tiled_img);
+        wholeImage(op.first, img, whole_img);
+        const double diff = norm(tiled_img, whole_img, NORM_INF);
+        const bool ok = diff == 0;
+        cout << op.first << ": max diff " << diff << (ok ? "" : "  SEAMS") << ", ";
+        report.print();
+        failed += ok ? 0 : 1;
+    }
+    remove(input.c_str());
+    remove(output.c_str());
+    return failed;
+}
+
+int main(int argc, char** argv) {
+    map<string, TiledFactory> ops = tiledOperations();
+    if(argc < 3) {
+        cout << "Usage: " << argv[0] << " --convert <image | .pgm | .ppm> <output.tim> [tile size]" << endl;
+        cout << "       " << argv[0] << " --export <input.tim> <output image>" << endl;
+        cout << "       " << argv[0] << " --verify <image> [tile size] [workers]" << endl;
+        cout << "       " << argv[0] << " <input.tim> <output.tim> <operation> [--workers N] [--profile trace.json]" << endl;
+        cout << "Operations:";
+        for(const auto& op : ops) {
+            cout << " " << op.first;
+        }
+        cout << endl;
+        return 1;
+    }
+
+    //OpenCV's own threading is switched off, the tiles are already processed in parallel
+    const int cores = max(1, getNumberOfCPUs());
+    setNumThreads(1);
+    const string mode = argv[1];
+    if(mode == "--convert" && argc >= 4) {
+        const int tileSize = argc > 4 ? atoi(argv[4]) : 512;
+        const string input = argv[2];
+        const string extension = input.size() > 4 ? input.substr(input.size() - 4) : "";
+        bool ok;
+        if(extension == ".pgm" || extension == ".ppm") {
+            //Streamed one stripe of rows at a time, the image never has to fit in memory
+            ok = convertPnmToTiled(input, argv[3], tileSize);
+        }
+        else {
+            Mat img = imread(input, IMREAD_UNCHANGED);
+            ok = !img.empty() && saveTiledImage(argv[3], img, tileSize);
+        }
+        cout << (ok ? "Converted " : "Failed to convert ") << input << endl;
+        return ok ? 0 : 1;
+    }
+    if(mode == "--export" && argc >= 4) {
+        Mat img;
+        if(!loadTiledImage(argv[2], img) || !imwrite(argv[3], img)) {
+            cout << "Failed to export " << argv[2] << endl;
+            return 1;
+        }
+        return 0;
+    }
+    if(mode == "--verify") {
+        Mat img = imread(argv[2], IMREAD_COLOR);
+        if(img.empty()) {
+            cout << "Failed to read " << argv[2] << endl;
+            return 1;
+        }
+        return verify(img, argc > 3 ? atoi(argv[3]) : 128, argc > 4 ? atoi(argv[4]) : cores) == 0 ? 0 : 1;
+    }
+
+    if(argc < 4 || ops.find(argv[3]) == ops.end()) {
+        cout << "Unknown operation " << (argc < 4 ? "" : argv[3]) << endl;
+        return 1;
+    }
+    int workers = cores;
+    string profile;
+    for(int i = 4; i + 1 < argc; i += 2) {
+        if(string(argv[i]) == "--workers") {
+            workers = atoi(argv[i + 1]);
+        }
+        else if(string(argv[i]) == "--profile") {
+            profile = argv[i + 1];
+            Profiler::get().enable();
+        }
+        else {
+            cout << "Unknown option " << argv[i] << endl;
+            return 1;
+        }
+    }
+    TiledImageReader reader(argv[1]);
+    if(!reader.isOpen()) {
+        cout << "Failed to open " << argv[1] << endl;
+        return 1;
+    }
+    cout << reader.size().width << "x" << reader.size().height << " image in " << reader.tileCount() << " tiles of " << reader.tileSize() << " px" << endl;
+    TiledExecutor executor(workers);
+    TiledReport report = executor.run(reader, argv[2], ops[argv[3]](reader, executor));
+    report.print();
+    if(!profile.empty()) {
+        Profiler::get().printSummary();
+        if(!Profiler::get().writeChromeTrace(profile)) {
+            cout << "Failed to write " << profile << endl;
+        }
+    }
+
+    return 0;
+}
\ No newline at end of file
@@ -0,0 +1,156 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/* Work-stealing thread pool
+   Every worker owns a deque. A task submitted from inside a worker goes to the back of that worker's own deque and the
+   worker takes from the back, so a task that makes more work runs its follow-ups next, while their inputs are still in
+   cache. An idle worker steals from the front of the other deques, taking the oldest and usually largest piece of
+   work. Tasks submitted from outside the pool are spread round robin. Each deque has its own small lock, the pool
+   is meant for coarse tasks (whole image operations), not for fine-grained loops.
+*/
+class WorkStealingPool {
+public:
+    explicit WorkStealingPool(int threads = std::max(1, (int)std::thread::hardware_concurrency())) {
+        threads = std::max(1, threads);
+        for(int t = 0; t < threads; t++) {
+            queues.emplace_back(new Queue());
+        }
+        for(int t = 0; t < threads; t++) {
+            workers.emplace_back([this, t] { loop(t); });
+        }
+    }
+
+    ~WorkStealingPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for(std::thread& worker : workers) {
+            worker.join();
+        }
+    }
+
+    WorkStealingPool(const WorkStealingPool&) = delete;
+    WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+    int size() const { return (int)queues.size(); }
+
+    void submit(std::function<void()> task) {
+        const int self = current().pool == this ? current().index : (int)(next++ % queues.size());
+        //Counted before it is visible, a worker may take and finish it before this thread gets past the push
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            pending++;
+            queued++;
+        }
+        {
+            std::lock_guard<std::mutex> lock(queues[self]->mutex);
+            queues[self]->tasks.push_back(std::move(task));
+        }
+        wake.notify_one();
+    }
+
+    //Blocks until every submitted task, including the ones tasks submit, has finished. Rethrows the first exception
+    void wait() {
+        std::unique_lock<std::mutex> lock(mutex);
+        finished.wait(lock, [this] { return pending == 0; });
+        if(error) {
+            std::exception_ptr failure = error;
+            error = nullptr;
+            std::rethrow_exception(failure);
+        }
+    }
+
+private:
+    struct Queue {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    //Which pool and worker the calling thread belongs to
+    struct Worker {
+        const WorkStealingPool* pool = nullptr;
+        int index = 0;
+    };
+    static Worker& current() {
+        static thread_local Worker worker;
+        return worker;
+    }
+
+    //Own deque from the back, then the others from the front
+    bool take(int self, std::function<void()>& task) {
+        for(size_t k = 0; k < queues.size(); k++) {
+            Queue& queue = *queues[(self + k) % queues.size()];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            if(!queue.tasks.empty()) {
+                if(k == 0) {
+                    task = std::move(queue.tasks.back());
+                    queue.tasks.pop_back();
+                }
+                else {
+                    task = std::move(queue.tasks.front());
+                    queue.tasks.pop_front();
+                }
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void loop(int self) {
+        current().pool = this;
+        current().index = self;
+        std::function<void()> task;
+        while(true) {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [this] { return stopping || queued > 0; });
+                if(stopping) {
+                    return;
+                }
+            }
+            if(!take(self, task)) {
+                std::this_thread::yield();      //Another worker got there first
+                continue;
+            }
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                queued--;
+            }
+            try {
+                task();
+            }
+            catch(...) {
+                std::lock_guard<std::mutex> lock(mutex);
+                if(!error) {
+                    error = std::current_exception();
+                }
+            }
+            task = nullptr;
+            std::lock_guard<std::mutex> lock(mutex);
+            if(--pending == 0) {
+                finished.notify_all();
+            }
+        }
+    }
+
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> workers;
+    std::atomic<size_t> next{0};
+    std::mutex mutex;
+    std::condition_variable wake, finished;
+    size_t pending = 0, queued = 0;
+    bool stopping = false;
+    std::exception_ptr error;
+};